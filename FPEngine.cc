@@ -95,6 +95,7 @@
 /* $Id$ */
 
 #include "FPEngine.h"
+#include "FPPredict.h"
 #include "Target.h"
 #include "NmapOps.h"
 #include "nmap_error.h"
@@ -374,7 +375,7 @@ int FPNetworkControl::setup_sniffer(const char *iface, const char *bpf_filter) {
 #endif
 
   /* Obtain a pcap descriptor */
-  if ((errmsg = nsock_pcap_open(this->nsp, this->pcap_nsi, pcapdev, 8192, 0, bpf_filter)) != NULL)
+  if ((errmsg = nsock_pcap_open(this->nsp, this->pcap_nsi, pcapdev, OSSCAN_PCAP_SNAPLEN, 0, bpf_filter)) != NULL)
     fatal("Error opening capture device %s --> %s\n", pcapdev, errmsg);
 
   /* Store the pcap NSI inside the pool so we can retrieve it inside a callback */
@@ -384,10 +385,31 @@ int FPNetworkControl::setup_sniffer(const char *iface, const char *bpf_filter) {
 }
 
 
+/* This method schedules the first packet capture event, if it has not been
+ * scheduled yet. After that, the response reception handler schedules a new
+ * capture event for each captured packet. Callers that transmit packets
+ * themselves instead of through scheduleProbe() must call this before
+ * sending anything. */
+void FPNetworkControl::begin_capture() {
+  if (!this->first_pcap_scheduled) {
+    this->pcap_ev_id = nsock_pcap_read_packet(this->nsp, this->pcap_nsi, response_reception_handler_wrapper, -1, NULL);
+    this->first_pcap_scheduled = true;
+  }
+}
+
+
 /* This method makes the controller process pending events (like packet
- * transmissions or packet captures). */
-void FPNetworkControl::handle_events() {
-  nsock_loop(nsp, 50);
+ * transmissions or packet captures) for the given number of milliseconds. */
+void FPNetworkControl::handle_events(int msecs) {
+  nsock_loop(nsp, msecs);
+}
+
+
+/* This method makes handle_events() return as soon as the event being
+ * processed has been handled. Callers use it when a captured packet lets
+ * them transmit earlier than they expected. */
+void FPNetworkControl::break_loop() {
+  nsock_loop_quit(this->nsp);
 }
 
 
@@ -407,7 +429,6 @@ int FPNetworkControl::scheduleProbe(FPProbe *pkt, int in_msecs_time) {
  * functions, so this is a small hack to make that happen. */
 void FPNetworkControl::probe_transmission_handler(nsock_pool nsp, nsock_event nse, void *arg) {
   assert(nsp_getud(nsp) != NULL);
-  nsock_iod nsi_pcap = *((nsock_iod *)nsp_getud(nsp));
   enum nse_status status = nse_status(nse);
   enum nse_type type = nse_type(nse);
   FPProbe *myprobe = (FPProbe *)arg;
@@ -419,13 +440,8 @@ void FPNetworkControl::probe_transmission_handler(nsock_pool nsp, nsock_event ns
     /* Timer events mean that we need to send a packet.  */
     case NSE_TYPE_TIMER:
 
-      /* The first time a packet is sent, we schedule a pcap event. After that
-       * we don't have to worry since the response reception handler schedules
-       * a new capture event for each captured packet. */
-      if (!this->first_pcap_scheduled) {
-        this->pcap_ev_id = nsock_pcap_read_packet(nsp, nsi_pcap, response_reception_handler_wrapper, -1, NULL);
-        this->first_pcap_scheduled = true;
-      }
+      /* The first time a packet is sent, we schedule a pcap event. */
+      this->begin_capture();
 
       buf = myprobe->getPacketBuffer(&len);
       /* Send the packet*/
@@ -479,6 +495,9 @@ void FPNetworkControl::response_reception_handler(nsock_pool nsp, nsock_event ns
   enum nse_type type = nse_type(nse);
   const u8 *rcvd_pkt = NULL;                    /* Points to the captured packet */
   size_t rcvd_pkt_len = 0;                      /* Lenght of the captured packet */
+  const u8 *link_data = NULL;                   /* Points to its link header     */
+  size_t link_len = 0;                          /* Length of the link header     */
+  struct link_header linkhdr;                   /* Copy of the link header       */
   struct timeval pcaptime;                    /* Time the packet was captured  */
   struct sockaddr_storage sent_ss;
   struct sockaddr_storage rcvd_ss;
@@ -489,9 +508,6 @@ void FPNetworkControl::response_reception_handler(nsock_pool nsp, nsock_event ns
   IPv6Header ip6;
   int res = -1;
 
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
-
   if (status == NSE_STATUS_SUCCESS) {
     switch(type) {
 
@@ -501,7 +517,13 @@ void FPNetworkControl::response_reception_handler(nsock_pool nsp, nsock_event ns
         this->pcap_ev_id = nsock_pcap_read_packet(nsp, nsi, response_reception_handler_wrapper, -1, NULL);
 
         /* Get captured packet */
-        nse_readpcap(nse, NULL, NULL, &rcvd_pkt, &rcvd_pkt_len, NULL, &pcaptime);
+        nse_readpcap(nse, &link_data, &link_len, &rcvd_pkt, &rcvd_pkt_len, NULL, &pcaptime);
+        memset(&linkhdr, 0, sizeof(linkhdr));
+        linkhdr.datalinktype = nsi_pcap_linktype(nsi);
+        if (link_data != NULL && link_len <= sizeof(linkhdr.header)) {
+          linkhdr.headerlen = link_len;
+          memcpy(linkhdr.header, link_data, link_len);
+        }
 
         /* Extract the packet's source address */
         ip4.storeRecvData(rcvd_pkt, rcvd_pkt_len);
@@ -534,7 +556,7 @@ void FPNetworkControl::response_reception_handler(nsock_pool nsp, nsock_event ns
            * target address. If it matches, pass the received packet
            * to the appropriate FPHost object through callback().  */
           if (sockaddr_storage_equal(&rcvd_ss, &sent_ss)) {
-            if ((res = this->callers[i]->callback(rcvd_pkt, rcvd_pkt_len, &tv)) >= 0) {
+            if ((res = this->callers[i]->callback(rcvd_pkt, rcvd_pkt_len, &pcaptime, &linkhdr)) >= 0) {
 
                /* If callback() returns >=0 it means that the packet we've just
                 * passed was successfully matched with a previous probe. Now
@@ -787,11 +809,12 @@ static double vectorize_isr(std::map<std::string, FPPacket>& resps) {
   return sum / t;
 }
 
-static struct feature_node *vectorize(const FingerPrintResultsIPv6 *FPR) {
+/* Fills in features, an array of get_nr_feature(&FPModel) values, with the
+   feature vector of the given fingerprint. Missing values are -1. */
+static void vectorize(const FingerPrintResultsIPv6 *FPR, double *features) {
   const char * const IPV6_PROBE_NAMES[] = {"S1", "S2", "S3", "S4", "S5", "S6", "IE1", "IE2", "NS", "U1", "TECN", "T2", "T3", "T4", "T5", "T6", "T7"};
   const char * const TCP_PROBE_NAMES[] = {"S1", "S2", "S3", "S4", "S5", "S6", "TECN", "T2", "T3", "T4", "T5", "T6", "T7"};
   unsigned int nr_feature, i, idx;
-  struct feature_node *features;
   std::map<std::string, FPPacket> resps;
 
   for (i = 0; i < NUM_FP_PROBES_IPv6; i++) {
@@ -806,23 +829,19 @@ static struct feature_node *vectorize(const FingerPrintResultsIPv6 *FPR) {
   }
 
   nr_feature = get_nr_feature(&FPModel);
-  features = new feature_node[nr_feature + 1];
-  for (i = 0; i < nr_feature; i++) {
-    features[i].index = i + 1;
-    features[i].value = -1;
-  }
-  features[i].index = -1;
+  for (i = 0; i < nr_feature; i++)
+    features[i] = -1;
 
   idx = 0;
   for (i = 0; i < NELEMS(IPV6_PROBE_NAMES); i++) {
     const char *probe_name;
 
     probe_name = IPV6_PROBE_NAMES[i];
-    features[idx++].value = vectorize_plen(resps[probe_name].getPacket());
-    features[idx++].value = vectorize_tc(resps[probe_name].getPacket());
+    features[idx++] = vectorize_plen(resps[probe_name].getPacket());
+    features[idx++] = vectorize_tc(resps[probe_name].getPacket());
   }
   /* TCP features */
-  features[idx++].value = vectorize_isr(resps);
+  features[idx++] = vectorize_isr(resps);
   for (i = 0; i < NELEMS(TCP_PROBE_NAMES); i++) {
     const char *probe_name;
     const TCPHeader *tcp;
@@ -845,17 +864,17 @@ static struct feature_node *vectorize(const FingerPrintResultsIPv6 *FPR) {
       idx += 48;
       continue;
     }
-    features[idx++].value = tcp->getWindow();
+    features[idx++] = tcp->getWindow();
     flags = tcp->getFlags16();
     for (mask = 0x001; mask <= 0x800; mask <<= 1)
-      features[idx++].value = (flags & mask) != 0;
+      features[idx++] = (flags & mask) != 0;
 
     for (j = 0; j < 16; j++) {
       nping_tcp_opt_t opt;
       opt = tcp->getOption(j);
       if (opt.value == NULL)
         break;
-      features[idx++].value = opt.type;
+      features[idx++] = opt.type;
       /* opt.len includes the two (type, len) bytes. */
       if (opt.type == TCPOPT_MSS && opt.len == 4 && mss == -1)
         mss = ntohs(*(u16 *) opt.value);
@@ -872,37 +891,35 @@ static struct feature_node *vectorize(const FingerPrintResultsIPv6 *FPR) {
       opt = tcp->getOption(j);
       if (opt.value == NULL)
         break;
-      features[idx++].value = opt.len;
+      features[idx++] = opt.len;
     }
     for (; j < 16; j++)
       idx++;
 
-    features[idx++].value = mss;
-    features[idx++].value = sackok;
-    features[idx++].value = wscale;
+    features[idx++] = mss;
+    features[idx++] = sackok;
+    features[idx++] = wscale;
   }
   assert(idx == nr_feature);
 
   if (o.debugging > 2) {
     log_write(LOG_PLAIN, "v = {");
     for (i = 0; i < nr_feature; i++)
-      log_write(LOG_PLAIN, "%.16g, ", features[i].value);
+      log_write(LOG_PLAIN, "%.16g, ", features[i]);
     log_write(LOG_PLAIN, "};\n");
   }
-
-  return features;
 }
 
-static void apply_scale(struct feature_node *features, unsigned int num_features,
+static void apply_scale(double *features, unsigned int num_features,
   const double (*scale)[2]) {
   unsigned int i;
 
   for (i = 0; i < num_features; i++) {
-    double val = features[i].value;
+    double val = features[i];
     if (val < 0)
       continue;
     val = (val + scale[i][0]) * scale[i][1];
-    features[i].value = val;
+    features[i] = val;
   }
 }
 
@@ -949,7 +966,7 @@ int label_prob_cmp(const void *a, const void *b) {
    tend to make small differences count a lot (because we probably want this
    fingerprint in order to expand the class), while still allowing near-perfect
    matches to match. */
-static double novelty_of(const struct feature_node *features, int label) {
+static double novelty_of(const double *features, int label) {
   const double *means, *variances;
   int i, nr_feature;
   double sum;
@@ -965,8 +982,7 @@ static double novelty_of(const struct feature_node *features, int label) {
   for (i = 0; i < nr_feature; i++) {
     double d, v;
 
-    assert(i + 1 == features[i].index);
-    d = features[i].value - means[i];
+    d = features[i] - means[i];
     v = variances[i];
     if (v == 0.0) {
       /* No variance? It means that samples were identical. Substitute a default
@@ -980,21 +996,16 @@ static double novelty_of(const struct feature_node *features, int label) {
   return sqrt(sum);
 }
 
-static void classify(FingerPrintResultsIPv6 *FPR) {
+/* Fills in the matches of FPR from the decision values of the model for its
+   scaled feature vector. */
+static void classify(FingerPrintResultsIPv6 *FPR, const double *features,
+  const double *values) {
   int nr_class, i;
-  struct feature_node *features;
-  double *values;
   struct label_prob *labels;
 
   nr_class = get_nr_class(&FPModel);
-
-  features = vectorize(FPR);
-  values = new double[nr_class];
   labels = new struct label_prob[nr_class];
 
-  apply_scale(features, get_nr_feature(&FPModel), FPscale);
-
-  predict_values(&FPModel, features, values);
   for (i = 0; i < nr_class; i++) {
     labels[i].label = i;
     labels[i].prob = 1.0 / (1.0 + exp(-values[i]));
@@ -1035,9 +1046,38 @@ static void classify(FingerPrintResultsIPv6 *FPR) {
     FPR->num_perfect_matches = 0;
   }
 
+  delete[] labels;
+}
+
+/* Classifies a batch of fingerprints. All feature vectors are built into a
+   single matrix (one row per fingerprint) so that the model is evaluated for
+   every host in one pass. */
+static void classify_batch(std::vector<FingerPrintResultsIPv6 *> &FPRs) {
+  unsigned int nr_feature, nr_class, n, i;
+  double *features;
+  double *values;
+
+  n = FPRs.size();
+  if (n == 0)
+    return;
+
+  nr_feature = get_nr_feature(&FPModel);
+  nr_class = get_nr_class(&FPModel);
+  features = new double[n * nr_feature];
+  values = new double[n * nr_class];
+
+  for (i = 0; i < n; i++) {
+    vectorize(FPRs[i], features + i * nr_feature);
+    apply_scale(features + i * nr_feature, nr_feature, FPscale);
+  }
+
+  predict_values_batch(&FPModel, features, n, values);
+
+  for (i = 0; i < n; i++)
+    classify(FPRs[i], features + i * nr_feature, values + i * nr_class);
+
   delete[] features;
   delete[] values;
-  delete[] labels;
 }
 
 
@@ -1141,12 +1181,14 @@ int FPEngine6::os_scan(std::vector<Target *> &Targets) {
 
   /* Once we've finished with all fphosts, check which ones were correctly
    * fingerprinted, and update the Target objects. */
+  std::vector<FingerPrintResultsIPv6 *> FPRs;
   for (size_t i = 0; i < this->fphosts.size(); i++) {
     fphosts[i]->finish();
 
     fphosts[i]->fill_FPR((FingerPrintResultsIPv6 *) Targets[i]->FPR);
-    classify((FingerPrintResultsIPv6 *) Targets[i]->FPR);
+    FPRs.push_back((FingerPrintResultsIPv6 *) Targets[i]->FPR);
   }
+  classify_batch(FPRs);
 
   /* Cleanup and return */
   while (this->fphosts.size() > 0) {
@@ -2218,10 +2260,9 @@ int FPHost6::set_done_and_wrap_up() {
  * response to a retransmitted probe, and so, it should not be used to alter
  * congestion control parameters. A negative return value indicates that the
  * supplied packet is not a response to any probe sent by this host. */
-int FPHost6::callback(const u8 *pkt, size_t pkt_len, const struct timeval *tv) {
-  PacketElement *rcvd = NULL;
-  /* Dummy packet to ensure destruction of rcvd. */
-  FPPacket dummy;
+int FPHost6::callback(const u8 *pkt, size_t pkt_len, const struct timeval *tv,
+                      const struct link_header *linkhdr) {
+  PacketView rcvd;
   bool match_found = false;
   int times_tx = 0;
 
@@ -2232,11 +2273,11 @@ int FPHost6::callback(const u8 *pkt, size_t pkt_len, const struct timeval *tv) {
   if (o.debugging > 3)
     log_write(LOG_PLAIN, "[%s] Captured %lu bytes\n", this->target_host->targetipstr(), (unsigned long)pkt_len);
 
-  /* Convert the ugly raw buffer into a nice chain of PacketElement objects, so
-   * it's easier to parse the captured packet */
-  if ((rcvd = PacketParser::split(pkt, pkt_len, false)) == NULL)
+  /* Locate the headers of the captured packet. This does not copy or
+   * allocate anything, which matters because most captured packets are not
+   * responses to any of our probes. */
+  if (rcvd.parse(pkt, pkt_len, false) == 0)
     return -2;
-  dummy.setPacket(rcvd);
 
   /* Iterate over the list of sent probes and determine if the captured
    * packet is a response to one of them. */
@@ -2246,7 +2287,7 @@ int FPHost6::callback(const u8 *pkt, size_t pkt_len, const struct timeval *tv) {
           continue;
 
       /* See if the received packet is a response to a probe */
-      if (this->fp_probes[i].isResponse(rcvd)) {
+      if (this->fp_probes[i].isResponse(&rcvd)) {
           struct timeval now, time_sent;
 
           gettimeofday(&now, NULL);
@@ -2279,9 +2320,13 @@ int FPHost6::callback(const u8 *pkt, size_t pkt_len, const struct timeval *tv) {
 
   if (match_found) {
     if (o.packetTrace()) {
-      log_write(LOG_PLAIN, "RCVD  ");
-      rcvd->print(stdout, LOW_DETAIL);
-      log_write(LOG_PLAIN, "\n");
+      PacketElement *pe = PacketParser::split(pkt, pkt_len, false);
+      if (pe != NULL) {
+        log_write(LOG_PLAIN, "RCVD  ");
+        pe->print(stdout, LOW_DETAIL);
+        log_write(LOG_PLAIN, "\n");
+        PacketParser::freePacketChain(pe);
+      }
     }
     /* Here, check if with this match we completed the OS detection */
     if (this->probes_answered + this->probes_unanswered == this->total_probes) {
@@ -2523,6 +2568,16 @@ bool FPProbe::isResponse(PacketElement *rcvd) {
 }
 
 
+/* Same as above, for a received packet that has been parsed into a
+ * PacketView instead of being split into PacketElement objects. */
+bool FPProbe::isResponse(const PacketView *rcvd) {
+  if (this->pkt_time.tv_sec == 0 && this->pkt_time.tv_usec == 0)
+    return false;
+
+  return PacketParser::is_response(this->pkt, rcvd);
+}
+
+
 /* Store this probe's textual identifier. Note that this method makes a copy
  * of the supplied string, so you can safely change its contents without
  * affecting the object's state. */
@@ -156,6 +156,10 @@ const unsigned int OSDETECT_FLOW_LABEL = 0x12345;
  * It is set to 3 seconds (3*10^6 usecs) as per RFC 2988. */
 #define OSSCAN_INITIAL_RTO (3*1000000)
 
+/* Capture length of the pcap descriptor on which responses are received. No
+ * captured packet is longer than this. */
+#define OSSCAN_PCAP_SNAPLEN 8192
+
 
 /******************************************************************************
  * CLASS DEFINITIONS                                                          *
@@ -193,7 +197,9 @@ class FPNetworkControl {
   int register_caller(FPHost *newcaller);
   int unregister_caller(FPHost *oldcaller);
   int setup_sniffer(const char *iface, const char *bfp_filter);
-  void handle_events();
+  void begin_capture();
+  void handle_events(int msecs = 50);
+  void break_loop();
   int scheduleProbe(FPProbe *pkt, int in_msecs_time);
   void probe_transmission_handler(nsock_pool nsp, nsock_event nse, void *arg);
   void response_reception_handler(nsock_pool nsp, nsock_event nse, void *arg);
@@ -310,6 +316,7 @@ class FPProbe : public FPPacket {
   ~FPProbe();
   void reset();
   bool isResponse(PacketElement *rcvd);
+  bool isResponse(const PacketView *rcvd);
   int setProbeID(const char *id);
   const char *getProbeID() const;
   int getRetransmissions() const;
@@ -389,10 +396,11 @@ class FPHost {
   struct timeval begin_time;
 
   FPHost();
-  ~FPHost();
+  virtual ~FPHost();
   virtual bool done() = 0;
   virtual int schedule() = 0;
-  virtual int callback(const u8 *pkt, size_t pkt_len, const struct timeval *tv) = 0;
+  virtual int callback(const u8 *pkt, size_t pkt_len, const struct timeval *tv,
+                       const struct link_header *linkhdr) = 0;
   const struct sockaddr_storage *getTargetAddress();
 
 };
@@ -419,7 +427,8 @@ class FPHost6 : public FPHost {
   void finish();
   bool done();
   int schedule();
-  int callback(const u8 *pkt, size_t pkt_len, const struct timeval *tv);
+  int callback(const u8 *pkt, size_t pkt_len, const struct timeval *tv,
+               const struct link_header *linkhdr);
   const FPProbe *getProbe(const char *id);
   const FPResponse *getResponse(const char *id);
 
@@ -96,46 +96,40 @@
 
 #include "nmap.h"
 
+#include <algorithm>
 #include <map>
+#include <string>
 
-/* Character pool memory allocation */
 #include "MACLookup.h"
+#include "databundle.h"
 #include "NmapOps.h"
 #include "nmap_error.h"
-#include "charpool.h"
 
 extern NmapOps o;
 
-std::map<int, char *> MacTable;
+/* Sorted by prefix, so it can be binary searched. */
+static DataTable MacTable;
 
 static inline int MacCharPrefix2Key(const u8 *prefix) {
   return (prefix[0] << 16) + (prefix[1] << 8) + prefix[2];
 }
 
-static void mac_prefix_init() {
-  static int initialized = 0;
-  if (initialized) return;
-  initialized = 1;
-  char filename[256];
+static bool mac_record_less(const struct data_record &rec, u32 prefix) {
+  return rec.number < prefix;
+}
+
+int mac_prefixes_parse_file(const char *filename, DataTable *table) {
+  std::map<int, std::string> entries;
+  std::map<int, std::string>::iterator it;
   FILE *fp;
   char line[128];
   int pfx;
   char *endptr, *vendor;
   int lineno = 0;
 
-  /* Now it is time to read in all of the entries ... */
-  if (nmap_fetchfile(filename, sizeof(filename), "nmap-mac-prefixes") != 1){
-    error("Cannot find nmap-mac-prefixes: Ethernet vendor correlation will not be performed");
-    return;
-  }
-
   fp = fopen(filename, "r");
-  if (!fp) {
-    error("Unable to open %s.  Ethernet vendor correlation will not be performed ", filename);
-    return;
-  }
-  /* Record where this data file was found. */
-  o.loaded_data_files["nmap-mac-prefixes"] = filename;
+  if (!fp)
+    return -1;
 
   while(fgets(line, sizeof(line), fp)) {
     lineno++;
@@ -157,8 +151,8 @@ static void mac_prefix_init() {
     while(*endptr && *endptr != '\n' && *endptr != '\r') endptr++;
     *endptr = '\0';
 
-    if (MacTable.find(pfx) == MacTable.end()) {
-      MacTable[pfx] = cp_strdup(vendor);
+    if (entries.find(pfx) == entries.end()) {
+      entries[pfx] = vendor;
     } else {
       if (o.debugging > 1)
 	error("MAC prefix %06X is duplicated in %s; ignoring duplicates.", pfx, filename);
@@ -167,18 +161,45 @@ static void mac_prefix_init() {
   }
 
   fclose(fp);
-  return;
+
+  for (it = entries.begin(); it != entries.end(); it++)
+    table->add(it->first, it->second.c_str());
+
+  return 0;
+}
+
+static void mac_prefix_init() {
+  static int initialized = 0;
+  if (initialized) return;
+  initialized = 1;
+  char filename[256];
+
+  /* Now it is time to read in all of the entries ... */
+  if (nmap_fetchfile(filename, sizeof(filename), "nmap-mac-prefixes") != 1){
+    error("Cannot find nmap-mac-prefixes: Ethernet vendor correlation will not be performed");
+    return;
+  }
+
+  if (!databundle_get("nmap-mac-prefixes", filename, &MacTable)
+      && mac_prefixes_parse_file(filename, &MacTable) == -1) {
+    error("Unable to open %s.  Ethernet vendor correlation will not be performed ", filename);
+    return;
+  }
+  /* Record where this data file was found. */
+  o.loaded_data_files["nmap-mac-prefixes"] = filename;
 }
 
 
 static const char *findMACEntry(int prefix) {
-  std::map<int, char *>::iterator i;
+  const struct data_record *begin, *end, *rec;
 
-  i = MacTable.find(prefix);
-  if (i == MacTable.end())
+  begin = MacTable.get_records();
+  end = begin + MacTable.size();
+  rec = std::lower_bound(begin, end, (u32) prefix, mac_record_less);
+  if (rec == end || rec->number != (u32) prefix)
     return NULL;
 
-  return i->second;
+  return MacTable.name(rec - begin);
 }
 
 /* Takes a three byte MAC address prefix (passing the whole MAC is OK
@@ -199,17 +220,17 @@ const char *MACPrefix2Corp(const u8 *prefix) {
    is not particularly efficient and so should be rewriteen if it is
    called often */
 bool MACCorp2Prefix(const char *vendorstr, u8 *mac_data) {
-  std::map<int, char *>::iterator i;
+  unsigned int i;
 
   if (!vendorstr) fatal("%s: vendorstr is NULL", __func__);
   if (!mac_data) fatal("%s: mac_data is NULL", __func__);
   mac_prefix_init();
 
-  for (i = MacTable.begin(); i != MacTable.end(); i++) {
-    if (strcasestr(i->second, vendorstr)) {
-      mac_data[0] = i->first >> 16;
-      mac_data[1] = (i->first >> 8) & 0xFF;
-      mac_data[2] = i->first & 0xFF;
+  for (i = 0; i < MacTable.size(); i++) {
+    if (strcasestr(MacTable.name(i), vendorstr)) {
+      mac_data[0] = MacTable.number(i) >> 16;
+      mac_data[1] = (MacTable.number(i) >> 8) & 0xFF;
+      mac_data[2] = MacTable.number(i) & 0xFF;
       return true;
     }
   }
@@ -99,6 +99,14 @@
 
 #include "nbase/nbase.h"
 
+class DataTable;
+
+/* Parses an nmap-mac-prefixes file into table, sorted by prefix. The number of
+   each record is the prefix and the name is the vendor. Only the first of
+   duplicate prefixes is kept. Returns 0 on success and -1 if the file can't be
+   read. */
+int mac_prefixes_parse_file(const char *filename, DataTable *table);
+
 /* Takes a three byte MAC address prefix (passing the whole MAC is OK
    too) and returns the company which has registered the prefix.
    NULL is returned if no vendor is found for the given prefix or if there
@@ -254,6 +254,7 @@ void NmapOps::Initialize() {
   stats_interval = 0.0; /* Unset. */
   randomize_hosts = 0;
   randomize_ports = 1;
+  likely_ports_first = false;
   sendpref = PACKET_SEND_NOPREF;
   spoofsource = 0;
   fastscan = 0;
@@ -284,6 +285,8 @@ void NmapOps::Initialize() {
   open_only = false;
   scanflags = -1;
   defeat_rst_ratelimit = 0;
+  stateless = false;
+  checkpoint_file = NULL;
   resume_ip.s_addr = 0;
   osscan_limit = 0;
   osscan_guess = 0;
@@ -513,6 +516,10 @@ dialog where you can start NPF if you have administrator privileges.";
   if (defeat_rst_ratelimit && !synscan) {
       fatal("Option --defeat-rst-ratelimit works only with a SYN scan (-sS)");
   }
+
+  if (stateless && !synscan && !(pingtype & PINGTYPE_TCP)) {
+      fatal("Option --stateless works only with a SYN scan (-sS) or TCP ping (-PS or -PA)");
+  }
   
   if (resume_ip.s_addr && generate_random_ips)
     resume_ip.s_addr = 0;
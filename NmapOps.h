@@ -183,6 +183,8 @@ class NmapOps {
   float stats_interval;
   int randomize_hosts;
   int randomize_ports;
+  /* Probe ports in order of nmap-services open frequency (--likely-ports-first). */
+  bool likely_ports_first;
   int spoofsource; /* -S used */
   int fastscan;
   char device[64];
@@ -264,7 +266,10 @@ class NmapOps {
   int defeat_rst_ratelimit; /* Solaris 9 rate-limits RSTs so scanning is very
             slow against it. If we don't distinguish between closed and filtered ports,
             we can get the list of open ports very fast */
+  /* Keep no per-probe state in SYN scans and TCP ping sweeps (--stateless). */
+  bool stateless;
 
+  char *checkpoint_file; /* --checkpoint file, or NULL */
   struct in_addr resume_ip; /* The last IP in the log file if user 
 			       requested --restore .  Otherwise 
 			       restore_ip.s_addr == 0.  Also 
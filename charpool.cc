@@ -101,96 +101,139 @@
 #include "charpool.h"
 #include "nmap_error.h"
 
-static char *charpool[16];
-static int currentcharpool;
-static int currentcharpoolsz;
-static char *nextchar;
-
 /* Allocated blocks are allocated to multiples of ALIGN_ON. This is the
    definition used by the malloc in Glibc 2.7, which says that it "suffices for
    nearly all current machines and C compilers." */
 #define ALIGN_ON (2 * sizeof(size_t))
 
-static int cp_init(void) {
-  static int charpool_initialized = 0;
-  if (charpool_initialized) return 0;
+/* Blocks double in size up to this, after which each new block is this big
+   (or as big as the allocation that needs it). */
+#define MAX_BLOCK_SIZE (1024 * 1024)
 
-  /* Create our char pool */
-  currentcharpool = 0;
-  currentcharpoolsz = 16384;
-  nextchar = charpool[0] = (char *) safe_malloc(currentcharpoolsz);
-  charpool_initialized = 1;
-  return 0;
+static CharPool *permanent_pool(void) {
+  static CharPool pool(16384);
+  return &pool;
 }
 
-void cp_free(void) {
-  int ccp;
-  for(ccp=0; ccp <= currentcharpool; ccp++)
-    if(charpool[ccp]){
-      free(charpool[ccp]);
-      charpool[ccp] = NULL;
-  }
-  currentcharpool = 0;
+static CharPool *current_pool = NULL;
+
+
+/****************************************************************************
+ *                   Implementation of class CharPool                       *
+ ****************************************************************************/
+
+CharPool::CharPool(size_t first_block_size) {
+  this->first_block_size = first_block_size;
+  this->block_size = first_block_size;
+  this->used = 0;
+  this->nextchar = NULL;
+  this->end = NULL;
 }
 
-static inline void cp_grow(void) {
-  /* Doh!  We've got to make room */
-  if (++currentcharpool > 15) {
-    fatal("Character Pool is out of buckets!");
-  }
-  currentcharpoolsz <<= 1;
+CharPool::~CharPool() {
+  clear();
+}
 
-  nextchar = charpool[currentcharpool] = (char *)
-    safe_malloc(currentcharpoolsz);
+void CharPool::clear() {
+  std::vector<char *>::iterator it;
+
+  for (it = blocks.begin(); it != blocks.end(); it++)
+    free(*it);
+  blocks.clear();
+  interned.clear();
+  block_size = first_block_size;
+  used = 0;
+  nextchar = NULL;
+  end = NULL;
 }
 
-void *cp_alloc(int sz) {
-  char *p;
-  int modulus;
+/* Starts a new block with room for at least sz bytes. Whatever was left of the
+   old block is abandoned. */
+void CharPool::grow(size_t sz) {
+  size_t new_size;
 
-  cp_init();
+  if (!blocks.empty() && block_size < MAX_BLOCK_SIZE)
+    block_size <<= 1;
+  new_size = MAX(block_size, sz);
+
+  nextchar = (char *) safe_malloc(new_size);
+  end = nextchar + new_size;
+  blocks.push_back(nextchar);
+}
+
+void *CharPool::alloc(size_t sz) {
+  size_t modulus;
+  char *p;
 
   if ((modulus = sz % ALIGN_ON))
     sz += ALIGN_ON - modulus;
-  
-  if ((nextchar - charpool[currentcharpool]) + sz <= currentcharpoolsz) {
-    p = nextchar;
-    nextchar += sz;
-    return p;
-  }
-  /* Doh!  We've got to make room */
-  cp_grow();
-
- return cp_alloc(sz);
- 
+
+  if (nextchar == NULL || (size_t) (end - nextchar) < sz)
+    grow(sz);
+
+  p = nextchar;
+  nextchar += sz;
+  used += sz;
+
+  return p;
+}
+
+char *CharPool::dup(const char *src, size_t len) {
+  char *p;
+
+  p = (char *) alloc(len + 1);
+  memcpy(p, src, len);
+  p[len] = '\0';
+
+  return p;
+}
+
+char *CharPool::dup(const char *src) {
+  return dup(src, strlen(src));
+}
+
+const char *CharPool::intern(const char *s) {
+  std::set<const char *, cstr_less>::iterator it;
+
+  it = interned.find(s);
+  if (it != interned.end())
+    return *it;
+
+  s = dup(s);
+  interned.insert(s);
+
+  return s;
+}
+
+
+/****************************************************************************
+ *                 Implementation of class CharPoolScope                    *
+ ****************************************************************************/
+
+CharPoolScope::CharPoolScope(CharPool *pool) {
+  prev = current_pool;
+  current_pool = pool;
+}
+
+CharPoolScope::~CharPoolScope() {
+  current_pool = prev;
+}
+
+CharPool *cp_current(void) {
+  if (current_pool == NULL)
+    return permanent_pool();
+
+  return current_pool;
+}
+
+void *cp_alloc(int sz) {
+  return permanent_pool()->alloc(sz);
 }
 
 char *cp_strdup(const char *src) {
-const char *p;
-char *q;
-/* end points to the first illegal char */
-char *end;
-int modulus;
-
- cp_init();
-
- end = charpool[currentcharpool] + currentcharpoolsz;
- q = nextchar;
- p = src;
- while((nextchar < end) && *p) {
-   *nextchar++ = *p++;
- }
-
- if (nextchar < end) {
-   /* Goody, we have space */
-   *nextchar++ = '\0';
-   if ((modulus = (nextchar - q) % ALIGN_ON))
-     nextchar += ALIGN_ON - modulus;
-   return q;
- }
-
- /* Doh!  We ran out -- need to allocate more */
- cp_grow();
-
- return cp_strdup(src);
+  return permanent_pool()->dup(src);
+}
+
+void cp_free(void) {
+  permanent_pool()->clear();
 }
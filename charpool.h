@@ -96,6 +96,74 @@
 #ifndef CHARPOOL_H
 #define CHARPOOL_H
 
+#include <stddef.h>
+#include <string.h>
+
+#include <set>
+#include <vector>
+
+/* A CharPool is an arena: many small allocations are carved out of a few
+   large blocks, and are all released at once by clear() or by destroying the
+   pool. Blocks grow geometrically, so a pool never runs out of room until
+   malloc does. Pools are not locked; code running on another thread should
+   allocate from a pool of its own. */
+class CharPool {
+public:
+  CharPool(size_t first_block_size = 1024);
+  ~CharPool();
+
+  void *alloc(size_t sz);
+  char *dup(const char *src);
+  char *dup(const char *src, size_t len);
+  /* Returns a copy of s that is stored only once in this pool, however many
+     times it is interned. */
+  const char *intern(const char *s);
+
+  /* Frees everything allocated from the pool. The pool can be reused. */
+  void clear();
+  /* Number of bytes handed out since the last clear(). */
+  size_t size() const { return used; }
+
+private:
+  struct cstr_less {
+    bool operator()(const char *a, const char *b) const {
+      return strcmp(a, b) < 0;
+    }
+  };
+
+  std::vector<char *> blocks;
+  std::set<const char *, cstr_less> interned;
+  size_t first_block_size;
+  size_t block_size;
+  size_t used;
+  char *nextchar;
+  char *end;
+
+  void grow(size_t sz);
+
+  /* Not copyable: pointers into the pool would be shared. */
+  CharPool(const CharPool &);
+  CharPool &operator=(const CharPool &);
+};
+
+/* While a CharPoolScope exists, cp_current() returns its pool. Scopes nest;
+   outside of any scope cp_current() is the permanent pool. This lets code
+   that interns strings (like the OS fingerprint code) put them in a pool
+   that is released along with the data that refers to them, for example the
+   OS database or the current host group. */
+class CharPoolScope {
+public:
+  CharPoolScope(CharPool *pool);
+  ~CharPoolScope();
+
+private:
+  CharPool *prev;
+};
+
+CharPool *cp_current(void);
+
+/* These allocate from the permanent pool, for data that lives as long as the
+   process. cp_free releases it, and is only for leak checking at exit. */
 void *cp_alloc(int sz);
 char *cp_strdup(const char *src);
 
@@ -0,0 +1,542 @@
+
+/***************************************************************************
+ * checkpoint.cc -- Periodic checkpoints for resuming scans.               *
+ *                                                                         *
+ ***********************IMPORTANT NMAP LICENSE TERMS************************
+ *                                                                         *
+ * The Nmap Security Scanner is (C) 1996-2012 Insecure.Com LLC. Nmap is    *
+ * also a registered trademark of Insecure.Com LLC.  This program is free  *
+ * software; you may redistribute and/or modify it under the terms of the  *
+ * GNU General Public License as published by the Free Software            *
+ * Foundation; Version 2 with the clarifications and exceptions described  *
+ * below.  This guarantees your right to use, modify, and redistribute     *
+ * this software under certain conditions.  If you wish to embed Nmap      *
+ * technology into proprietary software, we sell alternative licenses      *
+ * (contact sales@insecure.com).  Dozens of software vendors already       *
+ * license Nmap technology such as host discovery, port scanning, OS       *
+ * detection, version detection, and the Nmap Scripting Engine.            *
+ *                                                                         *
+ * Note that the GPL places important restrictions on "derived works", yet *
+ * it does not provide a detailed definition of that term.  To avoid       *
+ * misunderstandings, we interpret that term as broadly as copyright law   *
+ * allows.  For example, we consider an application to constitute a        *
+ * "derivative work" for the purpose of this license if it does any of the *
+ * following:                                                              *
+ * o Integrates source code from Nmap                                      *
+ * o Reads or includes Nmap copyrighted data files, such as                *
+ *   nmap-os-db or nmap-service-probes.                                    *
+ * o Executes Nmap and parses the results (as opposed to typical shell or  *
+ *   execution-menu apps, which simply display raw Nmap output and so are  *
+ *   not derivative works.)                                                *
+ * o Integrates/includes/aggregates Nmap into a proprietary executable     *
+ *   installer, such as those produced by InstallShield.                   *
+ * o Links to a library or executes a program that does any of the above   *
+ *                                                                         *
+ * The term "Nmap" should be taken to also include any portions or derived *
+ * works of Nmap, as well as other software we distribute under this       *
+ * license such as Zenmap, Ncat, and Nping.  This list is not exclusive,   *
+ * but is meant to clarify our interpretation of derived works with some   *
+ * common examples.  Our interpretation applies only to Nmap--we don't     *
+ * speak for other people's GPL works.                                     *
+ *                                                                         *
+ * If you have any questions about the GPL licensing restrictions on using *
+ * Nmap in non-GPL works, we would be happy to help.  As mentioned above,  *
+ * we also offer alternative license to integrate Nmap into proprietary    *
+ * applications and appliances.  These contracts have been sold to dozens  *
+ * of software vendors, and generally include a perpetual license as well  *
+ * as providing for priority support and updates.  They also fund the      *
+ * continued development of Nmap.  Please email sales@insecure.com for     *
+ * further information.                                                    *
+ *                                                                         *
+ * As a special exception to the GPL terms, Insecure.Com LLC grants        *
+ * permission to link the code of this program with any version of the     *
+ * OpenSSL library which is distributed under a license identical to that  *
+ * listed in the included docs/licenses/OpenSSL.txt file, and distribute   *
+ * linked combinations including the two. You must obey the GNU GPL in all *
+ * respects for all of the code used other than OpenSSL.  If you modify    *
+ * this file, you may extend this exception to your version of the file,   *
+ * but you are not obligated to do so.                                     *
+ *                                                                         *
+ * If you received these files with a written license agreement or         *
+ * contract stating terms other than the terms above, then that            *
+ * alternative license agreement takes precedence over these comments.     *
+ *                                                                         *
+ * Source is provided to this software because we believe users have a     *
+ * right to know exactly what a program is going to do before they run it. *
+ * This also allows you to audit the software for security holes (none     *
+ * have been found so far).                                                *
+ *                                                                         *
+ * Source code also allows you to port Nmap to new platforms, fix bugs,    *
+ * and add new features.  You are highly encouraged to send your changes   *
+ * to nmap-dev@insecure.org for possible incorporation into the main       *
+ * distribution.  By sending these changes to Fyodor or one of the         *
+ * Insecure.Org development mailing lists, or checking them into the Nmap  *
+ * source code repository, it is understood (unless you specify otherwise) *
+ * that you are offering the Nmap Project (Insecure.Com LLC) the           *
+ * unlimited, non-exclusive right to reuse, modify, and relicense the      *
+ * code.  Nmap will always be available Open Source, but this is important *
+ * because the inability to relicense code has caused devastating problems *
+ * for other Free Software projects (such as KDE and NASM).  We also       *
+ * occasionally relicense the code to third parties as discussed above.    *
+ * If you wish to specify special license conditions of your               *
+ * contributions, just say so when you send them.                          *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * General Public License v2.0 for more details at                         *
+ * http://www.gnu.org/licenses/gpl-2.0.html , or in the COPYING file       *
+ * included with Nmap.                                                     *
+ *                                                                         *
+ ***************************************************************************/
+
+
+/* $Id$ */
+
+/* A checkpoint file lets "nmap --resume" continue a scan in the middle of a
+   hostgroup. It is rewritten every CHECKPOINT_INTERVAL milliseconds during
+   ultra_scan and whenever a phase or a hostgroup finishes. Each write goes
+   to a temporary file which is then renamed over the old one, so that a
+   killed Nmap always leaves a complete checkpoint behind. The format is line
+   based:
+
+     # Nmap <version> checkpoint
+     args <command line without the program name>
+     last <address of the last host whose results were printed>
+     host <address> <srtt> <rttvar> <timeout> <cwnd> <ssthresh> <phases>
+     port <proto> <portno> <state> <reason> <ttl> <reason address>
+
+   where port lines belong to the preceding host line, phases is a
+   comma-separated list of the finished ultra_scan phases (stype values) or
+   "-", and the reason address is "-" if there is none. Numbers are only
+   meaningful to the same version of Nmap, which is checked on resume. */
+
+#include "nmap.h"
+#include "checkpoint.h"
+#include "NmapOps.h"
+#include "Target.h"
+#include "nmap_error.h"
+#include "portlist.h"
+#include "tcpip.h"
+#include "timing.h"
+#include "utils.h"
+
+#include <errno.h>
+
+#include <map>
+#include <set>
+#include <string>
+
+extern NmapOps o;
+
+struct checkpoint_port {
+  u8 proto;
+  u16 portno;
+  u8 state;
+  reason_t reason;
+  u8 ttl;
+  struct sockaddr_storage reason_addr; /* ss_family is AF_UNSPEC if unset. */
+};
+
+struct checkpoint_host {
+  checkpoint_host() : has_timing(false), timing_restored(false) {
+    to.srtt = to.rttvar = to.timeout = -1;
+    cwnd = 0.0;
+    ssthresh = 0;
+  }
+  bool has_timing;
+  bool timing_restored;
+  struct timeout_info to;
+  double cwnd;
+  int ssthresh;
+  std::set<int> phases;
+  std::vector<checkpoint_port> ports;
+};
+
+/* The command line to rerun, the last host whose output is complete, the
+   state saved for the hosts of the current hostgroup, and the state read back
+   from a resumed checkpoint that hasn't been superseded yet. */
+static std::string checkpoint_args;
+static std::string checkpoint_last;
+static std::map<std::string, checkpoint_host> checkpoint_current;
+static std::map<std::string, checkpoint_host> checkpoint_restored;
+static struct timeval checkpoint_last_write;
+
+void checkpoint_start(int argc, char *argv[]) {
+  int i;
+
+  checkpoint_args.clear();
+  for (i = 1; i < argc; i++) {
+    /* Resuming adds this option itself. */
+    if (strcmp(argv[i], "--append-output") == 0)
+      continue;
+    if (!checkpoint_args.empty())
+      checkpoint_args += " ";
+    checkpoint_args += argv[i];
+  }
+  gettimeofday(&checkpoint_last_write, NULL);
+}
+
+bool checkpoint_restoring() {
+  return !checkpoint_restored.empty();
+}
+
+bool checkpoint_due(const struct timeval *now) {
+  return o.checkpoint_file != NULL
+    && TIMEVAL_MSEC_SUBTRACT(*now, checkpoint_last_write) >= CHECKPOINT_INTERVAL;
+}
+
+void checkpoint_save_timing(const Target *t,
+                            const struct ultra_timing_vals *timing) {
+  checkpoint_host &host = checkpoint_current[t->targetipstr()];
+
+  host.cwnd = timing->cwnd;
+  host.ssthresh = timing->ssthresh;
+}
+
+static bool checkpoint_has_port(const checkpoint_host &host, u8 proto,
+                                u16 portno) {
+  std::vector<checkpoint_port>::const_iterator it;
+
+  for (it = host.ports.begin(); it != host.ports.end(); it++) {
+    if (it->proto == proto && it->portno == portno)
+      return true;
+  }
+  return false;
+}
+
+/* Builds the checkpoint record of a host in the current group from its port
+   list, merged with whatever was restored for it and not yet rescanned. */
+static checkpoint_host checkpoint_snapshot(Target *t) {
+  static const u8 protos[] = { IPPROTO_TCP, IPPROTO_UDP, IPPROTO_SCTP, IPPROTO_IP };
+  std::map<std::string, checkpoint_host>::iterator it;
+  checkpoint_host host;
+  Port *p, port;
+  unsigned int i;
+
+  it = checkpoint_current.find(t->targetipstr());
+  if (it != checkpoint_current.end())
+    host = it->second;
+  host.ports.clear();
+  host.has_timing = true;
+  host.to = t->to;
+
+  for (i = 0; i < sizeof(protos) / sizeof(*protos); i++) {
+    p = NULL;
+    while ((p = t->ports.nextPort(p, &port, protos[i], 0)) != NULL) {
+      checkpoint_port cp;
+
+      if (t->ports.portIsDefault(p->portno, p->proto))
+        continue;
+      cp.proto = p->proto;
+      cp.portno = p->portno;
+      cp.state = p->state;
+      cp.reason = p->reason.reason_id;
+      cp.ttl = p->reason.ttl;
+      memset(&cp.reason_addr, 0, sizeof(cp.reason_addr));
+      if (p->reason.ip_addr.sockaddr.sa_family == AF_INET)
+        memcpy(&cp.reason_addr, &p->reason.ip_addr.in, sizeof(p->reason.ip_addr.in));
+      else if (p->reason.ip_addr.sockaddr.sa_family == AF_INET6)
+        memcpy(&cp.reason_addr, &p->reason.ip_addr.in6, sizeof(p->reason.ip_addr.in6));
+      else
+        cp.reason_addr.ss_family = AF_UNSPEC;
+      host.ports.push_back(cp);
+    }
+  }
+
+  it = checkpoint_restored.find(t->targetipstr());
+  if (it != checkpoint_restored.end()) {
+    std::vector<checkpoint_port>::iterator pi;
+
+    host.phases.insert(it->second.phases.begin(), it->second.phases.end());
+    for (pi = it->second.ports.begin(); pi != it->second.ports.end(); pi++) {
+      if (!checkpoint_has_port(host, pi->proto, pi->portno))
+        host.ports.push_back(*pi);
+    }
+    if (host.cwnd == 0.0 && it->second.cwnd != 0.0) {
+      host.cwnd = it->second.cwnd;
+      host.ssthresh = it->second.ssthresh;
+    }
+  }
+
+  return host;
+}
+
+static void checkpoint_write_host(FILE *fp, const std::string &addr,
+                                  const checkpoint_host &host) {
+  std::set<int>::const_iterator si;
+  std::vector<checkpoint_port>::const_iterator pi;
+  std::string phases;
+  char buf[16];
+
+  for (si = host.phases.begin(); si != host.phases.end(); si++) {
+    Snprintf(buf, sizeof(buf), "%d", *si);
+    if (!phases.empty())
+      phases += ",";
+    phases += buf;
+  }
+  if (phases.empty())
+    phases = "-";
+
+  fprintf(fp, "host %s %d %d %d %g %d %s\n", addr.c_str(), host.to.srtt,
+          host.to.rttvar, host.to.timeout, host.cwnd, host.ssthresh,
+          phases.c_str());
+  for (pi = host.ports.begin(); pi != host.ports.end(); pi++) {
+    struct sockaddr_storage ss = pi->reason_addr;
+
+    fprintf(fp, "port %d %d %d %d %d %s\n", pi->proto, pi->portno, pi->state,
+            pi->reason, pi->ttl,
+            ss.ss_family == AF_UNSPEC ? "-" : inet_socktop(&ss));
+  }
+}
+
+/* Writes the whole checkpoint file through a temporary file. */
+static void checkpoint_write(std::vector<Target *> &Targets) {
+  std::map<std::string, checkpoint_host>::iterator it;
+  std::set<std::string> written;
+  std::string tmpname;
+  unsigned int i;
+  FILE *fp;
+
+  gettimeofday(&checkpoint_last_write, NULL);
+
+  tmpname = std::string(o.checkpoint_file) + ".tmp";
+  fp = fopen(tmpname.c_str(), "w");
+  if (fp == NULL) {
+    error("Unable to write checkpoint file %s: %s", tmpname.c_str(), strerror(errno));
+    return;
+  }
+
+  fprintf(fp, "# %s %s checkpoint\n", NMAP_NAME, NMAP_VERSION);
+  fprintf(fp, "args %s\n", checkpoint_args.c_str());
+  if (!checkpoint_last.empty())
+    fprintf(fp, "last %s\n", checkpoint_last.c_str());
+  for (i = 0; i < Targets.size(); i++) {
+    std::string addr = Targets[i]->targetipstr();
+
+    checkpoint_write_host(fp, addr, checkpoint_snapshot(Targets[i]));
+    written.insert(addr);
+  }
+  for (it = checkpoint_restored.begin(); it != checkpoint_restored.end(); it++) {
+    if (written.find(it->first) == written.end())
+      checkpoint_write_host(fp, it->first, it->second);
+  }
+
+  if (fclose(fp) != 0) {
+    error("Unable to write checkpoint file %s: %s", tmpname.c_str(), strerror(errno));
+    return;
+  }
+#ifdef WIN32
+  /* rename() doesn't replace an existing file on Windows. */
+  remove(o.checkpoint_file);
+#endif
+  if (rename(tmpname.c_str(), o.checkpoint_file) != 0)
+    error("Unable to rename %s to %s: %s", tmpname.c_str(), o.checkpoint_file, strerror(errno));
+}
+
+void checkpoint_update(std::vector<Target *> &Targets) {
+  if (o.checkpoint_file == NULL)
+    return;
+  checkpoint_write(Targets);
+}
+
+void checkpoint_phase_done(std::vector<Target *> &Targets, stype scantype) {
+  unsigned int i;
+
+  if (o.checkpoint_file == NULL)
+    return;
+  for (i = 0; i < Targets.size(); i++)
+    checkpoint_current[Targets[i]->targetipstr()].phases.insert(scantype);
+  checkpoint_write(Targets);
+}
+
+void checkpoint_group_done(std::vector<Target *> &Targets) {
+  std::vector<Target *> none;
+  unsigned int i;
+
+  if (o.checkpoint_file == NULL || Targets.empty())
+    return;
+  for (i = 0; i < Targets.size(); i++) {
+    checkpoint_current.erase(Targets[i]->targetipstr());
+    checkpoint_restored.erase(Targets[i]->targetipstr());
+  }
+  checkpoint_last = Targets.back()->targetipstr();
+  checkpoint_write(none);
+}
+
+/* The protocol of the ports scanned by an ultra_scan phase. */
+static u8 checkpoint_phase_proto(stype scantype) {
+  switch (scantype) {
+  case UDP_SCAN:
+    return IPPROTO_UDP;
+  case SCTP_INIT_SCAN:
+  case SCTP_COOKIE_ECHO_SCAN:
+    return IPPROTO_SCTP;
+  case IPPROT_SCAN:
+    return IPPROTO_IP;
+  default:
+    return IPPROTO_TCP;
+  }
+}
+
+bool checkpoint_restore_phase(Target *t, stype scantype,
+                              std::vector<u16> &ports) {
+  std::map<std::string, checkpoint_host>::iterator it;
+  std::vector<checkpoint_port>::iterator pi;
+  u8 proto = checkpoint_phase_proto(scantype);
+
+  it = checkpoint_restored.find(t->targetipstr());
+  if (it == checkpoint_restored.end())
+    return false;
+
+  for (pi = it->second.ports.begin(); pi != it->second.ports.end(); pi++) {
+    if (pi->proto != proto)
+      continue;
+    t->ports.setPortState(pi->portno, pi->proto, pi->state);
+    t->ports.setStateReason(pi->portno, pi->proto, pi->reason, pi->ttl,
+                            pi->reason_addr.ss_family == AF_UNSPEC ? NULL : &pi->reason_addr);
+    ports.push_back(pi->portno);
+  }
+
+  return it->second.phases.find(scantype) != it->second.phases.end();
+}
+
+bool checkpoint_restore_timing(Target *t, struct ultra_timing_vals *timing) {
+  std::map<std::string, checkpoint_host>::iterator it;
+
+  it = checkpoint_restored.find(t->targetipstr());
+  if (it == checkpoint_restored.end() || it->second.timing_restored)
+    return false;
+
+  it->second.timing_restored = true;
+  if (it->second.to.srtt > 0)
+    t->to = it->second.to;
+  if (it->second.cwnd == 0.0)
+    return false;
+  timing->cwnd = it->second.cwnd;
+  timing->ssthresh = it->second.ssthresh;
+  return true;
+}
+
+bool is_checkpoint_file(const char *fname) {
+  char line[128];
+  FILE *fp;
+  bool ret;
+
+  fp = fopen(fname, "r");
+  if (fp == NULL)
+    return false;
+  ret = fgets(line, sizeof(line), fp) != NULL
+    && strncmp(line, "# " NMAP_NAME " ", strlen(NMAP_NAME) + 3) == 0
+    && strstr(line, " checkpoint") != NULL;
+  fclose(fp);
+
+  return ret;
+}
+
+/* Parses an address written by the checkpoint code. */
+static bool checkpoint_parse_addr(const char *str, struct sockaddr_storage *ss) {
+  struct sockaddr_in *sin = (struct sockaddr_in *) ss;
+  struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) ss;
+
+  memset(ss, 0, sizeof(*ss));
+  if (strcmp(str, "-") == 0) {
+    ss->ss_family = AF_UNSPEC;
+    return true;
+  }
+  if (inet_pton(AF_INET, str, &sin->sin_addr) == 1) {
+    sin->sin_family = AF_INET;
+    return true;
+  }
+  if (inet_pton(AF_INET6, str, &sin6->sin6_addr) == 1) {
+    sin6->sin6_family = AF_INET6;
+    return true;
+  }
+  return false;
+}
+
+int gather_checkpoint_resumption_state(const char *fname, int *myargc,
+                                       char ***myargv) {
+  char line[4096], word[64], addrstr[INET6_ADDRSTRLEN + 1], phases[512];
+  std::string command;
+  checkpoint_host *host = NULL;
+  unsigned long lineno = 0;
+  FILE *fp;
+
+  fp = fopen(fname, "r");
+  if (fp == NULL)
+    fatal("Unable to open checkpoint file %s: %s", fname, strerror(errno));
+
+  checkpoint_restored.clear();
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    chomp(line);
+    if (lineno == 1) {
+      Snprintf(word, sizeof(word), "# %s %s checkpoint", NMAP_NAME, NMAP_VERSION);
+      if (strcmp(line, word) != 0)
+        fatal("Checkpoint file %s was not written by this version of %s (%s)", fname, NMAP_NAME, NMAP_VERSION);
+      continue;
+    }
+
+    if (strncmp(line, "args ", 5) == 0) {
+      command = std::string("nmap --append-output ") + (line + 5);
+    } else if (sscanf(line, "last %46s", addrstr) == 1) {
+      struct sockaddr_storage ss;
+
+      if (!checkpoint_parse_addr(addrstr, &ss))
+        fatal("Bad address at line %lu of checkpoint file %s", lineno, fname);
+      if (ss.ss_family == AF_INET)
+        o.resume_ip = ((struct sockaddr_in *) &ss)->sin_addr;
+      else
+        error("Warning: Resuming only skips completed IPv4 hosts; completed hostgroups will be scanned again.");
+    } else if (strncmp(line, "host ", 5) == 0) {
+      checkpoint_host h;
+      char *p, *q;
+
+      if (sscanf(line, "host %46s %d %d %d %lf %d %511s", addrstr, &h.to.srtt,
+                 &h.to.rttvar, &h.to.timeout, &h.cwnd, &h.ssthresh, phases) != 7)
+        fatal("Bad host line at line %lu of checkpoint file %s", lineno, fname);
+      h.has_timing = true;
+      if (strcmp(phases, "-") != 0) {
+        for (p = phases; *p != '\0'; p = (*q == ',') ? q + 1 : q) {
+          h.phases.insert(strtol(p, &q, 10));
+          if (q == p)
+            fatal("Bad phase list at line %lu of checkpoint file %s", lineno, fname);
+        }
+      }
+      host = &checkpoint_restored[addrstr];
+      *host = h;
+    } else if (strncmp(line, "port ", 5) == 0) {
+      int proto, portno, state, reason, ttl;
+      checkpoint_port cp;
+
+      if (host == NULL
+          || sscanf(line, "port %d %d %d %d %d %46s", &proto, &portno, &state,
+                    &reason, &ttl, addrstr) != 6
+          || proto < 0 || proto > 255 || portno < 0 || portno > 65535
+          || state < 0 || state >= PORT_HIGHEST_STATE || reason < 0
+          || !checkpoint_parse_addr(addrstr, &cp.reason_addr))
+        fatal("Bad port line at line %lu of checkpoint file %s", lineno, fname);
+      cp.proto = proto;
+      cp.portno = portno;
+      cp.state = state;
+      cp.reason = reason;
+      cp.ttl = ttl;
+      host->ports.push_back(cp);
+    } else if (line[0] != '\0' && line[0] != '#') {
+      fatal("Unrecognized line %lu in checkpoint file %s", lineno, fname);
+    }
+  }
+  fclose(fp);
+
+  if (command.empty())
+    fatal("Checkpoint file %s has no command line", fname);
+  if (command.find("--randomize-hosts") != std::string::npos)
+    error("WARNING: You are attempting to resume a scan which used --randomize-hosts.  Some hosts in the last randomized batch may be missed and others may be repeated once");
+
+  *myargc = arg_parse(command.c_str(), myargv);
+  if (*myargc == -1)
+    fatal("Unable to parse the command line in checkpoint file %s", fname);
+
+  return 0;
+}
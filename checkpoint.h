@@ -0,0 +1,158 @@
+
+/***************************************************************************
+ * checkpoint.h -- Periodic checkpoints for resuming scans.                *
+ *                                                                         *
+ ***********************IMPORTANT NMAP LICENSE TERMS************************
+ *                                                                         *
+ * The Nmap Security Scanner is (C) 1996-2012 Insecure.Com LLC. Nmap is    *
+ * also a registered trademark of Insecure.Com LLC.  This program is free  *
+ * software; you may redistribute and/or modify it under the terms of the  *
+ * GNU General Public License as published by the Free Software            *
+ * Foundation; Version 2 with the clarifications and exceptions described  *
+ * below.  This guarantees your right to use, modify, and redistribute     *
+ * this software under certain conditions.  If you wish to embed Nmap      *
+ * technology into proprietary software, we sell alternative licenses      *
+ * (contact sales@insecure.com).  Dozens of software vendors already       *
+ * license Nmap technology such as host discovery, port scanning, OS       *
+ * detection, version detection, and the Nmap Scripting Engine.            *
+ *                                                                         *
+ * Note that the GPL places important restrictions on "derived works", yet *
+ * it does not provide a detailed definition of that term.  To avoid       *
+ * misunderstandings, we interpret that term as broadly as copyright law   *
+ * allows.  For example, we consider an application to constitute a        *
+ * "derivative work" for the purpose of this license if it does any of the *
+ * following:                                                              *
+ * o Integrates source code from Nmap                                      *
+ * o Reads or includes Nmap copyrighted data files, such as                *
+ *   nmap-os-db or nmap-service-probes.                                    *
+ * o Executes Nmap and parses the results (as opposed to typical shell or  *
+ *   execution-menu apps, which simply display raw Nmap output and so are  *
+ *   not derivative works.)                                                *
+ * o Integrates/includes/aggregates Nmap into a proprietary executable     *
+ *   installer, such as those produced by InstallShield.                   *
+ * o Links to a library or executes a program that does any of the above   *
+ *                                                                         *
+ * The term "Nmap" should be taken to also include any portions or derived *
+ * works of Nmap, as well as other software we distribute under this       *
+ * license such as Zenmap, Ncat, and Nping.  This list is not exclusive,   *
+ * but is meant to clarify our interpretation of derived works with some   *
+ * common examples.  Our interpretation applies only to Nmap--we don't     *
+ * speak for other people's GPL works.                                     *
+ *                                                                         *
+ * If you have any questions about the GPL licensing restrictions on using *
+ * Nmap in non-GPL works, we would be happy to help.  As mentioned above,  *
+ * we also offer alternative license to integrate Nmap into proprietary    *
+ * applications and appliances.  These contracts have been sold to dozens  *
+ * of software vendors, and generally include a perpetual license as well  *
+ * as providing for priority support and updates.  They also fund the      *
+ * continued development of Nmap.  Please email sales@insecure.com for     *
+ * further information.                                                    *
+ *                                                                         *
+ * As a special exception to the GPL terms, Insecure.Com LLC grants        *
+ * permission to link the code of this program with any version of the     *
+ * OpenSSL library which is distributed under a license identical to that  *
+ * listed in the included docs/licenses/OpenSSL.txt file, and distribute   *
+ * linked combinations including the two. You must obey the GNU GPL in all *
+ * respects for all of the code used other than OpenSSL.  If you modify    *
+ * this file, you may extend this exception to your version of the file,   *
+ * but you are not obligated to do so.                                     *
+ *                                                                         *
+ * If you received these files with a written license agreement or         *
+ * contract stating terms other than the terms above, then that            *
+ * alternative license agreement takes precedence over these comments.     *
+ *                                                                         *
+ * Source is provided to this software because we believe users have a     *
+ * right to know exactly what a program is going to do before they run it. *
+ * This also allows you to audit the software for security holes (none     *
+ * have been found so far).                                                *
+ *                                                                         *
+ * Source code also allows you to port Nmap to new platforms, fix bugs,    *
+ * and add new features.  You are highly encouraged to send your changes   *
+ * to nmap-dev@insecure.org for possible incorporation into the main       *
+ * distribution.  By sending these changes to Fyodor or one of the         *
+ * Insecure.Org development mailing lists, or checking them into the Nmap  *
+ * source code repository, it is understood (unless you specify otherwise) *
+ * that you are offering the Nmap Project (Insecure.Com LLC) the           *
+ * unlimited, non-exclusive right to reuse, modify, and relicense the      *
+ * code.  Nmap will always be available Open Source, but this is important *
+ * because the inability to relicense code has caused devastating problems *
+ * for other Free Software projects (such as KDE and NASM).  We also       *
+ * occasionally relicense the code to third parties as discussed above.    *
+ * If you wish to specify special license conditions of your               *
+ * contributions, just say so when you send them.                          *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * General Public License v2.0 for more details at                         *
+ * http://www.gnu.org/licenses/gpl-2.0.html , or in the COPYING file       *
+ * included with Nmap.                                                     *
+ *                                                                         *
+ ***************************************************************************/
+
+
+/* $Id$ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "nmap.h"
+#include "global_structures.h"
+
+#include <vector>
+
+class Target;
+
+/* How often ultra_scan rewrites the checkpoint file, in milliseconds. */
+#define CHECKPOINT_INTERVAL 5000
+
+/* Starts checkpointing to o.checkpoint_file, recording the given command line
+   so that "nmap --resume" can rerun it. */
+void checkpoint_start(int argc, char *argv[]);
+
+/* Returns true if fname looks like a checkpoint file rather than a log. */
+bool is_checkpoint_file(const char *fname);
+
+/* Like gather_logfile_resumption_state(), but for a checkpoint file. Besides
+   the arguments and the last completed host, this loads the per-host results
+   and timing of the hostgroup that was being scanned, which ultra_scan then
+   uses instead of probing those ports again. */
+int gather_checkpoint_resumption_state(const char *fname, int *myargc,
+                                       char ***myargv);
+
+/* Returns true if a resumed checkpoint has results left to restore. */
+bool checkpoint_restoring();
+
+/* Returns true if it is time to write another checkpoint. */
+bool checkpoint_due(const struct timeval *now);
+
+/* Records the congestion control state of a host, to be written with the
+   next checkpoint. */
+void checkpoint_save_timing(const Target *t,
+                            const struct ultra_timing_vals *timing);
+
+/* Writes the port results and timing of every host in Targets, together with
+   any restored results that haven't been used yet. */
+void checkpoint_update(std::vector<Target *> &Targets);
+
+/* Marks an ultra_scan phase as finished for every host in Targets and writes
+   a checkpoint. */
+void checkpoint_phase_done(std::vector<Target *> &Targets, stype scantype);
+
+/* Called after the results for a hostgroup have been printed. The group's
+   hosts are dropped from the checkpoint, which now resumes after the last of
+   them. */
+void checkpoint_group_done(std::vector<Target *> &Targets);
+
+/* Restores the port results of scantype for t from a resumed checkpoint. The
+   restored port numbers are appended to ports. Returns true if the phase had
+   already finished for the host, in which case no ports need probing. */
+bool checkpoint_restore_phase(Target *t, stype scantype,
+                              std::vector<u16> &ports);
+
+/* Restores the timeouts of t and its congestion control state from a resumed
+   checkpoint. This is only done once per host. Returns true if timing was
+   restored into timing. */
+bool checkpoint_restore_timing(Target *t, struct ultra_timing_vals *timing);
+
+#endif /* CHECKPOINT_H */
@@ -0,0 +1,510 @@
+
+/***************************************************************************
+ * databundle.cc -- Pre-parsed, memory-mappable bundle of Nmap data files. *
+ *                                                                         *
+ ***********************IMPORTANT NMAP LICENSE TERMS************************
+ *                                                                         *
+ * The Nmap Security Scanner is (C) 1996-2012 Insecure.Com LLC. Nmap is    *
+ * also a registered trademark of Insecure.Com LLC.  This program is free  *
+ * software; you may redistribute and/or modify it under the terms of the  *
+ * GNU General Public License as published by the Free Software            *
+ * Foundation; Version 2 with the clarifications and exceptions described  *
+ * below.  This guarantees your right to use, modify, and redistribute     *
+ * this software under certain conditions.  If you wish to embed Nmap      *
+ * technology into proprietary software, we sell alternative licenses      *
+ * (contact sales@insecure.com).  Dozens of software vendors already       *
+ * license Nmap technology such as host discovery, port scanning, OS       *
+ * detection, version detection, and the Nmap Scripting Engine.            *
+ *                                                                         *
+ * Note that the GPL places important restrictions on "derived works", yet *
+ * it does not provide a detailed definition of that term.  To avoid       *
+ * misunderstandings, we interpret that term as broadly as copyright law   *
+ * allows.  For example, we consider an application to constitute a        *
+ * "derivative work" for the purpose of this license if it does any of the *
+ * following:                                                              *
+ * o Integrates source code from Nmap                                      *
+ * o Reads or includes Nmap copyrighted data files, such as                *
+ *   nmap-os-db or nmap-service-probes.                                    *
+ * o Executes Nmap and parses the results (as opposed to typical shell or  *
+ *   execution-menu apps, which simply display raw Nmap output and so are  *
+ *   not derivative works.)                                                *
+ * o Integrates/includes/aggregates Nmap into a proprietary executable     *
+ *   installer, such as those produced by InstallShield.                   *
+ * o Links to a library or executes a program that does any of the above   *
+ *                                                                         *
+ * The term "Nmap" should be taken to also include any portions or derived *
+ * works of Nmap, as well as other software we distribute under this       *
+ * license such as Zenmap, Ncat, and Nping.  This list is not exclusive,   *
+ * but is meant to clarify our interpretation of derived works with some   *
+ * common examples.  Our interpretation applies only to Nmap--we don't     *
+ * speak for other people's GPL works.                                     *
+ *                                                                         *
+ * If you have any questions about the GPL licensing restrictions on using *
+ * Nmap in non-GPL works, we would be happy to help.  As mentioned above,  *
+ * we also offer alternative license to integrate Nmap into proprietary    *
+ * applications and appliances.  These contracts have been sold to dozens  *
+ * of software vendors, and generally include a perpetual license as well  *
+ * as providing for priority support and updates.  They also fund the      *
+ * continued development of Nmap.  Please email sales@insecure.com for     *
+ * further information.                                                    *
+ *                                                                         *
+ * As a special exception to the GPL terms, Insecure.Com LLC grants        *
+ * permission to link the code of this program with any version of the     *
+ * OpenSSL library which is distributed under a license identical to that  *
+ * listed in the included docs/licenses/OpenSSL.txt file, and distribute   *
+ * linked combinations including the two. You must obey the GNU GPL in all *
+ * respects for all of the code used other than OpenSSL.  If you modify    *
+ * this file, you may extend this exception to your version of the file,   *
+ * but you are not obligated to do so.                                     *
+ *                                                                         *
+ * If you received these files with a written license agreement or         *
+ * contract stating terms other than the terms above, then that            *
+ * alternative license agreement takes precedence over these comments.     *
+ *                                                                         *
+ * Source is provided to this software because we believe users have a     *
+ * right to know exactly what a program is going to do before they run it. *
+ * This also allows you to audit the software for security holes (none     *
+ * have been found so far).                                                *
+ *                                                                         *
+ * Source code also allows you to port Nmap to new platforms, fix bugs,    *
+ * and add new features.  You are highly encouraged to send your changes   *
+ * to nmap-dev@insecure.org for possible incorporation into the main       *
+ * distribution.  By sending these changes to Fyodor or one of the         *
+ * Insecure.Org development mailing lists, or checking them into the Nmap  *
+ * source code repository, it is understood (unless you specify otherwise) *
+ * that you are offering the Nmap Project (Insecure.Com LLC) the           *
+ * unlimited, non-exclusive right to reuse, modify, and relicense the      *
+ * code.  Nmap will always be available Open Source, but this is important *
+ * because the inability to relicense code has caused devastating problems *
+ * for other Free Software projects (such as KDE and NASM).  We also       *
+ * occasionally relicense the code to third parties as discussed above.    *
+ * If you wish to specify special license conditions of your               *
+ * contributions, just say so when you send them.                          *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * General Public License v2.0 for more details at                         *
+ * http://www.gnu.org/licenses/gpl-2.0.html , or in the COPYING file       *
+ * included with Nmap.                                                     *
+ *                                                                         *
+ ***************************************************************************/
+
+
+/* $Id$ */
+
+/* A data bundle holds the already-parsed contents of the simple line-based
+   data files (nmap-services, nmap-protocols, nmap-rpc, nmap-mac-prefixes) in
+   a form that can be used straight from a read-only memory mapping. It is built
+   with "nmap --build-data-bundle <dir>" and is used only while the text files
+   it was built from are unchanged; otherwise the text files are parsed as
+   usual. The layout is
+
+     struct bundle_header
+     struct bundle_section[num_sections]
+     for each section: struct data_record[num_records], then the string pool
+
+   with every records array starting on an 8-byte boundary. Numbers are stored
+   in host byte order; a bundle built on a machine of the other endianness is
+   simply ignored. */
+
+#include "nmap.h"
+#include "databundle.h"
+#include "MACLookup.h"
+#include "protocols.h"
+#include "services.h"
+#include "nmap_rpc.h"
+#include "NmapOps.h"
+#include "nmap_error.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+#include <map>
+#include <string>
+
+extern NmapOps o;
+
+#define DATA_BUNDLE_MAGIC "NMAPDB\r\n"
+#define DATA_BUNDLE_FORMAT 1
+#define DATA_BUNDLE_BYTE_ORDER 0x01020304
+
+struct bundle_header {
+  char magic[8];
+  u32 byte_order;
+  u32 format;
+  char version[32];
+  u32 num_sections;
+  u32 reserved;
+};
+
+struct bundle_section {
+  char name[32];
+  u64 src_size;
+  u64 src_mtime;
+  u32 records_offset;
+  u32 num_records;
+  u32 strings_offset;
+  u32 strings_size;
+};
+
+/* The data files that go into a bundle, with their parsers. */
+static const struct {
+  const char *datafile;
+  int (*parse)(const char *filename, DataTable *table);
+} bundled_files[] = {
+  { "nmap-services", services_parse_file },
+  { "nmap-protocols", protocols_parse_file },
+  { "nmap-rpc", rpc_parse_file },
+  { "nmap-mac-prefixes", mac_prefixes_parse_file },
+};
+
+struct mapped_bundle {
+  const char *data;
+  size_t size;
+};
+
+/* Bundles that have been opened, by directory. NULL means that the directory
+   has no usable bundle. Bundles stay mapped for the life of the process,
+   because tables attached to them point into the mapping. */
+static std::map<std::string, struct mapped_bundle *> bundles;
+
+
+/****************************************************************************
+ *                   Implementation of class DataTable                      *
+ ****************************************************************************/
+
+DataTable::DataTable() {
+  clear();
+}
+
+void DataTable::clear() {
+  own_records.clear();
+  own_strings.clear();
+  /* Offset 0 is always the empty string. */
+  own_strings.push_back('\0');
+  sync();
+}
+
+void DataTable::add(u32 number, const char *name, const char *proto,
+                    double ratio, u32 flags) {
+  struct data_record rec;
+
+  rec.number = number;
+  rec.name = own_strings.size();
+  own_strings.insert(own_strings.end(), name, name + strlen(name) + 1);
+  if (proto == NULL || *proto == '\0') {
+    rec.proto = 0;
+  } else {
+    rec.proto = own_strings.size();
+    own_strings.insert(own_strings.end(), proto, proto + strlen(proto) + 1);
+  }
+  rec.flags = flags;
+  rec.ratio = ratio;
+  own_records.push_back(rec);
+  sync();
+}
+
+void DataTable::attach(const struct data_record *records, unsigned int count,
+                       const char *strings, u32 strings_size) {
+  own_records.clear();
+  own_strings.clear();
+  this->records = records;
+  this->count = count;
+  this->strings = strings;
+  this->strings_size = strings_size;
+}
+
+/* Point the public view at our own storage, which may have been reallocated. */
+void DataTable::sync() {
+  records = own_records.empty() ? NULL : &own_records[0];
+  count = own_records.size();
+  strings = &own_strings[0];
+  strings_size = own_strings.size();
+}
+
+
+/****************************************************************************
+ *                      Reading and writing bundles                         *
+ ****************************************************************************/
+
+/* Returns the directory part of filename, or "." if it has none. */
+static std::string dir_of(const char *filename) {
+  const char *p;
+
+  p = strrchr(filename, '/');
+#ifdef WIN32
+  const char *q = strrchr(filename, '\\');
+  if (q != NULL && (p == NULL || q > p))
+    p = q;
+#endif
+  if (p == NULL)
+    return ".";
+
+  return std::string(filename, p - filename);
+}
+
+/* Checks that the header and section table of a bundle make sense, so that
+   databundle_get can trust the offsets in them. */
+static bool bundle_valid(const char *data, size_t size) {
+  const struct bundle_header *hdr;
+  const struct bundle_section *sec;
+  unsigned int i;
+
+  if (size < sizeof(*hdr))
+    return false;
+  hdr = (const struct bundle_header *) data;
+  if (memcmp(hdr->magic, DATA_BUNDLE_MAGIC, sizeof(hdr->magic)) != 0
+      || hdr->byte_order != DATA_BUNDLE_BYTE_ORDER
+      || hdr->format != DATA_BUNDLE_FORMAT
+      || strncmp(hdr->version, NMAP_VERSION, sizeof(hdr->version)) != 0)
+    return false;
+  if (hdr->num_sections > (size - sizeof(*hdr)) / sizeof(*sec))
+    return false;
+
+  sec = (const struct bundle_section *) (data + sizeof(*hdr));
+  for (i = 0; i < hdr->num_sections; i++) {
+    if (sec[i].records_offset % 8 != 0
+        || sec[i].records_offset > size
+        || sec[i].num_records > (size - sec[i].records_offset) / sizeof(struct data_record)
+        || sec[i].strings_offset > size
+        || sec[i].strings_size > size - sec[i].strings_offset
+        || sec[i].strings_size == 0
+        || data[sec[i].strings_offset + sec[i].strings_size - 1] != '\0')
+      return false;
+  }
+
+  return true;
+}
+
+/* Maps dir/nmap-data.bundle, returning NULL if it doesn't exist or isn't a
+   bundle that this Nmap can use. */
+static struct mapped_bundle *bundle_open(const std::string &dir) {
+  struct mapped_bundle *b;
+  std::string path;
+  struct stat st;
+  char *data;
+  int fd;
+
+  path = dir + "/" + DATA_BUNDLE_FILENAME;
+  if (stat(path.c_str(), &st) == -1 || st.st_size <= 0)
+    return NULL;
+
+  fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    return NULL;
+
+#ifndef WIN32
+  data = (char *) mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == (char *) MAP_FAILED)
+    return NULL;
+#else
+  data = (char *) safe_malloc(st.st_size);
+  if (read(fd, data, st.st_size) != st.st_size) {
+    close(fd);
+    free(data);
+    return NULL;
+  }
+  close(fd);
+#endif
+
+  if (!bundle_valid(data, st.st_size)) {
+    if (o.debugging)
+      error("Ignoring invalid or out-of-date data bundle %s", path.c_str());
+#ifndef WIN32
+    munmap(data, st.st_size);
+#else
+    free(data);
+#endif
+    return NULL;
+  }
+
+  b = (struct mapped_bundle *) safe_malloc(sizeof(*b));
+  b->data = data;
+  b->size = st.st_size;
+
+  return b;
+}
+
+bool databundle_get(const char *datafile, const char *filename,
+                    DataTable *table) {
+  std::map<std::string, struct mapped_bundle *>::iterator it;
+  const struct bundle_header *hdr;
+  const struct bundle_section *sec;
+  struct mapped_bundle *b;
+  std::string dir;
+  struct stat st;
+  unsigned int i;
+
+  dir = dir_of(filename);
+  it = bundles.find(dir);
+  if (it == bundles.end())
+    it = bundles.insert(std::make_pair(dir, bundle_open(dir))).first;
+  b = it->second;
+  if (b == NULL)
+    return false;
+
+  if (stat(filename, &st) == -1)
+    return false;
+
+  hdr = (const struct bundle_header *) b->data;
+  sec = (const struct bundle_section *) (b->data + sizeof(*hdr));
+  for (i = 0; i < hdr->num_sections; i++) {
+    if (strncmp(sec[i].name, datafile, sizeof(sec[i].name)) == 0)
+      break;
+  }
+  if (i == hdr->num_sections)
+    return false;
+  sec += i;
+
+  if (sec->src_size != (u64) st.st_size || sec->src_mtime != (u64) st.st_mtime) {
+    if (o.debugging)
+      log_write(LOG_PLAIN, "%s has changed since the data bundle was built; parsing it.\n", filename);
+    return false;
+  }
+
+  table->attach((const struct data_record *) (b->data + sec->records_offset),
+                sec->num_records, b->data + sec->strings_offset, sec->strings_size);
+
+  /* Make sure no record points outside the string pool. */
+  for (i = 0; i < table->size(); i++) {
+    const struct data_record *rec = table->get_records() + i;
+    if (rec->name >= sec->strings_size || rec->proto >= sec->strings_size) {
+      error("Data bundle in %s is corrupt; parsing %s instead.", dir.c_str(), filename);
+      table->clear();
+      return false;
+    }
+  }
+
+  if (o.debugging > 1)
+    log_write(LOG_PLAIN, "Loaded %s from the data bundle in %s.\n", datafile, dir.c_str());
+
+  return true;
+}
+
+/* Pads the output to a multiple of 8 bytes. */
+static int write_padding(FILE *fp, long *offset) {
+  static const char zeros[8] = { 0 };
+  size_t n;
+
+  n = (8 - *offset % 8) % 8;
+  if (n > 0 && fwrite(zeros, 1, n, fp) != n)
+    return -1;
+  *offset += n;
+
+  return 0;
+}
+
+int databundle_write(const char *dir) {
+  const unsigned int num_files = sizeof(bundled_files) / sizeof(*bundled_files);
+  DataTable tables[sizeof(bundled_files) / sizeof(*bundled_files)];
+  struct bundle_section sections[sizeof(bundled_files) / sizeof(*bundled_files)];
+  struct bundle_header hdr;
+  std::string path, tmppath;
+  struct stat st;
+  unsigned int i, num_sections;
+  long offset;
+  FILE *fp;
+
+  /* Parse everything first, to lay out the sections. */
+  memset(sections, 0, sizeof(sections));
+  num_sections = 0;
+  offset = sizeof(hdr);
+  for (i = 0; i < num_files; i++) {
+    struct bundle_section *sec = &sections[num_sections];
+    DataTable *table = &tables[num_sections];
+
+    path = std::string(dir) + "/" + bundled_files[i].datafile;
+    if (stat(path.c_str(), &st) == -1) {
+      error("Not bundling %s: %s", path.c_str(), strerror(errno));
+      continue;
+    }
+    if (bundled_files[i].parse(path.c_str(), table) == -1) {
+      error("Not bundling %s: unable to read it", path.c_str());
+      continue;
+    }
+    Strncpy(sec->name, bundled_files[i].datafile, sizeof(sec->name));
+    sec->src_size = st.st_size;
+    sec->src_mtime = st.st_mtime;
+    sec->num_records = table->size();
+    sec->strings_size = table->get_strings_size();
+    num_sections++;
+  }
+  if (num_sections == 0) {
+    error("No data files found in %s; not writing a data bundle.", dir);
+    return -1;
+  }
+
+  offset += num_sections * sizeof(struct bundle_section);
+  for (i = 0; i < num_sections; i++) {
+    offset += (8 - offset % 8) % 8;
+    sections[i].records_offset = offset;
+    offset += sections[i].num_records * sizeof(struct data_record);
+    sections[i].strings_offset = offset;
+    offset += sections[i].strings_size;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, DATA_BUNDLE_MAGIC, sizeof(hdr.magic));
+  hdr.byte_order = DATA_BUNDLE_BYTE_ORDER;
+  hdr.format = DATA_BUNDLE_FORMAT;
+  Strncpy(hdr.version, NMAP_VERSION, sizeof(hdr.version));
+  hdr.num_sections = num_sections;
+
+  /* Write to a temporary file and rename it into place, so that a concurrently
+     starting Nmap never sees a partial bundle. */
+  path = std::string(dir) + "/" + DATA_BUNDLE_FILENAME;
+  tmppath = path + ".tmp";
+  fp = fopen(tmppath.c_str(), "wb");
+  if (fp == NULL) {
+    error("Unable to open %s for writing: %s", tmppath.c_str(), strerror(errno));
+    return -1;
+  }
+
+  offset = 0;
+  if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1
+      || fwrite(sections, sizeof(*sections), num_sections, fp) != num_sections)
+    goto write_error;
+  offset = sizeof(hdr) + num_sections * sizeof(*sections);
+  for (i = 0; i < num_sections; i++) {
+    if (write_padding(fp, &offset) == -1)
+      goto write_error;
+    if (fwrite(tables[i].get_records(), sizeof(struct data_record),
+               sections[i].num_records, fp) != sections[i].num_records
+        || fwrite(tables[i].get_strings(), 1, sections[i].strings_size, fp)
+           != sections[i].strings_size)
+      goto write_error;
+    offset += sections[i].num_records * sizeof(struct data_record) + sections[i].strings_size;
+  }
+
+  if (fclose(fp) != 0) {
+    fp = NULL;
+    goto write_error;
+  }
+#ifdef WIN32
+  /* rename() won't replace an existing file on Windows. */
+  unlink(path.c_str());
+#endif
+  if (rename(tmppath.c_str(), path.c_str()) == -1) {
+    error("Unable to rename %s to %s: %s", tmppath.c_str(), path.c_str(), strerror(errno));
+    unlink(tmppath.c_str());
+    return -1;
+  }
+
+  for (i = 0; i < num_sections; i++)
+    log_write(LOG_STDOUT, "Bundled %u records from %s.\n", sections[i].num_records, sections[i].name);
+  log_write(LOG_STDOUT, "Wrote %s.\n", path.c_str());
+
+  return 0;
+
+write_error:
+  error("Error writing %s: %s", tmppath.c_str(), strerror(errno));
+  if (fp != NULL)
+    fclose(fp);
+  unlink(tmppath.c_str());
+  return -1;
+}
@@ -0,0 +1,166 @@
+
+/***************************************************************************
+ * databundle.h -- Pre-parsed, memory-mappable bundle of Nmap data files.  *
+ *                                                                         *
+ ***********************IMPORTANT NMAP LICENSE TERMS************************
+ *                                                                         *
+ * The Nmap Security Scanner is (C) 1996-2012 Insecure.Com LLC. Nmap is    *
+ * also a registered trademark of Insecure.Com LLC.  This program is free  *
+ * software; you may redistribute and/or modify it under the terms of the  *
+ * GNU General Public License as published by the Free Software            *
+ * Foundation; Version 2 with the clarifications and exceptions described  *
+ * below.  This guarantees your right to use, modify, and redistribute     *
+ * this software under certain conditions.  If you wish to embed Nmap      *
+ * technology into proprietary software, we sell alternative licenses      *
+ * (contact sales@insecure.com).  Dozens of software vendors already       *
+ * license Nmap technology such as host discovery, port scanning, OS       *
+ * detection, version detection, and the Nmap Scripting Engine.            *
+ *                                                                         *
+ * Note that the GPL places important restrictions on "derived works", yet *
+ * it does not provide a detailed definition of that term.  To avoid       *
+ * misunderstandings, we interpret that term as broadly as copyright law   *
+ * allows.  For example, we consider an application to constitute a        *
+ * "derivative work" for the purpose of this license if it does any of the *
+ * following:                                                              *
+ * o Integrates source code from Nmap                                      *
+ * o Reads or includes Nmap copyrighted data files, such as                *
+ *   nmap-os-db or nmap-service-probes.                                    *
+ * o Executes Nmap and parses the results (as opposed to typical shell or  *
+ *   execution-menu apps, which simply display raw Nmap output and so are  *
+ *   not derivative works.)                                                *
+ * o Integrates/includes/aggregates Nmap into a proprietary executable     *
+ *   installer, such as those produced by InstallShield.                   *
+ * o Links to a library or executes a program that does any of the above   *
+ *                                                                         *
+ * The term "Nmap" should be taken to also include any portions or derived *
+ * works of Nmap, as well as other software we distribute under this       *
+ * license such as Zenmap, Ncat, and Nping.  This list is not exclusive,   *
+ * but is meant to clarify our interpretation of derived works with some   *
+ * common examples.  Our interpretation applies only to Nmap--we don't     *
+ * speak for other people's GPL works.                                     *
+ *                                                                         *
+ * If you have any questions about the GPL licensing restrictions on using *
+ * Nmap in non-GPL works, we would be happy to help.  As mentioned above,  *
+ * we also offer alternative license to integrate Nmap into proprietary    *
+ * applications and appliances.  These contracts have been sold to dozens  *
+ * of software vendors, and generally include a perpetual license as well  *
+ * as providing for priority support and updates.  They also fund the      *
+ * continued development of Nmap.  Please email sales@insecure.com for     *
+ * further information.                                                    *
+ *                                                                         *
+ * As a special exception to the GPL terms, Insecure.Com LLC grants        *
+ * permission to link the code of this program with any version of the     *
+ * OpenSSL library which is distributed under a license identical to that  *
+ * listed in the included docs/licenses/OpenSSL.txt file, and distribute   *
+ * linked combinations including the two. You must obey the GNU GPL in all *
+ * respects for all of the code used other than OpenSSL.  If you modify    *
+ * this file, you may extend this exception to your version of the file,   *
+ * but you are not obligated to do so.                                     *
+ *                                                                         *
+ * If you received these files with a written license agreement or         *
+ * contract stating terms other than the terms above, then that            *
+ * alternative license agreement takes precedence over these comments.     *
+ *                                                                         *
+ * Source is provided to this software because we believe users have a     *
+ * right to know exactly what a program is going to do before they run it. *
+ * This also allows you to audit the software for security holes (none     *
+ * have been found so far).                                                *
+ *                                                                         *
+ * Source code also allows you to port Nmap to new platforms, fix bugs,    *
+ * and add new features.  You are highly encouraged to send your changes   *
+ * to nmap-dev@insecure.org for possible incorporation into the main       *
+ * distribution.  By sending these changes to Fyodor or one of the         *
+ * Insecure.Org development mailing lists, or checking them into the Nmap  *
+ * source code repository, it is understood (unless you specify otherwise) *
+ * that you are offering the Nmap Project (Insecure.Com LLC) the           *
+ * unlimited, non-exclusive right to reuse, modify, and relicense the      *
+ * code.  Nmap will always be available Open Source, but this is important *
+ * because the inability to relicense code has caused devastating problems *
+ * for other Free Software projects (such as KDE and NASM).  We also       *
+ * occasionally relicense the code to third parties as discussed above.    *
+ * If you wish to specify special license conditions of your               *
+ * contributions, just say so when you send them.                          *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * General Public License v2.0 for more details at                         *
+ * http://www.gnu.org/licenses/gpl-2.0.html , or in the COPYING file       *
+ * included with Nmap.                                                     *
+ *                                                                         *
+ ***************************************************************************/
+
+
+/* $Id$ */
+
+#ifndef DATABUNDLE_H
+#define DATABUNDLE_H
+
+#include "nbase.h"
+
+#include <vector>
+
+#define DATA_BUNDLE_FILENAME "nmap-data.bundle"
+
+/* One entry of a data table. The meaning of number, name and proto depends on
+   the data file (port and service name, MAC prefix and vendor, etc.). Strings
+   are offsets into the table's string pool. The layout is that of the bundle
+   file, so it must not change without changing DATA_BUNDLE_FORMAT in
+   databundle.cc. */
+struct data_record {
+  u32 number;
+  u32 name;
+  u32 proto;
+  u32 flags;
+  double ratio;
+};
+
+/* A parsed data file: a list of records and the strings they refer to. A table
+   is either filled in by a data file parser through add() or attached to a
+   section of a memory-mapped bundle, in which case no copy is made. Strings
+   returned by name() and proto() remain valid as long as the table does. */
+class DataTable {
+public:
+  DataTable();
+  void clear();
+  void add(u32 number, const char *name, const char *proto = NULL,
+    double ratio = 0.0, u32 flags = 0);
+  void attach(const struct data_record *records, unsigned int count,
+    const char *strings, u32 strings_size);
+
+  unsigned int size() const { return count; }
+  const struct data_record *get_records() const { return records; }
+  const char *get_strings() const { return strings; }
+  u32 get_strings_size() const { return strings_size; }
+
+  u32 number(unsigned int i) const { return records[i].number; }
+  const char *name(unsigned int i) const { return strings + records[i].name; }
+  const char *proto(unsigned int i) const { return strings + records[i].proto; }
+  double ratio(unsigned int i) const { return records[i].ratio; }
+  u32 flags(unsigned int i) const { return records[i].flags; }
+
+private:
+  std::vector<struct data_record> own_records;
+  std::vector<char> own_strings;
+  const struct data_record *records;
+  unsigned int count;
+  const char *strings;
+  u32 strings_size;
+
+  void sync();
+};
+
+/* If a fresh bundle sits in the same directory as filename (the location of
+   the data file datafile, as returned by nmap_fetchfile()), attaches table to
+   the bundled copy of that data file and returns true. Otherwise returns false
+   and the caller should parse filename itself. A bundle is fresh if it was
+   built by this version of Nmap from a file with the same size and
+   modification time. */
+bool databundle_get(const char *datafile, const char *filename,
+  DataTable *table);
+
+/* Parses the data files in directory dir and writes a bundle of them to
+   dir/nmap-data.bundle. Returns 0 on success and -1 on error. */
+int databundle_write(const char *dir);
+
+#endif /* DATABUNDLE_H */
@@ -99,6 +99,8 @@
 
 #include <vector>
 
+#include "charpool.h"
+
 class TargetGroup;
 class Target;
 
@@ -212,6 +214,8 @@ struct FingerPrint {
 struct FingerPrintDB {
   FingerPrint *MatchPoints;
   std::vector<FingerPrint *> prints;
+  /* OS names and interned strings of the prints. */
+  CharPool strings;
 
   FingerPrintDB();
   ~FingerPrintDB();
@@ -110,6 +110,7 @@
 #include "struct_ip.h"
 
 #include <stdio.h>
+#include <vector>
 
 extern NmapOps o;
 
@@ -264,12 +265,25 @@ static void initialize_proxy_struct(struct idle_proxy_info *proxy) {
   proxy->ethptr = NULL;
 }
 
+/* Releases the capture handle and raw socket of a proxy that turned out
+   to be unusable */
+static void close_idleproxy(struct idle_proxy_info *proxy) {
+  if (proxy->pd) {
+    pcap_close(proxy->pd);
+    proxy->pd = NULL;
+  }
+  if (proxy->rawsd >= 0) {
+    close(proxy->rawsd);
+    proxy->rawsd = -1;
+  }
+}
+
 /* takes a proxy name/IP, resolves it if necessary, tests it for IP ID
    suitability, and fills out an idle_proxy_info structure.  If the
-   proxy is determined to be unsuitable, the function whines and exits
-   the program */
+   proxy is determined to be unsuitable, the function whines and returns
+   false so that the caller can try another one */
 #define NUM_IPID_PROBES 6
-static void initialize_idleproxy(struct idle_proxy_info *proxy, char *proxyName,
+static bool initialize_idleproxy(struct idle_proxy_info *proxy, char *proxyName,
 			  const struct in_addr *first_target, const struct scan_lists * ports) {
   int probes_sent = 0, probes_returned = 0;
   int hardtimeout = 9000000; /* Generally don't wait more than 9 secs total */
@@ -334,15 +348,18 @@ static void initialize_idleproxy(struct idle_proxy_info *proxy, char *proxyName,
 
   proxy->host.setHostName(name);
   if (resolve(name, 0, 0, &ss, &sslen, o.pf()) == 0) {
-    fatal("Could not resolve idle scan zombie host: %s", name);
+    error("Could not resolve idle scan zombie host: %s", name);
+    return false;
   }
   proxy->host.setTargetSockAddr(&ss, sslen);
   
   /* Lets figure out the appropriate source address to use when sending
      the pr0bez */
   proxy->host.TargetSockAddr(&ss, &sslen);
-  if (!nmap_route_dst(&ss, &rnfo))
-    fatal("Unable to find appropriate source address and device interface to use when sending packets to %s", proxyName);
+  if (!nmap_route_dst(&ss, &rnfo)) {
+    error("Unable to find appropriate source address and device interface to use when sending packets to %s", proxyName);
+    return false;
+  }
   
   if (o.spoofsource) {
     o.SourceSockAddr(&ss, &sslen);
@@ -366,9 +383,11 @@ static void initialize_idleproxy(struct idle_proxy_info *proxy, char *proxyName,
   /* Now lets send some probes to check IP ID algorithm ... */
   /* First we need a raw socket ... */
   if ((o.sendpref & PACKET_SEND_ETH) &&  proxy->host.ifType() == devt_ethernet) {
-    if (!setTargetNextHopMAC(&proxy->host))
-      fatal("%s: Failed to determine dst MAC address for Idle proxy", 
-	    __func__);
+    if (!setTargetNextHopMAC(&proxy->host)) {
+      error("%s: Failed to determine dst MAC address for Idle proxy %s",
+	    __func__, proxy->host.targetipstr());
+      return false;
+    }
     memcpy(proxy->eth.srcmac, proxy->host.SrcMACAddress(), 6);
     memcpy(proxy->eth.dstmac, proxy->host.NextHopMACAddress(), 6);
     proxy->eth.ethsd = eth_open_cached(proxy->host.deviceName());
@@ -492,10 +511,13 @@ static void initialize_idleproxy(struct idle_proxy_info *proxy, char *proxyName,
     }
   }
 
-  if (probes_returned == 0)
-    fatal("Idle scan zombie %s (%s) port %hu cannot be used because it has not returned any of our probes -- perhaps it is down or firewalled.", 
+  if (probes_returned == 0) {
+    error("Idle scan zombie %s (%s) port %hu cannot be used because it has not returned any of our probes -- perhaps it is down or firewalled.", 
 	  proxy->host.HostName(), proxy->host.targetipstr(), 
 	  proxy->probe_port);
+    close_idleproxy(proxy);
+    return false;
+  }
 
   proxy->seqclass = get_ipid_sequence(probes_returned, ipids, 0);
   switch(proxy->seqclass) {
@@ -504,7 +526,9 @@ static void initialize_idleproxy(struct idle_proxy_info *proxy, char *proxyName,
     log_write(LOG_PLAIN, "Idle scan using zombie %s (%s:%hu); Class: %s\n", proxy->host.HostName(), proxy->host.targetipstr(), proxy->probe_port, ipidclass2ascii(proxy->seqclass));
     break;
   default:
-    fatal("Idle scan zombie %s (%s) port %hu cannot be used because IP ID sequencability class is: %s.  Try another proxy.", proxy->host.HostName(), proxy->host.targetipstr(), proxy->probe_port, ipidclass2ascii(proxy->seqclass));
+    error("Idle scan zombie %s (%s) port %hu cannot be used because IP ID sequencability class is: %s.  Try another proxy.", proxy->host.HostName(), proxy->host.targetipstr(), proxy->probe_port, ipidclass2ascii(proxy->seqclass));
+    close_idleproxy(proxy);
+    return false;
   }
 
   proxy->latestid = ipids[probes_returned - 1];
@@ -550,20 +574,29 @@ static void initialize_idleproxy(struct idle_proxy_info *proxy, char *proxyName,
     if (newipid == -1)
       newipid = ipid_proxy_probe(proxy, NULL, NULL); /* OK, we'll give it one more try */
 
-    if (newipid < 0) fatal("Your IP ID Zombie (%s; %s) is behaving strangely -- suddenly cannot obtain IP ID", proxy->host.HostName(), proxy->host.targetipstr());
+    if (newipid < 0) {
+      error("Your IP ID Zombie (%s; %s) is behaving strangely -- suddenly cannot obtain IP ID", proxy->host.HostName(), proxy->host.targetipstr());
+      close_idleproxy(proxy);
+      return false;
+    }
       
     distance = ipid_distance(proxy->seqclass, proxy->latestid, newipid);
     if (distance <= 0) {
-      fatal("Your IP ID Zombie (%s; %s) is behaving strangely -- suddenly cannot obtain valid IP ID distance.", proxy->host.HostName(), proxy->host.targetipstr());
+      error("Your IP ID Zombie (%s; %s) is behaving strangely -- suddenly cannot obtain valid IP ID distance.", proxy->host.HostName(), proxy->host.targetipstr());
+      close_idleproxy(proxy);
+      return false;
     } else if (distance == 1) {
-      fatal("Even though your Zombie (%s; %s) appears to be vulnerable to IP ID sequence prediction (class: %s), our attempts have failed.  This generally means that either the Zombie uses a separate IP ID base for each host (like Solaris), or because you cannot spoof IP packets (perhaps your ISP has enabled egress filtering to prevent IP spoofing), or maybe the target network recognizes the packet source as bogus and drops them", proxy->host.HostName(), proxy->host.targetipstr(), ipidclass2ascii(proxy->seqclass));
+      error("Even though your Zombie (%s; %s) appears to be vulnerable to IP ID sequence prediction (class: %s), our attempts have failed.  This generally means that either the Zombie uses a separate IP ID base for each host (like Solaris), or because you cannot spoof IP packets (perhaps your ISP has enabled egress filtering to prevent IP spoofing), or maybe the target network recognizes the packet source as bogus and drops them", proxy->host.HostName(), proxy->host.targetipstr(), ipidclass2ascii(proxy->seqclass));
+      close_idleproxy(proxy);
+      return false;
     }
     if (o.debugging && distance != 5) {
       error("WARNING: IP ID spoofing test sent 4 packets and expected a distance of 5, but instead got %d", distance);
     }
     proxy->latestid = newipid;
   }
-  
+
+  return true;
 }
 
 
@@ -626,360 +659,525 @@ static void adjust_idle_timing(struct idle_proxy_info *proxy,
 }
 
 
+/* The state of one idle scan count: the number of open ports among
+   "ports", measured through the IP ID of "proxy".  Several counts can be
+   in progress at the same time as long as each one uses a different
+   zombie, since the IP ID increments of one zombie are not affected by
+   probes spoofed from another. */
+struct idle_count {
+  struct idle_proxy_info *proxy;
+  u16 *ports;
+  int numports;
+  int openports; /* The result, -1 if no IP ID change could be measured */
+  struct timeval sent_time; /* When the probes were sent and when the */
+  struct timeval rcv_time;  /* last IP ID change was seen.  Only set if
+                               open ports were found */
+
+  /* Private to idlescan_countopen2() */
+  struct timeval start, end, latestchange, next_probe;
+  struct timeval probe_times[4];
+  int tries;
+  int lasttry;
+  int dotry3;
+  int done;
+  int proxyprobes_sent; /* diff. from tries 'cause sometimes we skip tries */
+  int proxyprobes_rcvd; /* To determine if packets were dr0pped */
+  int newipid;
+};
+
+
+/* Works out when the next IP ID probe of an idle scan count is due,
+   skipping the tries that would come too soon after the previous one.
+   Marks the count as done when there are no tries left. */
+static void idle_count_schedule(struct idle_count *c) {
+  struct timeval now;
+  int sleeptime;
+
+  gettimeofday(&now, NULL);
+  for(; c->tries <= 3; c->tries++) {
+    if (c->tries == 2) c->dotry3 = (get_random_u8() > 200);
+    if (c->tries == 3 && !c->dotry3)
+      break; /* We usually want to skip the long-wait test */
+    if (c->tries == 3 || (c->tries == 2 && !c->dotry3))
+      c->lasttry = 1;
+
+    sleeptime = TIMEVAL_SUBTRACT(c->probe_times[c->tries], now);
+    if (!c->lasttry && c->proxyprobes_sent > 0 && sleeptime < 50000)
+      continue; /* No point going again so soon */
+
+    if (c->tries == 0 && sleeptime < 500)
+      sleeptime = 500;
+    if (o.debugging > 1) error("In preparation for idle scan probe try #%d via %s, sleeping for %d usecs", c->tries, c->proxy->host.targetipstr(), sleeptime);
+    TIMEVAL_ADD(c->next_probe, now, MAX(sleeptime, 0));
+    return;
+  }
+  c->done = 1;
+}
+
+
 /* OK, now this is the hardcore idle scan function which actually does
    the testing (most of the other cruft in this file is just
    coordination, preparation, etc).  This function simply uses the
    idle scan technique to try and count the number of open ports in the
-   given port array.  The sent_time and rcv_time are filled in with
-   the times that the probe packet & response were sent/received.
-   They can be NULL if you don't want to use them.  The purpose is for
-   timing adjustments if the numbers turn out to be accurate */
-
-static int idlescan_countopen2(struct idle_proxy_info *proxy, 
-			Target *target, u16 *ports, int numports,
-			struct timeval *sent_time, struct timeval *rcv_time) 
+   port array of each of the given counts.  The SYN probes of every count
+   are sent first, and then the IP ID probes of the different zombies are
+   interleaved in time order, so the waits for the target's responses to
+   reach the zombies overlap instead of adding up.  The sent_time and
+   rcv_time of each count are filled in with the times that the probe
+   packet & response were sent/received.  The purpose is for timing
+   adjustments if the numbers turn out to be accurate */
+
+static void idlescan_countopen2(Target *target, struct idle_count *counts,
+                                int ncounts)
 {
-
-#if 0 /* Testing code */
+  struct idle_count *c;
   int i;
-  for(i=0; i < numports; i++)
-    if (ports[i] == 22)
-      return 1;
-  return 0;
-#endif
-
-  int openports;
-  int tries;
-  int proxyprobes_sent = 0; /* diff. from tries 'cause sometimes we 
-			       skip tries */
-  int proxyprobes_rcvd = 0; /* To determine if packets were dr0pped */
   int sent, rcvd;
   int ipid_dist;
-  struct timeval start, end, latestchange, now;
-  struct timeval probe_times[4];
+  struct timeval now;
   int pr0be;
   static u32 seq = 0;
-  int newipid = 0;
   int sleeptime;
-  int lasttry = 0;
-  int dotry3 = 0;
   struct eth_nfo eth;
 
   if (seq == 0) seq = get_random_u32();
 
-  memset(&end, 0, sizeof(end));
-  memset(&latestchange, 0, sizeof(latestchange));
-  gettimeofday(&start, NULL);
-  if (sent_time) memset(sent_time, 0, sizeof(*sent_time));
-  if (rcv_time) memset(rcv_time, 0, sizeof(*rcv_time));
-
-  if (proxy->rawsd < 0) {
-    if (!setTargetNextHopMAC(target))
-      fatal("%s: Failed to determine dst MAC address for Idle proxy", 
-	    __func__);
-    memcpy(eth.srcmac, target->SrcMACAddress(), 6);
-    memcpy(eth.dstmac, target->NextHopMACAddress(), 6);
-    eth.ethsd = eth_open_cached(target->deviceName());
-    if (eth.ethsd == NULL)
-      fatal("%s: Failed to open ethernet device (%s)", __func__, target->deviceName());
-  } else eth.ethsd = NULL;
+  /* The SYN probes all go to the same target, so when zombies are reached
+     through ethernet the same frame information works for all of them. */
+  eth.ethsd = NULL;
+  for(i = 0; i < ncounts; i++) {
+    if (counts[i].proxy->rawsd < 0) {
+      if (!setTargetNextHopMAC(target))
+        fatal("%s: Failed to determine dst MAC address for Idle proxy", 
+              __func__);
+      memcpy(eth.srcmac, target->SrcMACAddress(), 6);
+      memcpy(eth.dstmac, target->NextHopMACAddress(), 6);
+      eth.ethsd = eth_open_cached(target->deviceName());
+      if (eth.ethsd == NULL)
+        fatal("%s: Failed to open ethernet device (%s)", __func__, target->deviceName());
+      break;
+    }
+  }
 
   /* I start by sending out the SYN pr0bez */
-  for(pr0be = 0; pr0be < numports; pr0be++) {
-    if (o.scan_delay) enforce_scan_delay(NULL);
-    else if (proxy->senddelay && pr0be > 0) usleep(proxy->senddelay);
-
-    /* Maybe I should involve decoys in the picture at some point --
-       but doing it the straightforward way (using the same decoys as
-       we use in probing the proxy box is risky.  I'll have to think
-       about this more. */
-    send_tcp_raw(proxy->rawsd, eth.ethsd? &eth : NULL,
-    		proxy->host.v4hostip(), target->v4hostip(),
-		o.ttl, false,
-		o.ipoptions, o.ipoptionslen,
-		proxy->probe_port, ports[pr0be], seq, 0, 0, TH_SYN, 0, 0,
-		(u8 *) "\x02\x04\x05\xb4", 4,
-		o.extra_payload, o.extra_payload_length);
+  for(i = 0; i < ncounts; i++) {
+    c = &counts[i];
+    c->openports = -1;
+    c->tries = c->lasttry = c->dotry3 = c->done = 0;
+    c->proxyprobes_sent = c->proxyprobes_rcvd = 0;
+    c->newipid = 0;
+    memset(&c->sent_time, 0, sizeof(c->sent_time));
+    memset(&c->rcv_time, 0, sizeof(c->rcv_time));
+    memset(&c->latestchange, 0, sizeof(c->latestchange));
+    gettimeofday(&c->start, NULL);
+
+    for(pr0be = 0; pr0be < c->numports; pr0be++) {
+      if (o.scan_delay) enforce_scan_delay(NULL);
+      else if (c->proxy->senddelay && pr0be > 0) usleep(c->proxy->senddelay);
+
+      /* Maybe I should involve decoys in the picture at some point --
+         but doing it the straightforward way (using the same decoys as
+         we use in probing the proxy box is risky.  I'll have to think
+         about this more. */
+      send_tcp_raw(c->proxy->rawsd, c->proxy->rawsd < 0 ? &eth : NULL,
+                   c->proxy->host.v4hostip(), target->v4hostip(),
+                   o.ttl, false,
+                   o.ipoptions, o.ipoptionslen,
+                   c->proxy->probe_port, c->ports[pr0be], seq, 0, 0, TH_SYN, 0, 0,
+                   (u8 *) "\x02\x04\x05\xb4", 4,
+                   o.extra_payload, o.extra_payload_length);
+    }
+    gettimeofday(&c->end, NULL);
+
+    TIMEVAL_MSEC_ADD(c->probe_times[0], c->start, MAX(50, (target->to.srtt * 3/4) / 1000));
+    TIMEVAL_MSEC_ADD(c->probe_times[1], c->start, target->to.srtt / 1000 );
+    TIMEVAL_MSEC_ADD(c->probe_times[2], c->end, MAX(75, (2 * target->to.srtt + 
+                                                         target->to.rttvar) / 1000));
+    TIMEVAL_MSEC_ADD(c->probe_times[3], c->end, MIN(4000, (2 * target->to.srtt + 
+                                                           (target->to.rttvar << 2 )) / 1000));
+    idle_count_schedule(c);
   }
-  gettimeofday(&end, NULL);
 
-  openports = -1;
-  tries = 0;
-  TIMEVAL_MSEC_ADD(probe_times[0], start, MAX(50, (target->to.srtt * 3/4) / 1000));
-  TIMEVAL_MSEC_ADD(probe_times[1], start, target->to.srtt / 1000 );
-  TIMEVAL_MSEC_ADD(probe_times[2], end, MAX(75, (2 * target->to.srtt + 
-						   target->to.rttvar) / 1000));
-  TIMEVAL_MSEC_ADD(probe_times[3], end, MIN(4000, (2 * target->to.srtt + 
-						     (target->to.rttvar << 2 )) / 1000));
-
-  do {
-    if (tries == 2) dotry3 = (get_random_u8() > 200);
-    if (tries == 3 && !dotry3)
-      break; /* We usually want to skip the long-wait test */
-    if (tries == 3 || (tries == 2 && !dotry3))
-      lasttry = 1;
+  /* Now probe the zombies, always serving the count whose next try is
+     due first */
+  while(1) {
+    c = NULL;
+    for(i = 0; i < ncounts; i++) {
+      if (!counts[i].done && (c == NULL || TIMEVAL_BEFORE(counts[i].next_probe, c->next_probe)))
+        c = &counts[i];
+    }
+    if (c == NULL)
+      break;
 
     gettimeofday(&now, NULL);
-    sleeptime = TIMEVAL_SUBTRACT(probe_times[tries], now);
-    if (!lasttry && proxyprobes_sent > 0 && sleeptime < 50000)
-      continue; /* No point going again so soon */
-
-    if (tries == 0 && sleeptime < 500)
-      sleeptime = 500;
-    if (o.debugging > 1) error("In preparation for idle scan probe try #%d, sleeping for %d usecs", tries, sleeptime);
+    sleeptime = TIMEVAL_SUBTRACT(c->next_probe, now);
     if (sleeptime > 0)
       usleep(sleeptime);
 
-    newipid = ipid_proxy_probe(proxy, &sent, &rcvd);
-    proxyprobes_sent += sent;
-    proxyprobes_rcvd += rcvd;
+    c->newipid = ipid_proxy_probe(c->proxy, &sent, &rcvd);
+    c->proxyprobes_sent += sent;
+    c->proxyprobes_rcvd += rcvd;
 
-    if (newipid > 0) {
-      ipid_dist = ipid_distance(proxy->seqclass, proxy->latestid, newipid);
+    if (c->newipid > 0) {
+      ipid_dist = ipid_distance(c->proxy->seqclass, c->proxy->latestid, c->newipid);
       /* I used to only do this if ipid_sit >= proxyprobes_sent, but I'd
-	 rather have a negative number in that case */
-      if (ipid_dist < proxyprobes_sent) {
-	if (o.debugging) 
-           error("%s: Must have lost a sent packet because ipid_dist is %d while proxyprobes_sent is %d.", __func__, ipid_dist, proxyprobes_sent);
-	/* I no longer whack timing here ... done at bottom */
+         rather have a negative number in that case */
+      if (ipid_dist < c->proxyprobes_sent) {
+        if (o.debugging) 
+          error("%s: Must have lost a sent packet because ipid_dist is %d while proxyprobes_sent is %d.", __func__, ipid_dist, c->proxyprobes_sent);
+        /* I no longer whack timing here ... done at bottom */
       }
-      ipid_dist -= proxyprobes_sent;
-      if (ipid_dist > openports) {
-	openports = ipid_dist;
-	gettimeofday(&latestchange, NULL);
-      } else if (ipid_dist < openports && ipid_dist >= 0) {
-	/* Uh-oh.  Perhaps I dropped a packet this time */
-	if (o.debugging > 1) {
-	  error("%s: Counted %d open ports in try #%d, but counted %d earlier ... probably a proxy_probe problem", __func__, ipid_dist, tries, openports);
-	}	
-	/* I no longer whack timing here ... done at bottom */
+      ipid_dist -= c->proxyprobes_sent;
+      if (ipid_dist > c->openports) {
+        c->openports = ipid_dist;
+        gettimeofday(&c->latestchange, NULL);
+      } else if (ipid_dist < c->openports && ipid_dist >= 0) {
+        /* Uh-oh.  Perhaps I dropped a packet this time */
+        if (o.debugging > 1) {
+          error("%s: Counted %d open ports in try #%d, but counted %d earlier ... probably a proxy_probe problem", __func__, ipid_dist, c->tries, c->openports);
+        }
+        /* I no longer whack timing here ... done at bottom */
       }
     }
-    
-    if (openports > numports || (numports <= 2 && (openports == numports))) 
-      break;    
-  } while(tries++ < 3);
-
-  if (proxyprobes_sent > proxyprobes_rcvd) {
-    /* Uh-oh.  It looks like we lost at least one proxy probe packet */
-    if (o.debugging) {
-      error("%s: Sent %d probes; only %d responses.  Slowing scan.", __func__, proxyprobes_sent, proxyprobes_rcvd);
+
+    if (c->openports > c->numports || (c->numports <= 2 && (c->openports == c->numports)))
+      c->done = 1;
+    else {
+      c->tries++;
+      idle_count_schedule(c);
     }
-    proxy->senddelay += 5000;
-    proxy->senddelay = MIN(proxy->max_senddelay, proxy->senddelay);
-    /* No group size should be greater than .5s of send delays */
-    proxy->current_groupsz = MAX(proxy->min_groupsz, MIN(proxy->current_groupsz, 500000 / (proxy->senddelay+1)));
-  } else {
-    /* Yeah, we got as many responses as we sent probes.  This calls for a 
-       very light timing acceleration ... */
-    proxy->senddelay = (int) (proxy->senddelay * 0.95);
-    if (proxy->senddelay < 500) proxy->senddelay = 0;
-    proxy->current_groupsz = MAX(proxy->min_groupsz, MIN(proxy->current_groupsz, 500000 / (proxy->senddelay+1)));
   }
 
-  if ((openports > 0) && (openports <= numports)) {
-    /* Yeah, we found open ports... lets adjust the timing ... */
-    if (o.debugging > 2) error("%s:  found %d open ports (out of %d) in %lu usecs", __func__, openports, numports, (unsigned long) TIMEVAL_SUBTRACT(latestchange, start));
-    if (sent_time) *sent_time = start;
-    if (rcv_time) *rcv_time = latestchange;
+  for(i = 0; i < ncounts; i++) {
+    c = &counts[i];
+    struct idle_proxy_info *proxy = c->proxy;
+
+    if (c->proxyprobes_sent > c->proxyprobes_rcvd) {
+      /* Uh-oh.  It looks like we lost at least one proxy probe packet */
+      if (o.debugging) {
+        error("%s: Sent %d probes; only %d responses.  Slowing scan.", __func__, c->proxyprobes_sent, c->proxyprobes_rcvd);
+      }
+      proxy->senddelay += 5000;
+      proxy->senddelay = MIN(proxy->max_senddelay, proxy->senddelay);
+      /* No group size should be greater than .5s of send delays */
+      proxy->current_groupsz = MAX(proxy->min_groupsz, MIN(proxy->current_groupsz, 500000 / (proxy->senddelay+1)));
+    } else {
+      /* Yeah, we got as many responses as we sent probes.  This calls for a 
+         very light timing acceleration ... */
+      proxy->senddelay = (int) (proxy->senddelay * 0.95);
+      if (proxy->senddelay < 500) proxy->senddelay = 0;
+      proxy->current_groupsz = MAX(proxy->min_groupsz, MIN(proxy->current_groupsz, 500000 / (proxy->senddelay+1)));
+    }
+
+    if ((c->openports > 0) && (c->openports <= c->numports)) {
+      /* Yeah, we found open ports... lets adjust the timing ... */
+      if (o.debugging > 2) error("%s:  found %d open ports (out of %d) in %lu usecs", __func__, c->openports, c->numports, (unsigned long) TIMEVAL_SUBTRACT(c->latestchange, c->start));
+      c->sent_time = c->start;
+      c->rcv_time = c->latestchange;
+    }
+    if (c->newipid > 0) proxy->latestid = c->newipid;
   }
-  if (newipid > 0) proxy->latestid = newipid;
   if (eth.ethsd) { eth.ethsd = NULL; } /* don't need to close it due to caching */
-  return openports;
 }
 
 
 
 /* The job of this function is to use the idle scan technique to count
-   the number of open ports in the given list.  Under the covers, this
-   function just farms out the hard work to another function */
-static int idlescan_countopen(struct idle_proxy_info *proxy, 
-		       Target *target, u16 *ports, int numports,
-		       struct timeval *sent_time, struct timeval *rcv_time) {
+   the number of open ports in the port list of each count.  Under the
+   covers, this function just farms out the hard work to another
+   function, and retries the counts that did not give a meaningful
+   result */
+static void idlescan_countopen(Target *target, struct idle_count *counts,
+                               int ncounts) {
+  std::vector<struct idle_count> retry;
+  std::vector<int> retry_idx;
   int tries = 0;
-  int openports;
+  int i;
 
+  idlescan_countopen2(target, counts, ncounts);
   do {
-    openports = idlescan_countopen2(proxy, target, ports, numports, sent_time,
-				    rcv_time);
     tries++;
-    if (tries == 6 || (openports >= 0 && openports <= numports))
-      break;
-    
-    if (o.debugging) {
-      error("%s: In try #%d, counted %d open ports out of %d.  Retrying", __func__, tries, openports, numports);
+    retry.clear();
+    retry_idx.clear();
+    for(i = 0; i < ncounts; i++) {
+      if (counts[i].openports >= 0 && counts[i].openports <= counts[i].numports)
+        continue;
+      if (tries == 6) {
+        /* Oh f*ck!!!! */
+        fatal("Idle scan is unable to obtain meaningful results from proxy %s (%s).  I'm sorry it didn't work out.", counts[i].proxy->host.HostName(), 
+              counts[i].proxy->host.targetipstr());
+      }
+      if (o.debugging) {
+        error("%s: In try #%d, counted %d open ports out of %d.  Retrying", __func__, tries, counts[i].openports, counts[i].numports);
+      }
+      retry.push_back(counts[i]);
+      retry_idx.push_back(i);
     }
+    if (retry.empty())
+      break;
+
     /* Sleep for a little while -- maybe proxy host had brief birst of 
        traffic or similar problem */
     sleep(tries * tries);
     if (tries == 5)
       sleep(45); /* We're gonna give up if this fails, so we will be a bit
-		    patient */
+                    patient */
     /* Since the host may have received packets while we were sleeping,
        lets update our proxy IP ID counter */
-    proxy->latestid = ipid_proxy_probe(proxy, NULL, NULL);
+    for(i = 0; i < (int) retry.size(); i++)
+      retry[i].proxy->latestid = ipid_proxy_probe(retry[i].proxy, NULL, NULL);
+
+    idlescan_countopen2(target, &retry[0], retry.size());
+    for(i = 0; i < (int) retry.size(); i++)
+      counts[retry_idx[i]] = retry[i];
   } while(1);
 
-  if (openports < 0 || openports > numports ) {
-    /* Oh f*ck!!!! */
-    fatal("Idle scan is unable to obtain meaningful results from proxy %s (%s).  I'm sorry it didn't work out.", proxy->host.HostName(), 
-	  proxy->host.targetipstr());
+  if (o.debugging > 2) {
+    for(i = 0; i < ncounts; i++)
+      error("%s: %d ports found open out of %d, starting with %hu", __func__, counts[i].openports, counts[i].numports, counts[i].ports[0]);
   }
+}
 
-  if (o.debugging > 2) error("%s: %d ports found open out of %d, starting with %hu", __func__, openports, numports, ports[0]);
 
-  return openports;
-}
+/* A group of ports scanned by idle_treescan() through one zombie */
+struct idle_tree {
+  struct idle_proxy_info *proxy;
+  u16 *ports;
+  int numports;
+  int expectedopen;
+  int totalfound; /* Set by idle_treescan() */
+};
 
-/* Recursively idle scans scans a group of ports using a depth-first
-   divide-and-conquer strategy to find the open one(s) */
-
-static int idle_treescan(struct idle_proxy_info *proxy, Target *target,
-		 u16 *ports, int numports, int expectedopen) {
-
-  int firstHalfSz = (numports + 1)/2;
-  int secondHalfSz = numports - firstHalfSz;
-  int flatcount1, flatcount2;
-  int deepcount1 = -1, deepcount2 = -1;
-  struct timeval sentTime1, rcvTime1, sentTime2, rcvTime2;
-  int retrycount = -1, retry2 = -1;
-  int totalfound = 0;
-  /* Scan the first half of the range */
 
-  if (o.debugging > 1) {  
-    error("%s: Called against %s with %d ports, starting with %hu. expectedopen: %d", __func__, target->targetipstr(), numports, ports[0], expectedopen);
-    error("IDLE SCAN TIMING: grpsz: %.3f delay: %d srtt: %d rttvar: %d",
-	  proxy->current_groupsz, proxy->senddelay, target->to.srtt,
-	  target->to.rttvar);
+static void idle_treescan(Target *target, struct idle_tree *trees, int ntrees);
+
+/* Runs idle_treescan() on the trees that need a deeper look at one of
+   their halves (second == false for the first half, true for the
+   second), expecting "expected[i]" open ports in tree i, and stores the
+   number found in "found[i]".  Trees with a negative expected count are
+   skipped. */
+static void idle_treescan_halves(Target *target, struct idle_tree *trees,
+                                 int ntrees, bool second,
+                                 const std::vector<int> &expected,
+                                 std::vector<int> &found) {
+  std::vector<struct idle_tree> sub;
+  std::vector<int> sub_idx;
+  int i, firstHalfSz;
+
+  for(i = 0; i < ntrees; i++) {
+    if (expected[i] < 0)
+      continue;
+    struct idle_tree t;
+    firstHalfSz = (trees[i].numports + 1)/2;
+    t.proxy = trees[i].proxy;
+    t.ports = second ? trees[i].ports + firstHalfSz : trees[i].ports;
+    t.numports = second ? trees[i].numports - firstHalfSz : firstHalfSz;
+    t.expectedopen = expected[i];
+    t.totalfound = -1;
+    sub.push_back(t);
+    sub_idx.push_back(i);
   }
+  if (sub.empty())
+    return;
+  idle_treescan(target, &sub[0], sub.size());
+  for(i = 0; i < (int) sub.size(); i++)
+    found[sub_idx[i]] = sub[i].totalfound;
+}
 
-  flatcount1 = idlescan_countopen(proxy, target, ports, firstHalfSz, 
-				  &sentTime1, &rcvTime1);
-  
 
-  
-  if (firstHalfSz > 1 && flatcount1 > 0) {
-    /* A port appears open!  We dig down deeper to find it ... */
-    deepcount1 = idle_treescan(proxy, target, ports, firstHalfSz, flatcount1);
-    /* Now we assume deepcount1 is right, and adjust timing if flatcount1 was
-       wrong */
-    adjust_idle_timing(proxy, target, flatcount1, deepcount1);
+/* Counts the open ports in one half of each of the trees for which
+   "which[i]" is true, storing the results in "counts". */
+static void idle_count_halves(Target *target, struct idle_tree *trees,
+                              int ntrees, bool second,
+                              const std::vector<bool> &which,
+                              std::vector<struct idle_count> &counts) {
+  std::vector<struct idle_count> batch;
+  std::vector<int> batch_idx;
+  int i, firstHalfSz;
+
+  for(i = 0; i < ntrees; i++) {
+    if (!which[i])
+      continue;
+    struct idle_count c;
+    firstHalfSz = (trees[i].numports + 1)/2;
+    c.proxy = trees[i].proxy;
+    c.ports = second ? trees[i].ports + firstHalfSz : trees[i].ports;
+    c.numports = second ? trees[i].numports - firstHalfSz : firstHalfSz;
+    batch.push_back(c);
+    batch_idx.push_back(i);
   }
+  if (batch.empty())
+    return;
+  idlescan_countopen(target, &batch[0], batch.size());
+  for(i = 0; i < (int) batch.size(); i++)
+    counts[batch_idx[i]] = batch[i];
+}
 
-  /* I guess we had better do the second half too ... */
 
-  flatcount2 = idlescan_countopen(proxy, target, ports + firstHalfSz, 
-				  secondHalfSz, &sentTime2, &rcvTime2);
-  
-  if ((secondHalfSz) > 1 && flatcount2 > 0) {
+/* Recursively idle scans scans a group of ports using a depth-first
+   divide-and-conquer strategy to find the open one(s).  Each of the
+   trees is scanned through its own zombie, and the trees advance in
+   lockstep so that their counts run concurrently.  With a single tree
+   this is exactly the classic one-zombie idle scan. */
+
+static void idle_treescan(Target *target, struct idle_tree *trees, int ntrees) {
+  std::vector<int> firstHalfSz(ntrees), secondHalfSz(ntrees);
+  std::vector<int> flatcount1(ntrees), flatcount2(ntrees);
+  std::vector<int> deepcount1(ntrees, -1), deepcount2(ntrees, -1);
+  std::vector<int> retrycount(ntrees, -1), expected(ntrees, -1);
+  std::vector<bool> which(ntrees), recheck(ntrees);
+  std::vector<struct idle_count> count1(ntrees), count2(ntrees), recount(ntrees);
+  int i;
+
+  for(i = 0; i < ntrees; i++) {
+    firstHalfSz[i] = (trees[i].numports + 1)/2;
+    secondHalfSz[i] = trees[i].numports - firstHalfSz[i];
+    if (o.debugging > 1) {  
+      error("%s: Called against %s with %d ports, starting with %hu. expectedopen: %d", __func__, target->targetipstr(), trees[i].numports, trees[i].ports[0], trees[i].expectedopen);
+      error("IDLE SCAN TIMING: grpsz: %.3f delay: %d srtt: %d rttvar: %d",
+            trees[i].proxy->current_groupsz, trees[i].proxy->senddelay, target->to.srtt,
+            target->to.rttvar);
+    }
+  }
+
+  /* Scan the first half of the range */
+  which.assign(ntrees, true);
+  idle_count_halves(target, trees, ntrees, false, which, count1);
+  for(i = 0; i < ntrees; i++) {
+    flatcount1[i] = count1[i].openports;
     /* A port appears open!  We dig down deeper to find it ... */
-    deepcount2 = idle_treescan(proxy, target, ports + firstHalfSz, 
-			       secondHalfSz, flatcount2);
+    expected[i] = (firstHalfSz[i] > 1 && flatcount1[i] > 0) ? flatcount1[i] : -1;
+  }
+  idle_treescan_halves(target, trees, ntrees, false, expected, deepcount1);
+  for(i = 0; i < ntrees; i++) {
     /* Now we assume deepcount1 is right, and adjust timing if flatcount1 was
        wrong */
-    adjust_idle_timing(proxy, target, flatcount2, deepcount2);
+    if (expected[i] >= 0)
+      adjust_idle_timing(trees[i].proxy, target, flatcount1[i], deepcount1[i]);
   }
 
-  totalfound = (deepcount1 == -1)? flatcount1 : deepcount1;
-  totalfound += (deepcount2 == -1)? flatcount2 : deepcount2;
+  /* I guess we had better do the second half too ... */
+  idle_count_halves(target, trees, ntrees, true, which, count2);
+  for(i = 0; i < ntrees; i++) {
+    flatcount2[i] = count2[i].openports;
+    expected[i] = (secondHalfSz[i] > 1 && flatcount2[i] > 0) ? flatcount2[i] : -1;
+  }
+  idle_treescan_halves(target, trees, ntrees, true, expected, deepcount2);
+  for(i = 0; i < ntrees; i++) {
+    if (expected[i] >= 0)
+      adjust_idle_timing(trees[i].proxy, target, flatcount2[i], deepcount2[i]);
+  }
 
-  if ((flatcount1 + flatcount2 == totalfound) && 
-      (expectedopen == totalfound || expectedopen == -1)) {
-    
-    if (flatcount1 > 0) {    
-      if (o.debugging > 1) {
-	error("Adjusting timing -- idlescan_countopen correctly found %d open ports (out of %d, starting with %hu)", flatcount1, firstHalfSz, ports[0]);
+  for(i = 0; i < ntrees; i++) {
+    struct idle_tree *t = &trees[i];
+    t->totalfound = (deepcount1[i] == -1)? flatcount1[i] : deepcount1[i];
+    t->totalfound += (deepcount2[i] == -1)? flatcount2[i] : deepcount2[i];
+
+    if ((flatcount1[i] + flatcount2[i] == t->totalfound) && 
+        (t->expectedopen == t->totalfound || t->expectedopen == -1)) {
+      if (flatcount1[i] > 0) {    
+        if (o.debugging > 1) {
+          error("Adjusting timing -- idlescan_countopen correctly found %d open ports (out of %d, starting with %hu)", flatcount1[i], firstHalfSz[i], t->ports[0]);
+        }
+        adjust_timeouts2(&count1[i].sent_time, &count1[i].rcv_time, &(target->to));
       }
-      adjust_timeouts2(&sentTime1, &rcvTime1, &(target->to));
-    }
-    
-    if (flatcount2 > 0) {    
-      if (o.debugging > 2) {
-	error("Adjusting timing -- idlescan_countopen correctly found %d open ports (out of %d, starting with %hu)", flatcount2, secondHalfSz, 
-	      ports[firstHalfSz]);
+      if (flatcount2[i] > 0) {    
+        if (o.debugging > 2) {
+          error("Adjusting timing -- idlescan_countopen correctly found %d open ports (out of %d, starting with %hu)", flatcount2[i], secondHalfSz[i], 
+                t->ports[firstHalfSz[i]]);
+        }
+        adjust_timeouts2(&count2[i].sent_time, &count2[i].rcv_time, &(target->to));
       }
-      adjust_timeouts2(&sentTime2, &rcvTime2, &(target->to));
     }
+    recheck[i] = (t->totalfound != t->expectedopen);
   }
-  
-  if (totalfound != expectedopen) {  
-    if (deepcount1 == -1) {
-      retrycount = idlescan_countopen(proxy, target, ports, firstHalfSz, NULL,
-				      NULL);
-      if (retrycount != flatcount1) {      
-	/* We have to do a deep count if new ports were found and
-	   there are more than 1 total */
-	if (firstHalfSz > 1 && retrycount > 0) {	
-	  retry2 = retrycount;
-	  retrycount = idle_treescan(proxy, target, ports, firstHalfSz, 
-				     retrycount);
-	  adjust_idle_timing(proxy, target, retry2, retrycount);
-	} else {
-	  if (o.debugging)
-	    error("Adjusting timing because my first scan of %d ports, starting with %hu found %d open, while second scan yielded %d", firstHalfSz, ports[0], flatcount1, retrycount);
-	  adjust_idle_timing(proxy, target, flatcount1, retrycount);
-	}
-	totalfound += retrycount - flatcount1;
-	flatcount1 = retrycount;
 
-	/* If our first count erroneously found and added an open port,
-	   we must delete it */
-	if (firstHalfSz == 1 && flatcount1 == 1 && retrycount == 0)
-	  target->ports.forgetPort(ports[0], IPPROTO_TCP);
-
-      }
+  /* Recount the first halves which were not already dug into */
+  for(i = 0; i < ntrees; i++)
+    which[i] = recheck[i] && deepcount1[i] == -1;
+  idle_count_halves(target, trees, ntrees, false, which, recount);
+  for(i = 0; i < ntrees; i++) {
+    retrycount[i] = which[i] ? recount[i].openports : flatcount1[i];
+    /* We have to do a deep count if new ports were found and
+       there are more than 1 total */
+    expected[i] = (retrycount[i] != flatcount1[i] && firstHalfSz[i] > 1 && retrycount[i] > 0) ? retrycount[i] : -1;
+  }
+  idle_treescan_halves(target, trees, ntrees, false, expected, retrycount);
+  for(i = 0; i < ntrees; i++) {
+    struct idle_tree *t = &trees[i];
+    if (!which[i] || (expected[i] < 0 && retrycount[i] == flatcount1[i]))
+      continue;
+    if (expected[i] >= 0) {
+      adjust_idle_timing(t->proxy, target, expected[i], retrycount[i]);
+    } else {
+      if (o.debugging)
+        error("Adjusting timing because my first scan of %d ports, starting with %hu found %d open, while second scan yielded %d", firstHalfSz[i], t->ports[0], flatcount1[i], retrycount[i]);
+      adjust_idle_timing(t->proxy, target, flatcount1[i], retrycount[i]);
     }
-    
-    if (deepcount2 == -1) {
-      retrycount = idlescan_countopen(proxy, target, ports + firstHalfSz, 
-				      secondHalfSz, NULL, NULL);
-      if (retrycount != flatcount2) {
-	if (secondHalfSz > 1 && retrycount > 0) {	
-	  retry2 = retrycount;
-	  retrycount = idle_treescan(proxy, target, ports + firstHalfSz, 
-				     secondHalfSz, retrycount);
-	  adjust_idle_timing(proxy, target, retry2, retrycount);
-	} else {
-	  if (o.debugging)
-	    error("Adjusting timing because my first scan of %d ports, starting with %hu found %d open, while second scan yeilded %d", secondHalfSz, ports[firstHalfSz], flatcount2, retrycount);
-	  adjust_idle_timing(proxy, target, flatcount2, retrycount);
-	}
-
-	totalfound += retrycount - flatcount2;
-	flatcount2 = retrycount;
-
-	/* If our first count erroneously found and added an open port,
-	   we must delete it */
-	if (secondHalfSz == 1 && flatcount2 == 1 && retrycount == 0)
-	  target->ports.forgetPort(ports[firstHalfSz], IPPROTO_TCP);
+    t->totalfound += retrycount[i] - flatcount1[i];
+    flatcount1[i] = retrycount[i];
 
+    /* If our first count erroneously found and added an open port,
+       we must delete it */
+    if (firstHalfSz[i] == 1 && flatcount1[i] == 1 && retrycount[i] == 0)
+      target->ports.forgetPort(t->ports[0], IPPROTO_TCP);
+  }
 
-      }
-    }
+  /* And the same for the second halves */
+  for(i = 0; i < ntrees; i++)
+    which[i] = recheck[i] && deepcount2[i] == -1;
+  idle_count_halves(target, trees, ntrees, true, which, recount);
+  for(i = 0; i < ntrees; i++) {
+    retrycount[i] = which[i] ? recount[i].openports : flatcount2[i];
+    expected[i] = (retrycount[i] != flatcount2[i] && secondHalfSz[i] > 1 && retrycount[i] > 0) ? retrycount[i] : -1;
   }
+  idle_treescan_halves(target, trees, ntrees, true, expected, retrycount);
+  for(i = 0; i < ntrees; i++) {
+    struct idle_tree *t = &trees[i];
+    if (!which[i] || (expected[i] < 0 && retrycount[i] == flatcount2[i]))
+      continue;
+    if (expected[i] >= 0) {
+      adjust_idle_timing(t->proxy, target, expected[i], retrycount[i]);
+    } else {
+      if (o.debugging)
+        error("Adjusting timing because my first scan of %d ports, starting with %hu found %d open, while second scan yeilded %d", secondHalfSz[i], t->ports[firstHalfSz[i]], flatcount2[i], retrycount[i]);
+      adjust_idle_timing(t->proxy, target, flatcount2[i], retrycount[i]);
+    }
+    t->totalfound += retrycount[i] - flatcount2[i];
+    flatcount2[i] = retrycount[i];
 
-  if (firstHalfSz == 1 && flatcount1 == 1) 
-    target->ports.setPortState(ports[0], IPPROTO_TCP, PORT_OPEN);
-  
-  if ((secondHalfSz == 1) && flatcount2 == 1) 
-    target->ports.setPortState(ports[firstHalfSz], IPPROTO_TCP, PORT_OPEN);
-  return totalfound;
+    /* If our first count erroneously found and added an open port,
+       we must delete it */
+    if (secondHalfSz[i] == 1 && flatcount2[i] == 1 && retrycount[i] == 0)
+      target->ports.forgetPort(t->ports[firstHalfSz[i]], IPPROTO_TCP);
+  }
 
+  for(i = 0; i < ntrees; i++) {
+    struct idle_tree *t = &trees[i];
+    if (firstHalfSz[i] == 1 && flatcount1[i] == 1) 
+      target->ports.setPortState(t->ports[0], IPPROTO_TCP, PORT_OPEN);
+    if ((secondHalfSz[i] == 1) && flatcount2[i] == 1) 
+      target->ports.setPortState(t->ports[firstHalfSz[i]], IPPROTO_TCP, PORT_OPEN);
+  }
 }
 
 
 
 /* The very top-level idle scan function -- scans the given target
-   host using the given proxy -- the proxy is cached so that you can keep
-   calling this function with different targets */
+   host using the given proxies -- the proxies are cached so that you
+   can keep calling this function with different targets.  proxyName is
+   a comma-separated list of zombies; the port list is sharded across
+   them and each zombie keeps its own timing state. */
 void idle_scan(Target *target, u16 *portarray, int numports,
 	       char *proxyName, const struct scan_lists * ports) {
 
-  static char lastproxy[MAXHOSTNAMELEN + 1] = ""; /* The proxy used in any previous call */
-  static struct idle_proxy_info proxy;
+  static char lastproxy[1024] = ""; /* The proxies used in any previous call */
+  static std::vector<struct idle_proxy_info *> proxies;
+  std::vector<struct idle_tree> trees;
   int groupsz;
   int portidx = 0; /* Used for splitting the port array into chunks */
   int portsleft;
+  unsigned int i, j;
   char scanname[128];
   Snprintf(scanname, sizeof(scanname), "idle scan against %s", target->NameIP());
   ScanProgressMeter SPM(scanname);
@@ -1003,19 +1201,57 @@ void idle_scan(Target *target, u16 *portarray, int numports,
 
   /* If this is the first call,  */
   if (!*lastproxy) {
-    initialize_idleproxy(&proxy, proxyName, target->v4hostip(), ports);
+    char *list, *name, *next;
+
+    if (strlen(proxyName) >= sizeof(lastproxy))
+      fatal("Idle scan zombie list is too long: %s", proxyName);
+    list = strdup(proxyName);
+    for(name = list; name != NULL; name = next) {
+      next = strchr(name, ',');
+      if (next) *next++ = '\0';
+      if (*name == '\0')
+        fatal("Empty zombie name in idle scan zombie list: %s", proxyName);
+      /* Two counts through the same zombie would disturb each other's IP
+         ID readings, so a zombie given twice is only used once */
+      struct idle_proxy_info *proxy = new struct idle_proxy_info;
+      if (!initialize_idleproxy(proxy, name, target->v4hostip(), ports)) {
+        delete proxy;
+        continue;
+      }
+      for(j = 0; j < proxies.size(); j++) {
+        if (proxies[j]->host.v4hostip()->s_addr == proxy->host.v4hostip()->s_addr)
+          break;
+      }
+      if (j < proxies.size()) {
+        error("WARNING: Idle scan zombie %s (%s) was given more than once; using it only once.", name, proxy->host.targetipstr());
+        close_idleproxy(proxy);
+        delete proxy;
+        continue;
+      }
+      proxies.push_back(proxy);
+    }
+    free(list);
+    if (proxies.empty())
+      fatal("None of the idle scan zombies given (%s) can be used.", proxyName);
     strncpy(lastproxy, proxyName, sizeof(lastproxy));
+    if (proxies.size() > 1)
+      log_write(LOG_PLAIN, "Idle scan using %u zombies in parallel\n", (unsigned int) proxies.size());
   }
 
   /* If we don't have timing infoz for the new target, we'll use values 
-     derived from the proxy */
+     derived from the slowest proxy */
+  int proxy_srtt = 0, proxy_rttvar = 0;
+  for(i = 0; i < proxies.size(); i++) {
+    proxy_srtt = MAX(proxy_srtt, proxies[i]->host.to.srtt);
+    proxy_rttvar = MAX(proxy_rttvar, proxies[i]->host.to.rttvar);
+  }
   if (target->to.srtt == -1 && target->to.rttvar == -1) {
-    target->to.srtt = MAX(200000,2 * proxy.host.to.srtt);
-    target->to.rttvar = MAX(10000, MIN(proxy.host.to.rttvar, 2000000));
+    target->to.srtt = MAX(200000,2 * proxy_srtt);
+    target->to.rttvar = MAX(10000, MIN(proxy_rttvar, 2000000));
     target->to.timeout = target->to.srtt + (target->to.rttvar << 2);
   } else {
-    target->to.srtt = MAX(target->to.srtt, proxy.host.to.srtt);
-    target->to.rttvar = MAX(target->to.rttvar, proxy.host.to.rttvar);
+    target->to.srtt = MAX(target->to.srtt, proxy_srtt);
+    target->to.rttvar = MAX(target->to.rttvar, proxy_rttvar);
     target->to.timeout = target->to.srtt + (target->to.rttvar << 2);
   }
 
@@ -1023,13 +1259,25 @@ void idle_scan(Target *target, u16 *portarray, int numports,
      scan is sort of tree structured (we scan a group and then divide
      it up and drill down in subscans of the group), we split the port
      space into smaller groups and then call a recursive
-     divide-and-counquer function to find the open ports */
+     divide-and-counquer function to find the open ports.  Each zombie
+     gets its own group, sized by its own timing, and the groups are
+     scanned together */
   while(portidx < numports) {
-    portsleft = numports - portidx;
-    /* current_groupsz is doubled below because idle_subscan cuts in half */
-    groupsz = MIN(portsleft, (int) (proxy.current_groupsz * 2));
-    idle_treescan(&proxy, target, portarray + portidx, groupsz, -1);
-    portidx += groupsz;
+    trees.clear();
+    for(i = 0; i < proxies.size() && portidx < numports; i++) {
+      struct idle_tree t;
+      portsleft = numports - portidx;
+      /* current_groupsz is doubled below because idle_subscan cuts in half */
+      groupsz = MIN(portsleft, (int) (proxies[i]->current_groupsz * 2));
+      t.proxy = proxies[i];
+      t.ports = portarray + portidx;
+      t.numports = groupsz;
+      t.expectedopen = -1;
+      t.totalfound = 0;
+      trees.push_back(t);
+      portidx += groupsz;
+    }
+    idle_treescan(target, &trees[0], trees.size());
   }
 
 
@@ -153,10 +153,21 @@ const char *PacketParser::header_type2string(int val){
 
 
 
-#define MAX_HEADERS_IN_PACKET 32
+/* Analyzes a packet and returns a static, zero-terminated array with the
+ * type and length of each of its headers. The array is overwritten by the
+ * next call. */
 pkt_type_t *PacketParser::parse_packet(const u8 *pkt, size_t pktlen, bool eth_included){
-  if(PKTPARSERDEBUG)printf("%s(%p, %lu)\n", __func__, pkt, (long unsigned)pktlen);
   static pkt_type_t this_packet[MAX_HEADERS_IN_PACKET+1]; /* Packet structure array   */
+  PacketParser::parse_packet(pkt, pktlen, eth_included, this_packet);
+  return this_packet;
+} /* End of parse_packet() */
+
+
+/* Same as above, but stores the headers in the supplied array, which must
+ * have room for MAX_HEADERS_IN_PACKET+1 entries. Returns the number of
+ * headers found. */
+int PacketParser::parse_packet(const u8 *pkt, size_t pktlen, bool eth_included, pkt_type_t *this_packet){
+  if(PKTPARSERDEBUG)printf("%s(%p, %lu)\n", __func__, pkt, (long unsigned)pktlen);
   u8 current_header=0;             /* Current array position of "this_packet" */
   const u8 *curr_pkt=pkt;          /* Pointer to current part of the packet   */
   size_t curr_pktlen=pktlen;       /* Remaining packet length                 */
@@ -180,7 +191,7 @@ pkt_type_t *PacketParser::parse_packet(const u8 *pkt, size_t pktlen, bool eth_in
   HopByHopHeader ext_hopt;
   RoutingHeader ext_routing;
   ARPHeader arp;
-  memset(this_packet, 0, sizeof(this_packet));
+  memset(this_packet, 0, sizeof(pkt_type_t)*(MAX_HEADERS_IN_PACKET+1));
 
   /* Decide which layer we have to start from */
   if( eth_included ){
@@ -605,10 +616,138 @@ pkt_type_t *PacketParser::parse_packet(const u8 *pkt, size_t pktlen, bool eth_in
     }
   }
 
-  return this_packet;
+  return current_header;
 } /* End of parse_received_packet() */
 
 
+PacketView::PacketView(){
+  this->reset();
+} /* End of PacketView constructor */
+
+
+PacketView::PacketView(const u8 *pkt, size_t pktlen, bool eth_included){
+  this->parse(pkt, pktlen, eth_included);
+} /* End of PacketView constructor */
+
+
+void PacketView::reset(){
+  this->pkt=NULL;
+  this->pktlen=0;
+  this->num_headers=0;
+} /* End of reset() */
+
+
+/* Parses the supplied packet and records the position of its headers.
+ * Returns the number of headers found. Nothing is copied: later calls to
+ * the get methods return pointers into "pkt". */
+int PacketView::parse(const u8 *pkt, size_t pktlen, bool eth_included){
+  size_t offset=0;
+  this->reset();
+  if(pkt==NULL || pktlen==0)
+    return 0;
+  this->pkt=pkt;
+  this->pktlen=pktlen;
+  PacketParser::parse_packet(pkt, pktlen, eth_included, this->headers);
+  for(int i=0; i<MAX_HEADERS_IN_PACKET && this->headers[i].length!=0; i++){
+    this->offsets[i]=offset;
+    offset+=this->headers[i].length;
+    this->num_headers++;
+  }
+  return this->num_headers;
+} /* End of parse() */
+
+
+int PacketView::getNumHeaders() const {
+  return this->num_headers;
+} /* End of getNumHeaders() */
+
+
+/* Returns the HEADER_TYPE_* of the header at position i, or 0 if there is
+ * no such header. */
+u32 PacketView::getType(int i) const {
+  if(i<0 || i>=this->num_headers)
+    return 0;
+  return this->headers[i].type;
+} /* End of getType() */
+
+
+size_t PacketView::getLength(int i) const {
+  if(i<0 || i>=this->num_headers)
+    return 0;
+  return this->headers[i].length;
+} /* End of getLength() */
+
+
+const u8 *PacketView::getHeader(int i) const {
+  if(i<0 || i>=this->num_headers)
+    return NULL;
+  return this->pkt+this->offsets[i];
+} /* End of getHeader() */
+
+
+const u8 *PacketView::getBuffer(size_t *len) const {
+  if(len!=NULL)
+    *len=this->pktlen;
+  return this->pkt;
+} /* End of getBuffer() */
+
+
+/* Returns the position of the first header of the supplied type at or after
+ * position "from", or -1 if the packet does not contain one. */
+int PacketView::find(u32 type, int from) const {
+  for(int i=MAX(from, 0); i<this->num_headers; i++){
+    if(this->headers[i].type==type)
+      return i;
+  }
+  return -1;
+} /* End of find() */
+
+
+const struct eth_hdr *PacketView::getEthernet(int from) const {
+  return (const struct eth_hdr *)this->getHeader(this->find(HEADER_TYPE_ETHERNET, from));
+} /* End of getEthernet() */
+
+
+const struct ip_hdr *PacketView::getIPv4(int from) const {
+  return (const struct ip_hdr *)this->getHeader(this->find(HEADER_TYPE_IPv4, from));
+} /* End of getIPv4() */
+
+
+const struct ip6_hdr *PacketView::getIPv6(int from) const {
+  return (const struct ip6_hdr *)this->getHeader(this->find(HEADER_TYPE_IPv6, from));
+} /* End of getIPv6() */
+
+
+const struct tcp_hdr *PacketView::getTCP(int from) const {
+  return (const struct tcp_hdr *)this->getHeader(this->find(HEADER_TYPE_TCP, from));
+} /* End of getTCP() */
+
+
+const struct udp_hdr *PacketView::getUDP(int from) const {
+  return (const struct udp_hdr *)this->getHeader(this->find(HEADER_TYPE_UDP, from));
+} /* End of getUDP() */
+
+
+const struct icmp_hdr *PacketView::getICMPv4(int from) const {
+  return (const struct icmp_hdr *)this->getHeader(this->find(HEADER_TYPE_ICMPv4, from));
+} /* End of getICMPv4() */
+
+
+const struct icmpv6_hdr *PacketView::getICMPv6(int from) const {
+  return (const struct icmpv6_hdr *)this->getHeader(this->find(HEADER_TYPE_ICMPv6, from));
+} /* End of getICMPv6() */
+
+
+/* Returns the first block of raw (unparsed) data at or after position "from"
+ * and stores its length in "len". Returns NULL if there is none. */
+const u8 *PacketView::getPayload(size_t *len, int from) const {
+  int i=this->find(HEADER_TYPE_RAW_DATA, from);
+  if(len!=NULL)
+    *len=this->getLength(i);
+  return this->getHeader(i);
+} /* End of getPayload() */
+
+
 /* TODO: remove */
 int PacketParser::dummy_print_packet_type(const u8 *pkt, size_t pktlen, bool eth_included){
   pkt_type_t *packetheaders=PacketParser::parse_packet(pkt, pktlen, eth_included);
@@ -1709,3 +1848,78 @@ bool PacketParser::is_response(PacketElement *sent, PacketElement *rcvd){
   if(PKTPARSERDEBUG)printf("%s(): The received packet was successfully matched with the sent packet.\n", __func__);
   return true;
 }
+
+
+/* Same as above, but the received packet is supplied as a PacketView rather
+ * than as a chain of PacketElements. The IP, ICMP, TCP and UDP headers of the
+ * received packet are loaded into objects on the stack and linked into a
+ * chain that is matched as above, so matching a response does not allocate
+ * any memory. Other headers are left out of the chain, since the matching
+ * skips them anyway. At most two headers of each kind are loaded: those of
+ * the response itself and those of the datagram quoted in an ICMP error. */
+bool PacketParser::is_response(PacketElement *sent, const PacketView *rcvd){
+  IPv4Header ip4[2];
+  IPv6Header ip6[2];
+  ICMPv4Header icmp4[2];
+  ICMPv6Header icmp6[2];
+  TCPHeader tcp[2];
+  UDPHeader udp[2];
+  int n_ip4=0, n_ip6=0, n_icmp4=0, n_icmp6=0, n_tcp=0, n_udp=0;
+  PacketElement *first=NULL, *last=NULL, *elem=NULL;
+  int i=0;
+
+  if(sent==NULL || rcvd==NULL || rcvd->getNumHeaders()==0)
+    return false;
+
+  /* The network layer must come first, after the link layer if any */
+  if(rcvd->getType(i)==HEADER_TYPE_ETHERNET)
+    i++;
+  if(rcvd->getType(i)!=HEADER_TYPE_IPv4 && rcvd->getType(i)!=HEADER_TYPE_IPv6)
+    return false;
+
+  for(; i<rcvd->getNumHeaders(); i++){
+    const u8 *hdr=rcvd->getHeader(i);
+    u32 len=rcvd->getLength(i);
+    int res=OP_FAILURE;
+
+    switch(rcvd->getType(i)){
+      case HEADER_TYPE_IPv4:
+        if(n_ip4<2 && (res=ip4[n_ip4].storeRecvData(hdr, len))==OP_SUCCESS)
+          elem=&ip4[n_ip4++];
+      break;
+      case HEADER_TYPE_IPv6:
+        if(n_ip6<2 && (res=ip6[n_ip6].storeRecvData(hdr, len))==OP_SUCCESS)
+          elem=&ip6[n_ip6++];
+      break;
+      case HEADER_TYPE_ICMPv4:
+        if(n_icmp4<2 && (res=icmp4[n_icmp4].storeRecvData(hdr, len))==OP_SUCCESS)
+          elem=&icmp4[n_icmp4++];
+      break;
+      case HEADER_TYPE_ICMPv6:
+        if(n_icmp6<2 && (res=icmp6[n_icmp6].storeRecvData(hdr, len))==OP_SUCCESS)
+          elem=&icmp6[n_icmp6++];
+      break;
+      case HEADER_TYPE_TCP:
+        if(n_tcp<2 && (res=tcp[n_tcp].storeRecvData(hdr, len))==OP_SUCCESS)
+          elem=&tcp[n_tcp++];
+      break;
+      case HEADER_TYPE_UDP:
+        if(n_udp<2 && (res=udp[n_udp].storeRecvData(hdr, len))==OP_SUCCESS)
+          elem=&udp[n_udp++];
+      break;
+      default:
+        continue;
+      break;
+    }
+    if(res!=OP_SUCCESS)
+      break;
+    if(last==NULL)
+      first=elem;
+    else
+      last->setNextElement(elem);
+    last=elem;
+  }
+  if(first==NULL)
+    return false;
+  return PacketParser::is_response(sent, first);
+} /* End of is_response() */
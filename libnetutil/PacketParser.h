@@ -126,6 +126,8 @@
 #define APPLICATION_LAYER  5
 #define EXTHEADERS_LAYER   6
 
+#define MAX_HEADERS_IN_PACKET 32
+
 typedef struct header_type_string{
     u32 type;
     const char *str;
@@ -138,6 +140,48 @@ typedef struct packet_type{
 }pkt_type_t;
 
 
+/* A packet decoded in place. Instead of copying each header into its own
+ * PacketElement object, a PacketView records the type, offset and length of
+ * every header and gives typed access to them through pointers into the
+ * caller's buffer. It has a fixed size and parsing does not allocate memory,
+ * so it can live on the stack of a packet reception handler. The buffer must
+ * stay valid (and unchanged) for as long as the view is used. */
+class PacketView {
+
+    private:
+    const u8 *pkt;
+    size_t pktlen;
+    int num_headers;
+    pkt_type_t headers[MAX_HEADERS_IN_PACKET+1];
+    size_t offsets[MAX_HEADERS_IN_PACKET+1];
+
+    public:
+    PacketView();
+    PacketView(const u8 *pkt, size_t pktlen, bool eth_included);
+    void reset();
+    int parse(const u8 *pkt, size_t pktlen, bool eth_included);
+
+    int getNumHeaders() const;
+    u32 getType(int i) const;
+    size_t getLength(int i) const;
+    const u8 *getHeader(int i) const;
+    const u8 *getBuffer(size_t *len) const;
+    int find(u32 type, int from=0) const;
+
+    /* Typed accessors. Each returns the first header of its type at or
+     * after position "from", or NULL if there is none. */
+    const struct eth_hdr *getEthernet(int from=0) const;
+    const struct ip_hdr *getIPv4(int from=0) const;
+    const struct ip6_hdr *getIPv6(int from=0) const;
+    const struct tcp_hdr *getTCP(int from=0) const;
+    const struct udp_hdr *getUDP(int from=0) const;
+    const struct icmp_hdr *getICMPv4(int from=0) const;
+    const struct icmpv6_hdr *getICMPv6(int from=0) const;
+    const u8 *getPayload(size_t *len, int from=0) const;
+
+}; /* End of class PacketView */
+
+
 class PacketParser {
 
     private:
@@ -151,6 +195,7 @@ class PacketParser {
 
     static const char *header_type2string(int val);
     static pkt_type_t *parse_packet(const u8 *pkt, size_t pktlen, bool eth_included);
+    static int parse_packet(const u8 *pkt, size_t pktlen, bool eth_included, pkt_type_t *headers);
     static int dummy_print_packet_type(const u8 *pkt, size_t pktlen, bool eth_included); /* TODO: remove */
     static int dummy_print_packet(const u8 *pkt, size_t pktlen, bool eth_included); /* TODO: remove */
     static int payload_offset(const u8 *pkt, size_t pktlen, bool link_included);
@@ -159,6 +204,7 @@ class PacketParser {
     static int freePacketChain(PacketElement *first);
     static const char *test_packet_parser(PacketElement *test_pkt);
     static bool is_response(PacketElement *sent, PacketElement *rcvd);
+    static bool is_response(PacketElement *sent, const PacketView *rcvd);
 
 }; /* End of class PacketParser */
 
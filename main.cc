@@ -98,6 +98,7 @@
 #include "nmap.h"
 #include "NmapOps.h"
 #include "utils.h"
+#include "checkpoint.h"
 
 #ifdef MTRACE
 #include "mcheck.h"
@@ -188,8 +189,12 @@ int main(int argc, char *argv[]) {
 
   if (argc == 3 && strcmp("--resume", argv[1]) == 0) {
     /* OK, they want to resume an aborted scan given the log file specified.
-       Lets gather our state from the log file */
-    if (gather_logfile_resumption_state(argv[2], &myargc, &myargv) == -1) {
+       Lets gather our state from the log file, or from a checkpoint file
+       written with --checkpoint */
+    if (is_checkpoint_file(argv[2])) {
+      if (gather_checkpoint_resumption_state(argv[2], &myargc, &myargv) == -1)
+        fatal("Cannot resume from checkpoint file %s", argv[2]);
+    } else if (gather_logfile_resumption_state(argv[2], &myargc, &myargv) == -1) {
       fatal("Cannot resume from (supposed) log file %s", argv[2]);
     }
     return nmap_main(myargc, myargv);
@@ -167,8 +167,9 @@ struct socks4_data {
  */
 #define DEFAULT_PROXY_PORT 3128
 
-/* Listen() backlog */
-#define BACKLOG 10
+/* Listen() backlog. A broker with many clients sees connections arrive in
+ * bursts, so use the largest backlog the system allows. */
+#define BACKLOG SOMAXCONN
 
 /* The default maximum number of simultaneous connections Ncat will accept to
  * a listening port. You may want to increase or decrease this value depending
@@ -118,12 +118,17 @@ struct conn_state {
     nsock_iod stdin_nsi;
     nsock_event_id idle_timer_event_id;
     int crlf_state;
+    /* Bytes that went through ncat_splice_relay rather than Nsock. */
+    unsigned long spliced_sent;
+    unsigned long spliced_recv;
 };
 
 static struct conn_state cs = {
     NULL,
     NULL,
     0,
+    0,
+    0,
     0
 };
 
@@ -620,8 +625,8 @@ int ncat_connect(void)
         gettimeofday(&end_time, NULL);
         time = TIMEVAL_MSEC_SUBTRACT(end_time, start_time) / 1000.0;
         loguser("%lu bytes sent, %lu bytes received in %.2f seconds.\n",
-            nsi_get_write_count(cs.sock_nsi),
-            nsi_get_read_count(cs.sock_nsi), time);
+            nsi_get_write_count(cs.sock_nsi) + cs.spliced_sent,
+            nsi_get_read_count(cs.sock_nsi) + cs.spliced_recv, time);
     }
 
     nsp_delete(mypool);
@@ -683,6 +688,24 @@ static void post_connect(nsock_pool nsp, nsock_iod iod)
         netexec(&info, o.cmdexec);
     }
 
+    /* If nothing needs to look at the data, let the kernel move it between
+       the socket and stdin/stdout. This falls through to the Nsock reads if
+       stdin or stdout is something splice can't handle, like a terminal. */
+    if (ncat_relay_is_opaque()) {
+        int sd = nsi_getsd(iod);
+        int rc;
+
+        rc = ncat_splice_relay(STDIN_FILENO, sd, sd, STDOUT_FILENO,
+            &cs.spliced_sent, &cs.spliced_recv);
+        if (rc == 1) {
+            loguser("%s.\n", socket_strerror(socket_errno()));
+            exit(1);
+        } else if (rc == 0) {
+            nsock_loop_quit(nsp);
+            return;
+        }
+    }
+
     /* Start the initial reads. */
 
     if (!o.sendonly)
@@ -408,6 +408,17 @@ void ncat_log_recv(const char *data, size_t len)
     ncat_log_send(data, len);
 }
 
+int ncat_relay_is_opaque(void)
+{
+    /* UDP and SCTP keep message boundaries that a byte stream relay would
+       lose. The rest either log the data or rewrite it. */
+    return !o.ssl && !o.udp && !o.sctp
+        && o.normlogfd == -1 && o.hexlogfd == -1
+        && !o.crlf && !o.telnet && !o.linedelay && o.idletimeout <= 0
+        && !o.sendonly && !o.recvonly
+        && !o.chat && !o.broker && o.cmdexec == NULL;
+}
+
 /* Convert session data to a neat hexdump logfile */
 static int ncat_hexdump(int logfd, const char *data, int len)
 {
@@ -217,3 +217,17 @@ extern int ncat_hostaccess(char *matchaddr, char *filename, char *remoteip);
 /* Make it so that line endings read from a console are always \n (not \r\n).
    Defined in ncat_posix.c and ncat_win.c. */
 extern void set_lf_mode(void);
+
+/* Returns true if no option in effect needs to see or change the data passing
+   between a socket and stdin/stdout, so it can be relayed opaquely. */
+extern int ncat_relay_is_opaque(void);
+
+/* Relay data from in1 to out1 and from in2 to out2 without copying it through
+   user space, using splice where the system has it. The relay ends when in2
+   reaches EOF. The byte counts for each direction are stored in nbytes1 and
+   nbytes2 if they are not NULL. Returns 0 after EOF, 1 after an error, or -1
+   without having moved any data if the descriptors can't be relayed this way,
+   in which case the caller must copy the data itself. Defined in ncat_posix.c
+   and ncat_win.c. */
+extern int ncat_splice_relay(int in1, int out1, int in2, int out2,
+    unsigned long *nbytes1, unsigned long *nbytes2);
@@ -137,6 +137,7 @@ static int listen_socket[NUM_LISTEN_ADDRS];
 static int stdin_eof = 0;
 static int crlf_state = 0;
 
+static int ncat_listen_nsock(int proto);
 static void handle_connection(int socket_accept);
 static int read_stdin(void);
 static int read_socket(int recv_fd);
@@ -184,7 +185,10 @@ static void sigchld_handler(int signum)
 }
 #endif
 
-static int ncat_listen_stream(int proto)
+/* The select-based stream listener. It is only used for --ssl, because Nsock
+   can't do the server side of an SSL handshake; everything else goes through
+   ncat_listen_nsock. */
+static int ncat_listen_stream_select(int proto)
 {
     int rc, i, fds_ready;
     fd_set listen_fds;
@@ -542,6 +546,558 @@ int read_socket(int recv_fd)
     return nbytes;
 }
 
+/* The Nsock-based stream listener. Every client gets its own nsock_iod, so
+   writes to a slow client are queued on that IOD instead of holding up the
+   others, and clients are kept on a list so that broadcasting a message costs
+   one queued write per client rather than a scan over every descriptor. The
+   epoll engine also removes the FD_SETSIZE limit on the number of clients. */
+
+/* A client that has queued more than this many writes without completing them
+   is disconnected rather than allowed to buffer without bound. */
+#define MAX_PENDING_WRITES 1024
+
+struct listen_client {
+    nsock_iod nsi;
+    union sockaddr_u remoteaddr;
+    /* Writes queued on nsi that haven't completed yet, and how many of those
+       carry data read from stdin. */
+    int writes_pending;
+    int stdin_writes_pending;
+    /* Set when the client is to be disconnected for not reading. */
+    int overflow;
+    struct listen_client *prev, *next;
+};
+
+static struct {
+    nsock_pool nsp;
+    nsock_iod listen_nsi[NUM_LISTEN_ADDRS];
+    nsock_iod stdin_nsi;
+    nsock_event_id stdin_read_id;
+    /* Is there a read outstanding on stdin_nsi? */
+    int stdin_reading;
+    /* Writes of stdin data that haven't completed. No more is read from stdin
+       until all of them are done. */
+    int stdin_writes_pending;
+    /* Quit as soon as the stdin writes have drained. */
+    int quit_when_flushed;
+    struct listen_client *clients_head, *clients_tail;
+    int num_clients;
+    /* Return value of ncat_listen_nsock. */
+    int rc;
+} ls;
+
+static void listen_client_close(struct listen_client *c, int failed);
+static void listen_accept_handler(nsock_pool nsp, nsock_event evt, void *data);
+static void listen_stdin_handler(nsock_pool nsp, nsock_event evt, void *data);
+static void listen_read_handler(nsock_pool nsp, nsock_event evt, void *data);
+static void listen_write_handler(nsock_pool nsp, nsock_event evt, void *data);
+static void listen_stdin_write_handler(nsock_pool nsp, nsock_event evt, void *data);
+
+static void listen_quit(int rc)
+{
+    ls.rc = rc;
+    nsock_loop_quit(ls.nsp);
+}
+
+/* Start reading stdin, unless there's no one to send the data to or the last
+   chunk hasn't been written out to every client yet. */
+static void listen_stdin_rearm(void)
+{
+    if (stdin_eof || ls.stdin_reading || ls.num_clients == 0
+        || ls.stdin_writes_pending > 0)
+        return;
+
+    ls.stdin_read_id = nsock_read(ls.nsp, ls.stdin_nsi, listen_stdin_handler, -1, NULL);
+    ls.stdin_reading = 1;
+}
+
+/* Queue a write of msg to every client except the one given. Returns -1 if any
+   client had to be disconnected because it wasn't reading. */
+static int listen_broadcast(const char *msg, size_t size,
+    const struct listen_client *except, int from_stdin)
+{
+    struct listen_client *c;
+    int ret;
+
+    if (o.recvonly)
+        return 0;
+
+    ret = 0;
+    for (c = ls.clients_head; c != NULL; c = c->next) {
+        if (c == except || c->overflow)
+            continue;
+
+        if (c->writes_pending >= MAX_PENDING_WRITES) {
+            c->overflow = 1;
+            ret = -1;
+            continue;
+        }
+
+        if (from_stdin) {
+            nsock_write(ls.nsp, c->nsi, listen_stdin_write_handler, -1, c, msg, size);
+            c->stdin_writes_pending++;
+            ls.stdin_writes_pending++;
+        } else {
+            nsock_write(ls.nsp, c->nsi, listen_write_handler, -1, c, msg, size);
+        }
+        c->writes_pending++;
+    }
+
+    ncat_log_send(msg, size);
+
+    /* Closing a client may broadcast a chat announcement, which changes the
+       list, so start over after each one. */
+    c = ls.clients_head;
+    while (ret == -1 && c != NULL) {
+        if (c->overflow) {
+            if (o.verbose)
+                loguser("Closing connection from %s: too much unsent data.\n",
+                    inet_socktop(&c->remoteaddr));
+            listen_client_close(c, 1);
+            c = ls.clients_head;
+        } else {
+            c = c->next;
+        }
+    }
+
+    return ret;
+}
+
+/* Announce the new connection and who is already connected. */
+static int listen_announce_connect(const struct listen_client *client)
+{
+    struct listen_client *c;
+    char *buf = NULL;
+    size_t size = 0, offset = 0;
+    int count, ret;
+
+    strbuf_sprintf(&buf, &size, &offset,
+        "<announce> %s is connected as <user%d>.\n",
+        inet_socktop(&client->remoteaddr), nsi_getsd(client->nsi));
+
+    strbuf_sprintf(&buf, &size, &offset, "<announce> already connected: ");
+    count = 0;
+    for (c = ls.clients_head; c != NULL; c = c->next) {
+        if (c == client)
+            continue;
+
+        if (count > 0)
+            strbuf_sprintf(&buf, &size, &offset, ", ");
+
+        strbuf_sprintf(&buf, &size, &offset, "%s as <user%d>",
+            inet_socktop(&c->remoteaddr), nsi_getsd(c->nsi));
+
+        count++;
+    }
+    if (count == 0)
+        strbuf_sprintf(&buf, &size, &offset, "nobody");
+    strbuf_sprintf(&buf, &size, &offset, ".\n");
+
+    ret = listen_broadcast(buf, offset, NULL, 0);
+
+    free(buf);
+
+    return ret;
+}
+
+/* Remove a client, discarding any writes still queued for it. failed says
+   whether the connection ended in an error, which matters to the exit status
+   when not in --keep-open or --broker mode. */
+static void listen_client_close(struct listen_client *c, int failed)
+{
+    int fd;
+
+    fd = nsi_getsd(c->nsi);
+
+    if (c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        ls.clients_head = c->next;
+    if (c->next != NULL)
+        c->next->prev = c->prev;
+    else
+        ls.clients_tail = c->prev;
+    ls.num_clients--;
+
+    /* The killed writes won't call back, so account for them here. */
+    ls.stdin_writes_pending -= c->stdin_writes_pending;
+    nsi_delete(c->nsi, NSOCK_PENDING_SILENT);
+    free(c);
+
+    conn_inc--;
+
+    if (ls.num_clients == 0 && ls.stdin_reading) {
+        /* Nobody left to send stdin to; stop reading it until someone
+           connects again. */
+        nsock_event_cancel(ls.nsp, ls.stdin_read_id, 0);
+        ls.stdin_reading = 0;
+    }
+
+    if (!o.keepopen && !o.broker) {
+        listen_quit(failed ? 1 : 0);
+        return;
+    }
+
+    if (o.chat) {
+        char buf[128];
+        int n;
+
+        n = Snprintf(buf, sizeof(buf),
+            "<announce> <user%d> is disconnected.\n", fd);
+        if (n > 0 && n < sizeof(buf))
+            listen_broadcast(buf, n, NULL, 0);
+    }
+
+    if (ls.quit_when_flushed && ls.stdin_writes_pending == 0)
+        listen_quit(0);
+    else
+        listen_stdin_rearm();
+}
+
+/* Allow or deny a newly accepted connection. Fork a command if o.cmdexec is
+   set. Otherwise, start reading from the client. */
+static void listen_handle_connection(int fd, const union sockaddr_u *remoteaddr)
+{
+    struct listen_client *c;
+    int conn_count, i;
+
+    /* In chat mode this is reported once the client has its final
+       descriptor number, which it is known by. */
+    if (o.verbose && !o.chat)
+        loguser("Connection from %s.\n", inet_socktop(remoteaddr));
+
+    if (!o.keepopen && !o.broker) {
+        for (i = 0; i < num_listenaddrs; i++) {
+            if (ls.listen_nsi[i] != NULL) {
+                nsi_delete(ls.listen_nsi[i], NSOCK_PENDING_SILENT);
+                ls.listen_nsi[i] = NULL;
+            }
+        }
+    }
+
+    if (o.verbose)
+        loguser("Connection from %s:%hu.\n", inet_socktop(remoteaddr), inet_port(remoteaddr));
+
+    /* Check conditions that might cause us to deny the connection. */
+    conn_count = get_conn_count();
+    if (conn_count >= o.conn_limit) {
+        if (o.verbose)
+            loguser("New connection denied: connection limit reached (%d)\n", conn_count);
+        Close(fd);
+        return;
+    }
+    if (!allow_access(remoteaddr)) {
+        if (o.verbose)
+            loguser("New connection denied: not allowed\n");
+        Close(fd);
+        return;
+    }
+
+    conn_inc++;
+
+    unblock_socket(fd);
+
+    if (o.cmdexec) {
+        struct fdinfo info = { 0 };
+
+        info.fd = fd;
+        info.remoteaddr = *remoteaddr;
+        if (o.keepopen)
+            netrun(&info, o.cmdexec);
+        else
+            netexec(&info, o.cmdexec);
+        return;
+    }
+
+    /* A single client whose data nothing needs to see can be spliced to
+       stdin/stdout in the kernel. */
+    if (!o.keepopen && ncat_relay_is_opaque()) {
+        int rc;
+
+        rc = ncat_splice_relay(STDIN_FILENO, fd, fd, STDOUT_FILENO, NULL, NULL);
+        if (rc != -1) {
+            if (rc == 1 && o.debug)
+                logdebug("Error relaying client data: %s\n", socket_strerror(socket_errno()));
+            Close(fd);
+            conn_inc--;
+            listen_quit(rc);
+            return;
+        }
+    }
+
+    c = (struct listen_client *) safe_zalloc(sizeof(*c));
+    c->remoteaddr = *remoteaddr;
+    /* nsi_new2 works on a duplicate of the descriptor. */
+    c->nsi = nsi_new2(ls.nsp, fd, c);
+    Close(fd);
+    if (c->nsi == NULL)
+        bye("Failed to create client nsiod.");
+
+    if (o.verbose && o.chat)
+        loguser("Connection from %s on file descriptor %d.\n", inet_socktop(remoteaddr), nsi_getsd(c->nsi));
+
+    c->prev = ls.clients_tail;
+    if (ls.clients_tail != NULL)
+        ls.clients_tail->next = c;
+    else
+        ls.clients_head = c;
+    ls.clients_tail = c;
+    ls.num_clients++;
+
+    if (!o.sendonly)
+        nsock_read(ls.nsp, c->nsi, listen_read_handler, -1, c);
+
+    /* Now that a client is connected, pay attention to stdin. */
+    listen_stdin_rearm();
+
+    if (o.chat)
+        listen_announce_connect(c);
+}
+
+static int ncat_listen_nsock(int proto)
+{
+    int i;
+
+    zmem(&ls, sizeof(ls));
+
+#ifdef WIN32
+    set_pseudo_sigchld_handler(decrease_conn_count);
+#else
+    /* Reap on SIGCHLD */
+    Signal(SIGCHLD, sigchld_handler);
+    /* Ignore the SIGPIPE that occurs when a client disconnects suddenly and we
+       send data to it before noticing. */
+    Signal(SIGPIPE, SIG_IGN);
+#endif
+
+    if ((ls.nsp = nsp_new(NULL)) == NULL)
+        bye("Failed to create nsock_pool.");
+
+    if (o.debug > 1)
+        /* A trace level of 1 still gives you an awful lot. */
+        nsp_settrace(ls.nsp, stderr, 1, nsock_gettimeofday());
+
+    for (i = 0; i < num_listenaddrs; i++) {
+        int fd;
+
+        fd = do_listen(SOCK_STREAM, proto, &listenaddrs[i]);
+        /* nsi_new2 makes its own non-blocking copy of the socket, so there
+           are no accept() timing issues; see UNPv1 2nd ed, p422. */
+        ls.listen_nsi[i] = nsi_new2(ls.nsp, fd, NULL);
+        Close(fd);
+        if (ls.listen_nsi[i] == NULL)
+            bye("Failed to create listening nsiod.");
+        nsock_readready(ls.nsp, ls.listen_nsi[i], listen_accept_handler, -1, NULL);
+    }
+
+    if ((ls.stdin_nsi = nsi_new2(ls.nsp, STDIN_FILENO, NULL)) == NULL)
+        bye("Failed to create stdin nsiod.");
+
+    if (nsock_loop(ls.nsp, -1) == NSOCK_LOOP_ERROR)
+        ls.rc = 1;
+
+    nsp_delete(ls.nsp);
+
+    return ls.rc;
+}
+
+/* A listening socket is readable: accept every pending connection. */
+static void listen_accept_handler(nsock_pool nsp, nsock_event evt, void *data)
+{
+    enum nse_status status = nse_status(evt);
+    nsock_iod nsi = nse_iod(evt);
+    int sd;
+
+    if (status == NSE_STATUS_CANCELLED || status == NSE_STATUS_KILL)
+        return;
+    if (status != NSE_STATUS_SUCCESS)
+        bye("Error waiting for connections: %s.", socket_strerror(nse_errorcode(evt)));
+
+    sd = nsi_getsd(nsi);
+    for (;;) {
+        union sockaddr_u remoteaddr;
+        socklen_t ss_len;
+        int fd;
+
+        ss_len = sizeof(remoteaddr.storage);
+        fd = accept(sd, &remoteaddr.sockaddr, &ss_len);
+        if (fd < 0) {
+            int err = socket_errno();
+
+            if (err == EINTR)
+                continue;
+            if (err != EAGAIN && err != EWOULDBLOCK && o.debug)
+                logdebug("Error in accept: %s\n", socket_strerror(err));
+            break;
+        }
+
+        listen_handle_connection(fd, &remoteaddr);
+
+        /* In single-connection mode the listening IODs are gone now. */
+        if (!o.keepopen && !o.broker)
+            return;
+    }
+
+    if (o.debug > 1 && o.broker)
+        logdebug("Broker connection count is %d\n", get_conn_count());
+
+    nsock_readready(nsp, nsi, listen_accept_handler, -1, NULL);
+}
+
+/* Read from stdin and broadcast to all clients. */
+static void listen_stdin_handler(nsock_pool nsp, nsock_event evt, void *data)
+{
+    enum nse_status status = nse_status(evt);
+    char *buf, *tempbuf = NULL, *chatbuf = NULL;
+    int nbytes;
+
+    if (status == NSE_STATUS_CANCELLED || status == NSE_STATUS_KILL)
+        return;
+
+    ls.stdin_reading = 0;
+
+    if (status != NSE_STATUS_SUCCESS) {
+        if (status == NSE_STATUS_ERROR && o.verbose)
+            logdebug("Error reading from stdin: %s\n", socket_strerror(nse_errorcode(evt)));
+        if (status == NSE_STATUS_EOF && o.debug)
+            logdebug("EOF on stdin\n");
+
+        /* Mark that we've seen EOF so stdin doesn't get read again. */
+        stdin_eof = 1;
+
+        if (!o.broker) {
+            if (status != NSE_STATUS_EOF) {
+                listen_quit(1);
+            } else if (o.sendonly) {
+                /* There will be nothing more to send. If we're not receiving
+                   anything, we can quit once the clients have it all. */
+                if (ls.stdin_writes_pending == 0)
+                    listen_quit(0);
+                else
+                    ls.quit_when_flushed = 1;
+            }
+        }
+        return;
+    }
+
+    buf = nse_readbuf(evt, &nbytes);
+
+    if (o.crlf) {
+        if (fix_line_endings(buf, &nbytes, &tempbuf, &crlf_state))
+            buf = tempbuf;
+    }
+
+    if (o.linedelay)
+        ncat_delay_timer(o.linedelay);
+
+    if (o.broker && o.chat) {
+        chatbuf = chat_filter(buf, nbytes, STDIN_FILENO, &nbytes);
+        if (chatbuf != NULL)
+            buf = chatbuf;
+    }
+
+    listen_broadcast(buf, nbytes, NULL, 1);
+
+    free(chatbuf);
+    free(tempbuf);
+
+    listen_stdin_rearm();
+}
+
+/* Read from a client and write to stdout, or in broker mode, to all the other
+   clients. */
+static void listen_read_handler(nsock_pool nsp, nsock_event evt, void *data)
+{
+    enum nse_status status = nse_status(evt);
+    struct listen_client *c = (struct listen_client *) data;
+    char *buf, *chatbuf = NULL;
+    int nbytes;
+
+    if (status == NSE_STATUS_CANCELLED || status == NSE_STATUS_KILL)
+        return;
+
+    if (status != NSE_STATUS_SUCCESS) {
+        if (status == NSE_STATUS_ERROR && o.debug)
+            logdebug("Error reading from client: %s\n", socket_strerror(nse_errorcode(evt)));
+        if (o.debug)
+            logdebug("Closing connection.\n");
+        listen_client_close(c, status != NSE_STATUS_EOF);
+        return;
+    }
+
+    buf = nse_readbuf(evt, &nbytes);
+
+    if (o.linedelay)
+        ncat_delay_timer(o.linedelay);
+    if (o.telnet)
+        dotelnet(nsi_getsd(c->nsi), (unsigned char *) buf, nbytes);
+    ncat_log_recv(buf, nbytes);
+
+    if (o.broker) {
+        if (o.debug > 1)
+            logdebug("Handling data from client %d.\n", nsi_getsd(c->nsi));
+
+        if (o.chat) {
+            chatbuf = chat_filter(buf, nbytes, nsi_getsd(c->nsi), &nbytes);
+            if (chatbuf == NULL) {
+                if (o.verbose)
+                    logdebug("Error formatting chat message from fd %d\n", nsi_getsd(c->nsi));
+            } else {
+                buf = chatbuf;
+            }
+        }
+
+        /* Send to everyone except the one who sent this message. */
+        listen_broadcast(buf, nbytes, c, 0);
+        free(chatbuf);
+    } else {
+        Write(STDOUT_FILENO, buf, nbytes);
+    }
+
+    nsock_read(nsp, c->nsi, listen_read_handler, -1, c);
+}
+
+static void listen_write_handler(nsock_pool nsp, nsock_event evt, void *data)
+{
+    enum nse_status status = nse_status(evt);
+    struct listen_client *c = (struct listen_client *) data;
+
+    if (status == NSE_STATUS_CANCELLED || status == NSE_STATUS_KILL)
+        return;
+
+    c->writes_pending--;
+
+    if (status != NSE_STATUS_SUCCESS) {
+        if (o.debug > 1)
+            logdebug("Error sending to fd %d: %s.\n", nsi_getsd(c->nsi),
+                socket_strerror(nse_errorcode(evt)));
+        listen_client_close(c, 1);
+    }
+}
+
+static void listen_stdin_write_handler(nsock_pool nsp, nsock_event evt, void *data)
+{
+    enum nse_status status = nse_status(evt);
+    struct listen_client *c = (struct listen_client *) data;
+
+    if (status == NSE_STATUS_CANCELLED || status == NSE_STATUS_KILL)
+        return;
+
+    c->stdin_writes_pending--;
+    ls.stdin_writes_pending--;
+
+    listen_write_handler(nsp, evt, data);
+    /* c may be gone now, and listen_client_close has already rearmed stdin
+       or quit if so. */
+    if (status != NSE_STATUS_SUCCESS)
+        return;
+
+    if (ls.stdin_writes_pending == 0 && ls.quit_when_flushed)
+        listen_quit(0);
+    else
+        listen_stdin_rearm();
+}
+
 /* This is sufficiently different from the TCP code (wrt SSL, etc) that it
  * resides in its own simpler function
  */
@@ -774,6 +1330,14 @@ static int ncat_listen_dgram(int proto)
     return 0;
 }
 
+static int ncat_listen_stream(int proto)
+{
+    if (o.ssl)
+        return ncat_listen_stream_select(proto);
+    else
+        return ncat_listen_nsock(proto);
+}
+
 int ncat_listen()
 {
     if (o.httpserver)
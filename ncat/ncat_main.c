@@ -731,12 +731,14 @@ static int ncat_listen_mode(void)
     if (o.proxytype != NULL && o.telnet)
         bye("Invalid option combination: --telnet has no effect with --proxy-type.");
 
-    if (o.conn_limit != -1 && !(o.keepopen || o.broker))
+    if (o.conn_limit != -1 && !(o.keepopen || o.broker || o.proxytype != NULL))
         loguser("Warning: Maximum connections ignored, since it does not take "
                 "effect without -k or --broker.\n");
 
-    /* Set the default maximum simultaneous TCP connection limit. */
-    if (o.conn_limit == -1)
+    /* Set the default maximum simultaneous TCP connection limit. The HTTP
+       proxy server has none unless one is given, because it is meant to
+       carry many tunnels at once. */
+    if (o.conn_limit == -1 && o.proxytype == NULL)
         o.conn_limit = DEFAULT_MAX_CONNS;
 
 #ifndef WIN32
@@ -90,10 +90,19 @@
 
 /* $Id$ */
 
+/* For splice. */
+#define _GNU_SOURCE
+
 #include <assert.h>
 
 #include "ncat.h"
 
+#ifdef HAVE_SPLICE
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#endif
+
 char **cmdline_split(const char *cmdexec);
 
 /* fork and exec a child process with netexec. Close the given file descriptor
@@ -339,6 +348,189 @@ void set_lf_mode(void)
     /* Nothing needed. */
 }
 
+#ifdef HAVE_SPLICE
+
+/* How much a relay pipe is asked to hold, and so how much one splice call can
+   move. Linux pipes default to 64 KB; a bigger one means fewer system calls
+   per byte. If the request is refused the default size is used. */
+#define SPLICE_PIPE_SIZE (1024 * 1024)
+
+/* One direction of a splice relay. Data goes from in into the pipe and from the
+   pipe to out; pending is how much is sitting in the pipe. */
+struct splice_dir {
+    int in, out;
+    int pipefd[2];
+    size_t pending;
+    int eof;
+    unsigned long count;
+};
+
+/* Can fd be spliced to or from? Stream sockets, pipes, and regular files can,
+   except files opened for appending (as by >>). Anything else, notably a
+   terminal, has to be copied the ordinary way. */
+static int splice_fd_ok(int fd)
+{
+    struct stat st;
+    int type;
+    socklen_t len;
+
+    if (fstat(fd, &st) == -1)
+        return 0;
+    if (S_ISSOCK(st.st_mode)) {
+        len = sizeof(type);
+        if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == -1)
+            return 0;
+        return type == SOCK_STREAM;
+    }
+
+    if (S_ISREG(st.st_mode))
+        return !(fcntl(fd, F_GETFL) & O_APPEND);
+
+    return S_ISFIFO(st.st_mode);
+}
+
+/* Move what is available from d->in into the pipe (if the pipe is empty), and
+   as much of the pipe as will go to d->out. Only called once poll has said
+   that one of them is ready, because either may be a blocking descriptor.
+   Returns -1 on error. */
+static int splice_dir_pump(struct splice_dir *d, size_t chunk)
+{
+    ssize_t n;
+
+    if (!d->eof && d->pending == 0) {
+        n = splice(d->in, NULL, d->pipefd[1], NULL, chunk,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0)
+            d->eof = 1;
+        else if (n > 0)
+            d->pending = n;
+        else if (errno != EAGAIN && errno != EINTR)
+            return -1;
+    }
+
+    while (d->pending > 0) {
+        n = splice(d->pipefd[0], NULL, d->out, NULL, d->pending,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            d->pending -= n;
+            d->count += n;
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1 && errno == EAGAIN) {
+            break;
+        } else {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int ncat_splice_relay(int in1, int out1, int in2, int out2,
+    unsigned long *nbytes1, unsigned long *nbytes2)
+{
+    struct splice_dir dirs[2];
+    struct pollfd pfds[2];
+    struct splice_dir *pdirs[2];
+    size_t chunk;
+    int i, n, rc, err;
+
+    if (!splice_fd_ok(in1) || !splice_fd_ok(out1)
+        || !splice_fd_ok(in2) || !splice_fd_ok(out2))
+        return -1;
+
+    zmem(dirs, sizeof(dirs));
+    dirs[0].in = in1;
+    dirs[0].out = out1;
+    dirs[1].in = in2;
+    dirs[1].out = out2;
+    if (pipe(dirs[0].pipefd) == -1)
+        return -1;
+    if (pipe(dirs[1].pipefd) == -1) {
+        close(dirs[0].pipefd[0]);
+        close(dirs[0].pipefd[1]);
+        return -1;
+    }
+    n = fcntl(dirs[0].pipefd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    if (n > 0 && fcntl(dirs[1].pipefd[1], F_SETPIPE_SZ, n) == n)
+        chunk = n;
+    else
+        chunk = 64 * 1024;
+
+    rc = 0;
+    for (;;) {
+        int nfds = 0;
+
+        if (dirs[1].eof && dirs[1].pending == 0)
+            break;
+
+        /* Wait for output room if data is stuck in the pipe, input otherwise. */
+        for (i = 0; i < 2; i++) {
+            if (dirs[i].pending > 0) {
+                pfds[nfds].fd = dirs[i].out;
+                pfds[nfds].events = POLLOUT;
+            } else if (!dirs[i].eof) {
+                pfds[nfds].fd = dirs[i].in;
+                pfds[nfds].events = POLLIN;
+            } else {
+                continue;
+            }
+            pfds[nfds].revents = 0;
+            pdirs[nfds] = &dirs[i];
+            nfds++;
+        }
+
+        if (poll(pfds, nfds, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            rc = 1;
+            break;
+        }
+
+        for (i = 0; i < nfds; i++) {
+            if (pfds[i].revents == 0)
+                continue;
+            if (splice_dir_pump(pdirs[i], chunk) == -1) {
+                /* Some kernels and protocols don't support splice on a
+                   descriptor that looks fine to fstat. If nothing has moved
+                   yet, the caller can still do it the ordinary way. */
+                if (errno == EINVAL && dirs[0].count + dirs[1].count == 0
+                    && dirs[0].pending + dirs[1].pending == 0) {
+                    rc = -1;
+                } else {
+                    rc = 1;
+                }
+                goto done;
+            }
+        }
+    }
+
+done:
+    /* Let the caller report the error that ended the relay. */
+    err = errno;
+    for (i = 0; i < 2; i++) {
+        close(dirs[i].pipefd[0]);
+        close(dirs[i].pipefd[1]);
+    }
+    errno = err;
+    if (nbytes1 != NULL)
+        *nbytes1 = dirs[0].count;
+    if (nbytes2 != NULL)
+        *nbytes2 = dirs[1].count;
+
+    return rc;
+}
+
+#else
+
+int ncat_splice_relay(int in1, int out1, int in2, int out2,
+    unsigned long *nbytes1, unsigned long *nbytes2)
+{
+    return -1;
+}
+
+#endif
+
 #ifdef HAVE_OPENSSL
 
 #define NCAT_CA_CERTS_PATH (NCAT_DATADIR "/" NCAT_CA_CERTS_FILE)
@@ -100,6 +100,10 @@
 #include <unistd.h>
 #endif
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #ifndef WIN32
 /* SIG_CHLD handler */
 static void proxyreaper(int signo)
@@ -115,22 +119,94 @@ static int send_string(struct fdinfo *fdn, const char *s)
     return fdinfo_send(fdn, s, strlen(s));
 }
 
-static void http_server_handler(int c);
+/* How long the proxy waits for a single read or write on a client or server
+   socket, in seconds, so that a stalled peer can't hold on to a handler
+   forever. */
+#define PROXY_IO_TIMEOUT 30
+
+/* Where a CONNECT request goes, for a caller of http_server_handler that
+   makes the connection itself. sslen is 0 if there is none. */
+struct connect_dest {
+    union sockaddr_u su;
+    size_t sslen;
+    unsigned short port;
+    /* Whatever the client sent after the request, to pass on once connected;
+       allocated with malloc. */
+    char *leftover;
+    size_t leftover_len;
+};
+
+static int http_server_handler(int c, struct connect_dest *dest);
 static int send_proxy_authenticate(struct fdinfo *fdn, int stale);
 static char *http_code2str(int code);
 
 static void fork_handler(int s, int c);
+#ifdef HAVE_PTHREAD_H
+static int ncat_http_server_pool(void);
+#endif
 
 static int handle_connect(struct socket_buffer *client_sock,
-    struct http_request *request);
+    struct http_request *request, struct connect_dest *dest);
 static int handle_method(struct socket_buffer *client_sock,
     struct http_request *request);
 
+/* Set the read and write timeouts of a socket. */
+static void set_io_timeout(int fd, int seconds)
+{
+#ifdef WIN32
+    DWORD ms = seconds * 1000;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (char *) &ms, sizeof(ms));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (char *) &ms, sizeof(ms));
+#else
+    struct timeval tv;
+
+    tv.tv_sec = seconds;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (char *) &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (char *) &tv, sizeof(tv));
+#endif
+}
+
+/* Connect a blocking socket, giving up after the --wait timeout. Returns 0 on
+   success or -1 on error or timeout. */
+static int connect_timeout(int s, const union sockaddr_u *su, size_t sslen)
+{
+    struct timeval tv;
+    fd_set w;
+    int err, rc;
+    socklen_t errlen;
+
+    unblock_socket(s);
+    if (connect(s, &su->sockaddr, sslen) == -1
+        && socket_errno() != EINPROGRESS && socket_errno() != EAGAIN) {
+        block_socket(s);
+        return -1;
+    }
+
+    tv.tv_sec = o.conntimeout / 1000;
+    tv.tv_usec = (o.conntimeout % 1000) * 1000;
+    do {
+        FD_ZERO(&w);
+        FD_SET(s, &w);
+        rc = fselect(s + 1, NULL, &w, NULL, &tv);
+    } while (rc == -1 && socket_errno() == EINTR);
+    block_socket(s);
+    if (rc <= 0)
+        return -1;
+
+    errlen = sizeof(err);
+    if (getsockopt(s, SOL_SOCKET, SO_ERROR, (char *) &err, &errlen) == -1 || err != 0)
+        return -1;
+
+    return 0;
+}
+
 static int check_auth(const struct http_request *request,
     const struct http_credentials *credentials, int *stale);
 
 /*
- * Simple forking HTTP proxy. It is an HTTP/1.0 proxy with knowledge of
+ * Simple HTTP proxy. It is an HTTP/1.0 proxy with knowledge of
  * HTTP/1.1. (The things lacking for HTTP/1.1 are the chunked transfer encoding
  * and the expect mechanism.) The proxy supports the CONNECT, GET, HEAD, and
  * POST methods. It supports Basic and Digest authentication of clients (use the
@@ -160,14 +236,19 @@ int ncat_http_server(void)
     socklen_t sslen;
     union sockaddr_u conn;
 
-#ifndef WIN32
-    Signal(SIGCHLD, proxyreaper);
-#endif
-
 #if HAVE_HTTP_DIGEST
     http_digest_init_secret();
 #endif
 
+#ifdef HAVE_PTHREAD_H
+    if (!o.ssl)
+        return ncat_http_server_pool();
+#endif
+
+#ifndef WIN32
+    Signal(SIGCHLD, proxyreaper);
+#endif
+
 #ifdef HAVE_OPENSSL
     if (o.ssl)
         setup_ssl_listen();
@@ -241,12 +322,476 @@ int ncat_http_server(void)
     return 0;
 }
 
+#ifdef HAVE_PTHREAD_H
+/*
+ * Non-forking proxy server, used on POSIX systems unless --ssl is given. The
+ * main thread runs an Nsock loop that accepts clients and relays CONNECT
+ * tunnels. The parts that block (reading and authenticating a request, and
+ * whole GET, HEAD, and POST transactions) go to a small pool of worker threads
+ * running the same http_server_handler as the forking server. For a CONNECT,
+ * the worker only resolves the server's address and hands the client back to
+ * the main thread, which connects and relays, so that neither slow connects
+ * nor open tunnels occupy workers. Every blocking read, write, and connect in
+ * a worker has a timeout.
+ *
+ * If --max-conns is given, it limits connections, including open tunnels;
+ * otherwise there is no limit. Sending the process SIGUSR1 prints
+ * statistics; with -v they are also printed on SIGINT or SIGTERM before
+ * exiting.
+ */
+
+/* Number of worker threads. */
+#define PROXY_WORKERS 8
+
+/* A client on its way to a worker and back. */
+struct proxy_conn {
+    int client_fd;
+    /* Set by the worker: where a CONNECT goes, and the return value of
+       http_server_handler. */
+    struct connect_dest dest;
+    int code;
+    struct proxy_conn *next;
+};
+
+/* A tunnel relayed by the main thread. Data read from one side is written to
+   the other before that side is read again, so a slow reader slows down the
+   writer instead of data piling up here. */
+struct proxy_tunnel {
+    nsock_iod client_nsi;
+    nsock_iod server_nsi;
+    /* Client data to send once the server is connected. */
+    char *leftover;
+    size_t leftover_len;
+    int writes_pending;
+    int closing;
+};
+
+static struct {
+    nsock_pool nsp;
+    nsock_iod listen_nsi[NUM_LISTEN_ADDRS];
+
+    /* Clients waiting for a worker, and clients the workers are done with.
+       Protected by lock. */
+    pthread_mutex_t lock;
+    pthread_cond_t jobs_cond;
+    struct proxy_conn *jobs_head, *jobs_tail;
+    struct proxy_conn *done;
+
+    /* Workers and signal handlers write a byte here to wake the main thread:
+       's' to print statistics, 'q' to print them and quit, anything else to
+       look at the done list. */
+    int wake_pipe[2];
+
+    /* Statistics. Only the main thread touches these. */
+    unsigned long accepted;
+    unsigned long denied;
+    unsigned long refused;
+    unsigned long tunnels;
+    unsigned long requests;
+    unsigned long failed;
+    unsigned long long tunnel_bytes;
+    int active;
+    int active_tunnels;
+    int peak;
+} ps;
+
+static void proxy_accept_handler(nsock_pool nsp, nsock_event evt, void *data);
+static void proxy_wake_handler(nsock_pool nsp, nsock_event evt, void *data);
+static void proxy_connect_handler(nsock_pool nsp, nsock_event evt, void *data);
+static void proxy_tunnel_read_handler(nsock_pool nsp, nsock_event evt, void *data);
+static void proxy_tunnel_write_handler(nsock_pool nsp, nsock_event evt, void *data);
+
+static void proxy_wake(char c)
+{
+    /* A full pipe means the main thread has wakeups waiting already. */
+    while (write(ps.wake_pipe[1], &c, 1) == -1 && errno == EINTR)
+        ;
+}
+
+static void proxy_signal_handler(int signo)
+{
+    int saved_errno = errno;
+
+    proxy_wake(signo == SIGUSR1 ? 's' : 'q');
+    errno = saved_errno;
+}
+
+static void proxy_print_stats(void)
+{
+    if (o.conn_limit == -1) {
+        loguser("Proxy: %lu connections accepted, %lu denied.\n",
+            ps.accepted, ps.denied);
+    } else {
+        loguser("Proxy: %lu connections accepted, %lu denied, %lu over the limit of %d.\n",
+            ps.accepted, ps.denied, ps.refused, o.conn_limit);
+    }
+    loguser("Proxy: %lu tunnels (%llu bytes relayed), %lu other requests, %lu failed.\n",
+        ps.tunnels, ps.tunnel_bytes, ps.requests, ps.failed);
+    loguser("Proxy: %d connections active, %d of them tunnels; peak %d.\n",
+        ps.active, ps.active_tunnels, ps.peak);
+}
+
+static void *proxy_worker(void *arg)
+{
+    struct proxy_conn *conn;
+
+    for (;;) {
+        pthread_mutex_lock(&ps.lock);
+        while (ps.jobs_head == NULL)
+            pthread_cond_wait(&ps.jobs_cond, &ps.lock);
+        conn = ps.jobs_head;
+        ps.jobs_head = conn->next;
+        if (ps.jobs_head == NULL)
+            ps.jobs_tail = NULL;
+        pthread_mutex_unlock(&ps.lock);
+
+        set_io_timeout(conn->client_fd, PROXY_IO_TIMEOUT);
+
+        conn->code = http_server_handler(conn->client_fd, &conn->dest);
+
+        pthread_mutex_lock(&ps.lock);
+        conn->next = ps.done;
+        ps.done = conn;
+        pthread_mutex_unlock(&ps.lock);
+        proxy_wake('w');
+    }
+
+    return NULL;
+}
+
+static int ncat_http_server_pool(void)
+{
+    pthread_t thread;
+    sigset_t mask, oldmask;
+    nsock_iod wake_nsi;
+    int i, rc;
+
+    zmem(&ps, sizeof(ps));
+    pthread_mutex_init(&ps.lock, NULL);
+    pthread_cond_init(&ps.jobs_cond, NULL);
+
+    /* Ignore the SIGPIPE that occurs when a client disconnects suddenly and we
+       send data to it before noticing. */
+    Signal(SIGPIPE, SIG_IGN);
+
+    if ((ps.nsp = nsp_new(NULL)) == NULL)
+        bye("Failed to create nsock_pool.");
+
+    if (o.debug > 1)
+        /* A trace level of 1 still gives you an awful lot. */
+        nsp_settrace(ps.nsp, stderr, 1, nsock_gettimeofday());
+
+    for (i = 0; i < num_listenaddrs; i++) {
+        int fd;
+
+        fd = do_listen(SOCK_STREAM, IPPROTO_TCP, &listenaddrs[i]);
+        ps.listen_nsi[i] = nsi_new2(ps.nsp, fd, NULL);
+        Close(fd);
+        if (ps.listen_nsi[i] == NULL)
+            bye("Failed to create listening nsiod.");
+        nsock_readready(ps.nsp, ps.listen_nsi[i], proxy_accept_handler, -1, NULL);
+    }
+
+    if (pipe(ps.wake_pipe) == -1)
+        die("pipe");
+    unblock_socket(ps.wake_pipe[1]);
+    if ((wake_nsi = nsi_new2(ps.nsp, ps.wake_pipe[0], NULL)) == NULL)
+        bye("Failed to create wakeup nsiod.");
+    nsock_read(ps.nsp, wake_nsi, proxy_wake_handler, -1, NULL);
+
+    /* The workers inherit this mask, leaving the signals below to the main
+       thread instead of interrupting a worker's blocking calls. */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+    for (i = 0; i < PROXY_WORKERS; i++) {
+        if (pthread_create(&thread, NULL, proxy_worker, NULL) != 0)
+            bye("Failed to start proxy worker thread.");
+        pthread_detach(thread);
+    }
+    pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+
+    Signal(SIGUSR1, proxy_signal_handler);
+    if (o.verbose) {
+        Signal(SIGINT, proxy_signal_handler);
+        Signal(SIGTERM, proxy_signal_handler);
+    }
+
+    rc = nsock_loop(ps.nsp, -1);
+
+    /* The workers may be in the middle of requests, so leave the pool and
+       the locks alone; the process is about to exit anyway. */
+    return rc == NSOCK_LOOP_ERROR ? 1 : 0;
+}
+
+static void proxy_accept_handler(nsock_pool nsp, nsock_event evt, void *data)
+{
+    enum nse_status status = nse_status(evt);
+    nsock_iod nsi = nse_iod(evt);
+    int sd;
+
+    if (status == NSE_STATUS_CANCELLED || status == NSE_STATUS_KILL)
+        return;
+    if (status != NSE_STATUS_SUCCESS)
+        bye("Error waiting for connections: %s.", socket_strerror(nse_errorcode(evt)));
+
+    sd = nsi_getsd(nsi);
+    for (;;) {
+        union sockaddr_u remoteaddr;
+        socklen_t ss_len;
+        struct proxy_conn *conn;
+        int fd;
+
+        ss_len = sizeof(remoteaddr.storage);
+        fd = accept(sd, &remoteaddr.sockaddr, &ss_len);
+        if (fd < 0) {
+            int err = socket_errno();
+
+            if (err == EINTR)
+                continue;
+            if (err != EAGAIN && err != EWOULDBLOCK && o.debug)
+                logdebug("Error in accept: %s\n", socket_strerror(err));
+            break;
+        }
+        ps.accepted++;
+
+        if (!allow_access(&remoteaddr)) {
+            ps.denied++;
+            Close(fd);
+            continue;
+        }
+        if (o.conn_limit != -1 && ps.active >= o.conn_limit) {
+            if (o.verbose)
+                loguser("New connection denied: connection limit reached (%d)\n", ps.active);
+            ps.refused++;
+            Close(fd);
+            continue;
+        }
+        if (o.debug > 1)
+            logdebug("Queueing %s for a worker.\n", inet_socktop(&remoteaddr));
+
+        ps.active++;
+        if (ps.active > ps.peak)
+            ps.peak = ps.active;
+
+        /* The workers use ordinary blocking I/O. */
+        block_socket(fd);
+
+        conn = (struct proxy_conn *) safe_zalloc(sizeof(*conn));
+        conn->client_fd = fd;
+        pthread_mutex_lock(&ps.lock);
+        if (ps.jobs_tail != NULL)
+            ps.jobs_tail->next = conn;
+        else
+            ps.jobs_head = conn;
+        ps.jobs_tail = conn;
+        pthread_cond_signal(&ps.jobs_cond);
+        pthread_mutex_unlock(&ps.lock);
+    }
+
+    nsock_readready(nsp, nsi, proxy_accept_handler, -1, NULL);
+}
+
+/* Take over a CONNECT request read by a worker, and connect to the server. */
+static void proxy_tunnel_start(struct proxy_conn *conn)
+{
+    struct proxy_tunnel *t;
+
+    t = (struct proxy_tunnel *) safe_zalloc(sizeof(*t));
+    /* nsi_new2 works on a duplicate of the descriptor. */
+    t->client_nsi = nsi_new2(ps.nsp, conn->client_fd, t);
+    t->server_nsi = nsi_new(ps.nsp, t);
+    Close(conn->client_fd);
+    if (t->client_nsi == NULL || t->server_nsi == NULL) {
+        if (o.debug)
+            logdebug("Failed to create tunnel nsiods.\n");
+        if (t->client_nsi != NULL)
+            nsi_delete(t->client_nsi, NSOCK_PENDING_SILENT);
+        if (t->server_nsi != NULL)
+            nsi_delete(t->server_nsi, NSOCK_PENDING_SILENT);
+        free(conn->dest.leftover);
+        free(t);
+        ps.failed++;
+        ps.active--;
+        return;
+    }
+    t->leftover = conn->dest.leftover;
+    t->leftover_len = conn->dest.leftover_len;
+
+    ps.active_tunnels++;
+
+    nsock_connect_tcp(ps.nsp, t->server_nsi, proxy_connect_handler,
+        o.conntimeout, t, &conn->dest.su.sockaddr, conn->dest.sslen,
+        conn->dest.port);
+}
+
+/* Send the client the response to its CONNECT, and start relaying once the
+   server is connected. The write handler reads from the side opposite each
+   write, so the server is read once the 200 has gone out, and the client once
+   its leftover data has. */
+static void proxy_connect_handler(nsock_pool nsp, nsock_event evt, void *data)
+{
+    enum nse_status status = nse_status(evt);
+    struct proxy_tunnel *t = (struct proxy_tunnel *) data;
+    const char *response;
+
+    if (status == NSE_STATUS_CANCELLED || status == NSE_STATUS_KILL)
+        return;
+
+    if (status != NSE_STATUS_SUCCESS) {
+        if (o.debug) {
+            logdebug("Can't connect to the server: %s.\n",
+                status == NSE_STATUS_TIMEOUT ? "timed out" : socket_strerror(nse_errorcode(evt)));
+        }
+        free(t->leftover);
+        t->leftover = NULL;
+        ps.failed++;
+        /* Close once the error response is written. */
+        t->closing = 1;
+        response = http_code2str(504);
+        nsock_write(nsp, t->client_nsi, proxy_tunnel_write_handler, -1, t,
+            response, strlen(response));
+        t->writes_pending++;
+        return;
+    }
+
+    ps.tunnels++;
+
+    response = http_code2str(200);
+    nsock_write(nsp, t->client_nsi, proxy_tunnel_write_handler, -1, t,
+        response, strlen(response));
+    t->writes_pending++;
+    if (t->leftover_len > 0) {
+        nsock_write(nsp, t->server_nsi, proxy_tunnel_write_handler, -1, t,
+            t->leftover, t->leftover_len);
+        t->writes_pending++;
+    } else {
+        nsock_read(nsp, t->client_nsi, proxy_tunnel_read_handler, -1, t);
+    }
+    free(t->leftover);
+    t->leftover = NULL;
+}
+
+/* Close a tunnel once the writes to it are finished. Pending reads are
+   killed silently when the IODs are deleted. */
+static void proxy_tunnel_close(struct proxy_tunnel *t)
+{
+    t->closing = 1;
+    if (t->writes_pending > 0)
+        return;
+
+    nsi_delete(t->client_nsi, NSOCK_PENDING_SILENT);
+    nsi_delete(t->server_nsi, NSOCK_PENDING_SILENT);
+    free(t);
+
+    ps.active--;
+    ps.active_tunnels--;
+}
+
+static void proxy_wake_handler(nsock_pool nsp, nsock_event evt, void *data)
+{
+    enum nse_status status = nse_status(evt);
+    struct proxy_conn *done, *next;
+    char *buf;
+    int i, nbytes;
+
+    if (status == NSE_STATUS_CANCELLED || status == NSE_STATUS_KILL)
+        return;
+    if (status != NSE_STATUS_SUCCESS)
+        bye("Error reading wakeup pipe.");
+
+    buf = nse_readbuf(evt, &nbytes);
+    for (i = 0; i < nbytes; i++) {
+        if (buf[i] == 's' || buf[i] == 'q')
+            proxy_print_stats();
+        if (buf[i] == 'q') {
+            nsock_loop_quit(nsp);
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&ps.lock);
+    done = ps.done;
+    ps.done = NULL;
+    pthread_mutex_unlock(&ps.lock);
+
+    for (; done != NULL; done = next) {
+        next = done->next;
+        if (done->dest.sslen != 0) {
+            proxy_tunnel_start(done);
+        } else {
+            if (done->code == 0)
+                ps.requests++;
+            else
+                ps.failed++;
+            ps.active--;
+        }
+        free(done);
+    }
+
+    nsock_read(nsp, nse_iod(evt), proxy_wake_handler, -1, NULL);
+}
+
+static void proxy_tunnel_read_handler(nsock_pool nsp, nsock_event evt, void *data)
+{
+    enum nse_status status = nse_status(evt);
+    struct proxy_tunnel *t = (struct proxy_tunnel *) data;
+    nsock_iod other;
+    char *buf;
+    int nbytes;
+
+    if (status == NSE_STATUS_CANCELLED || status == NSE_STATUS_KILL)
+        return;
+
+    /* A CONNECT tunnel ends when either side closes, as in the forking
+       server. */
+    if (status != NSE_STATUS_SUCCESS) {
+        if (status == NSE_STATUS_ERROR && o.debug > 1)
+            logdebug("Error reading from tunnel: %s\n", socket_strerror(nse_errorcode(evt)));
+        proxy_tunnel_close(t);
+        return;
+    }
+    if (t->closing)
+        return;
+
+    buf = nse_readbuf(evt, &nbytes);
+    ps.tunnel_bytes += nbytes;
+
+    other = nse_iod(evt) == t->client_nsi ? t->server_nsi : t->client_nsi;
+    nsock_write(nsp, other, proxy_tunnel_write_handler, -1, t, buf, nbytes);
+    t->writes_pending++;
+}
+
+static void proxy_tunnel_write_handler(nsock_pool nsp, nsock_event evt, void *data)
+{
+    enum nse_status status = nse_status(evt);
+    struct proxy_tunnel *t = (struct proxy_tunnel *) data;
+    nsock_iod other;
+
+    if (status == NSE_STATUS_CANCELLED || status == NSE_STATUS_KILL)
+        return;
+
+    t->writes_pending--;
+
+    if (status != NSE_STATUS_SUCCESS || t->closing) {
+        proxy_tunnel_close(t);
+        return;
+    }
+
+    /* Read more from the side this data came from. */
+    other = nse_iod(evt) == t->client_nsi ? t->server_nsi : t->client_nsi;
+    nsock_read(nsp, other, proxy_tunnel_read_handler, -1, t);
+}
+#endif
+
 #ifdef WIN32
 /* On Windows we don't actually fork but rather start a thread. */
 
 static DWORD WINAPI handler_thread_func(void *data)
 {
-    http_server_handler(*((int *) data));
+    http_server_handler(*((int *) data), NULL);
     free(data);
 
     return 0;
@@ -285,7 +830,7 @@ static void fork_handler(int s, int c)
             Close(STDERR_FILENO);
         }
 
-        http_server_handler(c);
+        http_server_handler(c, NULL);
         exit(0);
     } else {
         Close(c);
@@ -302,7 +847,12 @@ static int method_is_known(const char *method)
         || strcmp(method, "POST") == 0;
 }
 
-static void http_server_handler(int c)
+/* Read a request from the client on c and carry it out. Returns 0 if the
+   request was carried out, or else the error status code that was sent to the
+   client. The client socket is closed before returning, except that if dest
+   is not NULL, a CONNECT request leaves it open and only fills in dest, for
+   the caller to connect and relay. */
+static int http_server_handler(int c, struct connect_dest *dest)
 {
     int code;
     struct socket_buffer sock;
@@ -317,7 +867,7 @@ static void http_server_handler(int c)
             loguser("Failed SSL connection: %s\n",
                 ERR_error_string(ERR_get_error(), NULL));
             fdinfo_close(&sock.fdn);
-            return;
+            return 500;
         }
     }
 #endif
@@ -328,7 +878,7 @@ static void http_server_handler(int c)
             logdebug("Error reading Request-Line.\n");
         send_string(&sock.fdn, http_code2str(code));
         fdinfo_close(&sock.fdn);
-        return;
+        return code;
     }
     if (o.debug > 1)
         logdebug("Request-Line: %s", buf);
@@ -339,7 +889,7 @@ static void http_server_handler(int c)
             logdebug("Error parsing Request-Line.\n");
         send_string(&sock.fdn, http_code2str(code));
         fdinfo_close(&sock.fdn);
-        return;
+        return code;
     }
 
     if (!method_is_known(request.method)) {
@@ -348,7 +898,7 @@ static void http_server_handler(int c)
         http_request_free(&request);
         send_string(&sock.fdn, http_code2str(405));
         fdinfo_close(&sock.fdn);
-        return;
+        return 405;
     }
 
     code = http_read_header(&sock, &buf);
@@ -358,7 +908,7 @@ static void http_server_handler(int c)
         http_request_free(&request);
         send_string(&sock.fdn, http_code2str(code));
         fdinfo_close(&sock.fdn);
-        return;
+        return code;
     }
     if (o.debug > 1)
         logdebug("Header:\n%s", buf);
@@ -370,7 +920,7 @@ static void http_server_handler(int c)
         http_request_free(&request);
         send_string(&sock.fdn, http_code2str(code));
         fdinfo_close(&sock.fdn);
-        return;
+        return code;
     }
 
     /* Check authentication. */
@@ -383,7 +933,7 @@ static void http_server_handler(int c)
             send_proxy_authenticate(&sock.fdn, 0);
             http_request_free(&request);
             fdinfo_close(&sock.fdn);
-            return;
+            return 407;
         }
 
         ret = check_auth(&request, &credentials, &stale);
@@ -396,12 +946,12 @@ static void http_server_handler(int c)
             send_proxy_authenticate(&sock.fdn, stale);
             http_request_free(&request);
             fdinfo_close(&sock.fdn);
-            return;
+            return 407;
         }
     }
 
     if (strcmp(request.method, "CONNECT") == 0) {
-        code = handle_connect(&sock, &request);
+        code = handle_connect(&sock, &request, dest);
     } else if (strcmp(request.method, "GET") == 0
         || strcmp(request.method, "HEAD") == 0
         || strcmp(request.method, "POST") == 0) {
@@ -414,14 +964,22 @@ static void http_server_handler(int c)
     if (code != 0) {
         send_string(&sock.fdn, http_code2str(code));
         fdinfo_close(&sock.fdn);
-        return;
+        return code;
     }
 
-    fdinfo_close(&sock.fdn);
+    /* A tunnel handed back to the caller keeps the client socket open. */
+    if (dest == NULL || dest->sslen == 0)
+        fdinfo_close(&sock.fdn);
+
+    return 0;
 }
 
+/* Connect to the server named in a CONNECT request, send the client the 200
+   response, and relay data between the two until one side closes. If dest is
+   not NULL, only fill it in with the server's address and the data the client
+   has already sent, and return so the caller can do the rest. */
 static int handle_connect(struct socket_buffer *client_sock,
-    struct http_request *request)
+    struct http_request *request, struct connect_dest *dest)
 {
     union sockaddr_u su;
     size_t sslen = sizeof(su.storage);
@@ -444,6 +1002,20 @@ static int handle_connect(struct socket_buffer *client_sock,
         return 504;
     }
 
+    if (dest != NULL) {
+        line = socket_buffer_remainder(client_sock, &len);
+        dest->su = su;
+        dest->sslen = sslen;
+        dest->port = request->uri.port;
+        dest->leftover = NULL;
+        dest->leftover_len = len;
+        if (len > 0) {
+            dest->leftover = (char *) safe_malloc(len);
+            memcpy(dest->leftover, line, len);
+        }
+        return 0;
+    }
+
     s = Socket(su.storage.ss_family, SOCK_STREAM, IPPROTO_TCP);
 
     if (connect(s, &su.sockaddr, sslen) == -1) {
@@ -558,14 +1130,22 @@ static int handle_method(struct socket_buffer *client_sock,
         return 403;
     }
 
-    s = Socket(su.storage.ss_family, SOCK_STREAM, IPPROTO_TCP);
+    s = socket(su.storage.ss_family, SOCK_STREAM, IPPROTO_TCP);
+    if (s == -1) {
+        if (o.debug)
+            logdebug("Can't create socket: %s.\n", socket_strerror(socket_errno()));
+        return 500;
+    }
 
-    if (connect(s, &su.sockaddr, sslen) == -1) {
+    /* A server that doesn't answer or stalls mid-transfer mustn't hold the
+       handler (in the non-forking server, a shared worker) forever. */
+    if (connect_timeout(s, &su, sslen) == -1) {
         if (o.debug)
             logdebug("Can't connect to %s.\n", inet_socktop(&su));
         Close(s);
         return 504;
     }
+    set_io_timeout(s, PROXY_IO_TIMEOUT);
 
     socket_buffer_init(&server_sock, s);
 
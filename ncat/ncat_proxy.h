@@ -97,6 +97,8 @@
 #define HTTP_DIGEST_NONCE_EXPIRY 10
 
 /*
- * Simple forking HTTP proxy.
+ * Simple HTTP proxy. Each client gets its own process (a thread on Windows),
+ * except on POSIX systems without --ssl, where a worker thread pool and an
+ * Nsock loop serve all clients in one process.
  */
 extern int ncat_http_server(void);
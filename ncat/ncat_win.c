@@ -106,6 +106,13 @@ void set_lf_mode(void)
     _setmode(STDOUT_FILENO, _O_BINARY);
 }
 
+int ncat_splice_relay(int in1, int out1, int in2, int out2,
+    unsigned long *nbytes1, unsigned long *nbytes2)
+{
+    /* No splice on Windows. */
+    return -1;
+}
+
 #ifdef HAVE_OPENSSL
 
 int ssl_load_default_ca_certs(SSL_CTX *ctx)
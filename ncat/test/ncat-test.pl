@@ -12,6 +12,7 @@ use Data::Dumper;
 use Socket;
 use Digest::MD5 qw/md5_hex/;
 use POSIX ":sys_wait_h";
+use Fcntl;
 
 use IPC::Open3;
 use strict;
@@ -1514,6 +1515,41 @@ proxy_test "HTTP CONNECT proxy relays",
 	$resp eq "def\n" or die "Proxy relayed \"$resp\", not \"abc\\n\"";
 };
 
+# Connections to a server that never answers mustn't keep the proxy from
+# serving other clients. The server is a listener that never accepts, with its
+# backlog already full, so that further SYNs to it are dropped. There are more
+# such CONNECTs than the proxy has worker threads.
+proxy_test_raw "HTTP proxy serves clients while connects hang",
+[], [], [], sub {
+	my $BLACKHOLE_PORT = 40002;
+	my (@fill, @stuck, $c);
+	select(undef, undef, undef, 0.3);
+	socket(my $blackhole, PF_INET, SOCK_STREAM, getprotobyname("tcp")) or die "socket: $!";
+	setsockopt($blackhole, SOL_SOCKET, SO_REUSEADDR, 1);
+	bind($blackhole, sockaddr_in($BLACKHOLE_PORT, inet_aton($HOST))) or die "bind: $!";
+	listen($blackhole, 0) or die "listen: $!";
+	for (1 .. 4) {
+		socket(my $s, PF_INET, SOCK_STREAM, getprotobyname("tcp")) or die "socket: $!";
+		fcntl($s, F_SETFL, O_NONBLOCK);
+		connect($s, sockaddr_in($BLACKHOLE_PORT, inet_aton($HOST)));
+		push @fill, $s;
+	}
+	for (1 .. 16) {
+		socket(my $s, PF_INET, SOCK_STREAM, getprotobyname("tcp")) or die "socket: $!";
+		connect($s, sockaddr_in($PROXY_PORT, inet_aton($HOST))) or die "connect: $!";
+		syswrite($s, http_request("CONNECT", "$HOST:$BLACKHOLE_PORT"));
+		push @stuck, $s;
+	}
+	select(undef, undef, undef, 0.5);
+
+	socket($c, PF_INET, SOCK_STREAM, getprotobyname("tcp")) or die "socket: $!";
+	connect($c, sockaddr_in($PROXY_PORT, inet_aton($HOST))) or die "connect: $!";
+	syswrite($c, http_request("CONNECT", "$HOST:$PORT"));
+	my $resp = timeout_read($c, 2) or die "Read timeout";
+	my $code = HTTP::Response->parse($resp)->code;
+	$code == 200 or die "Expected response code 200, got $code";
+};
+
 # Proxy client shouldn't see the status line returned by the proxy server.
 server_client_test "HTTP CONNECT client hides proxy server response",
 ["--proxy-type", "http"], ["--proxy", "$HOST:$PORT", "--proxy-type", "http"], sub {
@@ -109,8 +109,11 @@
 #include "targets.h"
 #include "TargetGroup.h"
 #include "service_scan.h"
+#include "nmap_rpc.h"
 #include "charpool.h"
 #include "nmap_error.h"
+#include "databundle.h"
+#include "checkpoint.h"
 #include "utils.h"
 #include "xml.h"
 
@@ -271,6 +274,7 @@ printf("%s %s ( %s )\n"
        "  -r: Scan ports consecutively - don't randomize\n"
        "  --top-ports <number>: Scan <number> most common ports\n"
        "  --port-ratio <ratio>: Scan ports more common than <ratio>\n"
+       "  --likely-ports-first: Scan the ports most often found open first\n"
        "SERVICE/VERSION DETECTION:\n"
        "  -sV: Probe open ports to determine service/version info\n"
        "  --version-intensity <level>: Set from 0 (light) to 9 (try all probes)\n"
@@ -307,6 +311,7 @@ printf("%s %s ( %s )\n"
        "  --scan-delay/--max-scan-delay <time>: Adjust delay between probes\n"
        "  --min-rate <number>: Send packets no slower than <number> per second\n"
        "  --max-rate <number>: Send packets no faster than <number> per second\n"
+       "  --stateless: Keep no per-probe state in SYN scans and TCP ping sweeps\n"
        "FIREWALL/IDS EVASION AND SPOOFING:\n"
        "  -f; --mtu <val>: fragment packets (optionally w/given MTU)\n"
        "  -D <decoy1,decoy2[,ME],...>: Cloak a scan with decoys\n"
@@ -330,6 +335,7 @@ printf("%s %s ( %s )\n"
        "  --iflist: Print host interfaces and routes (for debugging)\n"
        "  --log-errors: Log errors/warnings to the normal-format output file\n"
        "  --append-output: Append to rather than clobber specified output files\n"
+       "  --checkpoint <filename>: Save scan progress for --resume every few seconds\n"
        "  --resume <filename>: Resume an aborted scan\n"
        "  --stylesheet <path/URL>: XSL stylesheet to transform XML output to HTML\n"
        "  --webxml: Reference stylesheet from Nmap.Org for more portable XML\n"
@@ -338,6 +344,8 @@ printf("%s %s ( %s )\n"
        "  -6: Enable IPv6 scanning\n"
        "  -A: Enable OS detection, version detection, script scanning, and traceroute\n"
        "  --datadir <dirname>: Specify custom Nmap data file location\n"
+       "  --build-data-bundle <dirname>: Pre-parse the data files in dirname for\n"
+       "     faster startup\n"
        "  --send-eth/--send-ip: Send using raw ethernet frames or IP packets\n"
        "  --privileged: Assume that the user is fully privileged\n"
        "  --unprivileged: Assume the user lacks raw socket privileges\n"
@@ -501,6 +509,7 @@ public:
     this->pre_max_retries       = -1;
     this->pre_host_timeout      = -1;
     this->iflist                = false;
+    this->bundle_dir            = NULL;
   }
 
   // Pre-specified timing parameters.
@@ -513,6 +522,7 @@ public:
   long  pre_host_timeout;
   char  *machinefilename, *kiddiefilename, *normalfilename, *xmlfilename;
   bool  iflist;
+  char  *bundle_dir;
   char  *exclude_spec, *exclude_file;
   char  *spoofSource;
   const char *spoofmac;
@@ -539,6 +549,7 @@ void parse_options(int argc, char **argv) {
       {"debug", optional_argument, 0, 'd'},
       {"help", no_argument, 0, 'h'},
       {"iflist", no_argument, 0, 0},
+      {"build-data-bundle", required_argument, 0, 0},
       {"release_memory", no_argument, 0, 0},
       {"release-memory", no_argument, 0, 0},
       {"nogcc", no_argument, 0, 0},
@@ -565,6 +576,7 @@ void parse_options(int argc, char **argv) {
       {"scanflags", required_argument, 0, 0},
       {"defeat_rst_ratelimit", no_argument, 0, 0},
       {"defeat-rst-ratelimit", no_argument, 0, 0},
+      {"stateless", no_argument, 0, 0},
       {"host_timeout", required_argument, 0, 0},
       {"host-timeout", required_argument, 0, 0},
       {"scan_delay", required_argument, 0, 0},
@@ -616,6 +628,7 @@ void parse_options(int argc, char **argv) {
       {"mtu", required_argument, 0, 0},
       {"append_output", no_argument, 0, 0},
       {"append-output", no_argument, 0, 0},
+      {"checkpoint", required_argument, 0, 0},
       {"noninteractive", no_argument, 0, 0},
       {"spoof_mac", required_argument, 0, 0},
       {"spoof-mac", required_argument, 0, 0},
@@ -643,6 +656,8 @@ void parse_options(int argc, char **argv) {
       {"port_ratio", required_argument, 0, 0},
       {"top-ports", required_argument, 0, 0},
       {"top_ports", required_argument, 0, 0},
+      {"likely-ports-first", no_argument, 0, 0},
+      {"likely_ports_first", no_argument, 0, 0},
 #ifndef NOLUA
       {"script", required_argument, 0, 0},
       {"script-trace", no_argument, 0, 0},
@@ -739,6 +754,8 @@ void parse_options(int argc, char **argv) {
         }
       } else if (strcmp(long_options[option_index].name, "iflist") == 0 ) {
         delayed_options.iflist = true;
+      } else if (optcmp(long_options[option_index].name, "build-data-bundle") == 0 ) {
+        delayed_options.bundle_dir = optarg;
       } else if (strcmp(long_options[option_index].name, "nogcc") == 0 ) {
         o.nogcc = 1;
       } else if (optcmp(long_options[option_index].name, "release-memory") == 0 ) {
@@ -771,6 +788,8 @@ void parse_options(int argc, char **argv) {
         o.requested_data_files["nmap-service-probes"] = optarg;
       } else if (optcmp(long_options[option_index].name, "append-output") == 0) {
         o.append_output = 1;
+      } else if (optcmp(long_options[option_index].name, "checkpoint") == 0) {
+        o.checkpoint_file = strdup(optarg);
       } else if (strcmp(long_options[option_index].name, "noninteractive") == 0) {
         o.noninteractive = true;
       } else if (optcmp(long_options[option_index].name, "spoof-mac") == 0) {
@@ -796,6 +815,8 @@ void parse_options(int argc, char **argv) {
         delayed_options.pre_scan_delay = l;
       } else if (optcmp(long_options[option_index].name, "defeat-rst-ratelimit") == 0) {
         o.defeat_rst_ratelimit = 1;
+      } else if (optcmp(long_options[option_index].name, "stateless") == 0) {
+        o.stateless = true;
       } else if (optcmp(long_options[option_index].name, "max-scan-delay") == 0) {
         l = tval2msecs(optarg);
         if (l < 0)
@@ -811,6 +832,8 @@ void parse_options(int argc, char **argv) {
                  || strcmp(long_options[option_index].name, "rH") == 0) {
         o.randomize_hosts = 1;
         o.ping_group_sz = PING_GROUP_SZ * 4;
+      } else if (optcmp(long_options[option_index].name, "likely-ports-first") == 0) {
+        o.likely_ports_first = true;
       } else if (optcmp(long_options[option_index].name, "nsock-engine") == 0) {
         nsock_set_default_engine(optarg);
       } else if (optcmp(long_options[option_index].name, "osscan-limit")  == 0) {
@@ -1527,6 +1550,9 @@ void  apply_delayed_options() {
 int nmap_main(int argc, char *argv[]) {
   int i;
   vector<Target *> Targets;
+  /* Strings that belong to the hosts of the current group, such as the values
+     in their OS fingerprints. Released once the group has been output. */
+  CharPool hostgroup_strings(16384);
   time_t now;
   struct hostent *target = NULL;
   time_t timep;
@@ -1581,6 +1607,9 @@ int nmap_main(int argc, char *argv[]) {
 
   apply_delayed_options();
 
+  if (o.checkpoint_file)
+    checkpoint_start(argc, fakeargv);
+
 #ifdef WIN32
   win_init();
 #endif
@@ -1590,6 +1619,10 @@ int nmap_main(int argc, char *argv[]) {
     exit(0);
   }
 
+  if (delayed_options.bundle_dir) {
+    exit(databundle_write(delayed_options.bundle_dir) == 0 ? 0 : 1);
+  }
+
   /* more fakeargv junk, BTW malloc'ing extra space in argv[0] doesn't work */
   if (o.quashargv) {
     size_t fakeargvlen = strlen(FAKE_ARGV), argvlen = strlen(argv[0]);
@@ -1768,6 +1801,8 @@ int nmap_main(int argc, char *argv[]) {
                   host_exp_group, num_host_exp_groups);
 
   do {
+    CharPoolScope hostgroup_scope(&hostgroup_strings);
+
     ideal_scan_group_sz = determineScanGroupSize(o.numhosts_scanned, &ports);
     while(Targets.size() < ideal_scan_group_sz) {
       o.current_scantype = HOST_DISCOVERY;
@@ -1975,8 +2010,7 @@ int nmap_main(int argc, char *argv[]) {
          * get's it's port scan list from the open port list of the current
          * host rather than port list the user specified.
          */
-        for(targetno = 0; targetno < Targets.size(); targetno++)
-          pos_scan(Targets[targetno], NULL, 0, RPC_SCAN);
+        rpc_scan(Targets);
       }
     }
 
@@ -2035,6 +2069,7 @@ int nmap_main(int argc, char *argv[]) {
       }
     }
     log_flush_all();
+    checkpoint_group_done(Targets);
 
     o.numhosts_scanned += Targets.size();
   
@@ -2044,6 +2079,7 @@ int nmap_main(int argc, char *argv[]) {
       delete currenths;
       Targets.pop_back();
     }
+    hostgroup_strings.clear();
     o.numhosts_scanning = 0;
   } while(!o.max_ips_to_scan || o.max_ips_to_scan > o.numhosts_scanned);
 
@@ -2,8 +2,8 @@
 /***************************************************************************
  * nmap_rpc.cc -- Functions related to the RPCGrind facility of Nmap.      *
  * This includes reading the nmap-rpc services file and sending rpc        *
- * queries and interpreting responses.  The actual scan engine used for    *
- * rpc grinding is pos_scan (which is not in this file)                    *
+ * queries and interpreting responses, with an nsock-based engine that     *
+ * grinds the RPC ports of a whole host group concurrently.                *
  *                                                                         *
  ***********************IMPORTANT NMAP LICENSE TERMS************************
  *                                                                         *
@@ -97,6 +97,7 @@
 
 
 #include "nmap_rpc.h"
+#include "databundle.h"
 #include "NmapOps.h"
 #include "Target.h"
 #include "charpool.h"
@@ -104,61 +105,35 @@
 #include "nmap_error.h"
 #include "utils.h"
 #include "nbase.h"
+#include "nsock.h"
+
+#include <list>
+#include <vector>
 
 extern NmapOps o;
 static struct rpc_info ri;
-static int udp_rpc_socket = -1;
-static int tcp_rpc_socket = -1;
 static unsigned long rpc_xid_base = (unsigned long) -1;
 					   /* The XID we send in queries is 
 					   this random base number + the 
 					   RPC prog number we are scanning
 					   for */
-static size_t tcp_readlen=0; /* used in get_rpc_results but can be reset in 
-			    send_rpc_query */
 
-static void rpc_services_init() {
-  static int services_initialized = 0;
-  if (services_initialized) return;
-  services_initialized = 1;
-
-  char filename[512];
+/* Parses an nmap-rpc (or /etc/rpc) file into table. The number of each record
+   is the RPC program number and the name is the program name. Returns 0 on
+   success and -1 if the file can't be read. */
+int rpc_parse_file(const char *filename, DataTable *table) {
   FILE *fp;
   char *tmpptr, *p;
   char line[1024];
-  int lineno = 0;
-
-  ri.num_alloc = 256;
-  ri.num_used = 0;
-  ri.names = (char **) cp_alloc(ri.num_alloc * sizeof(char *));
-  ri.numbers = (unsigned long *) cp_alloc(ri.num_alloc * sizeof(unsigned long));
-
-  if (nmap_fetchfile(filename, sizeof(filename), "nmap-rpc") != 1) {
-    error("Unable to find nmap-rpc!  Resorting to /etc/rpc");
-    strcpy(filename, "/etc/rpc");
-  }
+  const char *name;
 
   fp = fopen(filename, "r");
-  if (!fp) {
-    fatal("Unable to open %s for reading rpc information", filename);
-  }
-  /* Record where this data file was found. */
-  o.loaded_data_files["nmap-rpc"] = filename;
+  if (!fp)
+    return -1;
 
   while(fgets(line, sizeof(line), fp)) {
-    lineno++;
     p = line;
 
-    if (ri.num_used == ri.num_alloc) {
-      tmpptr = (char *) cp_alloc(ri.num_alloc * 3 * sizeof(char *));
-      memcpy(tmpptr, ri.names, ri.num_alloc * sizeof(char *));
-      ri.names = (char **) tmpptr;
-      tmpptr = (char *) cp_alloc(ri.num_alloc * 3 * sizeof(unsigned long));
-      memcpy(tmpptr, ri.numbers, ri.num_alloc * sizeof(char *));
-      ri.numbers = (unsigned long *) tmpptr;
-      ri.num_alloc *= 3;
-    }
-
     while(*p && *p != '#' && !isalnum((int) (unsigned char) *p)) p++;
 
     if (!*p || *p == '#') continue;
@@ -168,7 +143,7 @@ static void rpc_services_init() {
       continue;
     *tmpptr = '\0';
     
-    ri.names[ri.num_used] = cp_strdup(p);
+    name = p;
     p = tmpptr + 1;
 
     while(*p && !isdigit((int) (unsigned char) *p)) p++;
@@ -176,10 +151,42 @@ static void rpc_services_init() {
     if (!*p)
       continue;
 
-    ri.numbers[ri.num_used] = strtoul(p, NULL, 10);
-    ri.num_used++;
+    table->add(strtoul(p, NULL, 10), name);
   }
   fclose(fp);
+  return 0;
+}
+
+static void rpc_services_init() {
+  static int services_initialized = 0;
+  if (services_initialized) return;
+  services_initialized = 1;
+
+  /* The names in ri point into this. */
+  static DataTable rpc_data;
+  char filename[512];
+  unsigned int i;
+
+  if (nmap_fetchfile(filename, sizeof(filename), "nmap-rpc") != 1) {
+    error("Unable to find nmap-rpc!  Resorting to /etc/rpc");
+    strcpy(filename, "/etc/rpc");
+  }
+
+  if (!databundle_get("nmap-rpc", filename, &rpc_data)
+      && rpc_parse_file(filename, &rpc_data) == -1) {
+    fatal("Unable to open %s for reading rpc information", filename);
+  }
+  /* Record where this data file was found. */
+  o.loaded_data_files["nmap-rpc"] = filename;
+
+  ri.num_alloc = MAX(rpc_data.size(), 1);
+  ri.num_used = rpc_data.size();
+  ri.names = (char **) cp_alloc(ri.num_alloc * sizeof(char *));
+  ri.numbers = (unsigned long *) cp_alloc(ri.num_alloc * sizeof(unsigned long));
+  for (i = 0; i < rpc_data.size(); i++) {
+    ri.names[i] = (char *) rpc_data.name(i);
+    ri.numbers[i] = rpc_data.number(i);
+  }
   return;
 }
 
@@ -204,488 +211,736 @@ int get_rpc_procs(unsigned long **programs, unsigned long *num_programs) {
   return 0;
 }
 
-/* Send an RPC query to the specified host/port on the specified protocol
-   looking for the specified RPC program.  We cache our sending sockets
-   to avoid recreating and (with TCP) reconnect()'ing them each time */
-int send_rpc_query(Target *target_host, unsigned short portno,
-		   int ipproto, unsigned long program, int scan_offset, 
-		   int trynum) {
-  static struct sockaddr_storage last_target;
-  struct sockaddr_storage sock;
-  size_t socklen;
-  static int last_ipproto = -1;
-  struct sockaddr_in *sin = NULL, *lastsin = NULL;
-#ifdef HAVE_IPV6
-  struct sockaddr_in6 *sin6 = NULL, *lastsin6 = NULL;
-#endif
-  char rpch_buf[256]; 
-  struct rpc_hdr *rpch;
-  int res, err = 0;
+/* RPC grinding.  Every open port that version detection identified as
+   rpcbind is sent a NULL call for each program in nmap-rpc, with a bogus
+   version number.  A PROG_MISMATCH reply reveals the program along with
+   the range of versions it supports.  All such ports of all the targets
+   in a host group are ground at the same time on a single nsock pool.
+   Each host has its own window of outstanding queries, shared by its
+   ports, which grows as replies come back and shrinks when a reply shows
+   that a query had to be retransmitted. */
+
+#define RPC_MAX_TRIES 3     /* The try number must fit in two bits of the XID */
+#define RPC_TICK_MSECS 20   /* How often retransmissions are checked for */
+#define RPC_CONNECT_TIMEOUT 5000
+#define RPC_PACKET_INCR 4
+#define RPC_FALLBACK_PERCENT 0.7
+
+enum rpc_query_state { RPCQ_FRESH, RPCQ_TESTING, RPCQ_DONE };
+
+/* The query for one RPC program on one port */
+struct rpc_query {
+  enum rpc_query_state state;
+  int trynum;
+  struct timeval sent[RPC_MAX_TRIES];
+};
+
+class RPCHost;
+
+/* An rpcbind port being ground */
+class RPCPort {
+public:
+  RPCPort(RPCHost *host, u16 portno, u8 proto, unsigned long num_progs);
+
+  RPCHost *host;
+  u16 portno;
+  u8 proto;
+  nsock_iod nsi;
+  bool connected;
+  bool finished;
+  int status; /* RPC_STATUS_* */
+  unsigned long program;
+  unsigned long lowver; /* Lowest version number of program supported */
+  unsigned long highver; /* Highest version supported */
+  int valid_responses; /* Number of valid (RPC wise) responses we have
+                          received on this port */
+  std::vector<struct rpc_query> queries; /* One per program in nmap-rpc */
+  unsigned long next_fresh; /* Index of the first query not sent yet */
+  std::list<unsigned long> testing; /* Indexes of the queries in flight */
+  /* Partial TCP record left over from the last read: a record mark and at
+     most 32 bytes of reply */
+  char readbuf[RECORD_MARKING + 32];
+  size_t readlen;
+};
+
+/* A target with rpcbind ports, and its congestion control state */
+class RPCHost {
+public:
+  RPCHost(Target *target);
+
+  Target *target;
+  std::list<RPCPort *> ports_remaining; /* Not started yet */
+  std::list<RPCPort *> ports_active;
+  double numqueries_ideal; /* Window of outstanding queries */
+  int numqueries_outstanding;
+  struct timeval last_decrease; /* When the window was last shrunk */
+};
+
+/* Everything an RPC grind of a host group needs, available to the nsock
+   handlers through the pool's user data */
+class RPCGroup {
+public:
+  RPCGroup(std::vector<Target *> &Targets);
+  ~RPCGroup();
+
+  std::vector<RPCHost *> hosts;
+  std::vector<RPCPort *> ports; /* All of them, for bookkeeping */
+  unsigned long *progs; /* The program numbers from nmap-rpc */
+  unsigned long num_progs;
+  unsigned int ports_active;
+  unsigned int ports_finished;
+  unsigned int max_active; /* Ports ground at the same time */
+  int min_width, max_width; /* Bounds for the per-host windows */
+  ScanProgressMeter *SPM;
+};
+
+static void rpc_connect_handler(nsock_pool nsp, nsock_event nse, void *mydata);
+static void rpc_read_handler(nsock_pool nsp, nsock_event nse, void *mydata);
+static void rpc_write_handler(nsock_pool nsp, nsock_event nse, void *mydata);
+static void rpc_timer_handler(nsock_pool nsp, nsock_event nse, void *mydata);
+
+RPCPort::RPCPort(RPCHost *host, u16 portno, u8 proto, unsigned long num_progs) {
+  struct rpc_query fresh;
+
+  memset(&fresh, 0, sizeof(fresh));
+  fresh.state = RPCQ_FRESH;
+  this->host = host;
+  this->portno = portno;
+  this->proto = proto;
+  nsi = NULL;
+  connected = false;
+  finished = false;
+  status = RPC_STATUS_UNKNOWN;
+  program = lowver = highver = 0;
+  valid_responses = 0;
+  queries.assign(num_progs, fresh);
+  next_fresh = 0;
+  readlen = 0;
+}
 
-  /* static int numruns = 0;
-     if (numruns++ > 2)
-     fatal("Done");  */
+RPCHost::RPCHost(Target *target) {
+  this->target = target;
+  numqueries_ideal = 0;
+  numqueries_outstanding = 0;
+  memset(&last_decrease, 0, sizeof(last_decrease));
+}
 
-  rpch = (struct rpc_hdr *) ((char *)rpch_buf + sizeof(u32));
-  memset(rpch, 0, sizeof(struct rpc_hdr));
+RPCGroup::RPCGroup(std::vector<Target *> &Targets) {
+  const Port *nxtport;
+  Port port;
+  struct serviceDeductions sd;
+  unsigned int targetno;
+  int desired_par;
 
+  get_rpc_procs(&progs, &num_progs);
+  ports_active = ports_finished = 0;
+  SPM = NULL;
 
-  while(rpc_xid_base == (unsigned long) -1)
-    rpc_xid_base = (unsigned long) get_random_uint();
-  
-  if (o.debugging > 1) {
-    log_write(LOG_PLAIN, "Sending RPC probe for program %li to %hu/%s -- scan_offset=%d trynum=%d xid=%lX\n", program, portno, proto2ascii_lowercase(ipproto), scan_offset, trynum, rpc_xid_base + ((portno & 0x3FFF) << 16) + (trynum << 30) +  scan_offset);
-  }
-
-  memset(&sock, 0, sizeof(sock));
-  target_host->TargetSockAddr(&sock, &socklen);
-
-  if (sock.ss_family == AF_INET) {
-    sin = (struct sockaddr_in *) &sock;
-    lastsin = (struct sockaddr_in *) &last_target;
-
-    sin->sin_port = htons(portno);
-  }
-#ifdef HAVE_IPV6
-  else {
-    sin6 = (struct sockaddr_in6 *) &sock;
-    lastsin6 = (struct sockaddr_in6 *) &last_target;
-
-    sin6->sin6_port = htons(portno);
-  }
-#endif
-
-  /* First we check whether we have to create a new connection -- we 
-     need to if we have a new target_host, or a new portno, or the socket
-     we want to use is -1 */
-  if (ipproto == IPPROTO_TCP) {
-    if ((sock.ss_family == AF_INET &&
-         memcmp(sin, lastsin, sizeof(struct sockaddr_in)))
-#ifdef HAVE_IPV6
-     || (sock.ss_family == AF_INET6 &&
-         memcmp(sin6, lastsin6, sizeof(struct sockaddr_in6)))
-#endif
-     || last_ipproto != IPPROTO_TCP) {
-      /* New host or port -- kill our old tcp socket */
-      if (tcp_rpc_socket != -1) {
-        close(tcp_rpc_socket);
-        tcp_rpc_socket = -1;
-        tcp_readlen = 0;
+  min_width = o.min_parallelism ? o.min_parallelism : 1;
+  max_width = MAX(min_width, o.max_parallelism ? o.max_parallelism : 150);
+
+  for (targetno = 0; targetno < Targets.size(); targetno++) {
+    Target *target = Targets[targetno];
+    RPCHost *host = NULL;
+
+    if (target->timedOut(NULL))
+      continue;
+    nxtport = NULL;
+    while ((nxtport = target->ports.nextPort(nxtport, &port, TCPANDUDPANDSCTP, PORT_OPEN))) {
+      /* Only the ports that version detection found to be RPC are ground */
+      if (nxtport->proto != IPPROTO_TCP && nxtport->proto != IPPROTO_UDP)
+        continue;
+      target->ports.getServiceDeductions(nxtport->portno, nxtport->proto, &sd);
+      if (!sd.name || sd.service_tunnel != SERVICE_TUNNEL_NONE ||
+          strcmp(sd.name, "rpcbind") != 0)
+        continue;
+      if (host == NULL) {
+        host = new RPCHost(target);
+        host->numqueries_ideal = box(min_width, max_width, 2);
+        hosts.push_back(host);
       }
+      RPCPort *rp = new RPCPort(host, nxtport->portno, nxtport->proto, num_progs);
+      host->ports_remaining.push_back(rp);
+      ports.push_back(rp);
     }
   }
-  
-  last_target = sock;
-  last_ipproto = ipproto;
-
-  if (ipproto == IPPROTO_TCP && tcp_rpc_socket == -1) {
-    if ((tcp_rpc_socket = socket(sock.ss_family, SOCK_STREAM, IPPROTO_TCP)) == -1)
-      pfatal("Socket troubles in %s", __func__);
-    /* I should unblock the socket here and timeout the connect() */
-    res = connect(tcp_rpc_socket, (struct sockaddr *) &sock, socklen);
-    if (res == -1) {
-      if (o.debugging) {
-	gh_perror("Failed to connect to port %d of %s in %s",
-		  portno, target_host->targetipstr(), __func__);
-      }
-      close(tcp_rpc_socket);
-      tcp_rpc_socket = -1;
-      return -1;
-    }
-    unblock_socket(tcp_rpc_socket);
-  } else if (ipproto == IPPROTO_UDP && udp_rpc_socket == -1) {
-    if ((udp_rpc_socket = socket(sock.ss_family, SOCK_DGRAM, 0)) == -1)
-      pfatal("UDP socket troubles in %s", __func__);
-    unblock_socket(udp_rpc_socket);
+
+  desired_par = 1;
+  if (o.timing_level == 3) desired_par = 20;
+  if (o.timing_level == 4) desired_par = 30;
+  if (o.timing_level >= 5) desired_par = 40;
+  max_active = box(o.min_parallelism, MAX(o.min_parallelism, o.max_parallelism ? o.max_parallelism : 100), desired_par);
+}
+
+RPCGroup::~RPCGroup() {
+  unsigned int i;
+
+  for (i = 0; i < ports.size(); i++)
+    delete ports[i];
+  for (i = 0; i < hosts.size(); i++)
+    delete hosts[i];
+  if (SPM)
+    delete SPM;
+}
+
+
+/* Sends (or resends) the query for program number "idx" to port. */
+static void rpc_send_query(nsock_pool nsp, RPCPort *port, unsigned long idx) {
+  RPCGroup *RG = (RPCGroup *) nsp_getud(nsp);
+  struct rpc_query *q = &port->queries[idx];
+  char rpch_buf[sizeof(u32) + sizeof(struct rpc_hdr)];
+  struct rpc_hdr *rpch;
+  u32 xid;
+
+  while(rpc_xid_base == (unsigned long) -1)
+    rpc_xid_base = (unsigned long) get_random_uint();
+
+  /* Bits are TTPPPPPPPPPPPPPP BBBBBBBBBBBBBBBB */
+  /* Where T are trynum bits, P is the lowest 14 bits of the port number,
+     and B is the program's offset in nmap-rpc */
+  xid = rpc_xid_base + ((port->portno & 0x3FFF) << 16) + (q->trynum << 30) + idx;
+
+  if (o.debugging > 1) {
+    log_write(LOG_PLAIN, "Sending RPC probe for program %li to %s:%hu/%s -- scan_offset=%lu trynum=%d xid=%lX\n", RG->progs[idx], port->host->target->targetipstr(), port->portno, proto2ascii_lowercase(port->proto), idx, q->trynum, (unsigned long) xid);
   }
-  
-  /* OK, now that we have our sockets together, we form and send a
-     query ... */
+
+  rpch = (struct rpc_hdr *) (rpch_buf + sizeof(u32));
+  memset(rpch, 0, sizeof(struct rpc_hdr));
   rpch->type_msg = htonl(RPC_MSG_CALL); /* rpc request                 */
   rpch->version_rpc=htonl(2);           /* portmapper v.2 (hmm, and v3&&4?) */
-  /*rpch->prog_proc=0;*/                    /* proc_null() rpc function     */
-  /*rpch->authcred_flavor=0;*/              /* AUTH_NULL for credentials    */
-  /*rpch->authcred_length=0;*/              /* length of credentials is zero*/
-  /*rpch->authveri_flavor=0;*/              /* no verifiers field          */
-  /*rpch->authveri_length=0;*/              /* zero length verifier field  */
-  
-  /* Bits are TTPPPPPPPPPPPPPP BBBBBBBBBBBBBBBB */
-  /* Where T are trynum bits, P is the lowest 14 bits of the port number,
-     and B is the scan[] offset */
-  rpch->xid = htonl(rpc_xid_base + ((portno & 0x3FFF) << 16) + 
-		    (trynum << 30) +  scan_offset); 
-  rpch->prog_id = htonl(program);
+  /* proc_null() with AUTH_NULL credentials and verifier: all zeros */
+  rpch->xid = htonl(xid);
+  rpch->prog_id = htonl(RG->progs[idx]);
   rpch->prog_ver = htonl(31337 + (rpc_xid_base & 0xFFFFF));
-  
-  if (ipproto == IPPROTO_UDP) {
-    /* Simply send this sucker we have created ... */
-    do {  
-      if (o.debugging > 1)
-	  nmap_hexdump((unsigned char *) rpch, sizeof(struct rpc_hdr));
-      res = sendto(udp_rpc_socket, (char *)rpch, sizeof(struct rpc_hdr), 0,
-		   (struct sockaddr *) &sock, socklen);
-      if (res == -1)
-	err = socket_errno();
-     } while(res == -1 && (err == EINTR || err == ENOBUFS));
-
-
-    if (res == -1) {
-      if (o.debugging) {
-	gh_perror("Sendto in %s", __func__);
-      }
-      close(udp_rpc_socket);
-      udp_rpc_socket = -1;
-      return -1;
-    }
+
+  gettimeofday(&q->sent[q->trynum], NULL);
+  if (port->proto == IPPROTO_UDP) {
+    nsock_write(nsp, port->nsi, rpc_write_handler, RPC_CONNECT_TIMEOUT, port,
+                (char *) rpch, sizeof(struct rpc_hdr));
   } else {
-    /* TCP socket */
     /* 0x80000000 means only 1 record marking */
-    *(u32 *)rpch_buf = htonl(sizeof(struct rpc_hdr) | 0x80000000);
-    res = Send(tcp_rpc_socket, rpch_buf, sizeof(struct rpc_hdr) + sizeof(u32), 0);
-    if (res == -1) {
-      if (o.debugging) {
-	gh_perror("Write in %s", __func__);
+    *(u32 *) rpch_buf = htonl(sizeof(struct rpc_hdr) | 0x80000000);
+    nsock_write(nsp, port->nsi, rpc_write_handler, RPC_CONNECT_TIMEOUT, port,
+                rpch_buf, sizeof(rpch_buf));
+  }
+}
+
+
+/* Fills the window of a host with new queries, taking one from each of
+   its connected ports in turn. */
+static void rpc_send_queries(nsock_pool nsp, RPCHost *host) {
+  RPCGroup *RG = (RPCGroup *) nsp_getud(nsp);
+  unsigned int idle = 0;
+  RPCPort *port;
+
+  while (host->numqueries_outstanding < (int) host->numqueries_ideal &&
+         idle < host->ports_active.size()) {
+    port = host->ports_active.front();
+    host->ports_active.pop_front();
+    host->ports_active.push_back(port);
+    if (!port->connected || port->next_fresh >= RG->num_progs) {
+      idle++;
+      continue;
+    }
+    idle = 0;
+    if (o.scan_delay)
+      enforce_scan_delay(NULL);
+    port->queries[port->next_fresh].state = RPCQ_TESTING;
+    port->testing.push_back(port->next_fresh);
+    host->numqueries_outstanding++;
+    rpc_send_query(nsp, port, port->next_fresh);
+    port->next_fresh++;
+  }
+}
+
+
+/* Starts grinding more ports, as long as the group allows it. The ports
+   are taken from each host in turn, so that all hosts make progress. */
+static void rpc_launch_ports(nsock_pool nsp, RPCGroup *RG) {
+  struct sockaddr_storage ss;
+  size_t ss_len;
+  bool launched = true;
+  unsigned int i;
+
+  while (launched && RG->ports_active < RG->max_active) {
+    launched = false;
+    for (i = 0; i < RG->hosts.size() && RG->ports_active < RG->max_active; i++) {
+      RPCHost *host = RG->hosts[i];
+      RPCPort *port;
+
+      if (host->ports_remaining.empty() ||
+          host->target->timedOut(nsock_gettimeofday()))
+        continue;
+      port = host->ports_remaining.front();
+      host->ports_remaining.pop_front();
+      host->ports_active.push_back(port);
+      RG->ports_active++;
+      launched = true;
+
+      if ((port->nsi = nsi_new(nsp, port)) == NULL)
+        fatal("Failed to allocate Nsock I/O descriptor in %s()", __func__);
+      if (o.debugging)
+        log_write(LOG_STDOUT, "Starting RPC scan of %s:%hu/%s\n", host->target->targetipstr(), port->portno, proto2ascii_lowercase(port->proto));
+      if (o.spoofsource) {
+        o.SourceSockAddr(&ss, &ss_len);
+        nsi_set_localaddr(port->nsi, &ss, ss_len);
       }
-      close(tcp_rpc_socket);
-      tcp_rpc_socket = -1;
-      return -1;
+      if (o.ipoptionslen)
+        nsi_set_ipoptions(port->nsi, o.ipoptions, o.ipoptionslen);
+      host->target->TargetSockAddr(&ss, &ss_len);
+      if (port->proto == IPPROTO_TCP)
+        nsock_connect_tcp(nsp, port->nsi, rpc_connect_handler,
+                          RPC_CONNECT_TIMEOUT, port,
+                          (struct sockaddr *) &ss, ss_len, port->portno);
+      else
+        nsock_connect_udp(nsp, port->nsi, rpc_connect_handler, port,
+                          (struct sockaddr *) &ss, ss_len, port->portno);
     }
   }
-  return 0;
 }
 
-static int rpc_are_we_done(char *msg, int msg_len, Target *target, 
-		    struct portinfo *scan, struct scanstats *ss, 
-		    struct portinfolist *pil, struct rpcscaninfo *rsi) {
 
-  struct rpc_hdr_rcv *rpc_pack;
-  unsigned long scan_offset;
-  int trynum;
-  struct portinfo *current;
+/* Stops grinding a port. Its results are recorded unless the host timed
+   out. */
+static void rpc_end_port(nsock_pool nsp, RPCPort *port) {
+  RPCGroup *RG = (RPCGroup *) nsp_getud(nsp);
+  RPCHost *host = port->host;
+
+  if (port->finished)
+    return;
+  port->finished = true;
 
-  if (rsi->rpc_current_port->state == PORT_OPENFILTERED) {
-    /* Received a packet, so this port is actually open */
-     target->ports.setPortState(rsi->rpc_current_port->portno, 
-			   rsi->rpc_current_port->proto, PORT_OPEN);
+  if (!host->target->timedOut(nsock_gettimeofday())) {
+    host->target->ports.setRPCProbeResults(port->portno, port->proto,
+                                           port->status, port->program,
+                                           port->lowver, port->highver);
   }
+  host->numqueries_outstanding -= port->testing.size();
+  port->testing.clear();
+  if (port->nsi) {
+    nsi_delete(port->nsi, NSOCK_PENDING_SILENT);
+    port->nsi = NULL;
+  }
+  host->ports_active.remove(port);
+  RG->ports_active--;
+  RG->ports_finished++;
+
+  if (host->ports_active.empty() && host->ports_remaining.empty())
+    host->target->stopTimeOutClock(nsock_gettimeofday());
+}
+
+
+/* Returns true once every program has been answered or given up on. */
+static bool rpc_port_exhausted(RPCGroup *RG, RPCPort *port) {
+  return port->next_fresh >= RG->num_progs && port->testing.empty();
+}
 
-  rpc_pack = (struct rpc_hdr_rcv *) msg;     
-  if (msg_len < 24 || msg_len > 32 || (msg_len < 32 && rpc_pack->accept_stat == PROG_MISMATCH)) {
+
+/* Processes one RPC reply received on port. Returns true if we now know
+   enough about the port to stop grinding it. */
+static bool rpc_handle_reply(RPCGroup *RG, RPCPort *port, const char *msg,
+                             int msg_len) {
+  struct rpc_hdr_rcv rpc_pack;
+  RPCHost *host = port->host;
+  Target *target = host->target;
+  unsigned long scan_offset;
+  struct rpc_query *current;
+  struct timeval now;
+  int trynum;
+
+  memset(&rpc_pack, 0, sizeof(rpc_pack));
+  if (msg_len > 0)
+    memcpy(&rpc_pack, msg, MIN((size_t) msg_len, sizeof(rpc_pack)));
+  if (msg_len < 24 || msg_len > 32 || (msg_len < 32 && ntohl(rpc_pack.accept_stat) == PROG_MISMATCH)) {
     /* This is not a valid reply -- we kill the port 
        (from an RPC perspective) */ 
     if (o.debugging > 1) {
       log_write(LOG_PLAIN, "Port %hu/%s labelled NON_RPC because of invalid sized message (%d)\n", 
-		rsi->rpc_current_port->portno, 
-		proto2ascii_uppercase(rsi->rpc_current_port->proto), msg_len);
+                port->portno, proto2ascii_uppercase(port->proto), msg_len);
     }
-    rsi->rpc_status = RPC_STATUS_NOT_RPC;
-    ss->numqueries_outstanding = 0;
-    return 1;
+    port->status = RPC_STATUS_NOT_RPC;
+    return true;
   }
 
   /* Now it is time to decode the scan offset */
-  scan_offset = ntohl(rpc_pack->xid);
+  scan_offset = ntohl(rpc_pack.xid);
   scan_offset -= rpc_xid_base;
-  if (((scan_offset >> 16) & 0x3FFF) != (unsigned long) (rsi->rpc_current_port->portno & 0x3FFF)) {
+  if (((scan_offset >> 16) & 0x3FFF) != (unsigned long) (port->portno & 0x3FFF)) {
     /* Doh -- this doesn't seem right */
     if (o.debugging > 1) {
-      log_write(LOG_PLAIN, "Port %hu/%s labelled NON_RPC because ((scan_offset >> 16) & 0x3FFF) is %li\n", rsi->rpc_current_port->portno, proto2ascii_uppercase(rsi->rpc_current_port->proto), ((scan_offset >> 16) & 0x3FFF));
+      log_write(LOG_PLAIN, "Port %hu/%s labelled NON_RPC because ((scan_offset >> 16) & 0x3FFF) is %li\n", port->portno, proto2ascii_uppercase(port->proto), ((scan_offset >> 16) & 0x3FFF));
     }
-    rsi->rpc_status = RPC_STATUS_NOT_RPC;
-    ss->numqueries_outstanding = 0;
-    return 1;
+    port->status = RPC_STATUS_NOT_RPC;
+    return true;
   }
-  trynum = scan_offset >> 30;
+  trynum = (scan_offset >> 30) & 0x3;
   scan_offset &= 0xFFFF;
-  if (scan_offset >= rsi->rpc_number) {
+  if (scan_offset >= RG->num_progs) {
     error("Invalid scan_offset returned in RPC packet");
-    rsi->rpc_status = RPC_STATUS_NOT_RPC;
-    ss->numqueries_outstanding = 0;
-    return 1;
+    port->status = RPC_STATUS_NOT_RPC;
+    return true;
   }
-  if (ntohl(rpc_pack->type_msg) != RPC_MSG_REPLY) {
-    error("Strange -- RPC type is %lu should be RPC_MSG_REPLY (1)", (unsigned long) ntohl(rpc_pack->type_msg));
-    return 0;
+  if (ntohl(rpc_pack.type_msg) != RPC_MSG_REPLY) {
+    error("Strange -- RPC type is %lu should be RPC_MSG_REPLY (1)", (unsigned long) ntohl(rpc_pack.type_msg));
+    return false;
   }
-  if (ntohl(rpc_pack->auth_flavor) != 0 /* AUTH_NULL */ ||
-      ntohl(rpc_pack->opaque_length != 0)) {
+  if (ntohl(rpc_pack.auth_flavor) != 0 /* AUTH_NULL */ ||
+      ntohl(rpc_pack.opaque_length) != 0) {
     error("Strange -- auth flavor/opaque_length are %lu/%lu should generally be 0/0",
-      (unsigned long) rpc_pack->auth_flavor, (unsigned long) rpc_pack->opaque_length);
-    rsi->rpc_status = RPC_STATUS_NOT_RPC;
-    ss->numqueries_outstanding = 0;
-    return 1;
-  }
-
-  /* OK, now that we know what this is a response to, we delete the
-      appropriate entry from our scanlist */
-  current = &scan[scan_offset];
-   
-  if (current->state != PORT_TESTING && current->state != PORT_CLOSED &&
-      current->state != PORT_FILTERED) {
-    error("Supposed scan_offset refers to port in state %s (should be testing, closed, or filtered)", statenum2str(current->state));
-    rsi->rpc_status = RPC_STATUS_NOT_RPC;
-    ss->numqueries_outstanding = 0;
-    return 1;
-  }
-     
+      (unsigned long) ntohl(rpc_pack.auth_flavor), (unsigned long) ntohl(rpc_pack.opaque_length));
+    port->status = RPC_STATUS_NOT_RPC;
+    return true;
+  }
+
+  current = &port->queries[scan_offset];
+  if (current->state == RPCQ_FRESH) {
+    error("Supposed scan_offset refers to a program we have not queried yet");
+    port->status = RPC_STATUS_NOT_RPC;
+    return true;
+  }
   if (trynum > current->trynum) {
     error("Bogus trynum %d when we are only up to %d in %s", trynum, current->trynum, __func__);
-    rsi->rpc_status = RPC_STATUS_NOT_RPC;
-    ss->numqueries_outstanding = 0;
-    return 1;
-  }
-
-  if (current->next > -1) scan[current->next].prev = current->prev;
-  if (current->prev > -1) scan[current->prev].next = current->next;
-  if (current == pil->testinglist)
-    pil->testinglist = (current->next >= 0)?  &scan[current->next] : NULL;
-  current->next = -1;
-  current->prev = -1;
-     
-     /* Adjust timeouts ... */
+    port->status = RPC_STATUS_NOT_RPC;
+    return true;
+  }
+
+  /* OK, now that we know what this is a response to, we take the query
+     out of the list of those in flight */
+  if (current->state == RPCQ_TESTING) {
+    port->testing.remove(scan_offset);
+    host->numqueries_outstanding--;
+  }
+  current->state = RPCQ_DONE;
+
+  /* Adjust timeouts ... */
   adjust_timeouts(current->sent[trynum], &(target->to));
-     
-  /* If a non-zero trynum finds a port that hasn't been discovered, the
-	earlier packets(s) were probably dropped.  So we decrease our 
-	numqueries_ideal, otherwise we increase it slightly */
+
+  /* If a non-zero trynum finds a program that hasn't been discovered, the
+     earlier packets(s) were probably dropped.  So we shrink the host's
+     window (at most once per timeout period), otherwise we grow it
+     slightly */
   if (trynum == 0) {
-    ss->numqueries_ideal = MIN(ss->numqueries_ideal + (ss->packet_incr/ss->numqueries_ideal), ss->max_width);
-  } else  {
-    if (!ss->alreadydecreasedqueries) {
-      ss->alreadydecreasedqueries = 1;
-      ss->numqueries_ideal *= ss->fallback_percent;
-      if (ss->numqueries_ideal < 1.0) ss->numqueries_ideal = 1.0;
+    host->numqueries_ideal = MIN(host->numqueries_ideal + (RPC_PACKET_INCR/host->numqueries_ideal), RG->max_width);
+  } else {
+    gettimeofday(&now, NULL);
+    if (TIMEVAL_SUBTRACT(now, host->last_decrease) > target->to.timeout) {
+      host->last_decrease = now;
+      host->numqueries_ideal *= RPC_FALLBACK_PERCENT;
+      if (host->numqueries_ideal < RG->min_width) host->numqueries_ideal = RG->min_width;
       if (o.debugging) 
-	{ 
-	  log_write(LOG_STDOUT, "Lost a packet, decreasing window to %d\n", (int) ss->numqueries_ideal);
-	}
+        log_write(LOG_STDOUT, "Lost a packet to %s, decreasing window to %d\n", target->targetipstr(), (int) host->numqueries_ideal);
     }
   }
 
-  if (current->state == PORT_TESTING)
-    ss->numqueries_outstanding--;
-     
-  if (ntohl(rpc_pack->accept_stat) == PROG_UNAVAIL) {
-    current->state = PORT_CLOSED;
+  if (ntohl(rpc_pack.accept_stat) == PROG_UNAVAIL) {
     if (o.debugging > 1) {
       error("Port %hu/%s claims that it is not RPC service %li", 
-	    rsi->rpc_current_port->portno, 
-	    proto2ascii_uppercase(rsi->rpc_current_port->proto),  current->portno);
+            port->portno, proto2ascii_uppercase(port->proto), RG->progs[scan_offset]);
     }
-    rsi->valid_responses_this_port++;
-    return 0;
-  } else if (ntohl(rpc_pack->accept_stat) == PROG_MISMATCH) {
+    port->valid_responses++;
+    return rpc_port_exhausted(RG, port);
+  } else if (ntohl(rpc_pack.accept_stat) == PROG_MISMATCH) {
     if (o.debugging > 1) {
-      error("Port %hu/%s claims IT IS RPC service %li", rsi->rpc_current_port->portno, proto2ascii_uppercase(rsi->rpc_current_port->proto),  current->portno);
+      error("Port %hu/%s claims IT IS RPC service %li", port->portno, proto2ascii_uppercase(port->proto), RG->progs[scan_offset]);
     }
-    current->state = PORT_OPEN;
-    rsi->rpc_status = RPC_STATUS_GOOD_PROG;
-    rsi->rpc_program = current->portno;
-    rsi->rpc_lowver = ntohl(rpc_pack->low_version);
-    rsi->rpc_highver = ntohl(rpc_pack->high_version);
-    rsi->valid_responses_this_port++;
-    ss->numqueries_outstanding = 0;
-    return 1;
-  } else if (ntohl(rpc_pack->accept_stat) == SUCCESS) {
+    port->status = RPC_STATUS_GOOD_PROG;
+    port->program = RG->progs[scan_offset];
+    port->lowver = ntohl(rpc_pack.low_version);
+    port->highver = ntohl(rpc_pack.high_version);
+    port->valid_responses++;
+    return true;
+  } else if (ntohl(rpc_pack.accept_stat) == SUCCESS) {
     error("Umm -- RPC returned success for bogus version -- thats OK I guess");
-    rsi->rpc_status = RPC_STATUS_GOOD_PROG;
-    rsi->rpc_program = current->portno;
-    rsi->rpc_lowver = rsi->rpc_highver = 0;
-    rsi->valid_responses_this_port++;
-    ss->numqueries_outstanding = 0;
-    return 1;
-  } else {
-    fatal("Illegal rpc accept_stat");
+    port->status = RPC_STATUS_GOOD_PROG;
+    port->program = RG->progs[scan_offset];
+    port->lowver = port->highver = 0;
+    port->valid_responses++;
+    return true;
   }
-  return 0;
+
+  error("Illegal rpc accept_stat %lu from %s:%hu", (unsigned long) ntohl(rpc_pack.accept_stat), target->targetipstr(), port->portno);
+  port->status = RPC_STATUS_NOT_RPC;
+  return true;
 }
 
-static unsigned short sockaddr_port(const struct sockaddr_storage *ss) {
-  unsigned short port;
 
-  if (ss->ss_family == AF_INET)
-    port = ((struct sockaddr_in *) ss)->sin_port;
-  else if (ss->ss_family == AF_INET6)
-    port = ((struct sockaddr_in6 *) ss)->sin6_port;
-  else
-    port = 0;
+/* Reads the record mark at buf into reclen. Returns false, and marks the
+   port as not RPC, if the length is not that of a reply to our queries. */
+static bool rpc_record_len(RPCPort *port, const char *buf,
+                           unsigned long *reclen) {
+  u32 mark;
 
-  return ntohs(port);
+  /* I'm ignoring the multiple msg fragment possibility for now */
+  memcpy(&mark, buf, sizeof(mark));
+  *reclen = ntohl(mark) & 0x7FFFFFFF;
+  if (*reclen < 24 || *reclen > 32) {
+    if (o.debugging > 1) {
+      log_write(LOG_PLAIN, "Port %hu/%s labelled NON_RPC because current_msg_len is %li\n", 
+                port->portno, proto2ascii_uppercase(port->proto), *reclen);
+    }
+    port->status = RPC_STATUS_NOT_RPC;
+    return false;
+  }
+  return true;
 }
 
-void get_rpc_results(Target *target, struct portinfo *scan,
-		     struct scanstats *ss, struct portinfolist *pil, 
-                     struct rpcscaninfo *rsi) {
-  int max_sd = -1;
-  fd_set fds_r; 
-  int sres;
-  struct timeval tv;
-  int res;
-  static char readbuf[512];
-  char *current_msg;
-  unsigned long current_msg_len;
-
-  if ((udp_rpc_socket == -1 && tcp_rpc_socket == -1) || ss->numqueries_outstanding <= 0)
-    return;
-
-  FD_ZERO(&fds_r);
+/* Splits the TCP byte stream of a port into RPC records. A single read may
+   hold many pipelined replies, so complete records are handled straight
+   out of buf, and only a trailing partial record is kept in the port's
+   readbuf until the rest of it arrives. Returns true if the port is
+   done. */
+static bool rpc_read_tcp(RPCGroup *RG, RPCPort *port, const char *buf,
+                         int buflen) {
+  unsigned long reclen;
+  size_t n;
+
+  /* First complete the record left over from the previous read */
+  if (port->readlen > 0) {
+    if (port->readlen < RECORD_MARKING) {
+      n = MIN(RECORD_MARKING - port->readlen, (size_t) buflen);
+      memcpy(port->readbuf + port->readlen, buf, n);
+      port->readlen += n;
+      buf += n;
+      buflen -= n;
+      if (port->readlen < RECORD_MARKING)
+        return false;
+    }
+    if (!rpc_record_len(port, port->readbuf, &reclen))
+      return true;
+    n = MIN(RECORD_MARKING + reclen - port->readlen, (size_t) buflen);
+    memcpy(port->readbuf + port->readlen, buf, n);
+    port->readlen += n;
+    buf += n;
+    buflen -= n;
+    if (port->readlen < RECORD_MARKING + reclen)
+      return false;
+    port->readlen = 0;
+    if (rpc_handle_reply(RG, port, port->readbuf + RECORD_MARKING, reclen))
+      return true;
+  }
 
-  if (udp_rpc_socket >= 0 && rsi->rpc_current_port->proto == IPPROTO_UDP) {
-    FD_SET(udp_rpc_socket, &fds_r);
-    max_sd = udp_rpc_socket;
-  } else if (tcp_rpc_socket >= 0 && rsi->rpc_current_port->proto == IPPROTO_TCP) {
-    FD_SET(tcp_rpc_socket, &fds_r);
-    max_sd = tcp_rpc_socket;
-  } else {
-    error("Unable to find listening socket in %s", __func__);
-    return;
+  while ((size_t) buflen >= RECORD_MARKING) {
+    if (!rpc_record_len(port, buf, &reclen))
+      return true;
+    if ((size_t) buflen < RECORD_MARKING + reclen)
+      break;
+    if (rpc_handle_reply(RG, port, buf + RECORD_MARKING, reclen))
+      return true;
+    buf += RECORD_MARKING + reclen;
+    buflen -= RECORD_MARKING + reclen;
   }
 
+  memcpy(port->readbuf, buf, buflen);
+  port->readlen = buflen;
+  return false;
+}
 
-  while (ss->numqueries_outstanding > 0) {
-    /* Insure there is no timeout ... */
-    gettimeofday(&tv, NULL);
-    if (target->timedOut(&tv))
-      return;
 
-    tv.tv_sec = target->to.timeout / 1000000;
-    tv.tv_usec = target->to.timeout % 1000000;
-    sres = select(max_sd + 1, &fds_r, NULL, NULL, &tv);
-    if (!sres)
-      break;
-    if (sres == -1 && socket_errno() == EINTR)
-      continue;
-    if (udp_rpc_socket >= 0 && FD_ISSET(udp_rpc_socket, &fds_r)) {
-      struct sockaddr_storage from;
-      recvfrom6_t fromlen = sizeof(from);
-      unsigned short fromport;
-
-      res = recvfrom(udp_rpc_socket, readbuf, sizeof(readbuf), 0, (struct sockaddr *) &from, &fromlen);
-
-      if (res < 0) {
-        /* Doh! */
-        if (o.debugging || o.verbose)
-          gh_perror("recvfrom in %s", __func__);
-        ss->numqueries_outstanding = 0;
-        rsi->rpc_status = RPC_STATUS_NOT_RPC;
-        return;
-      }
-      fromport = sockaddr_port(&from);
-      if (o.debugging > 1)
-        log_write(LOG_PLAIN, "Received %d byte UDP packet\n", res);
-      /* Now we check that the response is from the expected host/port */
-      if (!sockaddr_storage_equal(&from, target->TargetSockAddr()) ||
-          fromport != rsi->rpc_current_port->portno) {
-        if (o.debugging > 1) {
-          log_write(LOG_PLAIN, "Received UDP packet from %s/%hu", inet_ntop_ez(&from, fromlen), fromport);
-          log_write(LOG_PLAIN, " when expecting packet from %s/%hu\n", target->targetipstr(), rsi->rpc_current_port->portno);
-        }
-        continue;
-      }
+/* Retransmits the queries of a port that timed out, and gives up on those
+   that were already tried RPC_MAX_TRIES times. Returns true if the port is
+   done. */
+static bool rpc_check_timeouts(nsock_pool nsp, RPCPort *port,
+                               const struct timeval *now) {
+  Target *target = port->host->target;
+  std::list<unsigned long>::iterator it;
+  struct rpc_query *q;
 
-      if (rpc_are_we_done(readbuf, res, target, scan, ss, pil, rsi) != 0) {
-        return;
-      }
-    } else if (tcp_rpc_socket >= 0 && FD_ISSET(tcp_rpc_socket, &fds_r)) {
-      do {     
-        res = recv(tcp_rpc_socket, readbuf + tcp_readlen, sizeof(readbuf) - tcp_readlen, 0);
-      } while(res == -1 && socket_errno() == EINTR);
-      if (res <= 0) {
+  for (it = port->testing.begin(); it != port->testing.end();) {
+    q = &port->queries[*it];
+    if (TIMEVAL_SUBTRACT(*now, q->sent[q->trynum]) <= target->to.timeout) {
+      it++;
+      continue;
+    }
+    if (q->trynum >= RPC_MAX_TRIES - 1) {
+      /* No responses !#$!#@$ firewalled? */
+      if (port->valid_responses == 0) {
         if (o.debugging) {
-          if (res == -1)
-            gh_perror("Failed to read() from tcp rpc socket in %s", __func__);
-          else {
-            error("Lamer on port %u closed RPC socket on me in %s", rsi->rpc_current_port->portno, __func__);
-          }
+          log_write(LOG_STDOUT, "RPC Scan giving up on port %hu proto %d due to repeated lack of response\n", port->portno, port->proto);
         }
-        ss->numqueries_outstanding = 0;
-        rsi->rpc_status = RPC_STATUS_NOT_RPC;
-        return;
+        port->status = RPC_STATUS_NOT_RPC;
+        return true;
       }
+      /* I think I am going to slow down a little */
+      target->to.rttvar = MIN(2000000, (int) (target->to.rttvar * 1.2));
+      if (o.debugging > 2) {
+        log_write(LOG_STDOUT, "Giving up on prog %lu of %s:%hu\n", ((RPCGroup *) nsp_getud(nsp))->progs[*it], target->targetipstr(), port->portno);
+      }
+      q->state = RPCQ_DONE;
+      it = port->testing.erase(it);
+      port->host->numqueries_outstanding--;
+      continue;
+    }
+    /* timeout ... we've got to resend */
+    if (o.scan_delay)
+      enforce_scan_delay(NULL);
+    q->trynum++;
+    rpc_send_query(nsp, port, *it);
+    it++;
+  }
+  return false;
+}
 
-      tcp_readlen += res;
 
-      if (tcp_readlen < 28) {
-        /* This is suspiciously small -- I'm assuming this is not the first
-           part of a valid RPC packet */
-        if (o.debugging > 1) {
-          log_write(LOG_PLAIN, "Port %hu/%s labelled NON_RPC because tcp_readlen is %d (should be at least 28)\n", 
-              rsi->rpc_current_port->portno, 
-              proto2ascii_uppercase(rsi->rpc_current_port->proto), 
-              (int) tcp_readlen);
-        }
-        ss->numqueries_outstanding = 0;
-        rsi->rpc_status = RPC_STATUS_NOT_RPC;
-        return;
-      }
-      /* I'm ignoring the multiple msg fragment possibility for now */
-      current_msg_len = ntohl((*(unsigned long *)readbuf)) & 0x7FFFFFFF;
-
-      if (current_msg_len > tcp_readlen - 4) {
-        if (o.debugging > 1) {
-          log_write(LOG_PLAIN, "Port %hu/%s labelled NON_RPC because current_msg_len is %li while tcp_readlen is %d\n",
-              rsi->rpc_current_port->portno, 
-              proto2ascii_uppercase(rsi->rpc_current_port->proto), 
-              current_msg_len, (int) tcp_readlen);
-        }
-        ss->numqueries_outstanding = 0;
-        rsi->rpc_status = RPC_STATUS_NOT_RPC;
-        return;
-      }
-      current_msg = readbuf + 4;
-
-      do {
-        if (rpc_are_we_done(current_msg, current_msg_len, target, scan, ss, 
-              pil, rsi) != 0) 
-          return;
-
-        current_msg += current_msg_len;
-        if ((current_msg - readbuf) + 4UL < tcp_readlen) {       
-          current_msg_len = ntohl(*(unsigned long *) current_msg) & 0x7FFFFFFF;
-          current_msg += 4;
-        } else {
-          if ((unsigned long) (current_msg - readbuf) < tcp_readlen) {
-            tcp_readlen -= current_msg - readbuf;
-            memmove(readbuf, current_msg, tcp_readlen);
-          } else tcp_readlen = 0;
-          break;	   
-        }
+static void rpc_connect_handler(nsock_pool nsp, nsock_event nse, void *mydata) {
+  RPCPort *port = (RPCPort *) mydata;
+  enum nse_status status = nse_status(nse);
 
-        if (current_msg_len < 24 || current_msg_len > 32) {
-          ss->numqueries_outstanding = 0;
-          if (o.debugging > 1) {
-            log_write(LOG_PLAIN, "Port %hu/%s labelled NON_RPC because current_msg_len is %li\n", 
-                rsi->rpc_current_port->portno, 
-                proto2ascii_uppercase(rsi->rpc_current_port->proto), 
-                current_msg_len);
-          }
-          rsi->rpc_status = RPC_STATUS_NOT_RPC;
-          return;
-        }
+  if (port->finished)
+    return;
+  if (status == NSE_STATUS_SUCCESS) {
+    port->connected = true;
+    nsock_read(nsp, port->nsi, rpc_read_handler, -1, port);
+    rpc_send_queries(nsp, port->host);
+  } else {
+    if (o.debugging)
+      error("Failed to connect to port %hu of %s for RPC scan: %s", port->portno, port->host->target->targetipstr(), nse_status2str(status));
+    port->status = RPC_STATUS_NOT_RPC;
+    rpc_end_port(nsp, port);
+  }
+}
 
-        if ((current_msg - readbuf) + current_msg_len > tcp_readlen) {
-          tcp_readlen -= current_msg - readbuf;
-          memmove(readbuf +4 , current_msg, tcp_readlen);
-          *(unsigned long *)&readbuf = htonl(current_msg_len);
-          tcp_readlen += 4;
-          break;
-        }
-      } while(1);
+
+static void rpc_write_handler(nsock_pool nsp, nsock_event nse, void *mydata) {
+  RPCPort *port = (RPCPort *) mydata;
+  enum nse_status status = nse_status(nse);
+
+  if (port->finished || status == NSE_STATUS_SUCCESS)
+    return;
+  if (o.debugging)
+    error("Failed to send RPC query to port %hu of %s: %s", port->portno, port->host->target->targetipstr(), nse_status2str(status));
+  port->status = RPC_STATUS_NOT_RPC;
+  rpc_end_port(nsp, port);
+}
+
+
+static void rpc_read_handler(nsock_pool nsp, nsock_event nse, void *mydata) {
+  RPCPort *port = (RPCPort *) mydata;
+  RPCGroup *RG = (RPCGroup *) nsp_getud(nsp);
+  enum nse_status status = nse_status(nse);
+  RPCHost *host = port->host;
+  bool done;
+  char *buf;
+  int buflen;
+
+  if (port->finished)
+    return;
+  if (status != NSE_STATUS_SUCCESS) {
+    if (o.debugging) {
+      if (status == NSE_STATUS_EOF)
+        error("Lamer on port %u closed RPC socket on me in %s", port->portno, __func__);
+      else
+        error("Failed to read from RPC port %hu of %s: %s", port->portno, host->target->targetipstr(), nse_status2str(status));
     }
+    port->status = RPC_STATUS_NOT_RPC;
+    rpc_end_port(nsp, port);
+    return;
   }
-  return;
-}
 
+  buf = nse_readbuf(nse, &buflen);
+  if (port->proto == IPPROTO_UDP) {
+    if (o.debugging > 1)
+      log_write(LOG_PLAIN, "Received %d byte UDP packet\n", buflen);
+    done = rpc_handle_reply(RG, port, buf, buflen);
+  } else {
+    done = rpc_read_tcp(RG, port, buf, buflen);
+  }
 
-void close_rpc_query_sockets() {
-  if (udp_rpc_socket != -1) {
-    close(udp_rpc_socket);
-    udp_rpc_socket = -1;
+  if (done) {
+    rpc_end_port(nsp, port);
+    rpc_launch_ports(nsp, RG);
+  } else {
+    nsock_read(nsp, port->nsi, rpc_read_handler, -1, port);
+    rpc_send_queries(nsp, host);
   }
+}
 
-  if (tcp_rpc_socket != -1) {
-    close(tcp_rpc_socket);
-    tcp_rpc_socket = -1;
+
+/* Runs every RPC_TICK_MSECS while there is work left: handles timeouts
+   and retransmissions, starts new ports and reports progress. */
+static void rpc_timer_handler(nsock_pool nsp, nsock_event nse, void *mydata) {
+  RPCGroup *RG = (RPCGroup *) nsp_getud(nsp);
+  struct timeval now;
+  unsigned int i;
+  bool work_left = false;
+
+  gettimeofday(&now, NULL);
+  for (i = 0; i < RG->hosts.size(); i++) {
+    RPCHost *host = RG->hosts[i];
+    std::list<RPCPort *> active(host->ports_active);
+    std::list<RPCPort *>::iterator it;
+
+    if (host->target->timedOut(&now)) {
+      /* Abandon whatever is left of this host */
+      for (it = active.begin(); it != active.end(); it++)
+        rpc_end_port(nsp, *it);
+      RG->ports_finished += host->ports_remaining.size();
+      host->ports_remaining.clear();
+      continue;
+    }
+    for (it = active.begin(); it != active.end(); it++) {
+      if ((*it)->connected &&
+          (rpc_check_timeouts(nsp, *it, &now) || rpc_port_exhausted(RG, *it)))
+        rpc_end_port(nsp, *it);
+    }
+    rpc_send_queries(nsp, host);
   }
+  rpc_launch_ports(nsp, RG);
+
+  for (i = 0; i < RG->hosts.size() && !work_left; i++)
+    work_left = !RG->hosts[i]->ports_active.empty() || !RG->hosts[i]->ports_remaining.empty();
+  if (work_left)
+    nsock_timer_create(nsp, rpc_timer_handler, RPC_TICK_MSECS, NULL);
+
+  if (RG->SPM->mayBePrinted(&now))
+    RG->SPM->printStatsIfNecessary((double) RG->ports_finished / RG->ports.size(), &now);
 }
 
+
+/* Grinds the rpcbind ports of all the Targets for RPC program numbers,
+   and records the results in their port lists. */
+void rpc_scan(std::vector<Target *> &Targets) {
+  RPCGroup *RG;
+  nsock_pool nsp;
+  enum nsock_loopstatus looprc;
+  struct timeval now;
+  unsigned int i;
+
+  o.current_scantype = RPC_SCAN;
+  RG = new RPCGroup(Targets);
+  if (RG->ports.empty()) {
+    delete RG;
+    return;
+  }
+
+  gettimeofday(&now, NULL);
+  for (i = 0; i < RG->hosts.size(); i++)
+    RG->hosts[i]->target->startTimeOutClock(&now);
+
+  if (o.debugging)
+    log_write(LOG_STDOUT, "Starting RPC scan of %u %s on %u %s\n",
+              (unsigned int) RG->ports.size(), RG->ports.size() == 1 ? "port" : "ports",
+              (unsigned int) RG->hosts.size(), RG->hosts.size() == 1 ? "host" : "hosts");
+  RG->SPM = new ScanProgressMeter(scantype2str(RPC_SCAN));
+
+  if ((nsp = nsp_new(RG)) == NULL)
+    fatal("%s() failed to create new nsock pool.", __func__);
+
+  rpc_launch_ports(nsp, RG);
+  nsock_timer_create(nsp, rpc_timer_handler, RPC_TICK_MSECS, NULL);
+
+  looprc = nsock_loop(nsp, -1);
+  if (looprc == NSOCK_LOOP_ERROR) {
+    int err = nsp_geterrorcode(nsp);
+    fatal("Unexpected nsock_loop error.  Error code %d (%s)", err, strerror(err));
+  }
+  nsp_delete(nsp);
+
+  if (o.verbose) {
+    char additional_info[64];
+    Snprintf(additional_info, sizeof(additional_info), "%u %s on %u %s",
+             (unsigned int) RG->ports.size(), RG->ports.size() == 1 ? "port" : "ports",
+             (unsigned int) RG->hosts.size(), RG->hosts.size() == 1 ? "host" : "hosts");
+    RG->SPM->endTask(NULL, additional_info);
+  }
+  delete RG;
+}
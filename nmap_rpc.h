@@ -2,8 +2,8 @@
 /***************************************************************************
  * nmap_rpc.h -- Functions related to the RPCGrind facility of Nmap.       *
  * This includes reading the nmap-rpc services file and sending rpc        *
- * queries and interpreting responses.  The actual scan engine used for    *
- * rpc grinding is pos_scan (which is not in this file)                    *
+ * queries and interpreting responses, with an nsock-based engine that     *
+ * grinds the RPC ports of a whole host group concurrently.                *
  *                                                                         *
  ***********************IMPORTANT NMAP LICENSE TERMS************************
  *                                                                         *
@@ -102,6 +102,10 @@
 #include "global_structures.h"
 #include "portlist.h"
 
+#include <vector>
+
+class Target;
+
 /* rpc related #define's */
 #define RECORD_MARKING 4        /* length of recoder marking (bytes)     */
 
@@ -149,34 +153,22 @@ struct rpc_info {
   int num_alloc;
 };
 
-struct rpcscaninfo {
-  const Port *rpc_current_port;
-  unsigned long *rpc_progs;
-  unsigned long rpc_number;
-  int valid_responses_this_port; /* Number of valid (RPC wise) responses we
-				    have received on this particular port */
+/* Results of grinding a port, as passed to PortList::setRPCProbeResults() */
 #define RPC_STATUS_UNTESTED 0
 #define RPC_STATUS_UNKNOWN 1   /* Don't know yet */
-#define RPC_STATUS_GOOD_PROG 2 /* the prog # specified in rpc_status_info and
-                                  the version info is
-				  valid for the rpc_current_port */
+#define RPC_STATUS_GOOD_PROG 2 /* The program number and version info are
+                                  valid for the port */
 #define RPC_STATUS_NOT_RPC 4   /* This doesn't even seem to be an RPC port */
-  int rpc_status;
-  unsigned long rpc_program;
-  unsigned long rpc_lowver; /* Lowest version number of program supported */
-  unsigned long rpc_highver; /* Highest version supported */
-};
 
 
+class DataTable;
+
+int rpc_parse_file(const char *filename, DataTable *table);
 int get_rpc_procs(unsigned long **programs, unsigned long *num_programs);
 char *nmap_getrpcnamebynum(unsigned long num);
-int send_rpc_query(Target *target_host, unsigned short portno,
-		   int ipproto, unsigned long program, int scan_offset, 
-		   int trynum);
-void get_rpc_results(Target *target, struct portinfo *scan,
-		     struct scanstats *ss, struct portinfolist *pil, 
-		     struct rpcscaninfo *rsi);
-void close_rpc_query_sockets();
+
+/* Grinds the open rpcbind ports of all the Targets concurrently */
+void rpc_scan(std::vector<Target *> &Targets);
 
 #endif /* NMAP_RPC_H */
 
@@ -258,6 +258,9 @@ char errstr[256];
   /* Timing and performance */
   {"delay", required_argument, 0, 0},
   {"rate", required_argument, 0, 0},
+  {"generator", no_argument, 0, 0},
+  {"stats-file", required_argument, 0, 0},
+  {"stats-interval", required_argument, 0, 0},
   {"host-timeout", required_argument, 0, 0},
 
   /* Misc */
@@ -921,12 +924,14 @@ char errstr[256];
         if (l >= 10 * 1000 && tval_unit(optarg) == NULL)
             outFatal(QT_3,"Since April 2010, the default unit for --delay is seconds, so your time of \"%s\" is %g seconds. Use \"%sms\" for %g milliseconds.", optarg, l / 1000.0, optarg, l / 1000.0);
         o.setDelay(l);
+        o.setRate(0);
     /* Tx rate */
     } else if (optcmp(long_options[option_index].name, "rate") == 0 ){
         if (parse_u32(optarg, &aux32)==OP_SUCCESS){
             if(aux32==0){
                 outFatal(QT_3,"Invalid rate supplied. Rate can never be zero.");
             }else{
+                o.setRate(aux32);
                 /* Compute delay from rate: delay= 1000ms/rate*/
                 aux32 = 1000 / aux32;
                 o.setDelay(aux32);
@@ -934,6 +939,17 @@ char errstr[256];
         }else{
             outFatal(QT_3,"Invalid rate supplied. Rate must be a valid, positive integer");
         }
+    /* Generator mode */
+    } else if (optcmp(long_options[option_index].name, "generator") == 0 ){
+        o.setGenerator(true);
+    /* Machine-readable RTT statistics */
+    } else if (optcmp(long_options[option_index].name, "stats-file") == 0 ){
+        if( o.setStatsFile(optarg)!=OP_SUCCESS )
+            outFatal(QT_3,"Invalid stats file name supplied.");
+    } else if (optcmp(long_options[option_index].name, "stats-interval") == 0 ){
+        if ( (l= tval2msecs(optarg)) <= 0 )
+            outFatal(QT_3,"Invalid stats interval supplied. Interval must be a valid, positive integer or floating point number.");
+        o.setStatsInterval(l);
     /* Host timeout */
     } else if (optcmp(long_options[option_index].name, "host-timeout") == 0 ){
         l = tval2msecs(optarg);
@@ -1298,6 +1314,9 @@ void ArgParser::printUsage(void){
 "  's' (seconds), 'm' (minutes), or 'h' (hours) to the value (e.g. 30m, 0.25h).\n"
 "  --delay <time>                   : Adjust delay between probes.\n"
 "  --rate  <rate>                   : Send num packets per second.\n"
+"  --generator                      : Send prebuilt packets in a tight loop.\n"
+"  --stats-file <file>              : Periodically write RTT stats to <file>.\n"
+"  --stats-interval <time>          : Time between two stats file updates.\n"
 //"  --host-timeout <time>            : Give up on target after this long.\n"
 "MISC:\n"
 "  -h, --help                       : Display help information.\n"
@@ -95,6 +95,7 @@
 #include "EchoHeader.h"
 #include "NEPContext.h"
 #include <vector>
+#include <algorithm>
 #include "nsock.h"
 #include "output.h"
 #include "NpingOps.h"
@@ -117,6 +118,10 @@ EchoServer::~EchoServer() {
 void EchoServer::reset() {
   this->client_ctx.clear();
   this->client_id_count=-1;
+  for(int i=0; i<=MAX_CLIENT_ID; i++)
+    this->client_pos[i]=-1;
+  for(int i=0; i<SPEC_INDEX_SIZE; i++)
+    this->spec_index[i].clear();
 } /* End of reset() */
 
 
@@ -124,6 +129,8 @@ void EchoServer::reset() {
 int EchoServer::addClientContext(NEPContext ctx){
   outPrint(DBG_4, "%s(ctx->id=%d)", __func__, ctx.getIdentifier());
   this->client_ctx.push_back(ctx);
+  if(ctx.getIdentifier()>=0 && ctx.getIdentifier()<=MAX_CLIENT_ID)
+    this->client_pos[ctx.getIdentifier()]=this->client_ctx.size()-1;
   return OP_SUCCESS;
 } /* End of addClientContext() */
 
@@ -133,11 +140,12 @@ int EchoServer::addClientContext(NEPContext ctx){
   * returned when no context could be found.  */
 NEPContext *EchoServer::getClientContext(clientid_t clnt){
   outPrint(DBG_4, "%s(%d) %lu", __func__, clnt, (unsigned long)this->client_ctx.size());
-  for(unsigned int i=0; i<this->client_ctx.size(); i++){
-    if(this->client_ctx[i].getIdentifier() == clnt ){
-        outPrint(DBG_3, "Found client with ID #%d at p%d. Total clients %lu", clnt, i, (unsigned long)this->client_ctx.size());
-        return &(this->client_ctx[i]);
-    }
+  int i=-1;
+  if(clnt>=0 && clnt<=MAX_CLIENT_ID)
+    i=this->client_pos[clnt];
+  if(i>=0 && i<(int)this->client_ctx.size() && this->client_ctx[i].getIdentifier() == clnt ){
+    outPrint(DBG_3, "Found client with ID #%d at p%d. Total clients %lu", clnt, i, (unsigned long)this->client_ctx.size());
+    return &(this->client_ctx[i]);
   }
   outPrint(DBG_3, "No client with ID #%d was found. Total clients %lu", clnt, (unsigned long)this->client_ctx.size());
   return NULL;
@@ -161,17 +169,19 @@ NEPContext *EchoServer::getClientContext(nsock_iod iod){
   * OP_SUCCESS if the context object was successfully deleted or OP_FAILURE if
   * the context could not be found.  */
 int EchoServer::destroyClientContext(clientid_t clnt){
-  bool deleted=false;
-  vector<NEPContext>::iterator it;
-  /* Iterate through the context array and delete the one that belongs to clnt */
-  for ( it=this->client_ctx.begin(); it<this->client_ctx.end(); it++){
-      if(it->getIdentifier()==clnt){
-        this->client_ctx.erase(it);
-        deleted=true;
-        break;
-      }
-  }
-  return (deleted) ? OP_SUCCESS : OP_FAILURE;
+  NEPContext *ctx=NULL;
+  int pos=0;
+  if( (ctx=this->getClientContext(clnt))==NULL )
+    return OP_FAILURE;
+  /* Remove the client from the spec index and delete its context. Clients
+   * stored after it move one position down so update their positions. */
+  this->unindexClientSpecs(ctx);
+  pos=this->client_pos[clnt];
+  this->client_ctx.erase(this->client_ctx.begin()+pos);
+  this->client_pos[clnt]=-1;
+  for(unsigned int i=pos; i<this->client_ctx.size(); i++)
+    this->client_pos[this->client_ctx[i].getIdentifier()]=i;
+  return OP_SUCCESS;
 } /* End of destroyClientContext() */
 
 
@@ -200,7 +210,7 @@ nsock_iod EchoServer::getClientNsockIOD(clientid_t clnt){
   * number conflicts with an active session ;-) */
 clientid_t EchoServer::getNewClientID(){
   outPrint(DBG_4, "%s()", __func__);
-  if(this->client_id_count==0xFFFF)  /* Wrap back to zero. */
+  if(this->client_id_count==MAX_CLIENT_ID)  /* Wrap back to zero. */
       this->client_id_count=0;
   else
     this->client_id_count++;
@@ -208,6 +218,116 @@ clientid_t EchoServer::getNewClientID(){
 } /* End of getNewClientID() */
 
 
+/** Returns true for the field specs that are stored in the spec index. Only
+  * fields that are likely to take a different value for each client are
+  * indexed: IP IDs, flow labels, ports, sequence numbers and payload magic. */
+static bool spec_is_indexed(u8 field){
+  switch(field){
+    case PSPEC_IPv4_ID:
+    case PSPEC_IPv6_FLOW:
+    case PSPEC_TCP_SPORT:
+    case PSPEC_TCP_DPORT:
+    case PSPEC_TCP_SEQ:
+    case PSPEC_TCP_ACK:
+    case PSPEC_UDP_SPORT:
+    case PSPEC_UDP_DPORT:
+    case PSPEC_PAYLOAD_MAGIC:
+        return true;
+    default:
+        return false;
+  }
+} /* End of spec_is_indexed() */
+
+
+/** Returns the number of bytes of a field spec value that nep_match_headers()
+  * compares for the supplied field. */
+static u8 spec_key_len(u8 field, u8 len){
+  switch(field){
+    case PSPEC_IPv6_FLOW:
+    case PSPEC_TCP_SEQ:
+    case PSPEC_TCP_ACK:
+        return 4;
+    case PSPEC_PAYLOAD_MAGIC:
+        return MIN(4, len);
+    default:
+        return 2;
+  }
+} /* End of spec_key_len() */
+
+
+/** Interprets the first "len" bytes (at most four) of "val" as a big-endian
+  * number. */
+static u32 spec_key(const u8 *val, u8 len){
+  u32 key=0;
+  for(int i=0; i<len && i<4; i++)
+    key=(key<<8) | val[i];
+  return key;
+} /* End of spec_key() */
+
+
+/** Returns the spec index bucket for the supplied field and key. */
+static int spec_bucket(u8 field, u8 len, u32 key){
+  return (key*2654435761u + field*40503u + len) % SPEC_INDEX_SIZE;
+} /* End of spec_bucket() */
+
+
+/** Adds the discriminating field specs of a client to the spec index so
+  * nep_match_headers() only has to score the clients that share at least one
+  * of those values with a captured packet. Only payload magic values use a
+  * non-zero entry length, since they are matched by prefix. */
+int EchoServer::indexClientSpecs(NEPContext *ctx){
+  spec_index_entry_t e;
+  fspec_t *fspec=NULL;
+  for(int k=0; (fspec=ctx->getClientFieldSpec(k))!=NULL; k++){
+    if( !spec_is_indexed(fspec->field) )
+        continue;
+    if( fspec->field==PSPEC_PAYLOAD_MAGIC && fspec->len==0 )
+        continue;
+    e.field=fspec->field;
+    e.key=spec_key(fspec->value, spec_key_len(fspec->field, fspec->len));
+    e.len=(fspec->field==PSPEC_PAYLOAD_MAGIC) ? spec_key_len(fspec->field, fspec->len) : 0;
+    e.clnt=ctx->getIdentifier();
+    this->spec_index[spec_bucket(e.field, e.len, e.key)].push_back(e);
+  }
+  return OP_SUCCESS;
+} /* End of indexClientSpecs() */
+
+
+/** Removes all spec index entries that belong to the supplied client. */
+int EchoServer::unindexClientSpecs(NEPContext *ctx){
+  fspec_t *fspec=NULL;
+  u8 len=0;
+  u32 key=0;
+  vector<spec_index_entry_t> *bucket=NULL;
+  for(int k=0; (fspec=ctx->getClientFieldSpec(k))!=NULL; k++){
+    if( !spec_is_indexed(fspec->field) )
+        continue;
+    key=spec_key(fspec->value, spec_key_len(fspec->field, fspec->len));
+    len=(fspec->field==PSPEC_PAYLOAD_MAGIC) ? spec_key_len(fspec->field, fspec->len) : 0;
+    bucket=&this->spec_index[spec_bucket(fspec->field, len, key)];
+    for(unsigned int i=0; i<bucket->size(); i++){
+        if( (*bucket)[i].clnt==ctx->getIdentifier() && (*bucket)[i].field==fspec->field ){
+            bucket->erase(bucket->begin()+i);
+            break;
+        }
+    }
+  }
+  return OP_SUCCESS;
+} /* End of unindexClientSpecs() */
+
+
+/** Appends to "clients" the identifier of every client that supplied a spec
+  * for "field" whose key matches the supplied one. */
+int EchoServer::lookupSpecIndex(u8 field, u8 len, u32 key, vector<clientid_t> *clients){
+  vector<spec_index_entry_t> *bucket=&this->spec_index[spec_bucket(field, len, key)];
+  for(unsigned int i=0; i<bucket->size(); i++){
+    if( (*bucket)[i].field==field && (*bucket)[i].len==len && (*bucket)[i].key==key )
+        clients->push_back( (*bucket)[i].clnt );
+  }
+  return OP_SUCCESS;
+} /* End of lookupSpecIndex() */
+
+
 /** Returns a socket suitable to be passed to accept() */
 int EchoServer::nep_listen_socket(){
   outPrint(DBG_4, "%s()", __func__);
@@ -336,6 +456,15 @@ int EchoServer::nep_listen_socket(){
 #define MIN_ACCEPTABLE_SCORE_UDP  8.0
 #define MIN_ACCEPTABLE_SCORE_ICMP 6.0
 
+/* Highest score a client can get from the fields that are not in the spec
+ * index. As long as these stay below the minimum acceptable scores, a client
+ * that does not share any indexed value with a packet can never match it. */
+#define UNINDEXED_SCORE_IPv4 (1*FACTOR_IPv4_TOS + 1*FACTOR_IPv4_PROTO + 2*FACTOR_IPv4_FRAGOFF)
+#define UNINDEXED_SCORE_IPv6 (1*FACTOR_IPv6_TCLASS + 1*FACTOR_IPv6_NHDR)
+#define UNINDEXED_SCORE_TCP  (1*FACTOR_TCP_FLAGS + 2*FACTOR_TCP_WIN + 2*FACTOR_TCP_URP)
+#define UNINDEXED_SCORE_UDP  (2*FACTOR_UDP_LEN)
+#define UNINDEXED_SCORE_ICMP (1*FACTOR_ICMP_TYPE + 1*FACTOR_ICMP_CODE)
+
 clientid_t EchoServer::nep_match_headers(IPv4Header *ip4, IPv6Header *ip6, TCPHeader *tcp, UDPHeader *udp, ICMPv4Header *icmp4, RawData *payload){
   outPrint(DBG_4, "%s(%p,%p,%p,%p,%p,%p)", __func__, ip4, ip6, tcp, udp, icmp4, payload);
     unsigned int i=0, k=0;
@@ -346,12 +475,67 @@ clientid_t EchoServer::nep_match_headers(IPv4Header *ip4, IPv6Header *ip6, TCPHe
     float current_score=0;
     float candidate_score=-1;
     float minimum_score=0;
+    float unindexed_score=0;
     clientid_t candidate=-1;
+    vector<clientid_t> ids;
+    vector<NEPContext *> clients;
 
-    /* Iterate through the list of connected clients */
-    for(i=0; i<this->client_ctx.size(); i++ ){
+    if( tcp!=NULL )
+        minimum_score=MIN_ACCEPTABLE_SCORE_TCP;
+    else if (udp!=NULL)
+        minimum_score=MIN_ACCEPTABLE_SCORE_UDP;
+    else if(icmp4!=NULL)
+        minimum_score=MIN_ACCEPTABLE_SCORE_ICMP;
+    else
+        minimum_score=10000;
+
+    if(ip4!=NULL) unindexed_score+=UNINDEXED_SCORE_IPv4;
+    if(ip6!=NULL) unindexed_score+=UNINDEXED_SCORE_IPv6;
+    if(tcp!=NULL) unindexed_score+=UNINDEXED_SCORE_TCP;
+    if(udp!=NULL) unindexed_score+=UNINDEXED_SCORE_UDP;
+    if(icmp4!=NULL) unindexed_score+=UNINDEXED_SCORE_ICMP;
+
+    /* Determine which clients need to be scored. Normally these are just the
+     * ones that share an IP ID, flow label, port, sequence number or payload
+     * magic with the packet, which we get from the spec index. If the
+     * packet carries enough unindexed fields to reach the minimum score on its
+     * own (e.g. IPv4 and IPv6 headers together), we try every client. */
+    if( unindexed_score >= minimum_score ){
+        for(i=0; i<this->client_ctx.size(); i++ )
+            clients.push_back( &(this->client_ctx[i]) );
+    }else{
+        if(ip4!=NULL)
+            this->lookupSpecIndex(PSPEC_IPv4_ID, 0, ip4->getIdentification(), &ids);
+        if(ip6!=NULL)
+            this->lookupSpecIndex(PSPEC_IPv6_FLOW, 0, ip6->getFlowLabel(), &ids);
+        if(tcp!=NULL){
+            this->lookupSpecIndex(PSPEC_TCP_SPORT, 0, tcp->getSourcePort(), &ids);
+            this->lookupSpecIndex(PSPEC_TCP_DPORT, 0, tcp->getDestinationPort(), &ids);
+            this->lookupSpecIndex(PSPEC_TCP_SEQ, 0, tcp->getSeq(), &ids);
+            this->lookupSpecIndex(PSPEC_TCP_ACK, 0, tcp->getAck(), &ids);
+        }
+        if(udp!=NULL){
+            this->lookupSpecIndex(PSPEC_UDP_SPORT, 0, udp->getSourcePort(), &ids);
+            this->lookupSpecIndex(PSPEC_UDP_DPORT, 0, udp->getDestinationPort(), &ids);
+        }
+        if(payload!=NULL && (buff=payload->getBinaryBuffer(&bufflen))!=NULL){
+            for(k=1; k<=4 && (int)k<=bufflen; k++)
+                this->lookupSpecIndex(PSPEC_PAYLOAD_MAGIC, k, spec_key(buff, k), &ids);
+        }
+        sort(ids.begin(), ids.end());
+        ids.erase(unique(ids.begin(), ids.end()), ids.end());
+        for(i=0; i<ids.size(); i++){
+            if( (ctx=this->getClientContext(ids[i]))!=NULL )
+                clients.push_back(ctx);
+        }
+        /* Score them in connection order, like a full scan would */
+        sort(clients.begin(), clients.end());
+    }
+
+    /* Iterate through the list of candidate clients */
+    for(i=0; i<clients.size(); i++ ){
         current_score=0;
-        ctx=&(this->client_ctx[i]);
+        ctx=clients[i];
         outPrint(DBG_2, "%s() Trying to match packet against client #%d", __func__, ctx->getIdentifier());
         if( ctx->ready() ){
             /* Iterate through client's list of packet field specifiers */
@@ -545,15 +729,6 @@ clientid_t EchoServer::nep_match_headers(IPv4Header *ip4, IPv6Header *ip6, TCPHe
         }
     } /* End of connected clients loop */
 
-    if( tcp!=NULL )
-        minimum_score=MIN_ACCEPTABLE_SCORE_TCP;
-    else if (udp!=NULL)
-        minimum_score=MIN_ACCEPTABLE_SCORE_UDP;
-    else if(icmp4!=NULL)
-        minimum_score=MIN_ACCEPTABLE_SCORE_ICMP;
-    else
-        minimum_score=10000;
-        
     /* Check if we managed to match packet and client */
     if (candidate>=0 && candidate_score>=minimum_score){
         outPrint(DBG_2, "%s() Packet matched successfully with client #%d", __func__, candidate);
@@ -1017,6 +1192,7 @@ int EchoServer::nep_packetspec_handler(nsock_pool nsp, nsock_event nse, void *pa
       return OP_FAILURE;
   }
   ctx->setState(STATE_READY_SENT);
+  this->indexClientSpecs(ctx);
   outPrint(VB_1, "[%lu] NEP handshake with client #%d (%s:%d) was performed successfully", (unsigned long)time(NULL), ctx->getIdentifier(), IPtoa(ctx->getAddress()), sockaddr2port(ctx->getAddress()));
 
   /* Craft response and send it */
@@ -103,12 +103,30 @@ using namespace std;
 
 #define LISTEN_QUEUE_SIZE 10
 
+/* Client identifiers wrap back to zero after this value */
+#define MAX_CLIENT_ID 0xFFFF
+
+/* Number of buckets in the field spec index */
+#define SPEC_INDEX_SIZE 4096
+
+/* An entry of the field spec index. It records that client "clnt" supplied
+ * a spec for header field "field" whose value (or, for payload magic, its
+ * first "len" bytes, at most four) is "key". */
+typedef struct spec_index_entry{
+    u8 field;
+    u8 len;
+    u32 key;
+    clientid_t clnt;
+}spec_index_entry_t;
+
 class EchoServer  {
 
     private:
         /* Attributes */
         vector<NEPContext> client_ctx;
         clientid_t client_id_count;
+        int client_pos[MAX_CLIENT_ID+1];   /**< Client ID -> client_ctx index */
+        vector<spec_index_entry_t> spec_index[SPEC_INDEX_SIZE];
 
         /* Methods */
         int nep_listen_socket();
@@ -118,6 +136,9 @@ class EchoServer  {
         int destroyClientContext(clientid_t clnt);
         nsock_iod getClientNsockIOD(clientid_t clnt);
         clientid_t getNewClientID();
+        int indexClientSpecs(NEPContext *ctx);
+        int unindexClientSpecs(NEPContext *ctx);
+        int lookupSpecIndex(u8 field, u8 len, u32 key, vector<clientid_t> *clients);
         clientid_t nep_match_packet(const u8 *pkt, size_t pktlen);
         clientid_t nep_match_headers(IPv4Header *ip4, IPv6Header *ip6, TCPHeader *tcp, UDPHeader *udp, ICMPv4Header *icmp4, RawData *payload);
         int parse_hs_client(u8 *pkt, size_t pktlen, NEPContext *ctx);
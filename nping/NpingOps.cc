@@ -144,6 +144,19 @@ NpingOps::NpingOps() {
     delay=0;
     delay_set=false;
 
+    rate=0;
+    rate_set=false;
+
+    generator_mode=false;
+    generator_mode_set=false;
+
+    stats_file=NULL;
+    stats_file_set=false;
+    stats_fd=NULL;
+
+    stats_interval=0;
+    stats_interval_set=false;
+
     memset(device, 0, MAX_DEV_LEN);
     device_set=false;
 
@@ -784,6 +797,100 @@ bool NpingOps::issetDelay(){
 } /* End of issetDelay() */
 
 
+/** Sets the transmission rate in packets per second. This is only kept so
+ *  generator mode can pace at rates above 1000 pps, which cannot be
+ *  expressed as a delay in milliseconds. Zero means the rate should be
+ *  derived from the inter-probe delay.
+ *  @return OP_SUCCESS on success and OP_FAILURE in case of error.           */
+int NpingOps::setRate(u32 pps){
+  this->rate=pps;
+  this->rate_set=true;
+  return OP_SUCCESS;
+} /* End of setRate() */
+
+
+/** Returns value of attribute rate */
+u32 NpingOps::getRate(){
+  return this->rate;
+} /* End of getRate() */
+
+
+/* Returns true if option has been set */
+bool NpingOps::issetRate(){
+  return this->rate_set;
+} /* End of issetRate() */
+
+
+/** Sets generator mode. In generator mode, packets are built once per
+ *  target and port and then retransmitted in a tight loop.
+ *  @return OP_SUCCESS on success and OP_FAILURE in case of error.           */
+int NpingOps::setGenerator(bool val){
+  this->generator_mode=val;
+  this->generator_mode_set=true;
+  return OP_SUCCESS;
+} /* End of setGenerator() */
+
+
+/** Returns value of attribute generator_mode */
+bool NpingOps::generator(){
+  return this->generator_mode;
+} /* End of generator() */
+
+
+/* Returns true if option has been set */
+bool NpingOps::issetGenerator(){
+  return this->generator_mode_set;
+} /* End of issetGenerator() */
+
+
+/** Sets the name of the file where machine-readable RTT statistics are
+ *  periodically written.
+ *  @return OP_SUCCESS on success and OP_FAILURE in case of error.           */
+int NpingOps::setStatsFile(char *filename){
+  if( filename==NULL || filename[0]=='\0' )
+    return OP_FAILURE;
+  this->stats_file=filename;
+  this->stats_file_set=true;
+  return OP_SUCCESS;
+} /* End of setStatsFile() */
+
+
+/** Returns value of attribute stats_file */
+char *NpingOps::getStatsFile(){
+  return this->stats_file;
+} /* End of getStatsFile() */
+
+
+/* Returns true if option has been set */
+bool NpingOps::issetStatsFile(){
+  return this->stats_file_set;
+} /* End of issetStatsFile() */
+
+
+/** Sets the interval between two stats file dumps. Supplied parameter is
+ *  assumed to be in milliseconds and must be greater than zero.
+ *  @return OP_SUCCESS on success and OP_FAILURE in case of error.           */
+int NpingOps::setStatsInterval(long t){
+  if( t <= 0 )
+    return OP_FAILURE;
+  this->stats_interval=t;
+  this->stats_interval_set=true;
+  return OP_SUCCESS;
+} /* End of setStatsInterval() */
+
+
+/** Returns value of attribute stats_interval */
+long NpingOps::getStatsInterval(){
+  return this->stats_interval;
+} /* End of getStatsInterval() */
+
+
+/* Returns true if option has been set */
+bool NpingOps::issetStatsInterval(){
+  return this->stats_interval_set;
+} /* End of issetStatsInterval() */
+
+
 /** Sets network device. Supplied parameter must be a valid network interface
  *  name.
  *  @return OP_SUCCESS on success and OP_FAILURE in case of error.           */
@@ -2395,8 +2502,9 @@ if (this->havePcap()==false){
   }
     
 
+  /* Generator mode sends as fast as it can unless told otherwise */
   if( !this->issetDelay() )
-    this->setDelay( DEFAULT_DELAY );
+    this->setDelay( this->generator() ? 0 : DEFAULT_DELAY );
 
 /** UDP UNPRIVILEGED MODE? ***************************************************/
   /* If user is NOT root and specified UDP mode, check if he did not specify
@@ -2414,6 +2522,33 @@ if (this->havePcap()==false){
   if( !this->isRoot() && this->getMode()!=UDP_UNPRIV && this->getMode()!=TCP_CONNECT )
     outFatal(QT_3,"Mode %s requires %s.", this->mode2Ascii( this->getMode() ), privreq);
 
+/** STATISTICS FILE ***********************************************************/
+  if( this->issetStatsInterval() && !this->issetStatsFile() )
+    outError(QT_2, "Warning: --stats-interval has no effect unless --stats-file is also specified.");
+  if( this->issetStatsFile() ){
+    if( !this->issetStatsInterval() )
+        this->setStatsInterval( DEFAULT_STATS_INTERVAL );
+    if( (this->stats_fd=fopen(this->getStatsFile(), "w"))==NULL )
+        outFatal(QT_3, "Cannot open stats file %s: %s", this->getStatsFile(), strerror(errno));
+    fprintf(this->stats_fd, "# %s %s RTT statistics. Times in microseconds, cumulative since start.\n", NPING_NAME, NPING_VERSION);
+    fprintf(this->stats_fd, "# elapsed target sent rcvd min p50 p90 p99 p99.9 max avg\n");
+    fflush(this->stats_fd);
+  }
+
+/** GENERATOR MODE ***********************************************************/
+  if( this->generator() ){
+    if( this->getRole()!=ROLE_NORMAL )
+        outFatal(QT_3,"Generator mode cannot be used in echo mode.");
+    if( this->getMode()!=TCP && this->getMode()!=UDP && this->getMode()!=ICMP && this->getMode()!=ARP )
+        outFatal(QT_3,"Generator mode requires one of the raw probe modes (TCP, UDP, ICMP or ARP).");
+    if( this->ipv6() )
+        outFatal(QT_3,"Generator mode does not support IPv6 yet.");
+    if( this->issetTraceroute() )
+        outFatal(QT_3,"Generator mode cannot be combined with --traceroute.");
+    /* Replies are not captured: reading them would slow down transmission. */
+    this->setDisablePacketCapture(true);
+  }
+
 
 /** DEFAULT HEADER PARAMETERS *************************************************/
   this->setDefaultHeaderValues();
@@ -2812,8 +2947,10 @@ void NpingOps::displayStatistics(){
             target->printStats();
     }else{
         target=this->targets.getNextTarget();
-        if( target!= NULL)
+        if( target!= NULL){
             target->printRTTs();
+            target->printRTTPercentiles();
+        }
     }
 
 #ifdef WIN32
@@ -2892,6 +3029,17 @@ void NpingOps::displayStatistics(){
      }
 #endif
 
+      /* Overall latency distribution */
+      if( this->targets.getTargetsFetched() > 1){
+          NpingHistogram all;
+          for(size_t i=0; i < this->targets.Targets.size(); i++)
+              all.merge( this->targets.Targets[i]->getRTTHistogram() );
+          if( all.getCount() > 0 ){
+              outPrint(QT_1|NO_NEWLINE, "Overall ");
+              all.printPercentiles();
+          }
+      }
+
       /* Transmission times & rates */
       outPrint(QT_1|NO_NEWLINE,"Tx time: %.5lfs ", this->stats.elapsedTx() );
       outPrint(QT_1|NO_NEWLINE,"| Tx bytes/s: %.2lf ", this->stats.getOverallTxByteRate() );
@@ -2900,11 +3048,67 @@ void NpingOps::displayStatistics(){
       outPrint(QT_1|NO_NEWLINE,"Rx time: %.5lfs ", this->stats.elapsedRx() );
       outPrint(QT_1|NO_NEWLINE,"| Rx bytes/s: %.2lf ", this->stats.getOverallRxByteRate() );
       outPrint(QT_1,"| Rx pkts/s: %.2lf", this->stats.getOverallRxPacketRate() );
+
+      /* Final snapshot for the stats file */
+      this->dumpStats();
 } /* End of displayStatistics() */
 
 
+/** Appends a snapshot of the RTT statistics to the file specified with
+ *  --stats-file: one line per target that has been probed plus an "all"
+ *  line computed by merging the per-target histograms. Values are cumulative
+ *  since the beginning of the run.
+ *  @warning This method does not use targets.getNextTarget(), so it is safe
+ *  to call it while ProbeMode is iterating over the targets.
+ *  @return OP_SUCCESS on success and OP_FAILURE in case of error.           */
+int NpingOps::dumpStats(){
+  NpingHistogram all;
+  NpingHistogram *h=NULL;
+  NpingTarget *target=NULL;
+  u64_t sent=0, rcvd=0;
+  double elapsed=0;
+
+  if( this->stats_fd==NULL )
+    return OP_FAILURE;
+
+  elapsed=this->stats.elapsedRuntime();
+  for(size_t i=0; i <= this->targets.Targets.size(); i++){
+    if( i < this->targets.Targets.size() ){
+        target=this->targets.Targets[i];
+        h=target->getRTTHistogram();
+        all.merge(h);
+        sent+=target->sent_total;
+        rcvd+=target->recv_total;
+        fprintf(this->stats_fd, "%.3f %s %lu %lu ", elapsed, target->getTargetIPstr(),
+                target->sent_total, target->recv_total);
+    }else{
+        h=&all;
+        fprintf(this->stats_fd, "%.3f all %llu %llu ", elapsed,
+                (unsigned long long)sent, (unsigned long long)rcvd);
+    }
+    if( h->getCount() > 0 ){
+        fprintf(this->stats_fd, "%llu %llu %llu %llu %llu %llu %.1f\n",
+                (unsigned long long)h->getMin(),
+                (unsigned long long)h->getPercentile(50.0),
+                (unsigned long long)h->getPercentile(90.0),
+                (unsigned long long)h->getPercentile(99.0),
+                (unsigned long long)h->getPercentile(99.9),
+                (unsigned long long)h->getMax(), h->getMean());
+    }else{
+        fprintf(this->stats_fd, "- - - - - - -\n");
+    }
+  }
+  fflush(this->stats_fd);
+  return OP_SUCCESS;
+} /* End of dumpStats() */
+
+
 /* Close open files, free allocated memory, etc. */
 int NpingOps::cleanup(){
+  if( this->stats_fd!=NULL ){
+    fclose(this->stats_fd);
+    this->stats_fd=NULL;
+  }
   this->targets.freeTargets();
   return OP_SUCCESS;
 } /* End of cleanup() */
@@ -191,6 +191,22 @@ class NpingOps {
     long getDelay();
     bool issetDelay();
 
+    int setRate(u32 pps);
+    u32 getRate();
+    bool issetRate();
+
+    int setGenerator(bool val);
+    bool generator();
+    bool issetGenerator();
+
+    int setStatsFile(char *filename);
+    char *getStatsFile();
+    bool issetStatsFile();
+
+    int setStatsInterval(long t);
+    long getStatsInterval();
+    bool issetStatsInterval();
+
     int setPacketCount(u32 val);
     u32 getPacketCount();
     bool issetPacketCount();
@@ -488,6 +504,7 @@ class NpingOps {
     /* Misc */
     void displayNpingDoneMsg();
     void displayStatistics();
+    int dumpStats();
     int cleanup();
     int setDefaultHeaderValues();
 
@@ -536,6 +553,19 @@ class NpingOps {
     long delay;               /**< Delay between each probe              */
     bool delay_set;
 
+    u32 rate;                 /**< Packets per second (0: use delay)     */
+    bool rate_set;
+
+    bool generator_mode;      /**< True: send prebuilt packets in a loop */
+    bool generator_mode_set;
+
+    char *stats_file;         /**< File for machine-readable RTT stats   */
+    bool stats_file_set;
+    FILE *stats_fd;
+
+    long stats_interval;      /**< Msecs between two stats file dumps    */
+    bool stats_interval_set;
+
     char device[MAX_DEV_LEN]; /**< Network interface                     */
     bool device_set;
 
@@ -157,6 +157,7 @@ void NpingTarget::Initialize() {
   min_rtt_set=false;
   avg_rtt=0;
   avg_rtt_set=false;
+  rtt_hist.reset();
 } /* End of Initialize() */
 
 
@@ -1021,6 +1022,7 @@ int NpingTarget::updateRTTs(unsigned long int diff){
     avg_rtt = ((avg_rtt*(recv_total-1))+diff) / (recv_total);
   avg_rtt_set=true;
 
+  this->rtt_hist.record(diff);
   return OP_SUCCESS;
 } /* End of updateRTTs() */
 
@@ -1031,6 +1033,10 @@ int NpingTarget::printStats(){
   this->printCounts();
   outPrint(VB_0|NO_NEWLINE," |_ ");
   this->printRTTs();
+  if( this->rtt_hist.getCount() > 0 ){
+    outPrint(VB_0|NO_NEWLINE," |_ ");
+    this->printRTTPercentiles();
+  }
   return OP_SUCCESS;
 } /* End of printStats() */
 
@@ -1073,3 +1079,16 @@ void NpingTarget::printRTTs(){
   else
     outPrint(VB_0,"| Avg rtt: N/A" );
 } /* End of printRTTs() */
+
+
+/* Print round trip time percentiles. Nothing is printed if no replies have
+ * been received. */
+void NpingTarget::printRTTPercentiles(){
+  this->rtt_hist.printPercentiles();
+} /* End of printRTTPercentiles() */
+
+
+/* Returns the histogram of round trip times measured for this target */
+NpingHistogram *NpingTarget::getRTTHistogram(){
+  return &this->rtt_hist;
+} /* End of getRTTHistogram() */
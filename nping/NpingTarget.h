@@ -99,6 +99,7 @@
 #include "nping.h"
 #include "common.h"
 #include "../libnetutil/netutil.h"
+#include "stats.h"
 
 #ifndef INET6_ADDRSTRLEN
 #define INET6_ADDRSTRLEN 46
@@ -273,6 +274,7 @@ unsigned long int min_rtt;
 bool min_rtt_set;
 unsigned long int avg_rtt;
 bool avg_rtt_set;
+NpingHistogram rtt_hist;
 
 
 int setProbeRecvTCP(u16 sport, u16 dport);
@@ -287,6 +289,8 @@ int updateRTTs(unsigned long int diff);
 int printStats();
 void printCounts();
 void printRTTs();
+void printRTTPercentiles();
+NpingHistogram *getRTTHistogram();
 /* STATS***********************************************************************/
 
 };
@@ -211,6 +211,10 @@ int ProbeMode::start(){
   /* Set up nsock */
   this->init_nsock();
 
+  /* Schedule periodic dumps of the RTT statistics */
+  if( o.issetStatsFile() )
+    nsock_timer_create(nsp, stats_dump_handler, o.getStatsInterval(), NULL);
+
  switch( o.getMode() ){
 
   /***************************************************************************/
@@ -332,6 +336,18 @@ int ProbeMode::start(){
     if((o.getMode()==TCP || o.getMode()==UDP) && targetPorts==NULL)
         outFatal(QT_3, "normalProbeMode(): NpingOps does not contain correct target ports\n");
 
+    /* In generator mode we skip nsock altogether: packets are built once and
+     * then sent in a rate-paced loop. Packet capture is always disabled. */
+    if( o.generator() ){
+        o.stats.startClocks();
+        this->generate(rawipsd, targetPorts, numTargetPorts);
+        o.stats.stopTxClock();
+        o.stats.stopRxClock();
+        if(rawipsd>=0)
+            close(rawipsd);
+        break;
+    }
+
     /* Set up libpcap */
     if(!o.disablePacketCapture()){
         /* Create new IOD for pcap */
@@ -493,6 +509,196 @@ int ProbeMode::start(){
 
 
 
+/** Incrementally updates the Internet checksum stored at "sum" after a 16-bit
+ * word of the data it covers changes from "oldval" to "newval", as described
+ * in RFC 1624 (eqn. 3). All values are in network byte order. */
+static void gen_adjust_sum(u8 *sum, u16 oldval, u16 newval){
+  u16 hc;
+  u32 s;
+  memcpy(&hc, sum, sizeof(hc));
+  s = (u16)~hc + (u16)~oldval + newval;
+  s = (s & 0xFFFF) + (s >> 16);
+  s = (s & 0xFFFF) + (s >> 16);
+  hc = (u16)~s;
+  memcpy(sum, &hc, sizeof(hc));
+} /* End of gen_adjust_sum() */
+
+
+/** Stores "val" (host byte order) in the 16-bit field pointed to by "field".
+ * If "sum" is not NULL, the checksum it points to is updated incrementally. */
+static void gen_patch16(u8 *field, u8 *sum, u16 val){
+  u16 oldval, newval;
+  memcpy(&oldval, field, sizeof(oldval));
+  newval = htons(val);
+  memcpy(field, &newval, sizeof(newval));
+  if( sum!=NULL )
+    gen_adjust_sum(sum, oldval, newval);
+} /* End of gen_patch16() */
+
+
+/** Same as gen_patch16() but for 32-bit fields. */
+static void gen_patch32(u8 *field, u8 *sum, u32 val){
+  gen_patch16(field, sum, (u16)(val >> 16));
+  gen_patch16(field+2, sum, (u16)(val & 0xFFFF));
+} /* End of gen_patch32() */
+
+
+/** Generator mode (--generator). Scheduling an nsock timer and rebuilding
+  * the packet from PacketElement objects for every probe costs far more than
+  * the transmission itself, so this function builds one template packet per
+  * target and port with fillPacket() and then sends it over and over in a
+  * tight loop. Before each transmission only the fields that are supposed to
+  * change (IP ID, TCP sequence number and ICMP sequence number, unless the
+  * user fixed them) are patched and the checksums adjusted incrementally.
+  * Packets go out in batches of up to GENERATOR_BATCH; the clock is checked
+  * once per batch and the loop sleeps as needed to honour --rate/--delay. If
+  * no rate was requested, packets are sent as fast as possible.
+  * @return OP_SUCCESS on success and fatal()s in case of failure. */
+int ProbeMode::generate(int rawipsd, u16 *targetPorts, int numTargetPorts){
+  vector<gentemplate_t> tmpl;
+  gentemplate_t t;
+  NpingTarget *target=NULL;
+  u8 pkt[MAX_IP_PACKET_LEN];
+  u8 pktinfobuffer[512+1];
+  int pktLen=0;
+  int nports=1;
+  int link_offset=(o.sendEth()) ? 14 : 0;
+  bool patch_ipid=!o.issetIdentification();
+  bool patch_seq=(o.getMode()==TCP && !o.issetTCPSequence());
+  bool patch_icmpseq=false;
+  u8 *ipsum=NULL, *l4sum=NULL;
+  double pps=0;
+  u64_t sent=0;
+  u64_t packetno=0;
+  u16 aux16=0;
+  u32 aux32=0;
+  u32 c=0;
+  size_t i=0;
+  int b=0, batch=GENERATOR_BATCH;
+  struct timeval start, now;
+  long long due=0, elapsed=0;
+
+  if( o.getMode()==ICMP && !o.issetICMPSequence() ){
+    switch( o.getICMPType() ){
+        case ICMP_ECHO:
+        case ICMP_ECHOREPLY:
+        case ICMP_TSTAMP:
+        case ICMP_TSTAMPREPLY:
+            patch_icmpseq=true;
+        break;
+    }
+  }
+
+  /* Build the templates, in the same order the regular mode sends them */
+  if( o.getMode()==TCP || o.getMode()==UDP ){
+    if( targetPorts==NULL )
+        outFatal(QT_3, "generate(): NpingOps does not contain correct target ports\n");
+    nports=numTargetPorts;
+  }
+  for(int p=0; p < nports; p++){
+    o.targets.rewind();
+    while( (target=o.targets.getNextTarget()) != NULL ){
+        memset(&t, 0, sizeof(t));
+        t.target=target;
+        t.dstport=(targetPorts!=NULL && (o.getMode()==TCP || o.getMode()==UDP)) ? targetPorts[p] : 0;
+        if( fillPacket(target, t.dstport, pkt, MAX_IP_PACKET_LEN, &pktLen, rawipsd) != OP_SUCCESS || pktLen <= link_offset )
+            outFatal(QT_3, "generate(): Error in packet creation");
+        t.pkt=(u8 *)safe_malloc(pktLen);
+        memcpy(t.pkt, pkt, pktLen);
+        t.pktLen=pktLen;
+        if( o.getMode()!=ARP ){
+            t.ip=t.pkt+link_offset;
+            t.l4=t.ip+((t.ip[0] & 0x0F) * 4);
+            if( t.l4 + ((o.getMode()==TCP) ? 20 : 8) > t.pkt+t.pktLen )
+                outFatal(QT_3, "generate(): Truncated template packet");
+            memcpy(&aux16, t.ip+4, sizeof(aux16));
+            t.ipid=ntohs(aux16);
+            if( o.getMode()==TCP ){
+                memcpy(&aux32, t.l4+4, sizeof(aux32));
+                t.tcpseq=ntohl(aux32);
+            }else if( o.getMode()==ICMP ){
+                memcpy(&aux16, t.l4+6, sizeof(aux16));
+                t.icmpseq=ntohs(aux16);
+            }
+        }
+        if( o.getDebugging() >= DBG_1 ){
+            if( o.getMode()==ARP )
+                getPacketStrInfo("ARP", t.pkt+14, t.pktLen-14, pktinfobuffer, 512);
+            else
+                getPacketStrInfo("IP", t.ip, t.pktLen-link_offset, pktinfobuffer, 512);
+            outPrint(DBG_1, "Generator template #%lu: %s", (unsigned long)tmpl.size(), pktinfobuffer);
+        }
+        tmpl.push_back(t);
+    }
+  }
+
+  /* Determine target rate. --rate takes precedence since rates over 1000pps
+   * cannot be expressed as a delay in milliseconds. */
+  if( o.getRate() > 0 )
+    pps=o.getRate();
+  else if( o.getDelay() > 0 )
+    pps=1000.0/o.getDelay();
+  if( pps > 0 ){
+    /* Check the clock at least every 10ms so slow rates stay smooth */
+    batch=(int)(pps/100);
+    if( batch < 1 )
+        batch=1;
+    else if( batch > GENERATOR_BATCH )
+        batch=GENERATOR_BATCH;
+    outPrint(VB_0, "Generator mode: %lu template packet%s, sending at %.2lf pkts/s.",
+             (unsigned long)tmpl.size(), (tmpl.size()==1) ? "" : "s", pps);
+  }else{
+    outPrint(VB_0, "Generator mode: %lu template packet%s, sending as fast as possible.",
+             (unsigned long)tmpl.size(), (tmpl.size()==1) ? "" : "s");
+  }
+
+  gettimeofday(&start, NULL);
+  for( c=0; c < o.getPacketCount(); c++){
+    for(i=0; i < tmpl.size(); ){
+
+        /* Send one batch */
+        for(b=0; b < batch && i < tmpl.size(); b++, i++){
+            gentemplate_t *g=&tmpl[i];
+            if( g->ip!=NULL ){
+                ipsum=(o.getBadsumIP()) ? NULL : g->ip+10;
+                if( patch_ipid )
+                    gen_patch16(g->ip+4, ipsum, (u16)(g->ipid + packetno));
+                if( patch_seq ){
+                    l4sum=(o.getBadsum()) ? NULL : g->l4+16;
+                    gen_patch32(g->l4+4, l4sum, g->tcpseq + c);
+                }else if( patch_icmpseq ){
+                    gen_patch16(g->l4+6, g->l4+2, (u16)(g->icmpseq + c));
+                }
+            }
+            packetno++;
+            if( send_packet(g->target, rawipsd, g->pkt, g->pktLen) == OP_SUCCESS ){
+                o.stats.addSentPacket(g->pktLen);
+                sent++;
+            }
+        }
+
+        /* Pace transmission */
+        if( pps > 0 ){
+            gettimeofday(&now, NULL);
+            due=(long long)(packetno * 1000000.0 / pps);
+            elapsed=TIMEVAL_SUBTRACT(now, start);
+            if( due > elapsed )
+                usleep((unsigned long)(due - elapsed));
+        }
+    }
+  }
+  gettimeofday(&now, NULL);
+  o.setLastPacketSentTime(now);
+  outPrint(DBG_1, "Generator mode: %llu packets sent.", (unsigned long long)sent);
+
+  for(i=0; i < tmpl.size(); i++)
+    free(tmpl[i].pkt);
+  return OP_SUCCESS;
+} /* End of generate() */
+
+
+
+
 
 /** Creates buffer suitable to be passed to a sendto() call. The buffer
  * represents a raw network packet. The specific protocols are obtained from
@@ -1735,6 +1941,17 @@ void ProbeMode::probe_delayed_output_handler(nsock_pool nsp, nsock_event nse, vo
 } /* End of probe_delayed_output_handler() */
 
 
+/** Writes a snapshot of the RTT statistics to the --stats-file every time the
+  * timer goes off, and schedules the next dump. */
+void ProbeMode::probe_stats_dump_handler(nsock_pool nsp, nsock_event nse, void *mydata){
+  if( nse_status(nse)!=NSE_STATUS_SUCCESS )
+    return;
+  o.dumpStats();
+  nsock_timer_create(nsp, stats_dump_handler, o.getStatsInterval(), NULL);
+  return;
+} /* End of probe_stats_dump_handler() */
+
+
 /* DEFAULT_MAX__DESCRIPTORS. is a hardcoded value for the maximum number of
  * opened descriptors in the current system. Nping tries to determine that
  * limit at run time, but sometimes it can't and the limit defaults to
@@ -2290,3 +2507,13 @@ void delayed_output_handler(nsock_pool nsp, nsock_event nse, void *arg){
   ProbeMode::probe_delayed_output_handler(nsp, nse, arg);
   return;
 } /* End of udpunpriv_event_handler() */
+
+
+/* This handler is a wrapper for the ProbeMode::probe_stats_dump_handler()
+ * method. We need this because C++ does not allow to use class methods as
+ * callback functions for things like signal() or the Nsock lib. */
+void stats_dump_handler(nsock_pool nsp, nsock_event nse, void *arg){
+  outPrint(DBG_4, "%s()", __func__);
+  ProbeMode::probe_stats_dump_handler(nsp, nse, arg);
+  return;
+} /* End of stats_dump_handler() */
@@ -122,6 +122,21 @@ typedef struct sendpkt{
     u16 dstport;
 }sendpkt_t;
 
+/* A gentemplate holds one prebuilt packet for generator mode (--generator),
+ * plus pointers to the headers whose fields are patched before each
+ * transmission. */
+typedef struct gentemplate{
+    u8 *pkt;
+    int pktLen;
+    NpingTarget *target;
+    u16 dstport;
+    u8 *ip;          /* IPv4 header inside pkt, NULL in ARP mode  */
+    u8 *l4;          /* TCP/UDP/ICMP header inside pkt           */
+    u16 ipid;        /* Values stored in the first packet built  */
+    u32 tcpseq;
+    u16 icmpseq;
+}gentemplate_t;
+
 
 class ProbeMode  {
 
@@ -137,6 +152,7 @@ class ProbeMode  {
         void reset();
         int init_nsock();
         int start();
+        int generate(int rawipsd, u16 *targetPorts, int numTargetPorts);
         int cleanup();
         nsock_pool getNsockPool();
         
@@ -151,6 +167,7 @@ class ProbeMode  {
         static char *getBPFFilterString();
         static void probe_nping_event_handler(nsock_pool nsp, nsock_event nse, void *arg);
         static void probe_delayed_output_handler(nsock_pool nsp, nsock_event nse, void *mydata);
+        static void probe_stats_dump_handler(nsock_pool nsp, nsock_event nse, void *mydata);
         static void probe_tcpconnect_event_handler(nsock_pool nsp, nsock_event nse, void *arg);
         static void probe_udpunpriv_event_handler(nsock_pool nsp, nsock_event nse, void *arg);
 
@@ -162,5 +179,6 @@ void nping_event_handler(nsock_pool nsp, nsock_event nse, void *arg);
 void tcpconnect_event_handler(nsock_pool nsp, nsock_event nse, void *arg);
 void udpunpriv_event_handler(nsock_pool nsp, nsock_event nse, void *arg);
 void delayed_output_handler(nsock_pool nsp, nsock_event nse, void *arg);
+void stats_dump_handler(nsock_pool nsp, nsock_event nse, void *arg);
 
 #endif /* __PROBEMODE_H__ */
@@ -333,6 +333,12 @@
 
 #define DEFAULT_DELAY 1000              /**< Milliseconds between each probe */
 
+/** Default milliseconds between two dumps of the --stats-file */
+#define DEFAULT_STATS_INTERVAL 1000
+
+/** Max number of packets generator mode sends between two clock checks */
+#define GENERATOR_BATCH 64
+
  /** Millisenconds Nping waits for teplies after all probes have been  sent */
 #define DEFAULT_WAIT_AFTER_PROBES 1000 
 
@@ -174,6 +174,176 @@ bool NpingTimer::timeval_set(const struct timeval *tv) {
 
 
 
+/*****************************************************************************/
+/* Implementation of NpingHistogram class.                                   */
+/*****************************************************************************/
+
+NpingHistogram::NpingHistogram(){
+  this->counts=NULL;
+  this->reset();
+}
+
+
+NpingHistogram::NpingHistogram(const NpingHistogram &h){
+  this->counts=NULL;
+  this->reset();
+  this->merge(&h);
+}
+
+
+NpingHistogram::~NpingHistogram(){
+  if(this->counts!=NULL)
+    free(this->counts);
+}
+
+
+NpingHistogram &NpingHistogram::operator=(const NpingHistogram &h){
+  if(this!=&h){
+    this->reset();
+    this->merge(&h);
+  }
+  return *this;
+}
+
+
+void NpingHistogram::reset(){
+  if(this->counts!=NULL)
+    memset(this->counts, 0, HIST_BUCKETS * sizeof(u32));
+  this->total=0;
+  this->min_value=0;
+  this->max_value=0;
+  this->sum=0;
+}
+
+
+/* Returns the bucket that holds "value". Buckets [0, 2^HIST_SUB_BITS) hold
+ * one value each. After that, a value whose most significant bit is bit
+ * (HIST_SUB_BITS-1+shift) goes to bucket shift*HIST_HALF_BUCKETS plus its top
+ * HIST_SUB_BITS bits. */
+int NpingHistogram::valueToIndex(u64_t value){
+  int shift=0;
+  if(value > HIST_MAX_VALUE)
+    value=HIST_MAX_VALUE;
+#if defined(__GNUC__)
+  if(value >= (1 << HIST_SUB_BITS))
+    shift = (63 - __builtin_clzll(value)) - (HIST_SUB_BITS-1);
+#else
+  while((value >> shift) >= (1 << HIST_SUB_BITS))
+    shift++;
+#endif
+  return (shift * HIST_HALF_BUCKETS) + (int)(value >> shift);
+}
+
+
+/* Returns the highest value that maps to the supplied bucket. */
+u64_t NpingHistogram::indexToValue(int index){
+  int shift=0;
+  u64_t top=index;
+  if(index >= (1 << HIST_SUB_BITS)){
+    shift = (index / HIST_HALF_BUCKETS) - 1;
+    top = index - (shift * HIST_HALF_BUCKETS);
+  }
+  return ((top+1) << shift) - 1;
+}
+
+
+/* Records one value. The bucket array is allocated on first use so targets
+ * that never reply do not pay for it. */
+int NpingHistogram::record(u64_t value){
+  if(this->counts==NULL)
+    this->counts=(u32 *)safe_zalloc(HIST_BUCKETS * sizeof(u32));
+  this->counts[valueToIndex(value)]++;
+  if(this->total==0 || value < this->min_value)
+    this->min_value=value;
+  if(this->total==0 || value > this->max_value)
+    this->max_value=value;
+  this->sum+=value;
+  this->total++;
+  return OP_SUCCESS;
+}
+
+
+/* Adds all values recorded in "h" to this histogram. */
+int NpingHistogram::merge(const NpingHistogram *h){
+  if(h==NULL || h->total==0)
+    return OP_SUCCESS;
+  if(this->counts==NULL)
+    this->counts=(u32 *)safe_zalloc(HIST_BUCKETS * sizeof(u32));
+  for(int i=0; i<HIST_BUCKETS; i++)
+    this->counts[i]+=h->counts[i];
+  if(this->total==0 || h->min_value < this->min_value)
+    this->min_value=h->min_value;
+  if(this->total==0 || h->max_value > this->max_value)
+    this->max_value=h->max_value;
+  this->sum+=h->sum;
+  this->total+=h->total;
+  return OP_SUCCESS;
+}
+
+
+u64_t NpingHistogram::getCount(){
+  return this->total;
+}
+
+
+u64_t NpingHistogram::getMin(){
+  return this->min_value;
+}
+
+
+u64_t NpingHistogram::getMax(){
+  return this->max_value;
+}
+
+
+double NpingHistogram::getMean(){
+  if(this->total==0)
+    return 0.0;
+  return (double)this->sum / this->total;
+}
+
+
+/* Returns the value below which "pct" percent of the recorded values fall,
+ * e.g. getPercentile(99.9). The result is the upper bound of the bucket that
+ * holds the requested rank, capped by the largest value recorded. */
+u64_t NpingHistogram::getPercentile(double pct){
+  u64_t rank=0, seen=0, val=0;
+  if(this->total==0)
+    return 0;
+  if(pct < 0.0)
+    pct=0.0;
+  else if(pct > 100.0)
+    pct=100.0;
+  rank=(u64_t)((pct / 100.0) * this->total + 0.5);
+  if(rank < 1)
+    rank=1;
+  for(int i=0; i<HIST_BUCKETS; i++){
+    seen+=this->counts[i];
+    if(seen >= rank){
+      val=indexToValue(i);
+      break;
+    }
+  }
+  if(val > this->max_value)
+    val=this->max_value;
+  if(val < this->min_value)
+    val=this->min_value;
+  return val;
+}
+
+
+/* Prints the usual latency percentiles on a single line, in milliseconds. */
+void NpingHistogram::printPercentiles(){
+  if(this->total==0)
+    return;
+  outPrint(VB_0|NO_NEWLINE, "Rtt p50: %.3lfms ", this->getPercentile(50.0)/1000.0);
+  outPrint(VB_0|NO_NEWLINE, "| p90: %.3lfms ", this->getPercentile(90.0)/1000.0);
+  outPrint(VB_0|NO_NEWLINE, "| p99: %.3lfms ", this->getPercentile(99.0)/1000.0);
+  outPrint(VB_0, "| p99.9: %.3lfms", this->getPercentile(99.9)/1000.0);
+}
+
+
+
 /*****************************************************************************/
 /* Implementation of NpingStats class.                                       */
 /*****************************************************************************/
@@ -169,6 +169,53 @@ class NpingTimer {
 };
 
 
+/* RTT histogram geometry. Values (in microseconds) below 2^HIST_SUB_BITS are
+ * counted exactly. Above that, every power-of-two range is split into
+ * 2^(HIST_SUB_BITS-1) equal buckets, so a recorded value is never off by more
+ * than 1/64 (about 1.6%) of itself. Values larger than HIST_MAX_VALUE (about
+ * 38 hours) are clamped. */
+#define HIST_SUB_BITS 7
+#define HIST_HALF_BUCKETS (1 << (HIST_SUB_BITS-1))
+#define HIST_MAX_SHIFT 30
+#define HIST_MAX_VALUE ((((u64_t)1) << (HIST_SUB_BITS+HIST_MAX_SHIFT)) - 1)
+#define HIST_BUCKETS ((HIST_MAX_SHIFT+2) * HIST_HALF_BUCKETS)
+
+
+/* Log-bucketed (HDR-style) histogram of round trip times. Recording a value
+ * takes constant time and memory is only allocated once the first value is
+ * recorded. Histograms can be copied (snapshots) and merged, which is how
+ * the overall statistics are computed from the per-target ones. */
+class NpingHistogram {
+
+  private:
+    u32 *counts;
+    u64_t total;
+    u64_t min_value;
+    u64_t max_value;
+    u64_t sum;
+
+    static int valueToIndex(u64_t value);
+    static u64_t indexToValue(int index);
+
+  public:
+    NpingHistogram();
+    NpingHistogram(const NpingHistogram &h);
+    ~NpingHistogram();
+    NpingHistogram &operator=(const NpingHistogram &h);
+
+    void reset();
+    int record(u64_t value);
+    int merge(const NpingHistogram *h);
+
+    u64_t getCount();
+    u64_t getMin();
+    u64_t getMax();
+    double getMean();
+    u64_t getPercentile(double pct);
+    void printPercentiles();
+};
+
+
 class NpingStats {
 
   private:
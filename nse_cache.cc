@@ -0,0 +1,53 @@
+#include "nse_cache.h"
+
+NseCache::NseCache(size_t max_size)
+{
+  this->max_size = max_size;
+  this->cur_size = 0;
+}
+
+void NseCache::erase(std::map<std::string, entry>::iterator it)
+{
+  cur_size -= it->first.size() + it->second.value.size();
+  lru_list.erase(it->second.lru);
+  store.erase(it);
+}
+
+bool NseCache::get(const std::string &key, time_t now, std::string &value)
+{
+  std::map<std::string, entry>::iterator it;
+
+  it = store.find(key);
+  if (it == store.end())
+    return false;
+  if (it->second.expires <= now) {
+    erase(it);
+    return false;
+  }
+  lru_list.splice(lru_list.begin(), lru_list, it->second.lru);
+  value = it->second.value;
+  return true;
+}
+
+bool NseCache::put(const std::string &key, const std::string &value,
+                   time_t now, time_t ttl)
+{
+  std::map<std::string, entry>::iterator it;
+  size_t len = key.size() + value.size();
+
+  it = store.find(key);
+  if (it != store.end())
+    erase(it);
+  if (ttl <= 0 || len > max_size)
+    return false;
+  while (cur_size + len > max_size)
+    erase(store.find(lru_list.back()));
+
+  entry &e = store[key];
+  e.value = value;
+  e.expires = now + ttl;
+  lru_list.push_front(key);
+  e.lru = lru_list.begin();
+  cur_size += len;
+  return true;
+}
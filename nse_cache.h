@@ -0,0 +1,48 @@
+#ifndef NSE_CACHE
+#define NSE_CACHE
+
+#include <time.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+/* Response cache shared by all scripts (nmap.cache_get and nmap.cache_put).
+ *
+ * Entries map a key, which the caller builds from the host, port and request,
+ * to a value that expires after its TTL. The total size of keys and values is
+ * capped; when an insert would exceed the cap, the least recently used entries
+ * are evicted first. The current time is passed in so that expiry does not
+ * depend on the clock. */
+class NseCache {
+public:
+  NseCache(size_t max_size);
+
+  /* Sets value to the entry for key and returns true, or returns false if
+     there is none or it has expired at time now. */
+  bool get(const std::string &key, time_t now, std::string &value);
+
+  /* Stores value under key until now + ttl, replacing any previous entry.
+     Returns false, storing nothing, if ttl is not positive or the entry alone
+     is larger than the cache. */
+  bool put(const std::string &key, const std::string &value, time_t now,
+           time_t ttl);
+
+  size_t size() const { return cur_size; }
+
+private:
+  struct entry {
+    std::string value;
+    time_t expires;
+    std::list<std::string>::iterator lru; /* position in lru_list */
+  };
+
+  void erase(std::map<std::string, entry>::iterator it);
+
+  std::map<std::string, entry> store;
+  std::list<std::string> lru_list; /* most recently used first */
+  size_t max_size;
+  size_t cur_size;
+};
+
+#endif
@@ -7,6 +7,8 @@ extern "C" {
 
 #include <math.h>
 
+#include <string>
+
 #include "nmap.h"
 #include "nmap_error.h"
 #include "NmapOps.h"
@@ -21,6 +23,7 @@ extern "C" {
 #include "libnetutil/netutil.h"
 
 #include "nse_nmaplib.h"
+#include "nse_cache.h"
 #include "nse_utility.h"
 #include "nse_nsock.h"
 #include "nse_dnet.h"
@@ -883,6 +886,57 @@ static int l_list_interfaces (lua_State *L)
   return 1;
 }
 
+/* Response cache shared by all scripts. Entries are scoped by the host
+ * address, port number and protocol, and by a script-chosen key (normally the
+ * request itself). See nse_cache.h. */
+#define NSE_CACHE_MAX_SIZE (4 * 1024 * 1024)
+#define NSE_CACHE_DEFAULT_TTL 60
+
+static NseCache cache(NSE_CACHE_MAX_SIZE);
+
+static std::string cache_key (lua_State *L)
+{
+  const char *addr, *targetname, *proto = NULL;
+  unsigned short portno;
+  size_t len;
+  const char *key;
+  char portstr[8];
+
+  nseU_checktarget(L, 1, &addr, &targetname);
+  portno = nseU_checkport(L, 2, &proto);
+  key = luaL_checklstring(L, 3, &len);
+  Snprintf(portstr, sizeof(portstr), "%hu", portno);
+  return std::string(addr) + "|" + (proto ? proto : "tcp") + "|" + portstr
+      + "|" + std::string(key, len);
+}
+
+/* nmap.cache_get(host, port, key) returns the cached value, or nil if there
+ * is none or it has expired. */
+static int l_cache_get (lua_State *L)
+{
+  std::string value;
+
+  if (cache.get(cache_key(L), time(NULL), value))
+    lua_pushlstring(L, value.data(), value.size());
+  else
+    lua_pushnil(L);
+  return 1;
+}
+
+/* nmap.cache_put(host, port, key, value[, ttl]) stores value for ttl seconds.
+ * Returns false if the entry alone is larger than the cache. */
+static int l_cache_put (lua_State *L)
+{
+  std::string key = cache_key(L);
+  size_t len;
+  const char *value = luaL_checklstring(L, 4, &len);
+  lua_Number ttl = luaL_optnumber(L, 5, NSE_CACHE_DEFAULT_TTL);
+
+  lua_pushboolean(L, cache.put(key, std::string(value, len), time(NULL),
+                               (time_t) ceil(ttl)));
+  return 1;
+}
+
 /* return the ttl (time to live) specified with the 
  * --ttl command line option. If a wrong value is 
  * specified it defaults to 64.
@@ -936,6 +990,8 @@ int luaopen_nmap (lua_State *L)
     {"list_interfaces", l_list_interfaces},
     {"get_ttl", l_get_ttl},
     {"get_payload_length",l_get_payload_length},
+    {"cache_get", l_cache_get},
+    {"cache_put", l_cache_put},
     {"new_dnet", nseU_placeholder}, /* deprecated, placeholder */
     {"get_interface_info", nseU_placeholder}, /* deprecated, placeholder */
     {"new_socket", nseU_placeholder}, /* deprecated, placeholder */
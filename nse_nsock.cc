@@ -10,6 +10,7 @@
 #include "nse_main.h"
 #include "nse_utility.h"
 #include "nse_ssl_cert.h"
+#include "nse_pool.h"
 
 #if HAVE_OPENSSL
 /* See the comments in service_scan.cc for the reason for _WINSOCKAPI_. */
@@ -23,6 +24,7 @@
 
 #include <sstream>
 #include <iomanip>
+#include <string>
 
 #define DEFAULT_TIMEOUT 30000
 
@@ -56,6 +58,8 @@ typedef struct nse_nsock_udata
   const char *action;
 
   void *ssl_session;
+  /* Cached session offered to a pending SSL connect; freed when it completes */
+  void *connect_ssl_session;
 
   struct sockaddr_storage source_addr;
   size_t source_addrlen;
@@ -67,10 +71,18 @@ typedef struct nse_nsock_udata
 
 } nse_nsock_udata;
 
+static bool pool_iod_usable (void *nsiod);
+static void pool_iod_discard (void *nsiod);
+
+/* Keep-alive connection pool and SSL session cache, described below. */
+static NseConnPool conn_pool(pool_iod_usable, pool_iod_discard);
+
 static int gc_pool (lua_State *L)
 {
   nsock_pool *nsp = (nsock_pool *) lua_touserdata(L, 1);
   assert(*nsp != NULL);
+  /* Idle pooled iods belong to the pool and are deleted along with it. */
+  conn_pool.clear();
   nsp_delete(*nsp);
   *nsp = NULL;
   return 0;
@@ -277,6 +289,102 @@ static unsigned short inet_port_both (int af, const void *v_addr)
   return ntohs(port);
 }
 
+/* Keep-alive connection pool.
+ *
+ * Scripts may opt into reusing connections with socket:checkout() and
+ * socket:checkin() instead of connect() and close(). Idle connections are kept
+ * in conn_pool (see nse_pool.h), keyed by protocol, address and port. They do
+ * not belong to any thread, so they do not count against the socket locks
+ * above. A connection is only handed out again if the peer has neither closed
+ * it nor sent unsolicited data while it sat idle.
+ *
+ * Independently of the pool, the session of every successful SSL connection
+ * is remembered in conn_pool (by address and port) and offered on the next SSL
+ * connect to the same service, so that new connections can skip the full
+ * handshake. Sessions are stored serialized, so that each connect gets its own
+ * SSL_SESSION and no reference counting is shared with nsock.
+ */
+static std::string pool_key (const char *proto, int af,
+    const struct sockaddr *sa, unsigned short port)
+{
+  char ipstring[INET6_ADDRSTRLEN];
+  std::ostringstream key;
+
+  key << proto << "|" << inet_ntop_both(af, sa, ipstring) << "|" << port;
+  return key.str();
+}
+
+/* Returns the key of the service an open, non-pcap iod is connected to. */
+static std::string pool_key_iod (nsock_iod nsiod, const char *proto)
+{
+  int protocol, af;
+  struct sockaddr_storage local, remote;
+
+  nsi_getlastcommunicationinfo(nsiod, &protocol, &af,
+      (struct sockaddr *) &local, (struct sockaddr *) &remote,
+      sizeof(struct sockaddr_storage));
+  return pool_key(proto, af, (struct sockaddr *) &remote,
+      inet_port_both(af, &remote));
+}
+
+/* An idle connection is usable if nothing is waiting to be read on it. For
+ * SSL, the library may already have read an EOF or unsolicited records off
+ * the socket, so its buffer and shutdown state are checked as well. */
+static bool pool_iod_usable (void *nsiod)
+{
+#ifdef HAVE_OPENSSL
+  if (nsi_checkssl(nsiod)) {
+    SSL *ssl = (SSL *) nsi_getssl(nsiod);
+
+    if (ssl == NULL || SSL_pending(ssl) > 0
+        || (SSL_get_shutdown(ssl) & SSL_RECEIVED_SHUTDOWN))
+      return false;
+  }
+#endif
+  return NseConnPool::fd_idle(nsi_getsd(nsiod));
+}
+
+static void pool_iod_discard (void *nsiod)
+{
+  nsi_delete(nsiod, NSOCK_PENDING_SILENT);
+}
+
+/* Remembers the SSL session of a freshly connected iod. */
+static void ssl_session_remember (nsock_iod nsiod)
+{
+#ifdef HAVE_OPENSSL
+  SSL_SESSION *session = (SSL_SESSION *) nsi_get0_ssl_session(nsiod);
+  std::string key;
+  unsigned char *buf, *p;
+  int len;
+
+  if (session == NULL || (len = i2d_SSL_SESSION(session, NULL)) <= 0)
+    return;
+  key = pool_key_iod(nsiod, "ssl");
+  buf = p = (unsigned char *) safe_malloc(len);
+  i2d_SSL_SESSION(session, &p);
+  conn_pool.put_session(key, std::string((char *) buf, len));
+  free(buf);
+#endif
+}
+
+/* Returns a new SSL session for the service identified by key (as built by
+ * pool_key), or NULL if none is cached. The caller must free it. */
+static void *ssl_session_lookup (const std::string &key)
+{
+#ifdef HAVE_OPENSSL
+  std::string session;
+  const unsigned char *p;
+
+  if (!conn_pool.get_session(key, session))
+    return NULL;
+  p = (const unsigned char *) session.data();
+  return d2i_SSL_SESSION(NULL, &p, session.size());
+#else
+  return NULL;
+#endif
+}
+
 #define TO      ">"
 #define FROM    "<"
 
@@ -343,6 +451,20 @@ static void callback (nsock_pool nsp, nsock_event nse, void *ud)
   status(L, nse_status(nse));
 }
 
+static void connect_ssl_callback (nsock_pool nsp, nsock_event nse, void *ud)
+{
+  nse_nsock_udata *nu = (nse_nsock_udata *) ud;
+#ifdef HAVE_OPENSSL
+  /* nsock does not take a reference to the session it was offered. */
+  if (nu->connect_ssl_session)
+    SSL_SESSION_free((SSL_SESSION *) nu->connect_ssl_session);
+#endif
+  nu->connect_ssl_session = NULL;
+  if (nse_status(nse) == NSE_STATUS_SUCCESS)
+    ssl_session_remember(nse_iod(nse));
+  callback(nsp, nse, ud);
+}
+
 static int yield (lua_State *L, nse_nsock_udata *nu, const char *action,
     const char *direction, int ctx, lua_CFunction k)
 {
@@ -427,6 +549,27 @@ static int l_reconnect_ssl (lua_State *L)
   return yield(L, nu, "SSL RECONNECT", TO, 0, NULL);
 }
 
+/* Resolves addr for a connection from nu, preferring the socket's address
+ * family (the one given to nmap.new_socket, which follows -6) and falling
+ * back to any family. l_connect and l_checkout must agree on the address, or
+ * checkout would look in the pool under a different key than connect uses. */
+static int resolve_dest (const nse_nsock_udata *nu, const char *addr,
+    int socktype, struct addrinfo **dest)
+{
+  struct addrinfo hints;
+  int rc;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = nu->af;
+  hints.ai_socktype = socktype;
+  rc = getaddrinfo(addr, NULL, &hints, dest);
+  if (rc != 0) {
+    hints.ai_family = AF_UNSPEC;
+    rc = getaddrinfo(addr, NULL, &hints, dest);
+  }
+  return rc;
+}
+
 static int l_connect (lua_State *L)
 {
   enum type {TCP, UDP, SSL};
@@ -462,7 +605,8 @@ static int l_connect (lua_State *L)
     return nseU_safeerror(L, "sorry, you don't have OpenSSL");
 #endif
 
-  error_id = getaddrinfo(addr, NULL, NULL, &dest);
+  error_id = resolve_dest(nu, addr, what == UDP ? SOCK_DGRAM : SOCK_STREAM,
+      &dest);
   if (error_id)
     return nseU_safeerror(L, gai_strerror(error_id));
 
@@ -502,8 +646,12 @@ static int l_connect (lua_State *L)
       break;
     case SSL:
       nu->proto = IPPROTO_TCP;
-      nsock_connect_ssl(nsp, nu->nsiod, callback, nu->timeout, nu,
-          dest->ai_addr, dest->ai_addrlen, IPPROTO_TCP, port, nu->ssl_session);
+      if (nu->ssl_session == NULL)
+        nu->connect_ssl_session = ssl_session_lookup(pool_key("ssl", nu->af,
+            dest->ai_addr, port));
+      nsock_connect_ssl(nsp, nu->nsiod, connect_ssl_callback, nu->timeout, nu,
+          dest->ai_addr, dest->ai_addrlen, IPPROTO_TCP, port,
+          nu->ssl_session ? nu->ssl_session : nu->connect_ssl_session);
       break;
   }
 
@@ -512,6 +660,43 @@ static int l_connect (lua_State *L)
   return yield(L, nu, "CONNECT", TO, 0, NULL);
 }
 
+/* Like l_connect, but first tries to take an idle connection to the same
+ * service out of the connection pool. */
+static int l_checkout (lua_State *L)
+{
+  static const char * const op[] = {"tcp", "udp", "ssl", NULL};
+
+  nse_nsock_udata *nu = check_nsock_udata(L, 1);
+  const char *addr, *targetname; nseU_checktarget(L, 2, &addr, &targetname);
+  const char *default_proto = NULL;
+  unsigned short port = nseU_checkport(L, 3, &default_proto);
+  if (default_proto == NULL)
+    default_proto = nu->proto == IPPROTO_UDP ? "udp" : "tcp";
+  const char *proto = op[luaL_checkoption(L, 4, default_proto, op)];
+  struct addrinfo *dest;
+  nsock_iod nsiod;
+  int af;
+
+  if (!socket_lock(L, 1)) /* we cannot get a socket lock */
+    return nse_yield(L, 0, l_checkout); /* restart on continuation */
+
+  if (nu->nsiod != NULL || strcmp(proto, "udp") == 0)
+    return l_connect(L);
+  if (resolve_dest(nu, addr, SOCK_STREAM, &dest) != 0 || dest == NULL)
+    return l_connect(L); /* let connect report the error */
+  nsiod = conn_pool.get(pool_key(proto, dest->ai_addr->sa_family,
+        dest->ai_addr, port), nsock_gettimeofday(), &af);
+  freeaddrinfo(dest);
+  if (nsiod == NULL)
+    return l_connect(L);
+
+  nu->nsiod = nsiod;
+  nu->proto = IPPROTO_TCP;
+  nu->af = af;
+  trace(nu->nsiod, "CHECKOUT", TO);
+  return nseU_success(L);
+}
+
 static int l_send (lua_State *L)
 {
   nsock_pool nsp = get_pool(L);
@@ -802,6 +987,7 @@ static void initialize (lua_State *L, int idx, nse_nsock_udata *nu,
   nu->proto = proto;
   nu->af = af;
   nu->ssl_session = NULL;
+  nu->connect_ssl_session = NULL;
   nu->source_addr.ss_family = AF_UNSPEC;
   nu->source_addrlen = sizeof(nu->source_addr);
   nu->timeout = DEFAULT_TIMEOUT;
@@ -848,6 +1034,35 @@ static int l_close (lua_State *L)
   return nseU_success(L);
 }
 
+/* Returns a connected TCP socket to the connection pool instead of closing
+ * it. Sockets that cannot be reused (UDP, pcap, unread buffered data, or a
+ * full pool) are simply closed. */
+static int l_checkin (lua_State *L)
+{
+  nse_nsock_udata *nu = check_nsock_udata(L, 1);
+  const char *proto;
+  size_t buffered;
+
+  if (nu->nsiod == NULL)
+    return nseU_safeerror(L, "socket already closed");
+  if (nu->is_pcap || nu->proto != IPPROTO_TCP || nu->ssl_session != NULL)
+    return l_close(L);
+  lua_getuservalue(L, 1);
+  lua_rawgeti(L, -1, BUFFER_I);
+  buffered = lua_rawlen(L, -1);
+  lua_pop(L, 2);
+  if (buffered > 0)
+    return l_close(L);
+
+  proto = nsi_checkssl(nu->nsiod) ? "ssl" : "tcp";
+  if (!conn_pool.put(pool_key_iod(nu->nsiod, proto), nu->nsiod, nu->af,
+        nsock_gettimeofday()))
+    return l_close(L);
+  trace(nu->nsiod, "CHECKIN", TO);
+  initialize(L, 1, nu, nu->proto, nu->af);
+  return nseU_success(L);
+}
+
 static int nsock_gc (lua_State *L)
 {
   nse_nsock_udata *nu = check_nsock_udata(L, 1);
@@ -974,6 +1189,8 @@ LUALIB_API int luaopen_nsock (lua_State *L)
 {
   static const luaL_Reg metatable_index[] = {
     {"bind", l_bind},
+    {"checkin", l_checkin},
+    {"checkout", l_checkout},
     {"close", l_close},
     {"connect", l_connect},
     {"get_info", l_get_info},
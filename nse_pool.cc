@@ -0,0 +1,113 @@
+#include "nse_pool.h"
+
+NseConnPool::NseConnPool(usable_fn usable, discard_fn discard)
+{
+  this->usable = usable;
+  this->discard = discard;
+  this->nidle = 0;
+}
+
+void NseConnPool::expire(const struct timeval *now)
+{
+  std::map<std::string, std::list<entry> >::iterator mi;
+  std::list<entry>::iterator li;
+
+  for (mi = conns.begin(); mi != conns.end(); ) {
+    for (li = mi->second.begin(); li != mi->second.end(); ) {
+      if (TIMEVAL_MSEC_SUBTRACT(*now, li->idle_since) >= POOL_IDLE_TIMEOUT) {
+        discard(li->conn);
+        li = mi->second.erase(li);
+        nidle--;
+      } else {
+        li++;
+      }
+    }
+    if (mi->second.empty())
+      conns.erase(mi++);
+    else
+      mi++;
+  }
+}
+
+bool NseConnPool::put(const std::string &key, void *conn, int af,
+                      const struct timeval *now)
+{
+  entry e;
+
+  expire(now);
+  if (nidle >= POOL_MAX_IDLE)
+    return false;
+  std::list<entry> &l = conns[key];
+  if (l.size() >= POOL_MAX_PER_KEY)
+    return false;
+  e.conn = conn;
+  e.af = af;
+  e.idle_since = *now;
+  l.push_back(e);
+  nidle++;
+  return true;
+}
+
+void *NseConnPool::get(const std::string &key, const struct timeval *now,
+                       int *af)
+{
+  std::map<std::string, std::list<entry> >::iterator mi;
+
+  expire(now);
+  mi = conns.find(key);
+  if (mi == conns.end())
+    return NULL;
+  while (!mi->second.empty()) {
+    entry e = mi->second.back();
+    mi->second.pop_back();
+    nidle--;
+    if (usable(e.conn)) {
+      *af = e.af;
+      if (mi->second.empty())
+        conns.erase(mi);
+      return e.conn;
+    }
+    discard(e.conn);
+  }
+  conns.erase(mi);
+  return NULL;
+}
+
+void NseConnPool::clear()
+{
+  conns.clear();
+  nidle = 0;
+  sessions.clear();
+}
+
+void NseConnPool::put_session(const std::string &key,
+                              const std::string &session)
+{
+  if (sessions.size() >= SSL_SESSION_CACHE_MAX
+      && sessions.find(key) == sessions.end())
+    sessions.erase(sessions.begin());
+  sessions[key] = session;
+}
+
+bool NseConnPool::get_session(const std::string &key, std::string &session)
+{
+  std::map<std::string, std::string>::iterator it;
+
+  it = sessions.find(key);
+  if (it == sessions.end())
+    return false;
+  session = it->second;
+  return true;
+}
+
+bool NseConnPool::fd_idle(int sd)
+{
+  struct timeval tv = {0, 0};
+  fd_set fds;
+
+  if (sd == -1)
+    return false;
+  FD_ZERO(&fds);
+  FD_SET(sd, &fds);
+  return select(sd + 1, &fds, NULL, NULL, &tv) == 0;
+}
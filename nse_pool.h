@@ -0,0 +1,77 @@
+#ifndef NSE_POOL
+#define NSE_POOL
+
+#include "nbase.h"
+
+#include <list>
+#include <map>
+#include <string>
+
+/* Idle connections and SSL sessions kept for reuse by NSE sockets
+ * (socket:checkout and socket:checkin).
+ *
+ * An idle connection is kept under a key, which the caller builds from the
+ * protocol, address and port, for at most POOL_IDLE_TIMEOUT milliseconds.
+ * Connections are opaque to the pool: the caller supplies one function that
+ * tells whether an idle connection can still be used and one that discards
+ * it. A connection is only handed out again if it is still usable, and the
+ * most recently returned one is preferred, being the least likely to have been
+ * timed out by the server.
+ *
+ * SSL sessions are stored serialized under a key of their own, so that each
+ * connect gets its own copy. As with NseCache, the current time is passed
+ * in. */
+#define POOL_IDLE_TIMEOUT  5000
+#define POOL_MAX_PER_KEY   4
+#define POOL_MAX_IDLE      64
+#define SSL_SESSION_CACHE_MAX 256
+
+class NseConnPool {
+public:
+  typedef bool (*usable_fn)(void *conn);
+  typedef void (*discard_fn)(void *conn);
+
+  NseConnPool(usable_fn usable, discard_fn discard);
+
+  /* Adds an idle connection. Returns false if the pool is full, in which case
+     the caller still owns conn. */
+  bool put(const std::string &key, void *conn, int af,
+           const struct timeval *now);
+
+  /* Returns a usable idle connection for key and sets *af to its address
+     family, or returns NULL if there is none. Unusable connections found on
+     the way are discarded. */
+  void *get(const std::string &key, const struct timeval *now, int *af);
+
+  /* Forgets all connections, without discarding them, and all sessions. */
+  void clear();
+
+  void put_session(const std::string &key, const std::string &session);
+
+  /* Sets session to the one stored under key and returns true, or returns
+     false if there is none. */
+  bool get_session(const std::string &key, std::string &session);
+
+  unsigned int idle() const { return nidle; }
+
+  /* Whether nothing is waiting to be read on an idle socket. A readable one
+     means either an EOF or data nobody asked for. */
+  static bool fd_idle(int sd);
+
+private:
+  struct entry {
+    void *conn;
+    int af;
+    struct timeval idle_since;
+  };
+
+  void expire(const struct timeval *now);
+
+  std::map<std::string, std::list<entry> > conns;
+  std::map<std::string, std::string> sessions;
+  unsigned int nidle;
+  usable_fn usable;
+  discard_fn discard;
+};
+
+#endif
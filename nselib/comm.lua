@@ -12,7 +12,10 @@
 -- lines. <code>"proto"</code> sets the protocol to communicate with,
 -- defaulting to <code>"tcp"</code> if not provided. <code>"timeout"</code>
 -- sets the socket timeout (see the socket function <code>set_timeout</code>
--- for details). 
+-- for details). <code>"cache"</code>, used only by <code>exchange</code>,
+-- is a number of seconds for which the response may be shared with other
+-- scripts sending the same data to the same port (see
+-- <code>nmap.cache_get</code>).
 --
 -- If both <code>"bytes"</code> and <code>"lines"</code> are provided,
 -- <code>"lines"</code> takes precedence. If neither are given, the functions
@@ -105,9 +108,7 @@ end
 -- @param opts The options. See the module description.
 -- @return Status (true or false).
 -- @return Data (if status is true) or error string (if status is false).
-exchange = function(host, port, data, opts)
-    opts = initopts(opts)
-
+local do_exchange = function(host, port, data, opts)
     local status, sock = setup_connect(host, port, opts)
     local ret
 
@@ -130,6 +131,35 @@ exchange = function(host, port, data, opts)
     return status, ret
 end
 
+exchange = function(host, port, data, opts)
+    opts = initopts(opts)
+
+    if not opts.cache then
+        return do_exchange(host, port, data, opts)
+    end
+
+    -- Only one thread at a time performs a given cacheable exchange, so that
+    -- concurrent scripts asking for the same thing wait for the first answer.
+    local key = table.concat({opts.proto, tostring(opts.lines),
+        tostring(opts.bytes), data}, "\0")
+    local mutex = nmap.mutex(table.concat({tostring(exchange),
+        type(host) == "table" and (host.ip or host.targetname) or host,
+        type(port) == "table" and port.number or port, key}, "|"))
+    mutex "lock"
+    local ret = nmap.cache_get(host, port, key)
+    if ret then
+        mutex "done"
+        return true, ret
+    end
+    local status
+    status, ret = do_exchange(host, port, data, opts)
+    if status then
+        nmap.cache_put(host, port, key, ret, opts.cache)
+    end
+    mutex "done"
+    return status, ret
+end
+
 --- This function just checks if the provided port number is on a list
 -- of ports that usually provide services with ssl
 --
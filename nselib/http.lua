@@ -897,45 +897,95 @@ local function buildCookies(cookies, path)
 end
 
 -- HTTP cache.
--- Cache of GET and HEAD requests. Uses <"host:port:path", record>.
--- record is in the format:
---   result: The result from http.get or http.head
+-- Responses to GET and HEAD requests are kept in the response cache shared by
+-- all scripts (see nmap.cache_put), under a key made of the method, the
+-- hostname, the port and the path. The response table is stored serialized,
+-- for CACHE_TTL seconds.
+--
+-- The entries this library stored are also listed in cache, as
+-- <key, record> and in its array part, so that their total size can be held
+-- to http.max-cache-size. record is in the format:
+--   host, port: Where the response came from, as given to nmap.cache_put.
+--   key: The key of the entry.
+--   size: The size of the serialized response.
 --   last_used: The time the record was last accessed or made.
---   get: Was the result received from a request to get or recently wiped?
---   size: The size of the record, equal to #record.result.body.
+--   expires: The time the shared cache drops the entry by itself.
+local CACHE_TTL = 600;
+
 local cache = {size = 0};
 
+-- Removes a record from cache, and its entry from the shared cache if drop is
+-- true.
+local function uncache (cache, record, drop)
+  if drop then
+    nmap.cache_put(record.host, record.port, record.key, "", 0);
+  end
+  cache.size = cache.size - record.size;
+  cache[record.key] = nil;
+  for i, r in ipairs(cache) do
+    if r == record then
+      table.remove(cache, i);
+      break;
+    end
+  end
+end
+
 local function check_size (cache)
   local max_size = tonumber(stdnse.get_script_args({'http.max-cache-size', 'http-max-cache-size'}) or 1e6);
+  local now = os.time();
 
-  local size = cache.size;
+  for i = #cache, 1, -1 do
+    if cache[i].expires <= now then
+      uncache(cache, cache[i], false);
+    end
+  end
 
-  if size > max_size then
+  if cache.size > max_size then
     stdnse.print_debug(1,
         "Current http cache size (%d bytes) exceeds max size of %d",
-        size, max_size);
+        cache.size, max_size);
     table.sort(cache, function(r1, r2)
-      return (r1.last_used or 0) < (r2.last_used or 0);
+      return r1.last_used < r2.last_used;
     end);
 
-    for i, record in ipairs(cache) do
-      if size <= max_size then break end
-      local result = record.result;
-      if type(result.body) == "string" then
-        size = size - record.size;
-        record.size, record.get, result.body = 0, false, "";
-      end
+    while cache.size > max_size and #cache > 0 do
+      uncache(cache, cache[1], true);
     end
-    cache.size = size;
   end
   stdnse.print_debug(2, "Final http cache size (%d bytes) of max size of %d",
-      size, max_size);
-  return size;
+      cache.size, max_size);
+  return cache.size;
 end
 
--- Unique value to signal value is being retrieved.
--- Also holds <mutex, thread> pairs, working thread is value
-local WORKING = setmetatable({}, {__mode = "v"});
+-- Serialize a table of strings, numbers, booleans and tables as a Lua
+-- constructor that deserialize can load.
+local function serialize (t)
+  local out = {};
+  for k, v in pairs(t) do
+    local kv = {};
+    for i, x in ipairs({k, v}) do
+      local tx = type(x);
+      if tx == "table" then
+        kv[i] = serialize(x);
+      elseif tx == "string" then
+        kv[i] = string.format("%q", x);
+      elseif tx == "number" then
+        kv[i] = string.format("%.17g", x);
+      elseif tx == "boolean" then
+        kv[i] = tostring(x);
+      end
+    end
+    if kv[1] and kv[2] then
+      out[#out+1] = "[" .. kv[1] .. "]=" .. kv[2];
+    end
+  end
+  return "{" .. table.concat(out, ",") .. "}";
+end
+
+local function deserialize (s)
+  local f = load("return " .. s, "http cache", "t", {});
+  return f and f();
+end
 
 local function lookup_cache (method, host, port, path, options)
   if(not(validate_options(options))) then
@@ -947,40 +997,33 @@ local function lookup_cache (method, host, port, path, options)
   local no_cache = options.no_cache; -- do not save result
   local no_cache_body = options.no_cache_body; -- do not save body
 
-  if type(port) == "table" then port = port.number end
-
-  local key = stdnse.get_hostname(host)..":"..port..":"..path;
+  local portno = type(port) == "table" and port.number or port;
+  local key = method..":"..stdnse.get_hostname(host)..":"..portno..":"..path;
   local mutex = nmap.mutex(tostring(lookup_cache)..key);
 
   local state = {
     mutex = mutex,
+    host = host,
+    port = port,
     key = key,
-    method = method,
-    bypass_cache = bypass_cache,
     no_cache = no_cache,
     no_cache_body = no_cache_body,
   };
 
-  while true do
-    mutex "lock";
-    local record = cache[key];
-    if bypass_cache or record == nil or method ~= record.method then
-      WORKING[mutex] = coroutine.running();
-      cache[key], state.old_record = WORKING, record;
-      return nil, state;
-    elseif record == WORKING then
-      local working = WORKING[mutex];
-      if working == nil or coroutine.status(working) == "dead" then
-        -- thread died before insert_cache could be called
-        cache[key] = nil; -- reset
-      end
-      mutex "done";
-    else
-      mutex "done";
-      record.last_used = os.time();
-      return tcopy(record.result), state;
-    end
+  -- The mutex is held until insert_cache, so that a thread asking for the
+  -- same resource waits for the response (the mutex is released if this
+  -- thread dies first).
+  mutex "lock";
+  local record = not bypass_cache and nmap.cache_get(host, port, key);
+  local result = record and deserialize(record);
+  if result == nil then
+    return nil, state;
+  end
+  if cache[key] then
+    cache[key].last_used = os.time();
   end
+  mutex "done";
+  return result, state;
 end
 
 local function response_is_cacheable(response)
@@ -1011,23 +1054,30 @@ local function insert_cache (state, response)
   local key = assert(state.key);
   local mutex = assert(state.mutex);
 
-  if response == nil or state.no_cache or not response_is_cacheable(response) then
-    cache[key] = state.old_record;
-  else
-    local record = {
-      result = tcopy(response),
-      last_used = os.time(),
-      method = state.method,
-      size = type(response.body) == "string" and #response.body or 0,
-    };
-    response = record.result; -- only modify copy
-    cache[key], cache[#cache+1] = record, record;
+  if response ~= nil and not state.no_cache and response_is_cacheable(response) then
+    local result = tcopy(response); -- only modify copy
     if state.no_cache_body then
-      response.body = "";
-    end
-    if type(response.body) == "string" then
-      cache.size = cache.size + #response.body;
+      result.body = "";
+    end
+    local value = serialize(result);
+    if cache[key] then
+      uncache(cache, cache[key], false);
+    end
+    if nmap.cache_put(state.host, state.port, key, value, CACHE_TTL) then
+      local now = os.time();
+      local record = {
+        host = state.host,
+        port = state.port,
+        key = key,
+        size = #value,
+        last_used = now,
+        expires = now + CACHE_TTL,
+      };
+      cache[key], cache[#cache+1] = record, record;
+      cache.size = cache.size + record.size;
       check_size(cache);
+    else
+      stdnse.print_debug(1, "http: response for %s is too large to cache", key);
     end
   end
   mutex "done";
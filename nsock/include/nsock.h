@@ -482,6 +482,11 @@ nsock_event_id nsock_readbytes(nsock_pool nsp, nsock_iod nsiod,
  * anything, otherwise it returns timeout, eof, or error as appropriate */
 nsock_event_id nsock_read(nsock_pool nsp, nsock_iod nsiod, nsock_ev_handler handler, int timeout_msecs, void *userdata);
 
+/* Signal readability of the IOD without reading anything from it. The caller
+ * does the I/O itself once the handler gets NSE_STATUS_SUCCESS, which makes it
+ * possible to watch listening sockets and accept() incoming connections */
+nsock_event_id nsock_readready(nsock_pool nsp, nsock_iod nsiod, nsock_ev_handler handler, int timeout_msecs, void *userdata);
+
 /* Write some data to the socket.  If the write is not COMPLETED within
  * timeout_msecs , NSE_STATUS_TIMEOUT will be returned.  If you are supplying
  * NUL-terminated data, you can optionally pass -1 for datalen and nsock_write
@@ -129,6 +129,10 @@ struct epoll_engine_info {
   int evlen;
   /* list of epoll events, resized if necessary (when polling over large numbers of IODs) */
   struct epoll_event *events;
+  /* number of IODs with watched events that epoll refused to register (regular
+   * files, /dev/null...). Those are always ready, so we don't block while there
+   * are any */
+  int nopoll_count;
 };
 
 
@@ -140,6 +144,7 @@ int epoll_init(mspool *nsp) {
   einfo->epfd = epoll_create(10); /* argument is ignored */
   einfo->evlen = INITIAL_EV_COUNT;
   einfo->events = (struct epoll_event *)safe_malloc(einfo->evlen * sizeof(struct epoll_event));
+  einfo->nopoll_count = 0;
 
   nsp->engine_data = (void *)einfo;
 
@@ -176,27 +181,40 @@ int epoll_iod_register(mspool *nsp, msiod *iod, int ev) {
     epev.events |= EPOLL_X_FLAGS;
 
   sd = nsi_getsd(iod);
-  if (epoll_ctl(einfo->epfd, EPOLL_CTL_ADD, sd, &epev) < 0)
-    fatal("Unable to register IOD #%lu: %s", iod->id, strerror(errno));
+  if (epoll_ctl(einfo->epfd, EPOLL_CTL_ADD, sd, &epev) < 0) {
+    /* EPERM means that the descriptor doesn't support polling at all, which is
+     * the case of regular files (e.g. stdin redirected from a file). Such
+     * descriptors never block, so treat them as permanently ready. */
+    if (errno != EPERM)
+      fatal("Unable to register IOD #%lu: %s", iod->id, strerror(errno));
+    IOD_PROPSET(iod, IOD_NOPOLL);
+    if (ev != EV_NONE)
+      einfo->nopoll_count++;
+  }
 
   IOD_PROPSET(iod, IOD_REGISTERED);
   return 1;
 }
 
 int epoll_iod_unregister(mspool *nsp, msiod *iod) {
-  iod->watched_events = EV_NONE;
-
   /* some IODs can be unregistered here if they're associated to an event that was
    * immediately completed */
   if (IOD_PROPGET(iod, IOD_REGISTERED)) {
     struct epoll_engine_info *einfo = (struct epoll_engine_info *)nsp->engine_data;
     int sd;
 
-    sd = nsi_getsd(iod);
-    epoll_ctl(einfo->epfd, EPOLL_CTL_DEL, sd, NULL);
+    if (IOD_PROPGET(iod, IOD_NOPOLL)) {
+      if (iod->watched_events != EV_NONE)
+        einfo->nopoll_count--;
+      IOD_PROPCLR(iod, IOD_NOPOLL);
+    } else {
+      sd = nsi_getsd(iod);
+      epoll_ctl(einfo->epfd, EPOLL_CTL_DEL, sd, NULL);
+    }
 
     IOD_PROPCLR(iod, IOD_REGISTERED);
   }
+  iod->watched_events = EV_NONE;
   return 1;
 }
 
@@ -219,6 +237,15 @@ int epoll_iod_modify(mspool *nsp, msiod *iod, int ev_set, int ev_clr) {
   if (new_events == iod->watched_events)
     return 1; /* nothing to do */
 
+  if (IOD_PROPGET(iod, IOD_NOPOLL)) {
+    if (iod->watched_events == EV_NONE)
+      einfo->nopoll_count++;
+    else if (new_events == EV_NONE)
+      einfo->nopoll_count--;
+    iod->watched_events = new_events;
+    return 1;
+  }
+
   iod->watched_events = new_events;
 
   /* regenerate the current set of events for this IOD */
@@ -275,6 +302,10 @@ int epoll_loop(mspool *nsp, int msec_timeout) {
      * timeout) */
     combined_msecs = MIN((unsigned)event_msecs, (unsigned)msec_timeout);
 
+    /* IODs that can't be polled are always ready, don't wait for the others */
+    if (einfo->nopoll_count > 0)
+      combined_msecs = 0;
+
 #if HAVE_PCAP
     /* do non-blocking read on pcap devices that doesn't support select()
      * If there is anything read, just leave this loop. */
@@ -374,8 +405,12 @@ void iterate_through_event_lists(mspool *nsp, int evcount) {
   while (current != NULL && GH_LIST_ELEM_PREV(current) != last) {
     msiod *nsi = (msiod *)GH_LIST_ELEM_DATA(current);
 
-    if (nsi->state != NSIOD_STATE_DELETED && nsi->events_pending)
-      process_iod_events(nsp, nsi, EV_NONE);
+    if (nsi->state != NSIOD_STATE_DELETED && nsi->events_pending) {
+      if (IOD_PROPGET(nsi, IOD_NOPOLL))
+        process_iod_events(nsp, nsi, nsi->watched_events);
+      else
+        process_iod_events(nsp, nsi, EV_NONE);
+    }
 
     next = GH_LIST_ELEM_NEXT(current);
     if (nsi->state == NSIOD_STATE_DELETED) {
@@ -736,6 +736,11 @@ void handle_read_result(mspool *ms, msevent *nse, enum nse_status status) {
   } else if (status == NSE_STATUS_CANCELLED) {
     nse->status = status;
     nse->event_done = 1;
+  } else if (status == NSE_STATUS_SUCCESS && nse->readinfo.read_type == NSOCK_READREADY) {
+    /* The caller only wants to know that the descriptor became readable and
+     * will do the actual I/O itself (e.g. accept() on a listening socket). */
+    nse->status = NSE_STATUS_SUCCESS;
+    nse->event_done = 1;
   } else if (status == NSE_STATUS_SUCCESS) {
     rc = do_actual_read(ms, nse);
     /* printf("DBG: Just read %d new bytes%s.\n", rc, iod->ssl? "( SSL!)" : ""); */
@@ -108,7 +108,8 @@
 enum nsock_read_types {
   NSOCK_READLINES,
   NSOCK_READBYTES,
-  NSOCK_READ
+  NSOCK_READ,
+  NSOCK_READREADY
 };
 
 enum msiod_state {
@@ -265,6 +266,7 @@ typedef struct {
   gh_list_elem *entry_in_nsp_active_iods;
 
 #define IOD_REGISTERED  0x01
+#define IOD_NOPOLL      0x02
 
 #define IOD_PROPSET(iod, flag)  ((iod)->_flags |= (flag))
 #define IOD_PROPCLR(iod, flag)  ((iod)->_flags &= ~(flag))
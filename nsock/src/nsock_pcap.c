@@ -348,6 +348,14 @@ nsock_event_id nsock_pcap_read_packet(nsock_pool nsp, nsock_iod nsiod,
 
   nsp_add_event(ms, nse);
 
+#if PCAP_CAN_DO_SELECT && !PCAP_BSD_SELECT_HACK
+  /* The descriptor may not signal again for packets that libpcap already
+   * holds (the epoll engine is edge-triggered), so check for one now.
+   * Otherwise it would sit there until some other packet arrives. */
+  if (((mspcap *)nsi->pcap)->pcap_desc >= 0 && do_actual_pcap_read(nse) == 1)
+    ms->next_ev = nsock_tod;
+#endif
+
   return nse->id;
 }
 
@@ -144,3 +144,25 @@ nsock_event_id nsock_read(nsock_pool nsp, nsock_iod ms_iod, nsock_ev_handler han
   return nse->id;
 }
 
+/* Like nsock_read, but nothing is read from the descriptor: the event completes
+ * with NSE_STATUS_SUCCESS as soon as the IOD is readable and the caller is
+ * expected to do the I/O itself. This is how listening sockets are watched for
+ * incoming connections. */
+nsock_event_id nsock_readready(nsock_pool nsp, nsock_iod ms_iod, nsock_ev_handler handler, int timeout_msecs, void *userdata) {
+  msiod *nsi = (msiod *)ms_iod;
+  mspool *ms = (mspool *)nsp;
+  msevent *nse;
+
+  nse = msevent_new(ms, NSE_TYPE_READ, nsi, timeout_msecs, handler, userdata);
+  assert(nse);
+
+  if (ms->tracelevel > 0)
+    nsock_trace(ms, "Readiness request from IOD #%li (timeout: %dms) EID %li",
+                nsi->id, timeout_msecs, nse->id);
+
+  nse->readinfo.read_type = NSOCK_READREADY;
+
+  nsp_add_event(ms, nse);
+
+  return nse->id;
+}
@@ -122,17 +122,13 @@
 extern NmapOps o;
 
 /* Store a string uniquely. The first time this function is called with a
-   certain string, it allocates memory and stores a copy of the string in a
-   static pool. Thereafter it will return a pointer to the saved string instead
-   of allocating memory for an identical one. */
+   certain string, it allocates memory and stores a copy of the string in the
+   current character pool (see cp_current). Thereafter it will return a pointer
+   to the saved string instead of allocating memory for an identical one. The
+   string is freed along with the pool. */
 const char *string_pool_insert(const char *s)
 {
-  static std::set<std::string> pool;
-  static std::pair<std::set<std::string>::iterator, bool> pair;
-
-  pair = pool.insert(s);
-
-  return pair.first->c_str();
+  return cp_current()->intern(s);
 }
 
 const char *string_pool_substr(const char *s, const char *t)
@@ -1103,7 +1099,7 @@ FingerPrint *parse_single_fingerprint(char *fprint_orig) {
         while (q > p && isspace((int) (unsigned char) *(--q)))
           ;
 
-        FP->match.OS_name = (char *) cp_alloc(q - p + 2);
+        FP->match.OS_name = (char *) cp_current()->alloc(q - p + 2);
         memcpy(FP->match.OS_name, p, q - p + 1);
         FP->match.OS_name[q - p + 1] = '\0';
       }
@@ -1166,6 +1162,9 @@ FingerPrintDB *parse_fingerprint_file(const char *fname) {
   if (!DB)
     fatal("non-allocated DB passed to %s", __func__);
 
+  /* The strings of the database belong to it. */
+  CharPoolScope strings_scope(&DB->strings);
+
   fp = fopen(fname, "r");
   if (!fp)
     fatal("Unable to open Nmap fingerprint file: %s", fname);
@@ -1210,7 +1209,7 @@ fparse:
       if (q < p)
         fatal("Parse error on line %d of fingerprint: %s", lineno, line);
 
-      current->match.OS_name = (char *) cp_alloc(q - p + 2);
+      current->match.OS_name = (char *) DB->strings.alloc(q - p + 2);
       memcpy(current->match.OS_name, p, q - p + 1);
       current->match.OS_name[q - p + 1] = '\0';
     }
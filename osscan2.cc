@@ -150,6 +150,9 @@ u16 prbWindowSz[] = { 1, 63, 4, 4, 16, 512, 3, 128, 256, 1024, 31337, 32768, 655
 /* Current time. It is globally accessible so it can save calls to gettimeofday() */
 static struct timeval now;
 
+/* Network controller shared with the IPv6 engine (see FPEngine.cc) */
+extern FPNetworkControl global_netctl;
+
 /* Global to store performance info */
 struct scan_performance_vars perf;
 
@@ -327,60 +330,6 @@ static void startTimeOutClocks(OsScanInfo *OSI) {
 }
 
 
-/** Sets up the pcap descriptor in HOS (obtains a descriptor and sets the
- * appropriate BPF filter, based on the supplied list of targets). */
-static void begin_sniffer(HostOsScan *HOS, vector<Target *> &Targets) {
-  char pcap_filter[2048];
-  /* 20 IPv6 addresses is max (45 byte addy + 14 (" or src host ")) * 20 == 1180 */
-  char dst_hosts[1200];
-  int filterlen = 0;
-  int len;
-  unsigned int targetno;
-  bool doIndividual = Targets.size() <= 20; // Don't bother IP limits if scanning huge # of hosts
-  pcap_filter[0] = '\0';
-
-  /* If we have 20 or less targets, build a list of addresses so we can set
-   * an explicit BPF filter */
-  if (doIndividual) {
-    for (targetno = 0; targetno < Targets.size(); targetno++) {
-      len = Snprintf(dst_hosts + filterlen,
-                     sizeof(dst_hosts) - filterlen,
-                     "%ssrc host %s", (targetno == 0)? "" : " or ",
-                     Targets[targetno]->targetipstr());
-      if (len < 0 || len + filterlen >= (int) sizeof(dst_hosts))
-        fatal("ran out of space in dst_hosts");
-      filterlen += len;
-    }
-    len = Snprintf(dst_hosts + filterlen, sizeof(dst_hosts) - filterlen, ")))");
-    if (len < 0 || len + filterlen >= (int) sizeof(dst_hosts))
-      fatal("ran out of space in dst_hosts");
-  }
-
-  /* Open a network interface for packet capture */
-  HOS->pd = my_pcap_open_live(Targets[0]->deviceName(), 8192,
-    o.spoofsource ? 1 : 0, pcap_selectable_fd_valid() ? 200 : 2);
-  if (HOS->pd == NULL)
-    fatal("%s", PCAP_OPEN_ERRMSG);
-
-  /* Build the final BPF filter */
-  if (doIndividual)
-    len = Snprintf(pcap_filter, sizeof(pcap_filter), "dst host %s and (icmp or (tcp and (%s",
-                   inet_ntoa(Targets[0]->v4source()), dst_hosts);
-  else
-    len = Snprintf(pcap_filter, sizeof(pcap_filter), "dst host %s and (icmp or tcp)",
-                   inet_ntoa(Targets[0]->v4source()));
-  if (len < 0 || len >= (int) sizeof(pcap_filter))
-    fatal("ran out of space in pcap filter");
-
-  /* Compile and apply the filter to the pcap descriptor */
-  if (o.debugging)
-    log_write(LOG_PLAIN, "Packet capture filter (device %s): %s\n", Targets[0]->deviceFullName(), pcap_filter);
-  set_pcap_filter(Targets[0]->deviceFullName(), HOS->pd, pcap_filter);
-
-  return;
-}
-
-
 /* Sets everything up so the current round can be performed. This includes
  * reinitializing some variables of the supplied objects and deleting
  * some old information. */
@@ -401,342 +350,30 @@ static void startRound(OsScanInfo *OSI, HostOsScan *HOS, int roundNum) {
   }
 }
 
-/* Run the sequence generation tests (6 TCP probes sent 100ms apart) */
-static void doSeqTests(OsScanInfo *OSI, HostOsScan *HOS) {
-  list<HostOsScanInfo *>::iterator hostI;
-  HostOsScanInfo *hsi = NULL;
-  HostOsScanStats *hss = NULL;
-  unsigned int unableToSend = 0;  /* # of times in a row that hosts were unable to send probe */
-  unsigned int expectReplies = 0;
-  long to_usec = 0;
-  int timeToSleep = 0;
-  struct ip *ip = NULL;
-  struct link_header linkhdr;
-  struct sockaddr_storage ss;
-  unsigned int bytes = 0;
-  struct timeval rcvdtime;
-  struct timeval stime;
-  struct timeval tmptv;
-  bool timedout = false;
-  bool thisHostGood = false;
-  bool foundgood = false;
-  bool goodResponse = false;
-  int numProbesLeft = 0;
-
-  memset(&stime, 0, sizeof(stime));
-  memset(&tmptv, 0, sizeof(tmptv));
-
-  /* For each host, build a list of sequence probes to send */
-  for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
-    hsi = *hostI;
-    hss = hsi->hss;
-    HOS->buildSeqProbeList(hss);
-  }
-
-  /* Iterate until we have sent all the probes */
-  do {
-    if (timeToSleep > 0) {
-      if (o.debugging > 1)
-        log_write(LOG_PLAIN, "Sleep %dus for next sequence probe\n", timeToSleep);
-      usleep(timeToSleep);
-    }
-
-    gettimeofday(&now, NULL);
-    expectReplies = 0;
-    unableToSend = 0;
-
-    if (o.debugging > 2) {
-      for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
-        hss = (*hostI)->hss;
-        log_write(LOG_PLAIN, "Host %s. ProbesToSend %d: \tProbesActive %d\n",
-                  hss->target->targetipstr(), hss->numProbesToSend(),
-                  hss->numProbesActive());
-      }
-    }
-
-    /* Send a seq probe to each host. */
-    while (unableToSend < OSI->numIncompleteHosts() && HOS->stats->sendOK()) {
-      hsi = OSI->nextIncompleteHost();
-      hss = hsi->hss;
-      gettimeofday(&now, NULL);
-      if (hss->numProbesToSend()>0 && HOS->hostSeqSendOK(hss, NULL)) {
-        HOS->sendNextProbe(hss);
-        expectReplies++;
-        unableToSend = 0;
-      } else {
-        unableToSend++;
-      }
-    }
-
-    HOS->stats->num_probes_sent_at_last_wait = HOS->stats->num_probes_sent;
-
-    gettimeofday(&now, NULL);
-
-    /* Count the pcap wait time. */
-    if (!HOS->stats->sendOK()) {
-      TIMEVAL_MSEC_ADD(stime, now, 1000);
-
-      for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
-        if (HOS->nextTimeout((*hostI)->hss, &tmptv)) {
-          if (TIMEVAL_SUBTRACT(tmptv, stime) < 0)
-            stime = tmptv;
-        }
-      }
-    } else {
-      foundgood = false;
-      for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
-        thisHostGood = HOS->hostSeqSendOK((*hostI)->hss, &tmptv);
-        if (thisHostGood) {
-          stime = tmptv;
-          foundgood = true;
-          break;
-        }
-
-        if (!foundgood || TIMEVAL_SUBTRACT(tmptv, stime) < 0) {
-          stime = tmptv;
-          foundgood = true;
-        }
-      }
-    }
-
-    do {
-      to_usec = TIMEVAL_SUBTRACT(stime, now);
-      if (to_usec < 2000)
-        to_usec = 2000;
-
-      if (o.debugging > 2)
-        log_write(LOG_PLAIN, "pcap wait time is %ld.\n", to_usec);
-
-      ip = (struct ip*) readipv4_pcap(HOS->pd, &bytes, to_usec, &rcvdtime, &linkhdr, true);
-
-      gettimeofday(&now, NULL);
-
-      if (!ip && TIMEVAL_SUBTRACT(stime, now) < 0) {
-        timedout = true;
-        break;
-      } else if (!ip) {
-        continue;
-      }
-
-      if (TIMEVAL_SUBTRACT(now, stime) > 200000) {
-        /* While packets are still being received, I'll be generous and give
-           an extra 1/5 sec.  But we have to draw the line somewhere */
-        timedout = true;
-      }
-
-      if (bytes < (4 * ip->ip_hl) + 4U)
-        continue;
-
-      memset(&ss, 0, sizeof(ss));
-      ((struct sockaddr_in *) &ss)->sin_addr.s_addr = ip->ip_src.s_addr;
-      ss.ss_family = AF_INET;
-      hsi = OSI->findIncompleteHost(&ss);
-      if (!hsi)
-        continue; /* Not from one of our targets. */
-      setTargetMACIfAvailable(hsi->target, &linkhdr, &ss, 0);
-
-      goodResponse = HOS->processResp(hsi->hss, ip, bytes, &rcvdtime);
-
-      if (goodResponse)
-        expectReplies--;
-
-    } while (!timedout && expectReplies > 0);
-
-    /* Remove any timeout hosts during the scan. */
-    OSI->removeCompletedHosts();
-
-    numProbesLeft = 0;
-    for (hostI = OSI->incompleteHosts.begin();
-        hostI != OSI->incompleteHosts.end(); hostI++) {
-      hss = (*hostI)->hss;
-      HOS->updateActiveSeqProbes(hss);
-      numProbesLeft += hss->numProbesToSend();
-      numProbesLeft += hss->numProbesActive();
-    }
-
-    gettimeofday(&now, NULL);
-
-    if (expectReplies == 0) {
-      timeToSleep = TIMEVAL_SUBTRACT(stime, now);
-    } else {
-      timeToSleep = 0;
-    }
-
-  } while (numProbesLeft > 0);
-
+/* Returns whether the next probe of a host may be sent now, using the rules
+ * of the phase the host is in. See hostSeqSendOK() and hostSendOK(). */
+static bool hostPhaseSendOK(HostOsScan *HOS, HostOsScanStats *hss,
+                            struct timeval *when) {
+  if (!hss->seqDone)
+    return HOS->hostSeqSendOK(hss, when);
+  return HOS->hostSendOK(hss, when);
 }
 
-
-/* TCP, UDP, ICMP Tests */
-static void doTUITests(OsScanInfo *OSI, HostOsScan *HOS) {
-  list<HostOsScanInfo *>::iterator hostI;
-  HostOsScanInfo *hsi = NULL;
-  HostOsScanStats *hss = NULL;
-  unsigned int unableToSend; /* # of times in a row that hosts were unable to send probe */
-  unsigned int expectReplies;
-  long to_usec;
-  int timeToSleep = 0;
-
-  struct ip *ip = NULL;
-  struct link_header linkhdr;
-  struct sockaddr_storage ss;
-  unsigned int bytes;
-  struct timeval rcvdtime;
-
-  struct timeval stime, tmptv;
-
-  bool timedout = false;
-  bool thisHostGood;
-  bool foundgood;
-  bool goodResponse;
-  int numProbesLeft = 0;
-
-  memset(&stime, 0, sizeof(stime));
-  memset(&tmptv, 0, sizeof(tmptv));
-
-  for (hostI = OSI->incompleteHosts.begin();
-      hostI != OSI->incompleteHosts.end(); hostI++) {
-    hsi = *hostI;
-    hss = hsi->hss;
-    HOS->buildTUIProbeList(hss);
-  }
-
-  do {
-
-    if (timeToSleep > 0) {
-      if (o.debugging > 1) {
-        log_write(LOG_PLAIN, "Time to sleep %d. Sleeping. \n", timeToSleep);
-      }
-
-      usleep(timeToSleep);
-    }
-
-    gettimeofday(&now, NULL);
-    expectReplies = 0;
-    unableToSend = 0;
-
-    if (o.debugging > 2) {
-      for (hostI = OSI->incompleteHosts.begin();
-          hostI != OSI->incompleteHosts.end(); hostI++) {
-        hss = (*hostI)->hss;
-        log_write(LOG_PLAIN, "Host %s. ProbesToSend %d: \tProbesActive %d\n",
-                  hss->target->targetipstr(), hss->numProbesToSend(),
-                  hss->numProbesActive());
-      }
-    }
-
-    while (unableToSend < OSI->numIncompleteHosts() && HOS->stats->sendOK()) {
-      hsi = OSI->nextIncompleteHost();
-      hss = hsi->hss;
-      gettimeofday(&now, NULL);
-      if (hss->numProbesToSend()>0 && HOS->hostSendOK(hss, NULL)) {
-        HOS->sendNextProbe(hss);
-        expectReplies++;
-        unableToSend = 0;
-      } else {
-        unableToSend++;
-      }
-    }
-
-    HOS->stats->num_probes_sent_at_last_wait = HOS->stats->num_probes_sent;
-
-    gettimeofday(&now, NULL);
-
-    /* Count the pcap wait time. */
-    if (!HOS->stats->sendOK()) {
-      TIMEVAL_MSEC_ADD(stime, now, 1000);
-
-      for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end();
-          hostI++) {
-        if (HOS->nextTimeout((*hostI)->hss, &tmptv)) {
-          if (TIMEVAL_SUBTRACT(tmptv, stime) < 0)
-            stime = tmptv;
-        }
-      }
-    }
-    else {
-      foundgood = false;
-      for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
-        thisHostGood = HOS->hostSendOK((*hostI)->hss, &tmptv);
-        if (thisHostGood) {
-          stime = tmptv;
-          foundgood = true;
-          break;
-        }
-
-        if (!foundgood || TIMEVAL_SUBTRACT(tmptv, stime) < 0) {
-          stime = tmptv;
-          foundgood = true;
-        }
-      }
-    }
-
-    do {
-      to_usec = TIMEVAL_SUBTRACT(stime, now);
-      if (to_usec < 2000) to_usec = 2000;
-
-      if (o.debugging > 2)
-        log_write(LOG_PLAIN, "pcap wait time is %ld.\n", to_usec);
-
-      ip = (struct ip*) readipv4_pcap(HOS->pd, &bytes, to_usec, &rcvdtime, &linkhdr, true);
-
-      gettimeofday(&now, NULL);
-
-      if (!ip && TIMEVAL_SUBTRACT(stime, now) < 0) {
-        timedout = true;
-        break;
-      } else if (!ip) {
-        continue;
-      }
-
-      if (TIMEVAL_SUBTRACT(now, stime) > 200000) {
-        /* While packets are still being received, I'll be generous and give
-           an extra 1/5 sec.  But we have to draw the line somewhere */
-        timedout = true;
-      }
-
-      if (bytes < (4 * ip->ip_hl) + 4U)
-        continue;
-
-      memset(&ss, 0, sizeof(ss));
-      ((struct sockaddr_in *) &ss)->sin_addr.s_addr = ip->ip_src.s_addr;
-      ss.ss_family = AF_INET;
-      hsi = OSI->findIncompleteHost(&ss);
-      if (!hsi)
-        continue; /* Not from one of our targets. */
-      setTargetMACIfAvailable(hsi->target, &linkhdr, &ss, 0);
-
-      goodResponse = HOS->processResp(hsi->hss, ip, bytes, &rcvdtime);
-
-      if (goodResponse)
-        expectReplies--;
-
-    } while (!timedout && expectReplies > 0);
-
-    /* Remove any timeout hosts during the scan. */
-    OSI->removeCompletedHosts();
-
-    numProbesLeft = 0;
-    for (hostI = OSI->incompleteHosts.begin();
-        hostI != OSI->incompleteHosts.end(); hostI++) {
-      hss = (*hostI)->hss;
-      HOS->updateActiveTUIProbes(hss);
-      numProbesLeft += hss->numProbesToSend();
-      numProbesLeft += hss->numProbesActive();
+/* Expires or retransmits the timed out probes of a host. A host whose
+ * sequence probes are all answered or expired moves on to the TCP/UDP/ICMP
+ * probes right away, without waiting for the other hosts of the round. */
+static void updateHostProbes(HostOsScan *HOS, HostOsScanStats *hss) {
+  if (!hss->seqDone) {
+    HOS->updateActiveSeqProbes(hss);
+    if (hss->numProbesToSend() == 0 && hss->numProbesActive() == 0) {
+      hss->seqDone = true;
+      HOS->buildTUIProbeList(hss);
     }
-
-    gettimeofday(&now, NULL);
-
-    if (expectReplies == 0) {
-      timeToSleep = TIMEVAL_SUBTRACT(stime, now);
-    } else {
-      timeToSleep = 0;
-    }
-
-  } while (numProbesLeft > 0);
+  } else {
+    HOS->updateActiveTUIProbes(hss);
+  }
 }
 
-
 static void endRound(OsScanInfo *OSI, HostOsScan *HOS, int roundNum) {
   list<HostOsScanInfo *>::iterator hostI;
   HostOsScanInfo *hsi = NULL;
@@ -958,6 +595,7 @@ HostOsScanStats::HostOsScanStats(Target * t) {
 
   distance = -1;
   distance_guess = -1;
+  seqDone = false;
 }
 
 
@@ -994,6 +632,8 @@ void HostOsScanStats::initScanStats() {
   Port port;
   int i;
 
+  seqDone = false;
+
   /* Lets find an open port to use if we don't already have one */
   openTCPPort = -1;
   /*  target->FPR->osscan_opentcpport = -1;
@@ -1259,7 +899,6 @@ void HostOsScan::adjust_times(HostOsScanStats *hss, OFProbe *probe, struct timev
 
 
 HostOsScan::HostOsScan(Target *t) {
-  pd = NULL;
   rawsd = -1;
   ethsd = NULL;
 
@@ -1295,10 +934,6 @@ HostOsScan::~HostOsScan() {
     close(rawsd);
     rawsd = -1;
   }
-  if (pd) {
-    pcap_close(pd);
-    pd = NULL;
-  }
   /*
    * No need to close ethsd due to caching
    * if (ethsd) {
@@ -1364,7 +999,7 @@ void HostOsScan::buildTUIProbeList(HostOsScanStats *hss) {
   /* The order of these probes are important for ipid generation
    * algorithm test and should not be changed.
    *
-   * At doSeqTests we sent 6 TSeq probes to generate 6 tcp replies,
+   * Before this we sent 6 TSeq probes to generate 6 tcp replies,
    * and here we follow with 3 probes to generate 3 icmp replies. In
    * this way we can expect to get "good" IPid sequence.
    *
@@ -3460,78 +3095,222 @@ int OsScanInfo::removeCompletedHosts() {
 }
 
 /******************************************************************************
- * Implementation of class OSScan()                                           *
+ * Implementation of class FPHost4                                            *
  ******************************************************************************/
 
-/* Constructor */
-OSScan::OSScan() {
-  this->reset();
-  return;
+FPHost4::FPHost4(HostOsScanStats *hss, HostOsScan *hos, FPNetworkControl *fpnc) {
+  this->__reset();
+  this->hss = hss;
+  this->hos = hos;
+  this->target_host = hss->target;
+  this->netctl = fpnc;
 }
 
-/* Destructor */
-OSScan::~OSScan() {
-  return;
+
+FPHost4::~FPHost4() {
+  if (this->netctl_registered) {
+    this->netctl->unregister_caller(this);
+    this->netctl_registered = false;
+  }
 }
 
-/* Function that initializes internal variables */
-void OSScan::reset() {
 
+/* Probes are built by HostOsScan, one phase at a time (see
+ * updateHostProbes()), so there is nothing to do here. */
+int FPHost4::build_probe_list() {
+  return OP_SUCCESS;
 }
 
 
-/* This function takes a group of targets and divides it in chunks if there are
- * too many to be processed at the same time. The threshold is based on Nmap's
- * timing level (when timing level is above 4, no chunking is performed).
- * The reason targets are processed in smaller groups is to improve accuracy. */
-int OSScan::chunk_and_do_scan(vector<Target *> &Targets, int family) {
-  unsigned int max_os_group_sz = 20;
-  double fudgeratio = 1.2; /* Allow a slightly larger final group rather than finish with a tiny one */
-  vector<Target *> tmpTargets;
-  unsigned int startidx = 0;
+/* Returns true if the host has no more probes to send or to wait for in
+ * the current round, or if it has timed out. */
+bool FPHost4::done() {
+  if (this->target_host->timedOut(&now))
+    return true;
+  return this->hss->seqDone && this->hss->numProbesToSend() == 0
+         && this->hss->numProbesActive() == 0;
+}
 
-  if (o.timing_level == 4)
-    max_os_group_sz = (unsigned int) (max_os_group_sz * 1.5);
 
-  if (o.timing_level > 4 || Targets.size() <= max_os_group_sz * fudgeratio) {
-    if (family == AF_INET6)
-      os_scan_ipv6(Targets);
-    else
-      os_scan_ipv4(Targets);
-    return OP_SUCCESS;
+/* Expires or retransmits timed out probes and, if both the host and the
+ * global congestion window allow it, sends the host's next probe. Only one
+ * probe is sent per call so that the engine can share the window among
+ * hosts fairly. Returns the number of probes sent. */
+int FPHost4::schedule() {
+  if (!this->netctl_registered) {
+    this->netctl->register_caller(this);
+    this->netctl_registered = true;
   }
 
-  /* We need to split it up */
-  while (startidx < Targets.size()) {
-    int diff = Targets.size() - startidx;
-    if (diff > max_os_group_sz * fudgeratio) {
-      diff = max_os_group_sz;
+  updateHostProbes(this->hos, this->hss);
+  if (this->done())
+    return 0;
+
+  if (this->hss->numProbesToSend() > 0 && this->hos->stats->sendOK()
+      && hostPhaseSendOK(this->hos, this->hss, NULL)) {
+    this->hos->sendNextProbe(this->hss);
+    return 1;
+  }
+  return 0;
+}
+
+
+bool FPHost4::next_event(struct timeval *when) {
+  struct timeval tmptv;
+  bool found = false;
+
+  if (this->hss->numProbesToSend() > 0 && this->hos->stats->sendOK()) {
+    hostPhaseSendOK(this->hos, this->hss, when);
+    found = true;
+  }
+  if (this->hos->nextTimeout(this->hss, &tmptv)) {
+    if (!found || TIMEVAL_BEFORE(tmptv, *when))
+      *when = tmptv;
+    found = true;
+  }
+  return found;
+}
+
+
+/* Called by the network controller for every packet captured from this
+ * host. Returns 0 if the packet was a response to one of our probes and -1
+ * otherwise. Congestion control is done by HostOsScan, so the controller's
+ * own counters are never updated for IPv4 hosts. */
+int FPHost4::callback(const u8 *pkt, size_t pkt_len, const struct timeval *tv,
+                      const struct link_header *linkhdr) {
+  /* processResp() needs an aligned, writable copy of the packet. */
+  u32 buf[OSSCAN_PCAP_SNAPLEN / sizeof(u32)];
+  struct ip *ip = (struct ip *) buf;
+  struct timeval rcvdtime;
+  bool goodResponse;
+
+  if (pkt_len < sizeof(struct ip) || pkt_len > sizeof(buf))
+    return -1;
+  memcpy(buf, pkt, pkt_len);
+  if (pkt_len < (4 * ip->ip_hl) + 4U)
+    return -1;
+
+  setTargetMACIfAvailable(this->hss->target, linkhdr, this->getTargetAddress(), 0);
+
+  rcvdtime = *tv;
+  gettimeofday(&now, NULL);
+  goodResponse = this->hos->processResp(this->hss, ip, pkt_len, &rcvdtime);
+
+  if (!goodResponse)
+    return -1;
+
+  /* The response may have opened the congestion window or completed a
+   * phase, so give the engine a chance to send right away. */
+  this->netctl->break_loop();
+  return 0;
+}
+
+
+/******************************************************************************
+ * Implementation of class FPEngine4                                          *
+ ******************************************************************************/
+
+FPEngine4::FPEngine4() {
+
+}
+
+
+FPEngine4::~FPEngine4() {
+  while (this->fphosts.size() > 0) {
+    delete this->fphosts.back();
+    this->fphosts.pop_back();
+  }
+}
+
+
+/* Runs the probes of one round for every host. Each host first gets the
+ * sequence generation tests (6 TCP probes sent 100ms apart), then the TCP,
+ * UDP and ICMP tests. The order matters for the IP ID tests, but only within
+ * a host, so hosts progress independently: while one host waits out the
+ * spacing between its sequence probes, probes to the others fill the gap.
+ * Between transmissions the engine sleeps in nsock, which hands captured
+ * responses to the right FPHost4. */
+void FPEngine4::do_probes(OsScanInfo *OSI, HostOsScan *HOS) {
+  list<HostOsScanInfo *>::iterator hostI;
+  HostOsScanStats *hss = NULL;
+  struct timeval next, tmptv;
+  bool all_done = false;
+  int sent = 0;
+  long to_msec = 0;
+
+  /* For each host, build a list of sequence probes to send. Hosts without
+   * an open TCP port get none and go straight to the other tests. */
+  for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
+    hss = (*hostI)->hss;
+    HOS->buildSeqProbeList(hss);
+    updateHostProbes(HOS, hss);
+    this->fphosts.push_back(new FPHost4(hss, HOS, &global_netctl));
+  }
+
+  global_netctl.begin_capture();
+
+  while (!all_done) {
+    gettimeofday(&now, NULL);
+
+    if (o.debugging > 2) {
+      for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
+        hss = (*hostI)->hss;
+        log_write(LOG_PLAIN, "Host %s (%s). ProbesToSend %d: \tProbesActive %d\n",
+                  hss->target->targetipstr(), hss->seqDone ? "TUI" : "seq",
+                  hss->numProbesToSend(), hss->numProbesActive());
+      }
     }
-    tmpTargets.assign(Targets.begin() + startidx, Targets.begin() + startidx + diff);
-    if (family == AF_INET6)
-      os_scan_ipv6(Targets);
-    else
-      os_scan_ipv4(Targets);
-    startidx += diff;
+
+    /* Give every host a probe in turn until nobody can send any more. */
+    do {
+      sent = 0;
+      for (size_t i = 0; i < this->fphosts.size(); i++) {
+        if (!this->fphosts[i]->done())
+          sent += this->fphosts[i]->schedule();
+      }
+    } while (sent > 0);
+
+    HOS->stats->num_probes_sent_at_last_wait = HOS->stats->num_probes_sent;
+
+    /* Find out how long we may wait for responses before something else
+     * needs doing. */
+    all_done = true;
+    TIMEVAL_MSEC_ADD(next, now, 50);
+    for (size_t i = 0; i < this->fphosts.size(); i++) {
+      if (this->fphosts[i]->done())
+        continue;
+      all_done = false;
+      if (this->fphosts[i]->next_event(&tmptv) && TIMEVAL_BEFORE(tmptv, next))
+        next = tmptv;
+    }
+    if (all_done)
+      break;
+
+    to_msec = TIMEVAL_MSEC_SUBTRACT(next, now);
+    if (to_msec < 1)
+      to_msec = 1;
+    if (o.debugging > 2)
+      log_write(LOG_PLAIN, "Waiting %ldms for responses.\n", to_msec);
+    global_netctl.handle_events(to_msec);
+  }
+
+  while (this->fphosts.size() > 0) {
+    delete this->fphosts.back();
+    this->fphosts.pop_back();
   }
-  return OP_SUCCESS;
 }
 
 
-/* Performs the OS detection for IPv4 hosts. This method should not be called
- * directly. os_scan() should be used instead, as it handles chunking so
- * you don't do too many targets in parallel */
-int OSScan::os_scan_ipv4(vector<Target *> &Targets) {
+/* Performs the OS detection for IPv4 hosts. Targets are scanned in rounds;
+ * hosts that match a fingerprint (or time out) are dropped after each round
+ * and the others are retried. */
+int FPEngine4::os_scan(std::vector<Target *> &Targets) {
   int itry = 0;
+  const char *bpf_filter = NULL;
   /* Hosts which haven't matched and have been removed from incompleteHosts because
    * they have exceeded the number of retransmissions the host is allowed. */
   list<HostOsScanInfo *> unMatchedHosts;
 
-  /* Check we have at least one target*/
-  if (Targets.size() == 0) {
-    return OP_FAILURE;
-  }
-
   perf.init();
 
   OsScanInfo OSI(Targets);
@@ -3544,8 +3323,13 @@ int OSScan::os_scan_ipv4(vector<Target *> &Targets) {
 
   HostOsScan HOS(Targets[0]);
 
-  /* Initialize the pcap session handler in HOS */
-  begin_sniffer(&HOS, Targets);
+  /* Set up the network controller and its sniffer */
+  global_netctl.init(Targets[0]->deviceName(), Targets[0]->ifType());
+  bpf_filter = this->bpf_filter(Targets);
+  if (o.debugging)
+    log_write(LOG_PLAIN, "Packet capture filter (device %s): %s\n", Targets[0]->deviceFullName(), bpf_filter);
+  global_netctl.setup_sniffer(Targets[0]->deviceName(), bpf_filter);
+
   while (OSI.numIncompleteHosts() != 0) {
     if (itry > 0)
       sleep(1);
@@ -3561,8 +3345,7 @@ int OSScan::os_scan_ipv4(vector<Target *> &Targets) {
       log_flush_all();
     }
     startRound(&OSI, &HOS, itry);
-    doSeqTests(&OSI, &HOS);
-    doTUITests(&OSI, &HOS);
+    this->do_probes(&OSI, &HOS);
     endRound(&OSI, &HOS, itry);
     expireUnmatchedHosts(&OSI, &unMatchedHosts);
     itry++;
@@ -3584,6 +3367,82 @@ int OSScan::os_scan_ipv4(vector<Target *> &Targets) {
 }
 
 
+/******************************************************************************
+ * Implementation of class OSScan()                                           *
+ ******************************************************************************/
+
+/* Constructor */
+OSScan::OSScan() {
+  this->reset();
+  return;
+}
+
+/* Destructor */
+OSScan::~OSScan() {
+  return;
+}
+
+/* Function that initializes internal variables */
+void OSScan::reset() {
+
+}
+
+
+/* This function takes a group of targets and divides it in chunks if there are
+ * too many to be processed at the same time. The threshold is based on Nmap's
+ * timing level (when timing level is above 4, no chunking is performed).
+ * The reason targets are processed in smaller groups is to improve accuracy. */
+int OSScan::chunk_and_do_scan(vector<Target *> &Targets, int family) {
+  unsigned int max_os_group_sz = 20;
+  double fudgeratio = 1.2; /* Allow a slightly larger final group rather than finish with a tiny one */
+  vector<Target *> tmpTargets;
+  unsigned int startidx = 0;
+
+  if (o.timing_level == 4)
+    max_os_group_sz = (unsigned int) (max_os_group_sz * 1.5);
+
+  if (o.timing_level > 4 || Targets.size() <= max_os_group_sz * fudgeratio) {
+    if (family == AF_INET6)
+      os_scan_ipv6(Targets);
+    else
+      os_scan_ipv4(Targets);
+    return OP_SUCCESS;
+  }
+
+  /* We need to split it up */
+  while (startidx < Targets.size()) {
+    int diff = Targets.size() - startidx;
+    if (diff > max_os_group_sz * fudgeratio) {
+      diff = max_os_group_sz;
+    }
+    tmpTargets.assign(Targets.begin() + startidx, Targets.begin() + startidx + diff);
+    if (family == AF_INET6)
+      os_scan_ipv6(Targets);
+    else
+      os_scan_ipv4(Targets);
+    startidx += diff;
+  }
+  return OP_SUCCESS;
+}
+
+
+/* Performs the OS detection for IPv4 hosts. This method should not be called
+ * directly. os_scan() should be used instead, as it handles chunking so
+ * you don't do too many targets in parallel */
+int OSScan::os_scan_ipv4(vector<Target *> &Targets) {
+
+  /* Object instantiation */
+  FPEngine4 fp4;
+
+  /* Safe checks. */
+  if (Targets.size() == 0) {
+    return OP_FAILURE;
+  }
+
+  return fp4.os_scan(Targets);
+}
+
+
 /* Performs the OS detection for IPv6 hosts. This method should not be called
  * directly. os_scan() should be used instead, as it handles chunking so
  * you don't do too many targets in parallel */
@@ -103,6 +103,7 @@
 #include <vector>
 #include <list>
 #include "Target.h"
+#include "FPEngine.h"
 class Target;
 
 
@@ -239,6 +240,10 @@ class HostOsScanStats {
   int distance;
   int distance_guess;
 
+  /* Set once the sequence probes of the current round are finished and the
+   * host has moved on to the TCP/UDP/ICMP probes. */
+  bool seqDone;
+
   /* Returns the amount of time taken between sending 1st tseq probe
    * and the last one.  Zero is
    * returned if we didn't send the tseq probes because there was no
@@ -327,7 +332,6 @@ class HostOsScan {
   HostOsScan(Target *t); /* OsScan need a target to set eth stuffs */
   ~HostOsScan();
 
-  pcap_t *pd;
   ScanStats *stats;
 
   /* (Re)Initialize the parameters that will be used during the scan.*/
@@ -484,6 +488,53 @@ class HostOsScanInfo {
 };
 
 
+/* This class represents IPv4 hosts to be fingerprinted, the counterpart of
+ * FPHost6. The probes and the fingerprint are those of HostOsScan, but
+ * transmissions are driven by FPEngine4 and responses are delivered by the
+ * FPNetworkControl sniffer that the IPv6 engine also uses. One FPHost4 is
+ * used for each host in each OS detection round. */
+class FPHost4 : public FPHost {
+
+ private:
+  HostOsScan *hos;      /* Probe builder/response parser shared by all hosts */
+  HostOsScanStats *hss; /* Scan state of this host in the current round      */
+
+  int build_probe_list();
+
+ public:
+  FPHost4(HostOsScanStats *hss, HostOsScan *hos, FPNetworkControl *fpnc);
+  ~FPHost4();
+  bool done();
+  int schedule();
+  int callback(const u8 *pkt, size_t pkt_len, const struct timeval *tv,
+               const struct link_header *linkhdr);
+  /* Fills in when with the time at which schedule() next has something to
+   * do (a transmission or a timeout). Returns false if there is nothing
+   * pending. */
+  bool next_event(struct timeval *when);
+
+};
+
+
+/* This class handles IPv4 OS fingerprinting on the FPEngine event framework.
+ * Every host sends its probes as soon as its own timing allows, and the
+ * engine sleeps in nsock (rather than polling pcap) until the next probe is
+ * due or a response arrives. */
+class FPEngine4 : public FPEngine {
+
+ private:
+  std::vector<FPHost4 *> fphosts; /* Hosts of the current round */
+
+  void do_probes(OsScanInfo *OSI, HostOsScan *HOS);
+
+ public:
+  FPEngine4();
+  ~FPEngine4();
+  int os_scan(std::vector<Target *> &Targets);
+
+};
+
+
 /** This is the class that performs OS detection (both IPv4 and IPv6).
   * Using it is simple, just call os_scan() passing a list of targets.
   * The results of the detection will be stored inside the supplied
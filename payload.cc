@@ -100,7 +100,7 @@
 #include <string.h>
 
 #include <string>
-#include <map>
+#include <vector>
 
 #include "NmapOps.h"
 #include "nbase.h"
@@ -114,25 +114,12 @@ struct payload {
   /* Extra data such as source port goes here. */
 };
 
-/* The key for the payload lookup map is a (proto, port) pair. */
-struct proto_dport {
-  u8 proto;
-  u16 dport;
-
-  proto_dport(u8 proto, u16 dport) {
-    this->proto = proto;
-    this->dport = dport;
-  }
-
-  bool operator<(const proto_dport& other) const {
-    if (proto == other.proto)
-      return dport < other.dport;
-    else
-      return proto < other.proto;
-  }
-};
-
-static std::map<struct proto_dport, struct payload> payloads;
+/* The UDP payloads, indexed directly by destination port. Each entry is NULL
+   for ports without payloads, or else the list of payload variants for the
+   port in the order they appear in nmap-payloads. Probes cycle through the
+   variants on retransmission, so a port that may run one of several
+   protocols gets each of them tried in turn. */
+static std::vector<struct payload> *udp_payloads[65536];
 
 /* Newlines are significant because keyword directives (like "source") that
    follow the payload string are significant to the end of the line. */
@@ -261,7 +248,7 @@ static int next_token(FILE *fp, struct token *token) {
   return -1;
 }
 
-/* Loop over fp, reading tokens and adding payloads to the global payloads map
+/* Loop over fp, reading tokens and adding payloads to the global payload table
    as they are completed. Returns -1 on error. */
 static int load_payloads_from_file(FILE *fp) {
   struct token token;
@@ -312,11 +299,12 @@ static int load_payloads_from_file(FILE *fp) {
     }
 
     for (p = 0; p < count; p++) {
-      struct proto_dport key(IPPROTO_UDP, ports[p]);
       struct payload payload;
 
+      if (udp_payloads[ports[p]] == NULL)
+        udp_payloads[ports[p]] = new std::vector<struct payload>;
       payload.data = payload_data;
-      payloads[key] = payload;
+      udp_payloads[ports[p]]->push_back(payload);
     }
 
     free(ports);
@@ -325,7 +313,7 @@ static int load_payloads_from_file(FILE *fp) {
   return 0;
 }
 
-/* Ensure that the payloads map is initialized from the nmap-payloads file. This
+/* Ensure that the payload table is initialized from the nmap-payloads file. This
    function keeps track of whether it has been called and does nothing after it
    is called the first time. */
 int init_payloads(void) {
@@ -360,31 +348,33 @@ int init_payloads(void) {
 
 /* Get a payload appropriate for the given UDP port. For certain selected ports
    a payload is returned, and for others a zero-length payload is returned. The
-   length is returned through the length pointer. */
-const char *udp_port2payload(u16 dport, size_t *length) {
+   length is returned through the length pointer. Ports with several payloads
+   return variant number tryno, wrapping around after the last, so that each
+   retransmission of a probe can try a different protocol. */
+const char *udp_port2payload(u16 dport, size_t *length, u8 tryno) {
   static const char *payload_null = "";
-  std::map<struct proto_dport, struct payload>::iterator it;
-  proto_dport pp(IPPROTO_UDP, dport);
+  const struct payload *payload;
 
-  it = payloads.find(pp);
-  if (it != payloads.end()) {
-    *length = it->second.data.size();
-    return it->second.data.data();
-  } else {
+  if (udp_payloads[dport] == NULL) {
     *length = 0;
     return payload_null;
   }
+
+  payload = &(*udp_payloads[dport])[tryno % udp_payloads[dport]->size()];
+  *length = payload->data.size();
+  return payload->data.data();
 }
 
 /* Get a payload appropriate for the given UDP port. If --data-length was used,
    returns the global random payload. Otherwise, for certain selected ports a
    payload is returned, and for others a zero-length payload is returned. The
-   length is returned through the length pointer. */
-const char *get_udp_payload(u16 dport, size_t *length) {
+   length is returned through the length pointer. tryno selects among the
+   variants of ports with more than one payload. */
+const char *get_udp_payload(u16 dport, size_t *length, u8 tryno) {
   if (o.extra_payload != NULL) {
     *length = o.extra_payload_length;
     return o.extra_payload;
   } else {
-    return udp_port2payload(dport, length);
+    return udp_port2payload(dport, length, tryno);
   }
 }
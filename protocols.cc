@@ -94,6 +94,7 @@
 /* $Id$ */
 
 #include "protocols.h"
+#include "databundle.h"
 #include "NmapOps.h"
 #include "services.h"
 #include "charpool.h"
@@ -105,26 +106,54 @@ static int numipprots = 0;
 static struct protocol_list *protocol_table[PROTOCOL_TABLE_SIZE];
 static int protocols_initialized = 0;
 
-static int nmap_protocols_init() {
-  if (protocols_initialized) return 0;
-
-  char filename[512];
+/* Parses an nmap-protocols (or /etc/protocols) file into table. The number of
+   each record is the protocol number and the name is the protocol name.
+   Returns 0 on success and -1 if the file can't be read. */
+int protocols_parse_file(const char *filename, DataTable *table) {
   FILE *fp;
   char protocolname[128];
   unsigned short protno;
   char *p;
   char line[1024];
-  int lineno = 0;
-  struct protocol_list *current, *previous;
   int res;
 
+  fp = fopen(filename, "r");
+  if (!fp)
+    return -1;
+
+  while(fgets(line, sizeof(line), fp)) {
+    p = line;
+    while(*p && isspace((int) (unsigned char) *p))
+      p++;
+    if (*p == '#')
+      continue;
+    res = sscanf(line, "%127s %hu", protocolname, &protno);
+    if (res !=2)
+      continue;
+    table->add(protno, protocolname);
+  }
+  fclose(fp);
+  return 0;
+}
+
+static int nmap_protocols_init() {
+  if (protocols_initialized) return 0;
+
+  /* The strings in the protocol table point into this. */
+  static DataTable protocols_data;
+  char filename[512];
+  unsigned short protno;
+  struct protocol_list *current, *previous;
+  unsigned int n;
+
   if (nmap_fetchfile(filename, sizeof(filename), "nmap-protocols") != 1) {
     error("Unable to find nmap-protocols!  Resorting to /etc/protocols");
     strcpy(filename, "/etc/protocols");
   }
 
-  fp = fopen(filename, "r");
-  if (!fp) {
+  protocols_data.clear();
+  if (!databundle_get("nmap-protocols", filename, &protocols_data)
+      && protocols_parse_file(filename, &protocols_data) == -1) {
     fatal("Unable to open %s for reading protocol information", filename);
   }
   /* Record where this data file was found. */
@@ -132,17 +161,8 @@ static int nmap_protocols_init() {
 
   memset(protocol_table, 0, sizeof(protocol_table));
   
-  while(fgets(line, sizeof(line), fp)) {
-    lineno++;
-    p = line;
-    while(*p && isspace((int) (unsigned char) *p))
-      p++;
-    if (*p == '#')
-      continue;
-    res = sscanf(line, "%127s %hu", protocolname, &protno);
-    if (res !=2)
-      continue;
-    protno = htons(protno);
+  for (n = 0; n < protocols_data.size(); n++) {
+    protno = htons(protocols_data.number(n));
 
     /* Now we make sure our protocols don't have duplicates */
     for(current = protocol_table[0], previous = NULL;
@@ -168,11 +188,10 @@ static int nmap_protocols_init() {
     } else {
       previous->next = current;
     }
-    current->protoent->p_name = cp_strdup(protocolname);
+    current->protoent->p_name = (char *) protocols_data.name(n);
     current->protoent->p_proto = protno;
     current->protoent->p_aliases = NULL;
   }
-  fclose(fp);
   protocols_initialized = 1;
   return 0;
 }
@@ -111,6 +111,9 @@ struct protocol_list {
   struct protocol_list *next;
 };
 
+class DataTable;
+
+int protocols_parse_file(const char *filename, DataTable *table);
 int addprotocolsfromservmask(char *mask, u8 *porttbl);
 struct protoent *nmap_getprotbynum(int num);
 
@@ -1,8 +1,8 @@
 
 /***************************************************************************
  * scan_engine.cc -- Includes much of the "engine" functions for scanning, *
- * such as pos_scan and ultra_scan.  It also includes dependant functions  *
- * such as those for collecting SYN/connect scan responses.                *
+ * such as ultra_scan.  It also includes dependant functions such as       *
+ * those for collecting SYN/connect scan responses.                        *
  *                                                                         *
  ***********************IMPORTANT NMAP LICENSE TERMS************************
  *                                                                         *
@@ -105,6 +105,8 @@
 #include "nmap_tty.h"
 #include "nmap_rpc.h"
 #include "payload.h"
+#include "services.h"
+#include "checkpoint.h"
 #include "Target.h"
 #include "targets.h"
 #include "utils.h"
@@ -112,8 +114,14 @@
 #include "struct_ip.h"
 
 #include <math.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#include <signal.h>
+#endif
+#include <algorithm>
 #include <list>
 #include <map>
+#include <vector>
 
 using namespace std;
 extern NmapOps o;
@@ -216,6 +224,10 @@ public:
   /* Pass an arp packet, including ethernet header. Must be 42bytes */
   void setARP(u8 *arppkt, u32 arplen);
   void setND(u8 *ndpkt, u32 ndlen);
+  /* Sets this UltraProbe as type UP_IP for a TCP probe sent in stateless
+     mode. Such probes are not kept after sending; this rebuilds one from the
+     values carried back by a response. */
+  void setStatelessTCP(const probespec *pspec, u16 sport, u32 seq);
   // The 4 accessors below all return in HOST BYTE ORDER
   // source port used if TCP, UDP or SCTP
   u16 sport() const {
@@ -393,6 +405,63 @@ struct rate_limit_detection_nfo {
   struct timeval rld_waittime; /* if RLD waiting, when can we send? */
 };
 
+/* How many arrival times of first responses rate_limit_model_nfo keeps, how
+   long its measurement windows are, and how many probes a window needs to
+   count. */
+#define RLM_SAMPLES 32
+#define RLM_WINDOW_MS 2000
+#define RLM_MIN_SAMPLES 8
+
+/* A model of the target's response rate limit, which is usually a token
+   bucket: Linux, for example, sends at most one ICMP error per second to a
+   destination, after a burst of six. Probes sent and responses received are
+   counted in fixed windows. The highest share of probes answered in a window
+   is taken as the port mix, what the target answers when it isn't limited.
+   A window answered below that share was limited, and its response rate
+   estimates the limit. The send delay that keeps the responses under the
+   limit is then the share divided by that rate. The first responses give the
+   burst size, and probes are paced by a bucket of our own with that rate and
+   burst. */
+struct rate_limit_model_nfo {
+  struct timeval first[RLM_SAMPLES]; /* Arrival times of the first responses */
+  unsigned int nresp; /* Number of responses recorded */
+  struct timeval window_start;
+  unsigned int window_sent; /* Probes sent in the current window */
+  unsigned int window_resp; /* Responses received in the current window */
+  unsigned int windows; /* Number of windows counted so far */
+  double ratio; /* Highest share of probes answered in a window */
+  double rate; /* Estimated limit in responses per ms, or 0 if unknown */
+  bool pacing; /* Whether sdn.delayms comes from the model */
+  unsigned int burst; /* Estimated burst size, in probes */
+  double tokens; /* Our bucket's tokens just after the last probe was sent */
+};
+
+/* In stateless mode (see UltraScanInfo::stateless) no UltraProbe is kept for
+   the probes sent to a host, so these counters are all there is. The ports
+   are probed in passes; pass n sends try number n to every port that has no
+   state yet. */
+struct stateless_nfo {
+  u8 tryno; /* Try number of the current pass */
+  int next; /* Index of the next port to probe in the current pass */
+  struct timeval pass_end; /* When the last probe of the pass was sent */
+  /* Probes sent during the current and the previous slot of probeTimeout()
+     length, less those answered. Their sum is num_probes_active; probes
+     older than that are given up on. */
+  unsigned int slot_sent[2];
+  struct timeval slot_start;
+  bool done; /* No more passes are needed */
+};
+
+/* Congestion control state shared by the hosts of a group that are in the
+   same subnet (a /24, or a /64 for IPv6), and so are probably reached through
+   the same router or firewall. A drop detected on any of them shrinks the
+   window for all of them, and a host that hasn't learned a window of its own
+   uses the subnet's. Hosts alone in their subnet in the group have none. */
+struct subnet_cc_nfo {
+  struct ultra_timing_vals timing;
+  unsigned int num_probes_active; /* Sum of num_probes_active of the hosts */
+};
+
 /* The ultra_scan() statistics that apply to individual target hosts in a
    group */
 class HostScanStats {
@@ -402,7 +471,15 @@ public:
   ~HostScanStats();
   int freshPortsLeft(); /* Returns the number of ports remaining to probe */
   int next_portidx; /* Index of the next port to probe in the relevent
-		       ports array in USI.ports */
+		       ports array in USI.ports.  If ports_probed is in use,
+		       this is just the number of ports probed so far. */
+  /* With USI->likely_order or ports restored from a checkpoint, which entries
+     of the ports array have been probed (empty otherwise), and how far this
+     host has got through the ports array (or USI->port_order) and
+     USI->group_open. */
+  std::vector<bool> ports_probed;
+  unsigned int next_orderidx;
+  unsigned int next_groupopenidx;
   bool sent_arp; /* Has an ARP probe been sent for the target yet? */
 
   /* massping state. */
@@ -577,11 +654,93 @@ public:
   void boostScanDelay();
   struct send_delay_nfo sdn;
   struct rate_limit_detection_nfo rld;
+  struct rate_limit_model_nfo rlm;
+  /* Records the arrival of a response to a port probe. */
+  void rateLimitResponse(const struct timeval *rcvdtime);
+  /* Closes rlm's measurement window if it has run its length. */
+  void rateLimitWindow();
+  /* The send delay in milliseconds that matches the target's rate limit
+     according to rlm, or 0 if it can't be estimated yet. Sets rlm.burst. */
+  unsigned int rateLimitDelay();
+  /* Fills tv with the earliest time that the send delay allows another
+     probe. */
+  void nextSendTime(struct timeval *tv);
+  struct stateless_nfo sln;
+  /* Shared with the other hosts of the subnet, or NULL. */
+  struct subnet_cc_nfo *subnet;
+  /* Whether the subnet's congestion window has room for another probe. */
+  bool subnetSendOK() {
+    return subnet == NULL || subnet->timing.cwnd >= subnet->num_probes_active + .5;
+  }
 
 private:
   u8 nxtpseq; /* the next scanping sequence number to use */
 };
 
+/* Dummy class to use sockaddr_storage as a map key. */
+struct lt_sockaddr_storage {
+  bool operator()(const struct sockaddr_storage& a, const struct sockaddr_storage& b) const {
+    return sockaddr_storage_cmp(&a, &b) < 0;
+  }
+};
+
+#ifdef HAVE_PTHREAD_H
+/* Number of frames the receive ring holds. Must be a power of two. */
+#define RECV_RING_SIZE 8192
+/* The snapshot length of the sniffer opened by begin_sniffer(). */
+#define RECV_SNAPLEN 256
+
+/* A frame taken by the receive thread, with its pcap header. */
+struct recv_frame {
+  struct pcap_pkthdr head;
+  u8 data[RECV_SNAPLEN];
+};
+
+/* A thread that reads the sniffer continuously and puts each frame in a
+   ring, so that responses are taken off the kernel's buffer while the scan
+   thread is busy sending. The ring has one producer and one consumer: the
+   receive thread only advances head and the scan thread only advances tail,
+   so frames are handed over without a lock. The mutex and condition variable
+   are used only to wake a scan thread that is waiting on an empty ring. */
+class PcapReceiver {
+public:
+  PcapReceiver(pcap_t *pd);
+  ~PcapReceiver();
+  /* Starts the thread. Returns false if it can't be used on this sniffer,
+     with the reason in errmsg(). */
+  bool start();
+  const char *errmsg() {
+    return errbuf;
+  }
+  void stop();
+  /* Like readip_pcap, but takes the next frame from the ring, waiting up to
+     to_usec for one to arrive. */
+  char *readip(unsigned int *len, long to_usec, struct timeval *rcvdtime,
+               struct link_header *linknfo, bool validate);
+  /* Milliseconds the receive thread spent waiting for room in the ring. */
+  unsigned int full_ms;
+
+private:
+  static void *run(void *arg);
+  static void capture(u_char *arg, const struct pcap_pkthdr *head,
+                      const u_char *frame);
+  pcap_t *pd;
+  struct recv_frame *ring;
+  volatile unsigned int head;
+  volatile unsigned int tail;
+  volatile bool stopping;
+  volatile bool failed;
+  char errbuf[PCAP_ERRBUF_SIZE];
+  /* stop() writes to wakefd[1] to interrupt the thread's select(). */
+  int wakefd[2];
+  bool running;
+  bool waiting; /* The scan thread is waiting on cond. Protected by lock. */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+#endif
+
 class UltraScanInfo {
 public:
   UltraScanInfo();
@@ -680,11 +839,47 @@ public:
   ScanProgressMeter *SPM;
   PacketRateMeter send_rate_meter;
   struct scan_lists *ports;
+  /* Whether ports are probed likeliest first (--likely-ports-first). If so,
+     port_order holds indexes into the ports array of this scan type sorted by
+     nmap-services open frequency, and group_open holds the indexes of ports
+     found open on any host of the group, in the order they were found. Each
+     host probes the ports in group_open that it hasn't tried yet before going
+     on with port_order. */
+  bool likely_order;
+  std::vector<int> port_order;
+  std::vector<int> group_open;
+  std::vector<bool> group_open_seen;
+  /* Maps a port number to its index in the ports array, or -1. */
+  std::vector<int> port_index;
+  u16 *scanPorts(int *count, u8 *proto);
+  void initPortIndex();
+  void initLikelyOrder();
+  void restoreCheckpoint();
   int rawsd; /* raw socket descriptor */
   pcap_t *pd;
+#ifdef HAVE_PTHREAD_H
+  /* Reads pd in a separate thread, if it could be started. */
+  PcapReceiver *rcvr;
+#endif
   eth_t *ethsd;
   u32 seqmask; /* This mask value is used to encode values in sequence
 		  numbers.  It is set randomly in UltraScanInfo::Init() */
+  /* Whether this is a stateless scan (--stateless). Only SYN scans and ping
+     scans using nothing but raw TCP probes may be. No UltraProbe is kept for
+     the probes sent; their source port and sequence number carry a token
+     made from stateless_key and the destination, which identifies responses.
+     The send time and try number are encoded next to it, relative to
+     stateless_epoch. */
+  bool stateless;
+  u8 stateless_key[16];
+  struct timeval stateless_epoch;
+  /* In stateless mode, every HostScanStats by address, so that responses
+     from large sweeps don't have to search the host lists. */
+  std::map<struct sockaddr_storage, HostScanStats *, lt_sockaddr_storage> hostIndex;
+  /* The subnet_cc_nfo of each subnet with more than one host, by subnet
+     address. */
+  std::map<struct sockaddr_storage, struct subnet_cc_nfo *, lt_sockaddr_storage> subnets;
+  void initSubnets();
 private:
 
   unsigned int numInitialTargets;
@@ -870,6 +1065,14 @@ void UltraProbe::setIP(u8 *ippacket, u32 len, const probespec *pspec) {
   return;
 }
 
+void UltraProbe::setStatelessTCP(const probespec *pspec, u16 sport, u32 seq) {
+  type = UP_IP;
+  probes.IP.ipid = 0;
+  probes.IP.pd.tcp.sport = sport;
+  probes.IP.pd.tcp.seq = seq;
+  mypspec = *pspec;
+}
+
 u32 UltraProbe::tcpseq() const {
   if (mypspec.proto == IPPROTO_TCP)
     return probes.IP.pd.tcp.seq;
@@ -1128,6 +1331,10 @@ HostScanStats::HostScanStats(Target *t, UltraScanInfo *UltraSI) {
   target = t;
   USI = UltraSI;
   next_portidx = 0;
+  if (USI->likely_order)
+    ports_probed.assign(USI->port_order.size(), false);
+  next_orderidx = 0;
+  next_groupopenidx = 0;
   sent_arp = false;
   next_ackportpingidx = 0;
   next_synportpingidx = 0;
@@ -1156,6 +1363,11 @@ HostScanStats::HostScanStats(Target *t, UltraScanInfo *UltraSI) {
   rld.max_tryno_sent = 0;
   rld.rld_waiting = false;
   rld.rld_waittime = USI->now;
+  memset(&rlm, 0, sizeof(rlm));
+  rlm.window_start = USI->now;
+  memset(&sln, 0, sizeof(sln));
+  sln.pass_end = sln.slot_start = USI->now;
+  subnet = NULL;
   if (!pingprobe_is_appropriate(USI, &target->pingprobe)) {
     if (o.debugging > 1)
       log_write(LOG_STDOUT, "%s pingprobe type %s is inappropriate for this scan type; resetting.\n", target->targetipstr(), pspectype2ascii(target->pingprobe.type));
@@ -1179,6 +1391,16 @@ HostScanStats::~HostScanStats() {
 /* Called whenever a probe is sent to this host. Takes care of updating scan
    delay and rate limiting variables. */
 void HostScanStats::probeSent(unsigned int nbytes) {
+  if (rlm.pacing) {
+    /* Refill our bucket for the time since the last probe, then take one
+       token. */
+    rlm.tokens += (double) TIMEVAL_MSEC_SUBTRACT(USI->now, lastprobe_sent) / sdn.delayms;
+    rlm.tokens = MIN(rlm.tokens, rlm.burst) - 1;
+    if (rlm.tokens < 0)
+      rlm.tokens = 0;
+  }
+  rateLimitWindow();
+  rlm.window_sent++;
   lastprobe_sent = USI->now;
 
   /* Update group variables. */
@@ -1216,6 +1438,13 @@ unsigned long HostScanStats::probeExpireTime(const UltraProbe *probe) {
     return MIN(10000000, probeTimeout() * 10);
 }
 
+/* The number of ports (or ping probes) in each pass of a stateless scan. */
+static int stateless_num_ports(const UltraScanInfo *USI) {
+  if (USI->ping_scan)
+    return USI->ports->syn_ping_count + USI->ports->ack_ping_count;
+  return USI->ports->tcp_count;
+}
+
 /* Returns OK if sending a new probe to this host is OK (to avoid
    flooding). If when is non-NULL, fills it with the time that sending
    will be OK assuming no pending probes are resolved by responses
@@ -1256,16 +1485,43 @@ bool HostScanStats::sendOK(struct timeval *when) {
   }
 
   if (sdn.delayms) {
-    if (TIMEVAL_MSEC_SUBTRACT(USI->now, lastprobe_sent) < (int) sdn.delayms) {
-      if (when) {
-        TIMEVAL_MSEC_ADD(*when, lastprobe_sent, sdn.delayms);
-      }
+    nextSendTime(&sendTime);
+    if (TIMEVAL_AFTER(sendTime, USI->now)) {
+      if (when)
+        *when = sendTime;
       return false;
     }
   }
 
+  if (USI->stateless) {
+    getTiming(&tmng);
+    if (tmng.cwnd >= num_probes_active + .5 && subnetSendOK()
+        && sln.next < stateless_num_ports(USI)) {
+      if (when)
+        *when = USI->now;
+      return true;
+    }
+    if (!when)
+      return false;
+    /* Things change when the oldest slot of probes is given up on, or when
+       the next pass may start. */
+    TIMEVAL_MSEC_ADD(earliest_to, USI->now, 10000);
+    if (num_probes_active > 0) {
+      TIMEVAL_MSEC_ADD(probe_to, sln.slot_start, probeTimeout() / 1000);
+      if (TIMEVAL_SUBTRACT(probe_to, earliest_to) < 0)
+        earliest_to = probe_to;
+    }
+    if (sln.next >= stateless_num_ports(USI)) {
+      TIMEVAL_MSEC_ADD(probe_to, sln.pass_end, probeTimeout() / 1000);
+      if (TIMEVAL_SUBTRACT(probe_to, earliest_to) < 0)
+        earliest_to = probe_to;
+    }
+    *when = earliest_to;
+    return false;
+  }
+
   getTiming(&tmng);
-  if (tmng.cwnd >= num_probes_active + .5 &&
+  if (tmng.cwnd >= num_probes_active + .5 && subnetSendOK() &&
       (freshPortsLeft() || num_probes_waiting_retransmit || !retry_stack.empty())) {
     if (when)
       *when = USI->now;
@@ -1290,7 +1546,7 @@ bool HostScanStats::sendOK(struct timeval *when) {
 
   // Will any scan delay affect this?
   if (sdn.delayms) {
-    TIMEVAL_MSEC_ADD(sendTime, lastprobe_sent, sdn.delayms);
+    nextSendTime(&sendTime);
     if (TIMEVAL_BEFORE(sendTime, USI->now))
       sendTime = USI->now;
     tdiff = TIMEVAL_MSEC_SUBTRACT(earliest_to, sendTime);
@@ -1324,6 +1580,16 @@ bool HostScanStats::nextTimeout(struct timeval *when) {
   memset(&probe_to, 0, sizeof(probe_to));
   memset(&earliest_to, 0, sizeof(earliest_to));
 
+  /* In a stateless scan, the oldest slot of probes times out as a whole. */
+  if (USI->stateless) {
+    if (num_probes_active == 0) {
+      *when = USI->now;
+      return false;
+    }
+    TIMEVAL_ADD(*when, sln.slot_start, probeTimeout());
+    return true;
+  }
+
   for (probeI = probes_outstanding.begin(); probeI != probes_outstanding.end();
        probeI++) {
     if (!(*probeI)->timedout) {
@@ -1401,12 +1667,19 @@ UltraScanInfo::~UltraScanInfo() {
     delete completedHosts.front();
     completedHosts.pop_front();
   }
+  while (!subnets.empty()) {
+    delete subnets.begin()->second;
+    subnets.erase(subnets.begin());
+  }
   delete gstats;
   delete SPM;
   if (rawsd >= 0) {
     close(rawsd);
     rawsd = -1;
   }
+#ifdef HAVE_PTHREAD_H
+  delete rcvr;
+#endif
   if (pd) {
     pcap_close(pd);
     pd = NULL;
@@ -1511,6 +1784,164 @@ static void set_default_port_state(vector<Target *> &targets, stype scantype) {
   }
 }
 
+/* Used to sort port indexes by nmap-services open frequency, most frequent
+   first. */
+struct port_ratio_compare {
+  const std::vector<double> &ratios;
+
+  port_ratio_compare(const std::vector<double> &r) : ratios(r) { }
+  bool operator()(int a, int b) const {
+    return ratios[a] > ratios[b];
+  }
+};
+
+/* Returns the array of ports (or protocols) probed by this port scan and its
+   length in count, and the protocol they belong to in proto. */
+u16 *UltraScanInfo::scanPorts(int *count, u8 *proto) {
+  if (tcp_scan) {
+    *count = ports->tcp_count;
+    *proto = IPPROTO_TCP;
+    return ports->tcp_ports;
+  } else if (udp_scan) {
+    *count = ports->udp_count;
+    *proto = IPPROTO_UDP;
+    return ports->udp_ports;
+  } else if (sctp_scan) {
+    *count = ports->sctp_count;
+    *proto = IPPROTO_SCTP;
+    return ports->sctp_ports;
+  } else {
+    assert(prot_scan);
+    *count = ports->prot_count;
+    *proto = IPPROTO_IP;
+    return ports->prots;
+  }
+}
+
+void UltraScanInfo::initPortIndex() {
+  u16 *portarray;
+  int count, i;
+  u8 proto;
+
+  portarray = scanPorts(&count, &proto);
+  port_index.assign(65536, -1);
+  for (i = 0; i < count; i++)
+    port_index[portarray[i]] = i;
+}
+
+/* Sets up the --likely-ports-first probe order for a TCP, UDP, or SCTP scan.
+   The sort is stable so ports with equal (usually zero) frequencies keep
+   their randomized order. */
+void UltraScanInfo::initLikelyOrder() {
+  std::vector<double> ratios;
+  u16 *portarray;
+  int count, i;
+  u8 proto;
+
+  portarray = scanPorts(&count, &proto);
+  initPortIndex();
+  likely_order = true;
+  port_order.resize(count);
+  ratios.resize(count);
+  group_open.clear();
+  group_open_seen.assign(count, false);
+  for (i = 0; i < count; i++) {
+    port_order[i] = i;
+    ratios[i] = getportratio(portarray[i], proto);
+  }
+  std::stable_sort(port_order.begin(), port_order.end(), port_ratio_compare(ratios));
+}
+
+/* Sets ss, a host address, to the address of its subnet for the purpose of
+   shared congestion control: the /24 for IPv4 or the /64 for IPv6. */
+static void subnet_addr(struct sockaddr_storage *ss) {
+  if (ss->ss_family == AF_INET) {
+    struct sockaddr_in *sin = (struct sockaddr_in *) ss;
+    sin->sin_addr.s_addr &= htonl(0xFFFFFF00);
+  } else if (ss->ss_family == AF_INET6) {
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) ss;
+    memset(sin6->sin6_addr.s6_addr + 8, 0, 8);
+  }
+}
+
+/* Gives the hosts that share a subnet with other hosts of the group a shared
+   subnet_cc_nfo. */
+void UltraScanInfo::initSubnets() {
+  std::map<struct sockaddr_storage, std::vector<HostScanStats *>, lt_sockaddr_storage> members;
+  std::map<struct sockaddr_storage, std::vector<HostScanStats *>, lt_sockaddr_storage>::iterator mi;
+  list<HostScanStats *>::iterator hostI;
+  struct sockaddr_storage ss;
+  size_t sslen;
+  struct subnet_cc_nfo *subnet;
+  unsigned int i;
+
+  for (hostI = incompleteHosts.begin(); hostI != incompleteHosts.end(); hostI++) {
+    sslen = sizeof(ss);
+    if ((*hostI)->target->TargetSockAddr(&ss, &sslen) != 0)
+      continue;
+    subnet_addr(&ss);
+    members[ss].push_back(*hostI);
+  }
+
+  for (mi = members.begin(); mi != members.end(); mi++) {
+    if (mi->second.size() < 2)
+      continue;
+    subnet = new struct subnet_cc_nfo;
+    init_ultra_timing_vals(&subnet->timing, TIMING_GROUP, mi->second.size(), &perf, &now);
+    subnet->num_probes_active = 0;
+    subnets[mi->first] = subnet;
+    for (i = 0; i < mi->second.size(); i++)
+      mi->second[i]->subnet = subnet;
+  }
+  if (o.debugging > 1 && !subnets.empty())
+    log_write(LOG_PLAIN, "%u subnets with more than one host share congestion control.\n",
+              (unsigned int) subnets.size());
+}
+
+/* Restores the port results and timing that an interrupted scan saved in a
+   checkpoint file, and marks those ports as already probed. Hosts for which
+   the whole phase had finished get no probes at all. */
+void UltraScanInfo::restoreCheckpoint() {
+  list<HostScanStats *>::iterator hostI;
+  std::vector<u16>::iterator pi;
+  int count, idx;
+  u8 proto;
+
+  scanPorts(&count, &proto);
+  if (port_index.empty())
+    initPortIndex();
+
+  for (hostI = incompleteHosts.begin(); hostI != incompleteHosts.end(); hostI++) {
+    HostScanStats *hss = *hostI;
+    std::vector<u16> restored;
+    bool done;
+
+    checkpoint_restore_timing(hss->target, &hss->timing);
+    done = checkpoint_restore_phase(hss->target, scantype, restored);
+    if (restored.empty() && !done)
+      continue;
+
+    if (hss->ports_probed.empty())
+      hss->ports_probed.assign(count, false);
+    for (pi = restored.begin(); pi != restored.end(); pi++) {
+      idx = port_index[*pi];
+      if (idx != -1 && !hss->ports_probed[idx]) {
+        hss->ports_probed[idx] = true;
+        hss->next_portidx++;
+        hss->ports_finished++;
+      }
+    }
+    if (done) {
+      hss->next_portidx = count;
+      hss->ports_finished = count;
+    }
+    if (o.debugging)
+      log_write(LOG_STDOUT, "Restored %u %s port results for %s from checkpoint%s\n",
+                (unsigned int) restored.size(), proto2ascii_lowercase(proto),
+                hss->target->targetipstr(), done ? " (phase complete)" : "");
+  }
+}
+
 /* Order of initializations in this function CAN BE IMPORTANT, so be careful
  mucking with it. */
 void UltraScanInfo::Init(vector<Target *> &Targets, struct scan_lists *pts, stype scantp) {
@@ -1587,6 +2018,26 @@ void UltraScanInfo::Init(vector<Target *> &Targets, struct scan_lists *pts, styp
 
   set_default_port_state(Targets, scantype);
 
+  likely_order = false;
+  if (o.likely_ports_first && (tcp_scan || udp_scan || sctp_scan))
+    initLikelyOrder();
+
+  stateless = false;
+  if (o.stateless) {
+    if (scantype == SYN_SCAN && o.scanflags == -1)
+      stateless = true;
+    else if (scantype == PING_SCAN && ptech.rawtcpscan && !ptech.rawicmpscan
+             && !ptech.rawudpscan && !ptech.rawsctpscan && !ptech.rawprotoscan
+             && !ptech.connecttcpscan)
+      stateless = true;
+    else if (o.debugging)
+      log_write(LOG_PLAIN, "--stateless does not apply to %s; keeping per-probe state.\n", scantype2str(scantype));
+  }
+  if (stateless) {
+    get_random_bytes(stateless_key, sizeof(stateless_key));
+    stateless_epoch = now;
+  }
+
   perf.init();
 
   /* Keep a completed host around for a standard TCP MSL (2 min) */
@@ -1601,14 +2052,30 @@ void UltraScanInfo::Init(vector<Target *> &Targets, struct scan_lists *pts, styp
 
     hss = new HostScanStats(Targets[targetno], this);
     incompleteHosts.push_back(hss);
+    if (stateless) {
+      struct sockaddr_storage target_addr;
+      size_t target_addr_len = sizeof(target_addr);
+
+      Targets[targetno]->TargetSockAddr(&target_addr, &target_addr_len);
+      hostIndex[target_addr] = hss;
+    }
   }
   numInitialTargets = Targets.size();
   nextI = incompleteHosts.begin();
 
+  if (!o.nogcc)
+    initSubnets();
+
+  if (checkpoint_restoring() && (tcp_scan || udp_scan || sctp_scan || prot_scan))
+    restoreCheckpoint();
+
   gstats = new GroupScanStats(this); /* Peeks at several elements in USI - careful of order */
   gstats->num_hosts_timedout += num_timedout;
 
   pd = NULL;
+#ifdef HAVE_PTHREAD_H
+  rcvr = NULL;
+#endif
   rawsd = -1;
   ethsd = NULL;
 
@@ -1761,6 +2228,13 @@ HostScanStats *UltraScanInfo::findHost(struct sockaddr_storage *ss) {
   struct sockaddr_storage target_addr;
   size_t target_addr_len;
 
+  if (stateless) {
+    std::map<struct sockaddr_storage, HostScanStats *, lt_sockaddr_storage>::iterator it;
+
+    it = hostIndex.find(*ss);
+    return (it == hostIndex.end()) ? NULL : it->second;
+  }
+
   for (hss = incompleteHosts.begin(); hss != incompleteHosts.end(); hss++) {
     target_addr_len = sizeof(target_addr);
     (*hss)->target->TargetSockAddr(&target_addr, &target_addr_len);
@@ -1821,6 +2295,13 @@ int UltraScanInfo::removeCompletedHosts() {
         continue;
 
       if ((unsigned) TIMEVAL_MSEC_SUBTRACT(now, hss->completiontime) > completedHostLifetime) {
+        if (stateless) {
+          struct sockaddr_storage target_addr;
+          size_t target_addr_len = sizeof(target_addr);
+
+          hss->target->TargetSockAddr(&target_addr, &target_addr_len);
+          hostIndex.erase(target_addr);
+        }
         completedHosts.erase(hostI);
         hostsRemoved++;
       }
@@ -1866,6 +2347,14 @@ int UltraScanInfo::removeCompletedHosts() {
             log_write(LOG_PLAIN, "* %s\n", probespec2ascii((probespec *) (*iter)->pspec(), tmpbuf, sizeof(tmpbuf)));
         }
       }
+      if (stateless) {
+        /* A host that timed out may still have probes counted as active. */
+        gstats->num_probes_active -= hss->num_probes_active;
+        if (hss->subnet)
+          hss->subnet->num_probes_active -= hss->num_probes_active;
+        hss->num_probes_active = 0;
+        hss->sln.slot_sent[0] = hss->sln.slot_sent[1] = 0;
+      }
       hss->completiontime = now;
       completedHosts.push_front(hss);
       incompleteHosts.erase(hostI);
@@ -1943,6 +2432,42 @@ static void init_ultra_timing_vals(ultra_timing_vals *timing,
   else gettimeofday(&timing->last_drop, NULL);
 }
 
+/* Returns the index in the ports array of the next port to probe against the
+   host, and counts it in next_portidx. Normally this is just the next index.
+   With --likely-ports-first, ports that were found open on other hosts in the
+   group come first, then the rest in order of open frequency. Ports restored
+   from a checkpoint are skipped. The caller has already checked that there
+   are ports left. */
+static int next_port_index(UltraScanInfo *USI, HostScanStats *hss) {
+  int idx;
+
+  if (hss->ports_probed.empty())
+    return hss->next_portidx++;
+
+  hss->next_portidx++;
+  if (USI->likely_order) {
+    while (hss->next_groupopenidx < USI->group_open.size()) {
+      idx = USI->group_open[hss->next_groupopenidx++];
+      if (!hss->ports_probed[idx]) {
+        hss->ports_probed[idx] = true;
+        return idx;
+      }
+    }
+  }
+  while (hss->next_orderidx < hss->ports_probed.size()) {
+    if (USI->likely_order)
+      idx = USI->port_order[hss->next_orderidx++];
+    else
+      idx = hss->next_orderidx++;
+    if (!hss->ports_probed[idx]) {
+      hss->ports_probed[idx] = true;
+      return idx;
+    }
+  }
+  assert(0);
+  return -1;
+}
+
 /* Returns the next probe to try against target.  Supports many
    different types of probes (see probespec structure).  Returns 0 and
    fills in pspec if there is a new probe, -1 if there are none
@@ -1960,7 +2485,7 @@ static int get_next_target_probe(UltraScanInfo *USI, HostScanStats *hss,
       pspec->type = PS_TCP;
     pspec->proto = IPPROTO_TCP;
 
-    pspec->pd.tcp.dport = USI->ports->tcp_ports[hss->next_portidx++];
+    pspec->pd.tcp.dport = USI->ports->tcp_ports[next_port_index(USI, hss)];
     if (USI->scantype == CONNECT_SCAN)
       pspec->pd.tcp.flags = TH_SYN;
     else if (o.scanflags != -1)
@@ -1999,14 +2524,14 @@ static int get_next_target_probe(UltraScanInfo *USI, HostScanStats *hss,
       return -1;
     pspec->type = PS_UDP;
     pspec->proto = IPPROTO_UDP;
-    pspec->pd.udp.dport = USI->ports->udp_ports[hss->next_portidx++];
+    pspec->pd.udp.dport = USI->ports->udp_ports[next_port_index(USI, hss)];
     return 0;
   } else if (USI->sctp_scan) {
     if (hss->next_portidx >= USI->ports->sctp_count)
       return -1;
     pspec->type = PS_SCTP;
     pspec->proto = IPPROTO_SCTP;
-    pspec->pd.sctp.dport = USI->ports->sctp_ports[hss->next_portidx++];
+    pspec->pd.sctp.dport = USI->ports->sctp_ports[next_port_index(USI, hss)];
     switch (USI->scantype) {
     case SCTP_INIT_SCAN:
       pspec->pd.sctp.chunktype = SCTP_INIT;
@@ -2022,7 +2547,7 @@ static int get_next_target_probe(UltraScanInfo *USI, HostScanStats *hss,
     if (hss->next_portidx >= USI->ports->prot_count)
       return -1;
     pspec->type = PS_PROTO;
-    pspec->proto = USI->ports->prots[hss->next_portidx++];
+    pspec->proto = USI->ports->prots[next_port_index(USI, hss)];
     return 0;
   } else if (USI->ping_scan_arp) {
     if (hss->sent_arp)
@@ -2195,6 +2720,8 @@ void HostScanStats::destroyOutstandingProbe(list<UltraProbe *>::iterator probeI)
     num_probes_active--;
     assert(USI->gstats->num_probes_active > 0);
     USI->gstats->num_probes_active--;
+    if (subnet)
+      subnet->num_probes_active--;
   }
 
   if (!probe->isPing() && probe->timedout && !probe->retransmitted) {
@@ -2253,6 +2780,11 @@ static void ultrascan_adjust_timing(UltraScanInfo *USI, HostScanStats *hss,
   hss->timing.num_replies_expected++;
   hss->timing.num_updates++;
 
+  if (hss->subnet) {
+    hss->subnet->timing.num_replies_expected++;
+    hss->subnet->timing.num_updates++;
+  }
+
   /* Notice a drop if
      1) We get a response to a retransmitted probe (meaning the first reply was
         dropped), or
@@ -2266,6 +2798,9 @@ static void ultrascan_adjust_timing(UltraScanInfo *USI, HostScanStats *hss,
       hss->timing.drop(hss->num_probes_active, &USI->perf, &USI->now);
     if (TIMEVAL_AFTER(probe->sent, USI->gstats->timing.last_drop))
       USI->gstats->timing.drop_group(USI->gstats->num_probes_active, &USI->perf, &USI->now);
+    /* The other hosts of the subnet slow down right away too. */
+    if (hss->subnet && TIMEVAL_AFTER(probe->sent, hss->subnet->timing.last_drop))
+      hss->subnet->timing.drop_group(hss->subnet->num_probes_active, &USI->perf, &USI->now);
   }
   /* If !probe->isPing() and rcvdtime == NULL, do nothing. */
 
@@ -2274,6 +2809,8 @@ static void ultrascan_adjust_timing(UltraScanInfo *USI, HostScanStats *hss,
   if (rcvdtime != NULL) {
     USI->gstats->timing.ack(&USI->perf, ping_magnifier);
     hss->timing.ack(&USI->perf, ping_magnifier);
+    if (hss->subnet)
+      hss->subnet->timing.ack(&USI->perf, ping_magnifier);
   }
 
   /* If packet drops are particularly bad, enforce a delay between
@@ -2316,6 +2853,8 @@ void HostScanStats::markProbeTimedout(list<UltraProbe *>::iterator probeI) {
   num_probes_active--;
   assert(USI->gstats->num_probes_active > 0);
   USI->gstats->num_probes_active--;
+  if (subnet)
+    subnet->num_probes_active--;
   ultrascan_adjust_timing(USI, this, probe, NULL);
   if (!probe->isPing())
     /* I'll leave it in the queue in case some response ever does come */
@@ -2331,6 +2870,11 @@ void HostScanStats::markProbeTimedout(list<UltraProbe *>::iterator probeI) {
 }
 
 bool HostScanStats::completed() {
+  /* A stateless scan has no probes to look at; stateless_update_host() decides
+     when the host is done. */
+  if (USI->stateless)
+    return sln.done;
+
   /* If there are probes active or awaiting retransmission, we are not done. */
   if (num_probes_active != 0 || num_probes_waiting_retransmit != 0
       || !probe_bench.empty() || !retry_stack.empty()) {
@@ -2437,6 +2981,128 @@ static bool sport_decode(const UltraScanInfo *USI, u16 magic_portno, u16 portno,
   return true;
 }
 
+/* Stateless scans put a token in the source port and in the sequence number
+   (or the acknowledgement number, for probes with the ACK flag) of each
+   probe, much like a SYN cookie. It is a SipHash of the destination address
+   and port under the secret USI->stateless_key, so it can be recomputed from
+   a response rather than looked up. The source port is 16 bits of it (unless
+   -g fixes the source port), and the top 16 bits of the sequence number are
+   16 more. The bottom 16 bits hold the try number and the send time in
+   STATELESS_TICK_MS units, masked with the rest of the hash. */
+#define STATELESS_TRYNO_BITS 4
+#define STATELESS_MAX_TRYNO ((1 << STATELESS_TRYNO_BITS) - 1)
+#define STATELESS_TICK_MS 4
+#define STATELESS_TICKS (1 << (16 - STATELESS_TRYNO_BITS))
+
+#define ROTL64(x, b) (u64) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND do { \
+  v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+  v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+  v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+  v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+} while (0)
+
+static u64 le64(const u8 *p) {
+  return (u64) p[0] | ((u64) p[1] << 8) | ((u64) p[2] << 16) | ((u64) p[3] << 24)
+         | ((u64) p[4] << 32) | ((u64) p[5] << 40) | ((u64) p[6] << 48) | ((u64) p[7] << 56);
+}
+
+/* SipHash-2-4 of inlen bytes at in, under the 128-bit key. */
+static u64 siphash24(const u8 key[16], const u8 *in, size_t inlen) {
+  u64 k0 = le64(key), k1 = le64(key + 8);
+  u64 v0 = k0 ^ 0x736f6d6570736575ULL;
+  u64 v1 = k1 ^ 0x646f72616e646f6dULL;
+  u64 v2 = k0 ^ 0x6c7967656e657261ULL;
+  u64 v3 = k1 ^ 0x7465646279746573ULL;
+  u64 b = (u64) inlen << 56;
+  u64 m;
+  size_t i;
+
+  for (; inlen >= 8; in += 8, inlen -= 8) {
+    m = le64(in);
+    v3 ^= m;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= m;
+  }
+  for (i = 0; i < inlen; i++)
+    b |= (u64) in[i] << (8 * i);
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* The hash that stateless tokens for probes to dst and dport are made of. */
+static u64 stateless_hash(const UltraScanInfo *USI,
+                          const struct sockaddr_storage *dst, u16 dport) {
+  u8 buf[18];
+  size_t len;
+
+  if (dst->ss_family == AF_INET6) {
+    memcpy(buf, &((const struct sockaddr_in6 *) dst)->sin6_addr, 16);
+    len = 16;
+  } else {
+    memcpy(buf, &((const struct sockaddr_in *) dst)->sin_addr, 4);
+    len = 4;
+  }
+  buf[len++] = dport >> 8;
+  buf[len++] = dport & 0xFF;
+
+  return siphash24(USI->stateless_key, buf, len);
+}
+
+/* The source port of stateless probes with hash h. */
+static u16 stateless_sport(u64 h) {
+  if (o.magic_port_set)
+    return o.magic_port;
+  return 1024 + (u16) ((h & 0xFFFF) % (65536 - 1024));
+}
+
+/* The sequence number of a stateless probe with hash h and the given try
+   number, sent now. */
+static u32 stateless_seq(const UltraScanInfo *USI, u64 h, unsigned int tryno) {
+  u32 ticks;
+  u16 low;
+
+  assert(tryno <= STATELESS_MAX_TRYNO);
+  ticks = TIMEVAL_MSEC_SUBTRACT(USI->now, USI->stateless_epoch) / STATELESS_TICK_MS;
+  low = ((ticks % STATELESS_TICKS) << STATELESS_TRYNO_BITS) | tryno;
+
+  return ((u32) (h >> 16) & 0xFFFF0000) | (u16) (low ^ (h >> 48));
+}
+
+/* Undoes stateless_seq. Checks a sequence number reflected by a response
+   received at rcvdtime against the token with hash h, and if it matches,
+   recovers the try number and send time of the probe. The send time is only
+   known modulo STATELESS_TICKS ticks; the latest one before rcvdtime is
+   taken. */
+static bool stateless_decode(const UltraScanInfo *USI, u64 h, u32 seq,
+                             const struct timeval *rcvdtime,
+                             unsigned int *tryno, struct timeval *sent) {
+  u32 ticks, now_ticks;
+  u16 low;
+
+  if ((seq & 0xFFFF0000) != ((u32) (h >> 16) & 0xFFFF0000))
+    return false;
+
+  low = (u16) (seq ^ (h >> 48));
+  *tryno = low & STATELESS_MAX_TRYNO;
+  ticks = low >> STATELESS_TRYNO_BITS;
+  now_ticks = TIMEVAL_MSEC_SUBTRACT(*rcvdtime, USI->stateless_epoch) / STATELESS_TICK_MS;
+  ticks = now_ticks - ((now_ticks - ticks) % STATELESS_TICKS);
+  TIMEVAL_MSEC_ADD(*sent, USI->stateless_epoch, (long) ticks * STATELESS_TICK_MS);
+
+  return true;
+}
+
 static bool tcp_probe_match(const UltraScanInfo *USI, const UltraProbe *probe,
                             const HostScanStats *hss, const struct tcp_hdr *tcp,
                             const struct sockaddr_storage *src, const struct sockaddr_storage *dst,
@@ -2533,7 +3199,12 @@ void HostScanStats::getTiming(struct ultra_timing_vals *tmng) {
     return;
   }
 
-  /* Otherwise, use the global cwnd stats if it has sufficient responses */
+  /* Otherwise, use what has been learned about the subnet, or about the whole
+     group, if there have been enough responses. */
+  if (subnet != NULL && subnet->timing.num_updates > 1) {
+    *tmng = subnet->timing;
+    return;
+  }
   if (USI->gstats->timing.num_updates > 1) {
     *tmng = USI->gstats->timing;
     return;
@@ -2696,6 +3367,16 @@ static bool ultrascan_port_pspec_update(UltraScanInfo *USI,
     break;
   }
 
+  /* Let the other hosts in the group know about a newly open port, so that
+     they can try it early. */
+  if (USI->likely_order && newstate == PORT_OPEN && oldstate != PORT_OPEN) {
+    int idx = USI->port_index[portno];
+    if (idx != -1 && !USI->group_open_seen[idx]) {
+      USI->group_open_seen[idx] = true;
+      USI->group_open.push_back(idx);
+    }
+  }
+
   return oldstate != newstate;
 }
 
@@ -2705,15 +3386,111 @@ void HostScanStats::boostScanDelay() {
   unsigned int maxAllowed = USI->tcp_scan ? o.maxTCPScanDelay() :
                             USI->udp_scan ? o.maxUDPScanDelay() :
                             o.maxSCTPScanDelay();
-  if (sdn.delayms == 0)
-    sdn.delayms = (USI->udp_scan) ? 50 : 5; // In many cases, a pcap wait takes a minimum of 80ms, so this matters little :(
-  else sdn.delayms = MIN(sdn.delayms * 2, MAX(sdn.delayms, 1000));
+  unsigned int modeldelay = rateLimitDelay();
+
+  /* If the rate limit model calls for a clearly longer delay, move halfway to
+     it (or to the maximum), so that a window that happened to look limited
+     can't slow the scan down all at once. Otherwise the drops aren't (only)
+     the rate limit's doing, or the port mix was only ever seen limited and
+     the model falls short; keep doubling. */
+  if (modeldelay > sdn.delayms + sdn.delayms / 8 && sdn.delayms < maxAllowed) {
+    if (!rlm.pacing) {
+      rlm.pacing = true;
+      rlm.tokens = 0;
+    }
+    sdn.delayms += (modeldelay - sdn.delayms + 1) / 2;
+    if (o.debugging)
+      log_write(LOG_STDOUT, "%s appears to rate limit responses to %.2f/s (%.0f%% of probes answered, burst of %u probes); moving scan delay toward %ums\n",
+                target->targetipstr(), rlm.rate * 1000, rlm.ratio * 100, rlm.burst, modeldelay);
+  } else {
+    if (sdn.delayms == 0)
+      sdn.delayms = (USI->udp_scan) ? 50 : 5; // In many cases, a pcap wait takes a minimum of 80ms, so this matters little :(
+    else sdn.delayms = MIN(sdn.delayms * 2, MAX(sdn.delayms, 1000));
+    rlm.pacing = false;
+  }
   sdn.delayms = MIN(sdn.delayms, maxAllowed);
   sdn.last_boost = USI->now;
   sdn.droppedRespSinceDelayChanged = 0;
   sdn.goodRespSinceDelayChanged = 0;
 }
 
+void HostScanStats::rateLimitResponse(const struct timeval *rcvdtime) {
+  if (rlm.nresp < RLM_SAMPLES)
+    rlm.first[rlm.nresp] = *rcvdtime;
+  rlm.nresp++;
+  rateLimitWindow();
+  rlm.window_resp++;
+}
+
+void HostScanStats::rateLimitWindow() {
+  long elapsed = TIMEVAL_MSEC_SUBTRACT(USI->now, rlm.window_start);
+  double share, rate;
+
+  if (elapsed < RLM_WINDOW_MS)
+    return;
+
+  if (rlm.window_sent >= RLM_MIN_SAMPLES) {
+    share = (double) rlm.window_resp / rlm.window_sent;
+    rate = (double) rlm.window_resp / elapsed;
+    /* The first window holds the target's burst, which says nothing about
+       either the port mix or the limit. */
+    if (rlm.windows > 0) {
+      if (share > rlm.ratio)
+        rlm.ratio = share;
+      else if (rlm.rate == 0)
+        rlm.rate = rate;
+      else
+        rlm.rate = 0.75 * rlm.rate + 0.25 * rate;
+    }
+    rlm.windows++;
+  }
+
+  rlm.window_start = USI->now;
+  rlm.window_sent = 0;
+  rlm.window_resp = 0;
+}
+
+unsigned int HostScanStats::rateLimitDelay() {
+  unsigned int nfirst = MIN(rlm.nresp, RLM_SAMPLES);
+  unsigned int i;
+  long gap, maxgap = 0;
+
+  if (rlm.rate <= 0 || rlm.ratio <= 0)
+    return 0;
+
+  /* The burst is the run of first responses that came much faster than the
+     slowest ones did. Only a share of the probes use it up. */
+  for (i = 1; i < nfirst; i++) {
+    gap = TIMEVAL_SUBTRACT(rlm.first[i], rlm.first[i - 1]);
+    maxgap = MAX(maxgap, gap);
+  }
+  for (i = 1; i < nfirst; i++) {
+    if (TIMEVAL_SUBTRACT(rlm.first[i], rlm.first[i - 1]) >= maxgap / 4)
+      break;
+  }
+  rlm.burst = MAX(1, (unsigned int) (i / rlm.ratio));
+
+  /* Milliseconds per probe that keep the responses at the limit, plus 5% to
+     stay under it. */
+  return (unsigned int) ceil(rlm.ratio / rlm.rate * 1.05);
+}
+
+void HostScanStats::nextSendTime(struct timeval *tv) {
+  double tokens;
+
+  if (rlm.pacing && rlm.burst > 1) {
+    /* After a pause, the target's bucket has refilled, and so has ours. */
+    tokens = rlm.tokens + (double) TIMEVAL_MSEC_SUBTRACT(USI->now, lastprobe_sent) / sdn.delayms;
+    if (tokens >= 1) {
+      *tv = USI->now;
+      return;
+    }
+    TIMEVAL_MSEC_ADD(*tv, lastprobe_sent, (long) ((1 - rlm.tokens) * sdn.delayms));
+    return;
+  }
+  TIMEVAL_MSEC_ADD(*tv, lastprobe_sent, sdn.delayms);
+}
+
 /* Dismiss all probe attempts on bench -- hosts are marked down and ports will
    be set to whatever the default port state is for the scan. */
 void HostScanStats::dismissBench() {
@@ -2803,15 +3580,14 @@ static bool ultrascan_host_pspec_update(UltraScanInfo *USI, HostScanStats *hss,
 
 /* Called when a new status is determined for host in hss (eg. it is
    found to be up or down by a ping/ping_arp scan.  The probe that led
-   to this new decision is in probeI.  This function needs to update
+   to this new decision is probe.  This function needs to update
    timing information and other stats as appropriate. If
-   adjust_timing_hint is false, packet stats are not updated. */
-static void ultrascan_host_probe_update(UltraScanInfo *USI, HostScanStats *hss,
-                                        list<UltraProbe *>::iterator probeI,
-                                        int newstate, struct timeval *rcvdtime,
-                                        bool adjust_timing_hint = true) {
-  UltraProbe *probe = *probeI;
-
+   adjust_timing_hint is false, packet stats are not updated. Unlike
+   ultrascan_host_probe_update(), this leaves the probe alone. */
+static void ultrascan_host_update(UltraScanInfo *USI, HostScanStats *hss,
+                                  UltraProbe *probe,
+                                  int newstate, struct timeval *rcvdtime,
+                                  bool adjust_timing_hint = true) {
   if (o.debugging > 1) {
     struct timeval tv;
 
@@ -2857,29 +3633,40 @@ static void ultrascan_host_probe_update(UltraScanInfo *USI, HostScanStats *hss,
     hss->target->pingprobe = *probe->pspec();
     hss->target->pingprobe_state = PORT_UNKNOWN;
   }
+}
 
+/* Like ultrascan_host_update(), for the probe in probeI, which is then
+   destroyed. */
+static void ultrascan_host_probe_update(UltraScanInfo *USI, HostScanStats *hss,
+                                        list<UltraProbe *>::iterator probeI,
+                                        int newstate, struct timeval *rcvdtime,
+                                        bool adjust_timing_hint = true) {
+  ultrascan_host_update(USI, hss, *probeI, newstate, rcvdtime, adjust_timing_hint);
   hss->destroyOutstandingProbe(probeI);
 }
 
 /* This function is called when a new status is determined for a port.
-   the port in the probeI of host hss is now in newstate.  This
+   the port probed by probe on host hss is now in newstate.  This
    function needs to update timing information, other stats, and the
    Nmap port state table as appropriate.  If rcvdtime is NULL or we got
    unimportant packet, packet stats are not updated.  If you don't have an
-   UltraProbe list iterator, you may need to call ultrascan_port_psec_update()
+   UltraProbe, you may need to call ultrascan_port_psec_update()
    instead. If adjust_timing_hint is false, packet stats are not
-   updated. */
-static void ultrascan_port_probe_update(UltraScanInfo *USI, HostScanStats *hss,
-                                        list<UltraProbe *>::iterator probeI,
-                                        int newstate, struct timeval *rcvdtime,
-                                        bool adjust_timing_hint = true) {
-  UltraProbe *probe = *probeI;
+   updated. Unlike ultrascan_port_probe_update(), this leaves the probe
+   alone. */
+static void ultrascan_port_update(UltraScanInfo *USI, HostScanStats *hss,
+                                  UltraProbe *probe,
+                                  int newstate, struct timeval *rcvdtime,
+                                  bool adjust_timing_hint = true) {
   const probespec *pspec = probe->pspec();
 
   ultrascan_port_pspec_update(USI, hss, pspec, newstate);
 
   ultrascan_adjust_timeouts(USI, hss, probe, rcvdtime);
 
+  if (rcvdtime != NULL)
+    hss->rateLimitResponse(rcvdtime);
+
   /* Decide whether to adjust timing. We and together a bunch of conditions.
      First, don't adjust timing if adjust_timing_hint is false. */
   bool adjust_timing = adjust_timing_hint;
@@ -2944,7 +3731,15 @@ static void ultrascan_port_probe_update(UltraScanInfo *USI, HostScanStats *hss,
     hss->target->pingprobe = *probe->pspec();
     hss->target->pingprobe_state = newstate;
   }
+}
 
+/* Like ultrascan_port_update(), for the probe in probeI, which is then
+   destroyed. */
+static void ultrascan_port_probe_update(UltraScanInfo *USI, HostScanStats *hss,
+                                        list<UltraProbe *>::iterator probeI,
+                                        int newstate, struct timeval *rcvdtime,
+                                        bool adjust_timing_hint = true) {
+  ultrascan_port_update(USI, hss, *probeI, newstate, rcvdtime, adjust_timing_hint);
   hss->destroyOutstandingProbe(probeI);
 }
 
@@ -3030,6 +3825,8 @@ static UltraProbe *sendConnectScanProbe(UltraScanInfo *USI, HostScanStats *hss,
   probeI--;
   USI->gstats->num_probes_active++;
   hss->num_probes_active++;
+  if (hss->subnet)
+    hss->subnet->num_probes_active++;
 
   /* It would be convenient if the connect() call would never succeed
      or permanantly fail here, so related code cood all be localized
@@ -3132,6 +3929,8 @@ static UltraProbe *sendArpScanProbe(UltraScanInfo *USI, HostScanStats *hss,
   hss->probes_outstanding.push_back(probe);
   USI->gstats->num_probes_active++;
   hss->num_probes_active++;
+  if (hss->subnet)
+    hss->subnet->num_probes_active++;
 
   gettimeofday(&USI->now, NULL);
   return probe;
@@ -3201,6 +4000,8 @@ static UltraProbe *sendNDScanProbe(UltraScanInfo *USI, HostScanStats *hss,
   hss->probes_outstanding.push_back(probe);
   USI->gstats->num_probes_active++;
   hss->num_probes_active++;
+  if (hss->subnet)
+    hss->subnet->num_probes_active++;
 
   gettimeofday(&USI->now, NULL);
   return probe;
@@ -3421,7 +4222,7 @@ static UltraProbe *sendIPScanProbe(UltraScanInfo *USI, HostScanStats *hss,
     const char *payload;
     size_t payload_length;
 
-    payload = get_udp_payload(pspec->pd.udp.dport, &payload_length);
+    payload = get_udp_payload(pspec->pd.udp.dport, &payload_length, tryno);
 
     if (hss->target->af() == AF_INET) {
       for (decoy = 0; decoy < o.numdecoys; decoy++) {
@@ -3587,6 +4388,8 @@ static UltraProbe *sendIPScanProbe(UltraScanInfo *USI, HostScanStats *hss,
   hss->probes_outstanding.push_back(probe);
   USI->gstats->num_probes_active++;
   hss->num_probes_active++;
+  if (hss->subnet)
+    hss->subnet->num_probes_active++;
 
   gettimeofday(&USI->now, NULL);
   return probe;
@@ -3681,61 +4484,238 @@ static void doAnyRetryStackRetransmits(UltraScanInfo *USI) {
   }
 }
 
-/* Sends a ping probe to the host.  Assumes that caller has already
-   checked that sending is OK w/congestion control and that pingprobe is
-   available */
-static void sendPingProbe(UltraScanInfo *USI, HostScanStats *hss) {
-  if (o.debugging > 1) {
-    char tmpbuf[64];
-    log_write(LOG_PLAIN, "Ultrascan PING SENT to %s [%s]\n", hss->target->targetipstr(),
-              probespec2ascii(&hss->target->pingprobe, tmpbuf, sizeof(tmpbuf)));
-  }
-  if (hss->target->pingprobe.type == PS_CONNECTTCP) {
-    sendConnectScanProbe(USI, hss, hss->target->pingprobe.pd.tcp.dport, 0,
-                         hss->nextPingSeq(true));
-  } else if (hss->target->pingprobe.type == PS_TCP || hss->target->pingprobe.type == PS_UDP
-             || hss->target->pingprobe.type == PS_SCTP || hss->target->pingprobe.type == PS_PROTO
-             || hss->target->pingprobe.type == PS_ICMP) {
-    sendIPScanProbe(USI, hss, &hss->target->pingprobe, 0, hss->nextPingSeq(true));
-  } else if (hss->target->pingprobe.type == PS_ARP) {
-    sendArpScanProbe(USI, hss, 0, hss->nextPingSeq(true));
-  } else if (hss->target->pingprobe.type == PS_ND) {
-    sendNDScanProbe(USI, hss, 0, hss->nextPingSeq(true));
-  } else if (USI->scantype == RPC_SCAN) {
-    assert(0); /* TODO: fill out */
-  } else {
-    assert(0);
-  }
-  USI->gstats->probes_sent++;
+/* Gives up on the stateless probes counted in hss->sln.slot_sent[slot]. */
+static void stateless_expire_slot(UltraScanInfo *USI, HostScanStats *hss,
+                                  int slot) {
+  unsigned int n = hss->sln.slot_sent[slot];
+
+  assert(hss->num_probes_active >= n);
+  hss->num_probes_active -= n;
+  assert(USI->gstats->num_probes_active >= (int) n);
+  USI->gstats->num_probes_active -= n;
+  if (hss->subnet)
+    hss->subnet->num_probes_active -= n;
+  hss->sln.slot_sent[slot] = 0;
 }
 
-static void sendGlobalPingProbe(UltraScanInfo *USI) {
-  HostScanStats *hss;
-
-  hss = USI->gstats->pinghost;
-  assert(hss != NULL);
+/* Counts a response to one of the stateless probes of hss. Which one isn't
+   known, so the oldest slot is assumed. */
+static void stateless_probe_answered(UltraScanInfo *USI, HostScanStats *hss) {
+  int slot = (hss->sln.slot_sent[1] > 0) ? 1 : 0;
 
-  if (o.debugging > 1) {
-    char tmpbuf[64];
-    log_write(LOG_PLAIN, "Ultrascan GLOBAL PING SENT to %s [%s]\n", hss->target->targetipstr(),
-              probespec2ascii(&hss->target->pingprobe, tmpbuf, sizeof(tmpbuf)));
-  }
-  sendPingProbe(USI, hss);
+  if (hss->sln.slot_sent[slot] == 0)
+    return; /* Late response to a probe already given up on */
+  hss->sln.slot_sent[slot]--;
+  hss->num_probes_active--;
+  USI->gstats->num_probes_active--;
+  if (hss->subnet)
+    hss->subnet->num_probes_active--;
 }
 
-static void doAnyPings(UltraScanInfo *USI) {
-  list<HostScanStats *>::iterator hostI;
-  HostScanStats *hss = NULL;
-
-  gettimeofday(&USI->now, NULL);
-  /* First single host pings */
-  for (hostI = USI->incompleteHosts.begin();
-       hostI != USI->incompleteHosts.end(); hostI++) {
-    hss = *hostI;
-    if (hss->target->pingprobe.type != PS_NONE &&
-        hss->rld.rld_waiting == false &&
-        hss->numprobes_sent >= hss->lastping_sent_numprobes + 10 &&
-        TIMEVAL_SUBTRACT(USI->now, hss->lastrcvd) > USI->perf.pingtime &&
+/* Sends a stateless probe (see stateless_hash()) with the given try number.
+   Nothing is kept about it but the counters in hss->sln. */
+static void sendStatelessProbe(UltraScanInfo *USI, HostScanStats *hss,
+                               const probespec *pspec, u8 tryno) {
+  u8 *packet = NULL;
+  u32 packetlen = 0;
+  int decoy = 0;
+  u32 seq = 0;
+  u32 ack = 0;
+  u16 sport;
+  u16 ipid = get_random_u16();
+  u64 h;
+  struct eth_nfo eth;
+  struct eth_nfo *ethptr = NULL;
+  u8 *tcpops = NULL;
+  u16 tcpopslen = 0;
+
+  assert(pspec->type == PS_TCP);
+
+  if (USI->ethsd) {
+    memcpy(eth.srcmac, hss->target->SrcMACAddress(), 6);
+    memcpy(eth.dstmac, hss->target->NextHopMACAddress(), 6);
+    eth.ethsd = USI->ethsd;
+    eth.devname[0] = '\0';
+    ethptr = &eth;
+  }
+
+  h = stateless_hash(USI, hss->target->TargetSockAddr(), pspec->pd.tcp.dport);
+  sport = stateless_sport(h);
+  /* As in sendIPScanProbe, a probe with the ACK flag gets the token in its
+     ACK field, because that is what a response reflects. */
+  if (pspec->pd.tcp.flags & TH_ACK)
+    ack = stateless_seq(USI, h, tryno);
+  else
+    seq = stateless_seq(USI, h, tryno);
+
+  if (pspec->pd.tcp.flags & TH_SYN) {
+    tcpops = (u8 *) "\x02\x04\x05\xb4";
+    tcpopslen = 4;
+  }
+
+  if (hss->target->af() == AF_INET) {
+    for (decoy = 0; decoy < o.numdecoys; decoy++) {
+      packet = build_tcp_raw(&o.decoys[decoy], hss->target->v4hostip(),
+                             o.ttl, ipid, IP_TOS_DEFAULT, false,
+                             o.ipoptions, o.ipoptionslen,
+                             sport, pspec->pd.tcp.dport,
+                             seq, ack, 0, pspec->pd.tcp.flags, 0, 0,
+                             tcpops, tcpopslen,
+                             o.extra_payload, o.extra_payload_length,
+                             &packetlen);
+      hss->probeSent(packetlen);
+      send_ip_packet(USI->rawsd, ethptr, hss->target->TargetSockAddr(), packet, packetlen);
+      free(packet);
+    }
+  } else if (hss->target->af() == AF_INET6) {
+    struct sockaddr_storage source;
+    struct sockaddr_in6 *sin6;
+    size_t source_len;
+
+    source_len = sizeof(source);
+    hss->target->SourceSockAddr(&source, &source_len);
+    sin6 = (struct sockaddr_in6 *) &source;
+    packet = build_tcp_raw_ipv6(&sin6->sin6_addr, hss->target->v6hostip(),
+                                0, 0, o.ttl, sport, pspec->pd.tcp.dport,
+                                seq, ack, 0, pspec->pd.tcp.flags, 0, 0,
+                                tcpops, tcpopslen,
+                                o.extra_payload, o.extra_payload_length,
+                                &packetlen);
+    hss->probeSent(packetlen);
+    send_ip_packet(USI->rawsd, ethptr, hss->target->TargetSockAddr(), packet, packetlen);
+    free(packet);
+  }
+
+  hss->numprobes_sent++;
+  USI->gstats->probes_sent++;
+  hss->sln.slot_sent[0]++;
+  hss->num_probes_active++;
+  USI->gstats->num_probes_active++;
+  if (hss->subnet)
+    hss->subnet->num_probes_active++;
+
+  gettimeofday(&USI->now, NULL);
+}
+
+/* Fills in pspec with the next probe of the current pass of a stateless scan
+   of hss, skipping ports whose state is already known. Returns false if the
+   pass is over. The end of the pass is noted in hss->sln.pass_end. */
+static bool stateless_next_probe(UltraScanInfo *USI, HostScanStats *hss,
+                                 probespec *pspec) {
+  int numports = stateless_num_ports(USI);
+  int synports = 0;
+  bool found = false;
+  int idx;
+
+  memset(pspec, 0, sizeof(*pspec));
+  pspec->type = PS_TCP;
+  pspec->proto = IPPROTO_TCP;
+  if (USI->ping_scan && (o.pingtype & PINGTYPE_TCP_USE_SYN))
+    synports = USI->ports->syn_ping_count;
+
+  while (!found && hss->sln.next < numports) {
+    idx = hss->sln.next++;
+    if (USI->ping_scan) {
+      if (idx < synports) {
+        pspec->pd.tcp.dport = USI->ports->syn_ping_ports[idx];
+        pspec->pd.tcp.flags = TH_SYN;
+      } else {
+        pspec->pd.tcp.dport = USI->ports->ack_ping_ports[idx - synports];
+        pspec->pd.tcp.flags = TH_ACK;
+      }
+      found = true;
+    } else {
+      if (USI->likely_order)
+        idx = USI->port_order[idx];
+      pspec->pd.tcp.dport = USI->ports->tcp_ports[idx];
+      pspec->pd.tcp.flags = TH_SYN;
+      found = hss->target->ports.portIsDefault(pspec->pd.tcp.dport, IPPROTO_TCP);
+    }
+  }
+  if (hss->sln.next >= numports)
+    hss->sln.pass_end = USI->now;
+
+  return found;
+}
+
+/* The stateless counterpart of doAnyNewProbes() and the retransmission
+   functions. Retransmissions are just later passes over the ports. */
+static void doAnyStatelessProbes(UltraScanInfo *USI) {
+  HostScanStats *hss, *unableToSend;
+  probespec pspec;
+
+  gettimeofday(&USI->now, NULL);
+
+  unableToSend = NULL;
+  hss = USI->nextIncompleteHost();
+  while (hss != NULL && hss != unableToSend && USI->gstats->sendOK(NULL)) {
+    if (hss->sendOK(NULL) && stateless_next_probe(USI, hss, &pspec)) {
+      sendStatelessProbe(USI, hss, &pspec, hss->sln.tryno);
+      unableToSend = NULL;
+    } else if (unableToSend == NULL) {
+      /* Mark this as the first host we were not able to send to so we can break
+         when we see it again. */
+      unableToSend = hss;
+    }
+    hss = USI->nextIncompleteHost();
+  }
+}
+
+/* Sends a ping probe to the host.  Assumes that caller has already
+   checked that sending is OK w/congestion control and that pingprobe is
+   available */
+static void sendPingProbe(UltraScanInfo *USI, HostScanStats *hss) {
+  if (o.debugging > 1) {
+    char tmpbuf[64];
+    log_write(LOG_PLAIN, "Ultrascan PING SENT to %s [%s]\n", hss->target->targetipstr(),
+              probespec2ascii(&hss->target->pingprobe, tmpbuf, sizeof(tmpbuf)));
+  }
+  if (hss->target->pingprobe.type == PS_CONNECTTCP) {
+    sendConnectScanProbe(USI, hss, hss->target->pingprobe.pd.tcp.dport, 0,
+                         hss->nextPingSeq(true));
+  } else if (hss->target->pingprobe.type == PS_TCP || hss->target->pingprobe.type == PS_UDP
+             || hss->target->pingprobe.type == PS_SCTP || hss->target->pingprobe.type == PS_PROTO
+             || hss->target->pingprobe.type == PS_ICMP) {
+    sendIPScanProbe(USI, hss, &hss->target->pingprobe, 0, hss->nextPingSeq(true));
+  } else if (hss->target->pingprobe.type == PS_ARP) {
+    sendArpScanProbe(USI, hss, 0, hss->nextPingSeq(true));
+  } else if (hss->target->pingprobe.type == PS_ND) {
+    sendNDScanProbe(USI, hss, 0, hss->nextPingSeq(true));
+  } else if (USI->scantype == RPC_SCAN) {
+    assert(0); /* TODO: fill out */
+  } else {
+    assert(0);
+  }
+  USI->gstats->probes_sent++;
+}
+
+static void sendGlobalPingProbe(UltraScanInfo *USI) {
+  HostScanStats *hss;
+
+  hss = USI->gstats->pinghost;
+  assert(hss != NULL);
+
+  if (o.debugging > 1) {
+    char tmpbuf[64];
+    log_write(LOG_PLAIN, "Ultrascan GLOBAL PING SENT to %s [%s]\n", hss->target->targetipstr(),
+              probespec2ascii(&hss->target->pingprobe, tmpbuf, sizeof(tmpbuf)));
+  }
+  sendPingProbe(USI, hss);
+}
+
+static void doAnyPings(UltraScanInfo *USI) {
+  list<HostScanStats *>::iterator hostI;
+  HostScanStats *hss = NULL;
+
+  gettimeofday(&USI->now, NULL);
+  /* First single host pings */
+  for (hostI = USI->incompleteHosts.begin();
+       hostI != USI->incompleteHosts.end(); hostI++) {
+    hss = *hostI;
+    if (hss->target->pingprobe.type != PS_NONE &&
+        hss->rld.rld_waiting == false &&
+        hss->numprobes_sent >= hss->lastping_sent_numprobes + 10 &&
+        TIMEVAL_SUBTRACT(USI->now, hss->lastrcvd) > USI->perf.pingtime &&
         TIMEVAL_SUBTRACT(USI->now, hss->lastping_sent) > USI->perf.pingtime &&
         USI->gstats->sendOK(NULL) && hss->sendOK(NULL)) {
       sendPingProbe(USI, hss);
@@ -4155,6 +5135,199 @@ static bool do_one_select_round(UltraScanInfo *USI, struct timeval *stime) {
   return numGoodSD;
 }
 
+#ifdef HAVE_PTHREAD_H
+PcapReceiver::PcapReceiver(pcap_t *pd) {
+  this->pd = pd;
+  ring = NULL;
+  head = tail = 0;
+  full_ms = 0;
+  stopping = failed = false;
+  errbuf[0] = '\0';
+  wakefd[0] = wakefd[1] = -1;
+  running = waiting = false;
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&cond, NULL);
+}
+
+PcapReceiver::~PcapReceiver() {
+  stop();
+  if (wakefd[0] != -1) {
+    close(wakefd[0]);
+    close(wakefd[1]);
+  }
+  free(ring);
+  pthread_mutex_destroy(&lock);
+  pthread_cond_destroy(&cond);
+}
+
+bool PcapReceiver::start() {
+  sigset_t mask, oldmask;
+  int rc;
+
+  /* The thread selects on the sniffer so that stop() can interrupt it. */
+  if (!pcap_selectable_fd_valid() || my_pcap_get_selectable_fd(pd) == -1) {
+    Strncpy(errbuf, "sniffer is not selectable", sizeof(errbuf));
+    return false;
+  }
+  if (pipe(wakefd) == -1) {
+    Snprintf(errbuf, sizeof(errbuf), "pipe: %s", strerror(errno));
+    wakefd[0] = wakefd[1] = -1;
+    return false;
+  }
+  /* Nonblocking, so that pcap_dispatch takes whatever is buffered and
+     returns. */
+  if (pcap_setnonblock(pd, 1, errbuf) == -1)
+    return false;
+  ring = (struct recv_frame *) safe_malloc(RECV_RING_SIZE * sizeof(*ring));
+
+  /* Signals are handled by the scan thread. */
+  sigfillset(&mask);
+  pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+  rc = pthread_create(&thread, NULL, run, this);
+  pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+  if (rc != 0) {
+    pcap_setnonblock(pd, 0, errbuf);
+    Snprintf(errbuf, sizeof(errbuf), "pthread_create: %s", strerror(rc));
+    return false;
+  }
+  running = true;
+
+  return true;
+}
+
+void PcapReceiver::stop() {
+  if (!running)
+    return;
+  stopping = true;
+  if (write(wakefd[1], "", 1) == -1)
+    error("%s: write: %s", __func__, strerror(errno));
+  pthread_join(thread, NULL);
+  running = false;
+  pcap_setnonblock(pd, 0, errbuf);
+}
+
+void *PcapReceiver::run(void *arg) {
+  PcapReceiver *r = (PcapReceiver *) arg;
+  int fd = my_pcap_get_selectable_fd(r->pd);
+  fd_set fds;
+  unsigned int room;
+  int n;
+
+  while (!r->stopping) {
+    /* If the ring is full, leave frames in the kernel buffer until the scan
+       thread makes room. */
+    room = RECV_RING_SIZE - (r->head - r->tail);
+    if (room == 0) {
+      r->full_ms++;
+      usleep(1000);
+      continue;
+    }
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    FD_SET(r->wakefd[0], &fds);
+    n = select(MAX(fd, r->wakefd[0]) + 1, &fds, NULL, NULL, NULL);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      Snprintf(r->errbuf, sizeof(r->errbuf), "select: %s", strerror(errno));
+    } else if (r->stopping || !FD_ISSET(fd, &fds)) {
+      continue;
+    } else {
+      n = pcap_dispatch(r->pd, room, capture, (u_char *) r);
+      if (n == -1)
+        Strncpy(r->errbuf, pcap_geterr(r->pd), sizeof(r->errbuf));
+    }
+
+    if (n != 0) {
+      pthread_mutex_lock(&r->lock);
+      if (n == -1)
+        r->failed = true;
+      if (r->waiting)
+        pthread_cond_signal(&r->cond);
+      pthread_mutex_unlock(&r->lock);
+      if (n == -1)
+        break;
+    }
+  }
+
+  return NULL;
+}
+
+void PcapReceiver::capture(u_char *arg, const struct pcap_pkthdr *head,
+                           const u_char *frame) {
+  PcapReceiver *r = (PcapReceiver *) arg;
+  unsigned int h = r->head;
+  struct recv_frame *f;
+
+  /* run() asks pcap_dispatch for no more frames than there is room for. */
+  assert(h - r->tail < RECV_RING_SIZE);
+  /* Don't write the slot before the scan thread is done reading it. */
+  __sync_synchronize();
+  f = &r->ring[h % RECV_RING_SIZE];
+  f->head = *head;
+  if (f->head.caplen > sizeof(f->data))
+    f->head.caplen = sizeof(f->data);
+  memcpy(f->data, frame, f->head.caplen);
+  /* Publish the frame only after its contents are written. */
+  __sync_synchronize();
+  r->head = h + 1;
+}
+
+char *PcapReceiver::readip(unsigned int *len, long to_usec,
+                           struct timeval *rcvdtime,
+                           struct link_header *linknfo, bool validate) {
+  unsigned int t = tail;
+  struct recv_frame *f;
+  char *p;
+
+  if (head == t) {
+    struct timeval now, deadline;
+    struct timespec ts;
+
+    gettimeofday(&now, NULL);
+    TIMEVAL_ADD(deadline, now, MAX(to_usec, 0));
+    ts.tv_sec = deadline.tv_sec;
+    ts.tv_nsec = deadline.tv_usec * 1000;
+    pthread_mutex_lock(&lock);
+    waiting = true;
+    while (head == t && !failed) {
+      if (pthread_cond_timedwait(&cond, &lock, &ts) == ETIMEDOUT)
+        break;
+    }
+    waiting = false;
+    pthread_mutex_unlock(&lock);
+    if (head == t) {
+      if (failed)
+        fatal("Error reading packets: %s", errbuf);
+      *len = 0;
+      return NULL;
+    }
+  }
+
+  /* Read the frame only after seeing the head that published it. */
+  __sync_synchronize();
+  f = &ring[t % RECV_RING_SIZE];
+  p = readip_pcap_frame(pd, &f->head, f->data, len, rcvdtime, linknfo, validate);
+  /* p points to a copy, so the slot can be given back. */
+  __sync_synchronize();
+  tail = t + 1;
+
+  return p;
+}
+#endif
+
+/* Reads an IP packet from USI->pd like readip_pcap, through the receive
+   thread if there is one. */
+static char *ultrascan_readip(UltraScanInfo *USI, unsigned int *len,
+                              long to_usec, struct timeval *rcvdtime,
+                              struct link_header *linknfo, bool validate) {
+#ifdef HAVE_PTHREAD_H
+  if (USI->rcvr != NULL)
+    return USI->rcvr->readip(len, to_usec, rcvdtime, linknfo, validate);
+#endif
+  return readip_pcap(USI->pd, len, to_usec, rcvdtime, linknfo, validate);
+}
+
 /* Tries to get one *good* (finishes a probe) ARP response with pcap
    by the (absolute) time given in stime.  Even if stime is now, try
    an ultra-quick pcap read just in case.  Returns true if a "good"
@@ -4341,7 +5514,7 @@ static bool get_pcap_result(UltraScanInfo *USI, struct timeval *stime) {
     to_usec = TIMEVAL_SUBTRACT(*stime, USI->now);
     if (to_usec < 2000)
       to_usec = 2000;
-    ip_tmp = (struct ip *) readip_pcap(USI->pd, &bytes, to_usec, &rcvdtime, &linkhdr, true);
+    ip_tmp = (struct ip *) ultrascan_readip(USI, &bytes, to_usec, &rcvdtime, &linkhdr, true);
     gettimeofday(&USI->now, NULL);
     if (!ip_tmp && TIMEVAL_SUBTRACT(*stime, USI->now) < 0) {
       timedout = true;
@@ -4945,8 +6118,8 @@ static int get_ping_pcap_result(UltraScanInfo *USI, struct timeval *stime) {
     to_usec = TIMEVAL_SUBTRACT(*stime, USI->now);
     if (to_usec < 2000)
       to_usec = 2000;
-    ip_tmp = (struct ip *) readip_pcap(USI->pd, &bytes, to_usec, &rcvdtime,
-                                       &linkhdr, true);
+    ip_tmp = (struct ip *) ultrascan_readip(USI, &bytes, to_usec, &rcvdtime,
+                                            &linkhdr, true);
     gettimeofday(&USI->now, NULL);
     if (!ip_tmp) {
       if (TIMEVAL_SUBTRACT(*stime, USI->now) < 0) {
@@ -5389,6 +6562,218 @@ static int get_ping_pcap_result(UltraScanInfo *USI, struct timeval *stime) {
   return 0;
 }
 
+/* Tries to get one good response to a stateless scan by the (absolute) time
+   given in stime, like get_pcap_result() and get_ping_pcap_result(). There is
+   no list of probes to match responses against; instead, the token that
+   stateless_hash() describes is recomputed from the response and checked, and
+   the probe is rebuilt from it. */
+static bool get_stateless_pcap_result(UltraScanInfo *USI, struct timeval *stime) {
+  bool goodone = false;
+  bool timedout = false;
+  bool adjust_timing = true;
+  struct timeval rcvdtime;
+  struct link_header linkhdr;
+  unsigned int bytes;
+  long to_usec;
+  HostScanStats *hss = NULL;
+  int newstate = PORT_UNKNOWN;
+  reason_t current_reason = ER_NORESPONSE;
+  struct sockaddr_storage reason_sip = { AF_UNSPEC };
+  struct sockaddr_storage target_src, target_dst;
+  size_t ss_len;
+  probespec pspec;
+  unsigned int tryno = 0;
+  struct timeval sent;
+  u32 seq = 0;
+  u16 sport = 0;
+  u64 h;
+
+  const void *data = NULL;
+  unsigned int datalen;
+  struct abstract_ip_hdr hdr;
+
+  gettimeofday(&USI->now, NULL);
+  memset(&pspec, 0, sizeof(pspec));
+  pspec.type = PS_TCP;
+  pspec.proto = IPPROTO_TCP;
+
+  do {
+    struct ip *ip_tmp;
+
+    to_usec = TIMEVAL_SUBTRACT(*stime, USI->now);
+    if (to_usec < 2000)
+      to_usec = 2000;
+    ip_tmp = (struct ip *) ultrascan_readip(USI, &bytes, to_usec, &rcvdtime, &linkhdr, true);
+    gettimeofday(&USI->now, NULL);
+    if (!ip_tmp && TIMEVAL_SUBTRACT(*stime, USI->now) < 0) {
+      timedout = true;
+      break;
+    } else if (!ip_tmp)
+      continue;
+
+    if (TIMEVAL_SUBTRACT(USI->now, *stime) > 200000) {
+      /* While packets are still being received, I'll be generous and give
+      an extra 1/5 sec.  But we have to draw the line somewhere */
+      timedout = true;
+    }
+
+    datalen = bytes;
+    data = ip_get_data(ip_tmp, &datalen, &hdr);
+    if (data == NULL)
+      continue;
+
+    if (hdr.proto == IPPROTO_TCP) {
+      const struct tcp_hdr *tcp = (struct tcp_hdr *) data;
+
+      if (datalen < 20)
+        continue;
+      if (!(tcp->th_flags & TH_RST)
+          && ((tcp->th_flags & (TH_SYN | TH_ACK)) != (TH_SYN | TH_ACK)))
+        continue;
+      hss = USI->findHost(&hdr.src);
+      if (!hss)
+        continue; // Not from a host that interests us
+      ss_len = sizeof(target_src);
+      hss->target->SourceSockAddr(&target_src, &ss_len);
+      if (sockaddr_storage_cmp(&target_src, &hdr.dst) != 0)
+        continue;
+
+      pspec.pd.tcp.dport = ntohs(tcp->th_sport);
+      h = stateless_hash(USI, &hdr.src, pspec.pd.tcp.dport);
+      sport = stateless_sport(h);
+      if (ntohs(tcp->th_dport) != sport)
+        continue;
+      /* As in tcp_probe_match(), try the places where the token may come
+         back: the ACK field, incremented or not, for a SYN probe, and the SEQ
+         field for an ACK probe. */
+      pspec.pd.tcp.flags = TH_SYN;
+      if (stateless_decode(USI, h, ntohl(tcp->th_ack) - 1, &rcvdtime, &tryno, &sent)) {
+        seq = ntohl(tcp->th_ack) - 1;
+      } else if (stateless_decode(USI, h, ntohl(tcp->th_ack), &rcvdtime, &tryno, &sent)) {
+        seq = ntohl(tcp->th_ack);
+      } else if (stateless_decode(USI, h, ntohl(tcp->th_seq), &rcvdtime, &tryno, &sent)) {
+        seq = ntohl(tcp->th_seq);
+        pspec.pd.tcp.flags = TH_ACK;
+      } else {
+        if (o.debugging)
+          log_write(LOG_PLAIN, "Bad stateless token from host %s.\n", inet_ntop_ez(&hdr.src, sizeof(hdr.src)));
+        continue;
+      }
+      setTargetMACIfAvailable(hss->target, &linkhdr, &hdr.src, 0);
+
+      if ((tcp->th_flags & (TH_SYN | TH_ACK)) == (TH_SYN | TH_ACK)) {
+        newstate = PORT_OPEN;
+        current_reason = ER_SYNACK;
+      } else {
+        newstate = PORT_CLOSED;
+        current_reason = ER_RESETPEER;
+      }
+      if (USI->ping_scan)
+        newstate = HOST_UP;
+      goodone = true;
+    } else if (hdr.proto == IPPROTO_ICMP || hdr.proto == IPPROTO_ICMPV6) {
+      const u8 *icmp = (const u8 *) data;
+      const void *encaps_data;
+      unsigned int encaps_len;
+      struct abstract_ip_hdr encaps_hdr;
+      const struct tcp_hdr *tcp;
+
+      if (datalen < 8)
+        continue;
+      /* Destination unreachable */
+      if (!(hdr.proto == IPPROTO_ICMP && icmp[0] == 3)
+          && !(hdr.proto == IPPROTO_ICMPV6 && icmp[0] == ICMPV6_UNREACH))
+        continue;
+
+      encaps_len = datalen - 8;
+      encaps_data = ip_get_data_any((char *) data + 8, &encaps_len, &encaps_hdr);
+      /* TCP hdr up to seq # */
+      if (encaps_data == NULL || encaps_len < 8 || encaps_hdr.proto != IPPROTO_TCP)
+        continue;
+
+      hss = USI->findHost(&encaps_hdr.dst);
+      if (!hss)
+        continue; // Not from a host that interests us
+      ss_len = sizeof(target_src);
+      hss->target->SourceSockAddr(&target_src, &ss_len);
+      if (sockaddr_storage_cmp(&target_src, &encaps_hdr.src) != 0)
+        continue;
+
+      tcp = (struct tcp_hdr *) encaps_data;
+      pspec.pd.tcp.dport = ntohs(tcp->th_dport);
+      h = stateless_hash(USI, &encaps_hdr.dst, pspec.pd.tcp.dport);
+      sport = stateless_sport(h);
+      if (ntohs(tcp->th_sport) != sport)
+        continue;
+      /* The ACK field of an ACK probe is only there if the error quotes more
+         than the minimum 8 bytes. */
+      pspec.pd.tcp.flags = TH_SYN;
+      if (stateless_decode(USI, h, ntohl(tcp->th_seq), &rcvdtime, &tryno, &sent)) {
+        seq = ntohl(tcp->th_seq);
+      } else if (encaps_len >= 12
+                 && stateless_decode(USI, h, ntohl(tcp->th_ack), &rcvdtime, &tryno, &sent)) {
+        seq = ntohl(tcp->th_ack);
+        pspec.pd.tcp.flags = TH_ACK;
+      } else {
+        continue;
+      }
+
+      current_reason = icmp_to_reason(hdr.proto, icmp[0], icmp[1]);
+      if (USI->ping_scan) {
+        ss_len = sizeof(target_dst);
+        hss->target->TargetSockAddr(&target_dst, &ss_len);
+        /* An error that came directly from the target means it's up. */
+        newstate = (sockaddr_storage_cmp(&target_dst, &hdr.src) == 0) ? HOST_UP : HOST_DOWN;
+      } else {
+        newstate = PORT_FILTERED;
+      }
+      goodone = true;
+    }
+  } while (!goodone && !timedout);
+
+  if (!goodone)
+    return false;
+
+  stateless_probe_answered(USI, hss);
+
+  /* A port or host that already has its state was answered by an earlier
+     try. The response to this one says nothing about drops. */
+  if (USI->ping_scan ? (hss->target->flags & HOST_UP) != 0
+      : !hss->target->ports.portIsDefault(pspec.pd.tcp.dport, IPPROTO_TCP))
+    adjust_timing = false;
+
+  UltraProbe probe;
+  probe.setStatelessTCP(&pspec, sport, seq);
+  probe.tryno = tryno;
+  probe.sent = sent;
+  /* The previous try is long forgotten; use the latest time it could have
+     been sent. */
+  probe.prevSent = sent;
+
+  ss_len = sizeof(target_dst);
+  hss->target->TargetSockAddr(&target_dst, &ss_len);
+  if (sockaddr_storage_cmp(&hdr.src, &target_dst) == 0)
+    reason_sip.ss_family = AF_UNSPEC;
+  else
+    reason_sip = hdr.src;
+
+  if (USI->ping_scan) {
+    if (hss->target->flags & HOST_UP)
+      return true;
+    ultrascan_host_update(USI, hss, &probe, newstate, &rcvdtime, adjust_timing);
+    hss->target->reason.reason_id = current_reason;
+    hss->target->reason.ttl = hdr.ttl;
+    if (reason_sip.ss_family != AF_UNSPEC)
+      hss->target->reason.set_ip_addr(&reason_sip);
+  } else {
+    ultrascan_port_update(USI, hss, &probe, newstate, &rcvdtime, adjust_timing);
+    hss->target->ports.setStateReason(pspec.pd.tcp.dport, IPPROTO_TCP,
+                                      current_reason, hdr.ttl, &reason_sip);
+  }
+
+  return true;
+}
+
 static void waitForResponses(UltraScanInfo *USI) {
   struct timeval stime;
   bool gotone;
@@ -5399,7 +6784,9 @@ static void waitForResponses(UltraScanInfo *USI) {
   do {
     gotone = false;
     USI->sendOK(&stime);
-    if (USI->ping_scan_arp) {
+    if (USI->stateless) {
+      gotone = get_stateless_pcap_result(USI, &stime);
+    } else if (USI->ping_scan_arp) {
       gotone = get_arp_result(USI, &stime);
     } else if (USI->ping_scan_nd) {
       gotone = get_ns_result(USI, &stime);
@@ -5517,9 +6904,88 @@ static void begin_sniffer(UltraScanInfo *USI, vector<Target *> &Targets) {
     log_write(LOG_PLAIN, "Packet capture filter (device %s): %s\n", Targets[0]->deviceFullName(), pcap_filter.c_str());
   set_pcap_filter(Targets[0]->deviceFullName(), USI->pd, pcap_filter.c_str());
   /* pcap_setnonblock(USI->pd, 1, NULL); */
+
+#ifdef HAVE_PTHREAD_H
+  /* Drain the sniffer in a separate thread, so that responses aren't left in
+     the kernel buffer (and possibly dropped) during long bursts of sending.
+     ARP and ND replies are read from pd directly. */
+  if (!USI->ping_scan_arp && !USI->ping_scan_nd) {
+    USI->rcvr = new PcapReceiver(USI->pd);
+    if (!USI->rcvr->start()) {
+      if (o.debugging)
+        log_write(LOG_STDOUT, "Not using a receive thread: %s\n",
+                  USI->rcvr->errmsg());
+      delete USI->rcvr;
+      USI->rcvr = NULL;
+    }
+  }
+#endif
   return;
 }
 
+/* The stateless counterpart of the probe list processing in processData():
+   gives up on the older slot of probes to hss once the newer one is
+   probeTimeout() old, starts the next pass over the ports once the last one
+   has had that long for responses, and decides when the host is done. */
+static void stateless_update_host(UltraScanInfo *USI, HostScanStats *hss) {
+  struct stateless_nfo *sln = &hss->sln;
+  long timeout = hss->probeTimeout();
+  bool capped = false;
+  unsigned int maxtries;
+
+  if (TIMEVAL_SUBTRACT(USI->now, sln->slot_start) > timeout) {
+    stateless_expire_slot(USI, hss, 1);
+    sln->slot_sent[1] = sln->slot_sent[0];
+    sln->slot_sent[0] = 0;
+    sln->slot_start = USI->now;
+  }
+
+  if (sln->done)
+    return;
+
+  /* With ping scan, we are done once we know the host is up or down; with a
+     port scan, once every port has a state. */
+  if (USI->ping_scan ? (hss->target->flags & (HOST_UP | HOST_DOWN)) != 0
+      : hss->ports_finished >= USI->gstats->numprobes) {
+    stateless_expire_slot(USI, hss, 0);
+    stateless_expire_slot(USI, hss, 1);
+    sln->done = true;
+    return;
+  }
+
+  if (sln->next < stateless_num_ports(USI)
+      || TIMEVAL_SUBTRACT(USI->now, sln->pass_end) <= timeout)
+    return;
+
+  maxtries = hss->allowedTryno(&capped, NULL);
+  if (maxtries > STATELESS_MAX_TRYNO) {
+    maxtries = STATELESS_MAX_TRYNO;
+    capped = true;
+  }
+  if (sln->tryno < maxtries) {
+    sln->tryno++;
+    sln->next = 0;
+    return;
+  }
+
+  if (capped && !hss->retry_capped_warned) {
+    log_write(LOG_PLAIN, "Warning: %s giving up on port because"
+              " retransmission cap hit (%d).\n", hss->target->targetipstr(),
+              sln->tryno);
+    hss->retry_capped_warned = true;
+  }
+  if (USI->ping_scan) {
+    ultrascan_host_pspec_update(USI, hss, NULL, HOST_DOWN);
+    if (hss->target->reason.reason_id == ER_UNKNOWN)
+      hss->target->reason.reason_id = ER_NORESPONSE;
+  }
+  /* Ports without a response keep the default state set by
+     setDefaultPortState. */
+  stateless_expire_slot(USI, hss, 0);
+  stateless_expire_slot(USI, hss, 1);
+  sln->done = true;
+}
+
 /* Go through the data structures, making appropriate changes (such as expiring
    probes, noting when hosts are complete, etc. */
 static void processData(UltraScanInfo *USI) {
@@ -5543,6 +7009,14 @@ static void processData(UltraScanInfo *USI) {
   if (USI->incompleteHostsEmpty())
     return;
 
+  if (USI->stateless) {
+    for (hostI = USI->incompleteHosts.begin();
+         hostI != USI->incompleteHosts.end(); hostI++)
+      stateless_update_host(USI, *hostI);
+    USI->removeCompletedHosts();
+    return;
+  }
+
   /* Run through probe lists to:
      1) Mark timedout entries as such
      2) Remove long-expired and retransmitted entries
@@ -5668,6 +7142,16 @@ static void startTimeOutClocks(vector<Target *> &Targets) {
   }
 }
 
+/* Saves the congestion control state of every host for the checkpoint file. */
+static void ultrascan_checkpoint_timing(UltraScanInfo *USI) {
+  list<HostScanStats *>::iterator hostI;
+
+  for (hostI = USI->incompleteHosts.begin(); hostI != USI->incompleteHosts.end(); hostI++)
+    checkpoint_save_timing((*hostI)->target, &(*hostI)->timing);
+  for (hostI = USI->completedHosts.begin(); hostI != USI->completedHosts.end(); hostI++)
+    checkpoint_save_timing((*hostI)->target, &(*hostI)->timing);
+}
+
 /* 3rd generation Nmap scanning function. Handles most Nmap port scan types.
 
    The parameter to gives group timing information, and if it is not NULL,
@@ -5713,12 +7197,17 @@ void ultra_scan(vector<Target *> &Targets, struct scan_lists *ports,
 
   begin_sniffer(USI, Targets);
   while (!USI->incompleteHostsEmpty()) {
-    doAnyPings(USI);
-    doAnyOutstandingRetransmits(USI); // Retransmits from probes_outstanding
-    /* Retransmits from retry_stack -- goes after OutstandingRetransmits for
-       memory consumption reasons */
-    doAnyRetryStackRetransmits(USI);
-    doAnyNewProbes(USI);
+    if (USI->stateless) {
+      /* No pings; they would need per-probe state. */
+      doAnyStatelessProbes(USI);
+    } else {
+      doAnyPings(USI);
+      doAnyOutstandingRetransmits(USI); // Retransmits from probes_outstanding
+      /* Retransmits from retry_stack -- goes after OutstandingRetransmits for
+         memory consumption reasons */
+      doAnyRetryStackRetransmits(USI);
+      doAnyNewProbes(USI);
+    }
     gettimeofday(&USI->now, NULL);
     // printf("TRACE: Finished doAnyNewProbes() at %.4fs\n", o.TimeSinceStartMS(&USI->now) / 1000.0);
     printAnyStats(USI);
@@ -5727,6 +7216,11 @@ void ultra_scan(vector<Target *> &Targets, struct scan_lists *ports,
     // printf("TRACE: Finished waitForResponses() at %.4fs\n", o.TimeSinceStartMS(&USI->now) / 1000.0);
     processData(USI);
 
+    if (!USI->ping_scan && checkpoint_due(&USI->now)) {
+      ultrascan_checkpoint_timing(USI);
+      checkpoint_update(Targets);
+    }
+
     if (keyWasPressed()) {
       // This prints something like
       // SYN Stealth Scan Timing: About 1.14% done; ETC: 15:01 (0:43:23 remaining);
@@ -5744,6 +7238,11 @@ void ultra_scan(vector<Target *> &Targets, struct scan_lists *ports,
 
   USI->send_rate_meter.stop(&USI->now);
 
+  if (!USI->ping_scan && o.checkpoint_file != NULL) {
+    ultrascan_checkpoint_timing(USI);
+    checkpoint_phase_done(Targets, scantype);
+  }
+
   /* Save the computed timeouts. */
   if (to != NULL)
     *to = USI->gstats->to;
@@ -5766,6 +7265,14 @@ void ultra_scan(vector<Target *> &Targets, struct scan_lists *ports,
   if (o.debugging)
     USI->log_overall_rates(LOG_STDOUT);
 
+#ifdef HAVE_PTHREAD_H
+  if (USI->rcvr != NULL) {
+    USI->rcvr->stop();
+    if (o.debugging && USI->rcvr->full_ms > 0)
+      log_write(LOG_STDOUT, "Receive ring was full for %u ms.\n",
+                USI->rcvr->full_ms);
+  }
+#endif
   if (o.debugging > 2 && USI->pd != NULL)
     pcap_print_stats(LOG_PLAIN, USI->pd);
 
@@ -5906,334 +7413,3 @@ void bounce_scan(Target *target, u16 *portarray, int numports,
   return;
 }
 
-/* I want to reverse the order of all PORT_TESTING entries in
-   the scan list -- this way if an intermediate router along the
-   way got overloaded and dropped the last X packets, they are
-   likely to get through (and flag us a problem if responsive)
-   if we let them go first in the next round */
-static void reverse_testing_order(struct portinfolist *pil, struct portinfo *scanarray) {
-  int nextidx;
-  struct portinfo *current;
-
-  current = pil->testinglist;
-
-  if (current == NULL || current->state != PORT_TESTING)
-    return;
-
-  while (1) {
-    nextidx = current->next;
-    /* current->state is always PORT_TESTING here */
-    current->next = current->prev; // special case 1st node dealt w/later
-    current->prev = nextidx; // special last TESTING node case dealt w/later
-    if (nextidx == -1) {
-      // Every node was in TESTING state
-      current->prev = -1; // New head of list
-      pil->testinglist->next = -1;
-      pil->testinglist = current;
-      break;
-    } else if (scanarray[nextidx].state != PORT_TESTING) {
-      current->prev = -1; // New head of list
-      pil->testinglist->next = nextidx;
-      scanarray[nextidx].prev = pil->testinglist - scanarray;
-      pil->testinglist = current;
-      break;
-    }
-    current = scanarray + nextidx;
-  }
-}
-
-
-/* Used to handle all the "positive-response" scans (where we get a
-   response telling us that the port is open based on the probe.  This
-   includes SYN Scan, Connect Scan, RPC scan, Window Scan, and ACK
-   scan.  Now ultra_scan() does all of those, except for RPC scan,
-   which is the only pos_scan now supported.  */
-void pos_scan(Target *target, u16 *portarray, int numports, stype scantype) {
-  o.current_scantype = scantype;
-
-  struct scanstats ss;
-  int senddelay = 0;
-  int rpcportsscanned = 0;
-  struct timeval starttm;
-  struct portinfo *scan = NULL,  *current, *next;
-  struct portinfolist pil;
-  struct timeval now;
-  struct rpcscaninfo rsi;
-  unsigned long j;
-  struct serviceDeductions sd;
-  bool doingOpenFiltered = false;
-  Port port;
-
-  ScanProgressMeter *SPM = NULL;
-
-  if (target->timedOut(NULL))
-    return;
-
-  if (scantype != RPC_SCAN)
-    fatal("%s now handles only rpc scan", __func__);
-
-  if (target->ports.getStateCounts(PORT_OPEN) == 0 &&
-      (o.servicescan || target->ports.getStateCounts(PORT_OPENFILTERED) == 0))
-    return; // RPC Scan only works against already known-open ports
-
-  if (o.debugging)
-    log_write(LOG_STDOUT, "Starting RPC scan against %s\n", target->NameIP());
-
-  gettimeofday(&starttm, NULL);
-  target->startTimeOutClock(&starttm);
-
-  ss.packet_incr = 4;
-  ss.initial_packet_width = (scantype == RPC_SCAN) ? 2 : 30;
-  ss.fallback_percent = 0.7;
-  ss.numqueries_outstanding = 0;
-  ss.ports_left = numports;
-  ss.alreadydecreasedqueries = 0;
-
-  memset(&pil, 0, sizeof(pil));
-
-  ss.min_width = o.min_parallelism ? o.min_parallelism : 1;
-  ss.max_width = MAX(ss.min_width, o.max_parallelism ? o.max_parallelism : 150);
-
-  ss.initial_packet_width = box(ss.min_width, ss.max_width, ss.initial_packet_width);
-  ss.numqueries_ideal = ss.initial_packet_width;
-
-  get_rpc_procs(&(rsi.rpc_progs), &(rsi.rpc_number));
-  scan = (struct portinfo *) safe_malloc(rsi.rpc_number * sizeof(struct portinfo));
-  for (j = 0; j < rsi.rpc_number; j++) {
-    scan[j].state = PORT_FRESH;
-    scan[j].portno = rsi.rpc_progs[j];
-    scan[j].trynum = 0;
-    scan[j].prev = j - 1;
-    scan[j].sd[0] = scan[j].sd[1] = scan[j].sd[2] = -1;
-    if (j < rsi.rpc_number - 1 )
-      scan[j].next = j + 1;
-    else
-      scan[j].next = -1;
-  }
-  current = pil.testinglist = &scan[0];
-  rsi.rpc_current_port = NULL;
-
-  do {
-    ss.changed = 0;
-
-    if (senddelay > 200000) {
-      ss.max_width = MIN(ss.max_width, 5);
-      ss.numqueries_ideal = MIN(ss.max_width, ss.numqueries_ideal);
-    }
-
-    if (target->timedOut(NULL))
-      goto posscan_timedout;
-
-    /* Make sure we have ports left to scan */
-    while (1) {
-      if (doingOpenFiltered) {
-        rsi.rpc_current_port = target->ports.nextPort(rsi.rpc_current_port,
-                               &port, TCPANDUDPANDSCTP,
-                               PORT_OPENFILTERED);
-      } else {
-        rsi.rpc_current_port = target->ports.nextPort(rsi.rpc_current_port,
-                               &port, TCPANDUDPANDSCTP,
-                               PORT_OPEN);
-        if (!rsi.rpc_current_port && !o.servicescan) {
-          doingOpenFiltered = true;
-          continue;
-        }
-      }
-      // When service scan is in use, we only want to scan ports that have already
-      // been determined to be RPC
-
-      if (!rsi.rpc_current_port)
-        break; // done!
-      target->ports.getServiceDeductions(rsi.rpc_current_port->portno, rsi.rpc_current_port->proto, &sd);
-      if (sd.name && sd.service_tunnel == SERVICE_TUNNEL_NONE &&
-          strcmp(sd.name, "rpcbind") == 0)
-        break; // Good - an RPC port for us to scan.
-    }
-
-    if (!rsi.rpc_current_port)
-      break;  /* Woop!  Done! */
-
-    /* Reinit our testinglist so we try each RPC prog */
-    pil.testinglist = &scan[0];
-    rsi.valid_responses_this_port = 0;
-    rsi.rpc_status = RPC_STATUS_UNKNOWN;
-    rpcportsscanned++;
-
-
-    // This initial message is way down here because we don't want to print it if
-    // no RPC ports need scanning.
-    if (!SPM) {
-      char scanname[48];
-      Snprintf(scanname, sizeof(scanname), "%s against %s", scantype2str(scantype), target->NameIP());
-      scanname[sizeof(scanname) - 1] = '\0';
-      SPM = new ScanProgressMeter(scanname);
-    }
-
-    while (pil.testinglist != NULL) { /* While we have live queries or more ports to scan */
-
-      if (keyWasPressed()) {
-        // We can print out some status here if we want
-      }
-
-      /* Check the possible retransmissions first */
-      gettimeofday(&now, NULL);
-
-      /* Insure we haven't overrun our allotted time ... */
-      if (target->timedOut(&now))
-        goto posscan_timedout;
-
-      for ( current = pil.testinglist; current ; current = next) {
-        /* For each port or RPC program */
-        next = (current->next > -1) ? &scan[current->next] : NULL;
-        if (current->state == PORT_TESTING) {
-          if ( TIMEVAL_SUBTRACT(now, current->sent[current->trynum]) > target->to.timeout) {
-            if (current->trynum > 1) {
-              /* No responses !#$!#@$ firewalled? */
-
-              if (rsi.valid_responses_this_port == 0) {
-                if (o.debugging) {
-                  log_write(LOG_STDOUT, "RPC Scan giving up on port %hu proto %d due to repeated lack of response\n", rsi.rpc_current_port->portno,  rsi.rpc_current_port->proto);
-                }
-                rsi.rpc_status = RPC_STATUS_NOT_RPC;
-                ss.numqueries_outstanding = 0;
-                break;
-              } else {
-                /* I think I am going to slow down a little */
-                target->to.rttvar = MIN(2000000, (int) (target->to.rttvar * 1.2));
-              }
-
-              if (o.debugging > 2) {
-                log_write(LOG_STDOUT, "Moving port or prog %lu to the potentially firewalled list\n", (unsigned long) current->portno);
-              }
-              current->state = PORT_FILTERED; /* For various reasons */
-              /* First delete from old list */
-              if (current->next > -1)
-                scan[current->next].prev = current->prev;
-              if (current->prev > -1)
-                scan[current->prev].next = current->next;
-              if (current == pil.testinglist)
-                pil.testinglist = (current->next >= 0) ?  &scan[current->next] : NULL;
-              current->next = -1;
-              current->prev = -1;
-              /* Now move into new list */
-
-              ss.numqueries_outstanding--;
-            } else {  /* timeout ... we've got to resend */
-              if (o.scan_delay)
-                enforce_scan_delay(NULL);
-              if (o.debugging > 2)
-                log_write(LOG_STDOUT, "Timeout, resending to portno/progno %lu\n", current->portno);
-              current->trynum++;
-              gettimeofday(&current->sent[current->trynum], NULL);
-              now = current->sent[current->trynum];
-              if (send_rpc_query(target, rsi.rpc_current_port->portno,
-                                 rsi.rpc_current_port->proto,
-                                 current->portno, current - scan,
-                                 current->trynum) == -1) {
-                /* Futz, I'll give up on this guy ... */
-                rsi.rpc_status = RPC_STATUS_NOT_RPC;
-                break;
-              }
-
-              if (senddelay)
-                usleep(senddelay);
-            }
-          }
-        } else {
-          if (current->state != PORT_FRESH)
-            fatal("State mismatch!!@ %d", current->state);
-          /* current->state == PORT_FRESH */
-          /* OK, now we have gone through our list of in-transit queries, so now
-             we try to send off new queries if we can ... */
-          if (ss.numqueries_outstanding >= (int) ss.numqueries_ideal)
-            break;
-          if (o.scan_delay)
-            enforce_scan_delay(NULL);
-          if (o.debugging > 2)
-            log_write(LOG_STDOUT, "Sending initial query to port/prog %lu\n", current->portno);
-          /* Otherwise lets send a packet! */
-          current->state = PORT_TESTING;
-          current->trynum = 0;
-          /*	if (!testinglist) testinglist = current; */
-          ss.numqueries_outstanding++;
-          gettimeofday(&current->sent[0], NULL);
-          if (send_rpc_query(target,
-                             rsi.rpc_current_port->portno,
-                             rsi.rpc_current_port->proto, current->portno,
-                             current - scan, current->trynum) == -1) {
-            /* Futz, I'll give up on this guy ... */
-            rsi.rpc_status = RPC_STATUS_NOT_RPC;
-            break;
-          }
-          if (senddelay)
-            usleep(senddelay);
-        }
-      }
-      if (o.debugging > 1) {
-        log_write(LOG_STDOUT, "Ideal number of queries: %d outstanding: %d max %d ports_left %d timeout %d senddelay: %dus\n",
-          (int) ss.numqueries_ideal, ss.numqueries_outstanding, ss.max_width, ss.ports_left, target->to.timeout, senddelay);
-      }
-
-      /* Now that we have sent the packets we wait for responses */
-      ss.alreadydecreasedqueries = 0;
-      /* We only bother worrying about responses if we haven't reached
-         a conclusion yet */
-      if (rsi.rpc_status == RPC_STATUS_UNKNOWN) {
-        get_rpc_results(target, scan, &ss, &pil, &rsi);
-      }
-      if (rsi.rpc_status != RPC_STATUS_UNKNOWN)
-        break;
-
-      /* I want to reverse the order of all PORT_TESTING entries in
-               the list -- this way if an intermediate router along the
-               way got overloaded and dropped the last X packets, they are
-               likely to get through (and flag us a problem if responsive)
-               if we let them go first in the next round */
-      reverse_testing_order(&pil, scan);
-
-      /* If we timed out while trying to get results -- we're outta here! */
-      if (target->timedOut(NULL))
-        goto posscan_timedout;
-    }
-
-    /* Now we figure out the results of the port we just RPC scanned */
-
-    target->ports.setRPCProbeResults(rsi.rpc_current_port->portno, rsi.rpc_current_port->proto,
-                                     rsi.rpc_status, rsi.rpc_program,
-                                     rsi.rpc_lowver, rsi.rpc_highver);
-
-    /* Time to put our RPC program scan list back together for the
-       next port ... */
-    for (j = 0; j < rsi.rpc_number; j++) {
-      scan[j].state = PORT_FRESH;
-      scan[j].trynum = 0;
-      scan[j].prev = j - 1;
-      if (j < rsi.rpc_number - 1)
-        scan[j].next = j + 1;
-      else scan[j].next = -1;
-    }
-    current = pil.testinglist = &scan[0];
-    pil.firewalled = NULL;
-
-    if (o.debugging) {
-      log_write(LOG_STDOUT, "Finished round. Current stats: numqueries_ideal: %d; min_width: %d; max_width: %d; packet_incr: %d; senddelay: %dus; fallback: %.f%%\n", (int) ss.numqueries_ideal, ss.min_width, ss.max_width, ss.packet_incr, senddelay, floor(100 * ss.fallback_percent));
-    }
-    ss.numqueries_ideal = ss.initial_packet_width;
-  } while (pil.testinglist);
-
-  numports = rpcportsscanned;
-  if (SPM && o.verbose && (numports > 0)) {
-    char scannedportsstr[14];
-    Snprintf(scannedportsstr, sizeof(scannedportsstr), "%d %s", numports, (numports > 1) ? "ports" : "port");
-    SPM->endTask(NULL, scannedportsstr);
-  }
-posscan_timedout:
-  target->stopTimeOutClock(NULL);
-  free(scan);
-  close_rpc_query_sockets();
-  if (SPM) {
-    delete SPM;
-    SPM = NULL;
-  }
-  return;
-}
@@ -95,13 +95,14 @@
 
 #include "nmap.h"
 #include "services.h"
+#include "databundle.h"
 #include "NmapOps.h"
-#include "charpool.h"
 #include "nmap_error.h"
 #include "utils.h"
 
-#include <list>
+#include <algorithm>
 #include <map>
+#include <vector>
 
 /* This structure is the key for looking up services in the
    port/proto -> service map. */
@@ -126,25 +127,46 @@ public:
   double ratio;
 };
 
-/* Compare the ratios of two service nodes for top-ports purposes. Larger ratios
+/* An entry in the per-protocol top-ports index. */
+struct ratio_port {
+  u16 portno; /* Host byte order */
+  double ratio;
+};
+
+/* Compare the ratios of two index entries for top-ports purposes. Larger ratios
    come before smaller. */
-bool service_node_ratio_compare(const service_node& a, const service_node& b) {
+static bool ratio_port_compare(const ratio_port& a, const ratio_port& b) {
   return a.ratio > b.ratio;
 }
 
+/* The protocols that have their own top-ports index. */
+#define RATIO_PROTO_TCP  0
+#define RATIO_PROTO_UDP  1
+#define RATIO_PROTO_SCTP 2
+#define RATIO_NUM_PROTOS 3
+
 extern NmapOps o;
 static int numtcpports;
 static int numudpports;
 static int numsctpports;
 static std::map<port_spec, service_node> service_table;
-static std::list<service_node> services_by_ratio;
+/* For each protocol, the ports in nmap-services ordered from most to least
+   frequently open, and the same ratios indexed directly by port number. They
+   are built once when nmap-services is loaded so that --top-ports and
+   --port-ratio don't need to sort, and so that the scan engine can look up
+   the open probability of any port in constant time. */
+static std::vector<ratio_port> ports_by_ratio[RATIO_NUM_PROTOS];
+static float port_ratios[RATIO_NUM_PROTOS][65536];
 static int services_initialized;
 static int ratio_format; // 0 = /etc/services no-ratio format. 1 = new nmap format
 
-static int nmap_services_init() {
-  if (services_initialized) return 0;
-
-  char filename[512];
+/* Parses an nmap-services (or /etc/services) file into table. The number of
+   each record is the port number in host byte order, the name and proto are the
+   service name and protocol, and the ratio is the port frequency. Records whose
+   ratio was given in Nmap's format have bit 0 of flags set. Entries for unknown
+   protocols are left out. Returns 0 on success and -1 if the file can't be
+   read. */
+int services_parse_file(const char *filename, DataTable *table) {
   FILE *fp;
   char servicename[128], proto[16];
   u16 portno;
@@ -155,44 +177,11 @@ static int nmap_services_init() {
   double ratio;
   int ratio_n, ratio_d;
   char ratio_str[32];
-
-  numtcpports = 0;
-  numudpports = 0;
-  numsctpports = 0;
-  service_table.clear();
-  services_by_ratio.clear();
-  ratio_format = 0;
-
-  if (nmap_fetchfile(filename, sizeof(filename), "nmap-services") != 1) {
-#ifndef WIN32
-    error("Unable to find nmap-services!  Resorting to /etc/services");
-    strcpy(filename, "/etc/services");
-#else
-	int len, wnt = GetVersion() < 0x80000000;
-    error("Unable to find nmap-services!  Resorting to /etc/services");
-	if(wnt)
-		len = GetSystemDirectory(filename, 480);	//	be safe
-	else
-		len = GetWindowsDirectory(filename, 480);	//	be safe
-	if(!len)
-		error("Get%sDirectory failed (%d) @#!#@",
-		 wnt ? "System" : "Windows", GetLastError());
-	else
-	{
-		if(wnt)
-			strcpy(filename + len, "\\drivers\\etc\\services");
-		else
-			strcpy(filename + len, "\\services");
-	}
-#endif
-  }
+  u32 flags;
 
   fp = fopen(filename, "r");
-  if (!fp) {
-    fatal("Unable to open %s for reading service information", filename);
-  }
-  /* Record where this data file was found. */
-  o.loaded_data_files["nmap-services"] = filename;
+  if (!fp)
+    return -1;
 
   while(fgets(line, sizeof(line), fp)) {
     lineno++;
@@ -204,6 +193,7 @@ static int nmap_services_init() {
 
     res = sscanf(line, "%127s %hu/%15s %31s", servicename, &portno, proto, ratio_str);
     
+    flags = 0;
     if (res == 3) {
       ratio = 0;
     } else if (res == 4) {
@@ -222,11 +212,11 @@ static int nmap_services_init() {
 	  fatal("%s:%d has a ratio denominator of 0 causing a division by 0 error", filename, lineno);
 	
 	ratio = (double)ratio_n / ratio_d;
-	ratio_format = 1;
+	flags = 1;
       } else if (strncmp(ratio_str, "0.", 2) == 0) {
 	/* We assume the ratio is in floating point notation already */
 	ratio = strtod(ratio_str, NULL);
-	ratio_format = 1;
+	flags = 1;
       } else {
 	ratio = 0;
       }
@@ -234,7 +224,84 @@ static int nmap_services_init() {
       continue;
     }
 
-    portno = htons(portno);
+    if (strncasecmp(proto, "tcp", 3) != 0
+        && strncasecmp(proto, "udp", 3) != 0
+        && strncasecmp(proto, "sctp", 4) != 0
+        /* ddp is some apple thing...we don't "do" that */
+        && strncasecmp(proto, "ddp", 3) != 0
+        /* divert sockets are for freebsd's natd */
+        && strncasecmp(proto, "divert", 6) != 0
+        /* possibly misplaced comment, but who cares? */
+        && strncasecmp(proto, "#", 1) != 0) {
+      if (o.debugging)
+	error("Unknown protocol (%s) on line %d of services file %s.", proto, lineno, filename);
+      continue;
+    }
+
+    table->add(portno, servicename, proto, ratio, flags);
+  }
+
+  fclose(fp);
+  return 0;
+}
+
+static int nmap_services_init() {
+  if (services_initialized) return 0;
+
+  /* The strings in the service table point into this. */
+  static DataTable services_data;
+  char filename[512];
+  const char *proto;
+  u16 portno;
+  unsigned int n;
+
+  numtcpports = 0;
+  numudpports = 0;
+  numsctpports = 0;
+  service_table.clear();
+  for (n = 0; n < RATIO_NUM_PROTOS; n++) {
+    ports_by_ratio[n].clear();
+    memset(port_ratios[n], 0, sizeof(port_ratios[n]));
+  }
+  services_data.clear();
+  ratio_format = 0;
+
+  if (nmap_fetchfile(filename, sizeof(filename), "nmap-services") != 1) {
+#ifndef WIN32
+    error("Unable to find nmap-services!  Resorting to /etc/services");
+    strcpy(filename, "/etc/services");
+#else
+	int len, wnt = GetVersion() < 0x80000000;
+    error("Unable to find nmap-services!  Resorting to /etc/services");
+	if(wnt)
+		len = GetSystemDirectory(filename, 480);	//	be safe
+	else
+		len = GetWindowsDirectory(filename, 480);	//	be safe
+	if(!len)
+		error("Get%sDirectory failed (%d) @#!#@",
+		 wnt ? "System" : "Windows", GetLastError());
+	else
+	{
+		if(wnt)
+			strcpy(filename + len, "\\drivers\\etc\\services");
+		else
+			strcpy(filename + len, "\\services");
+	}
+#endif
+  }
+
+  if (!databundle_get("nmap-services", filename, &services_data)
+      && services_parse_file(filename, &services_data) == -1) {
+    fatal("Unable to open %s for reading service information", filename);
+  }
+  /* Record where this data file was found. */
+  o.loaded_data_files["nmap-services"] = filename;
+
+  for (n = 0; n < services_data.size(); n++) {
+    portno = htons(services_data.number(n));
+    proto = services_data.proto(n);
+    if (services_data.flags(n) & 1)
+      ratio_format = 1;
 
     port_spec ps;
     ps.portno = portno;
@@ -249,50 +316,50 @@ static int nmap_services_init() {
       continue;
     }
 
+    int idx = -1;
     if (strncasecmp(proto, "tcp", 3) == 0) {
       numtcpports++;
+      idx = RATIO_PROTO_TCP;
     } else if (strncasecmp(proto, "udp", 3) == 0) {
       numudpports++;
+      idx = RATIO_PROTO_UDP;
     } else if (strncasecmp(proto, "sctp", 4) == 0) {
       numsctpports++;
-    } else if (strncasecmp(proto, "ddp", 3) == 0) {
-      /* ddp is some apple thing...we don't "do" that */
-    } else if (strncasecmp(proto, "divert", 6) == 0) {
-      /* divert sockets are for freebsd's natd */
-    } else if (strncasecmp(proto, "#", 1) == 0) {
-      /* possibly misplaced comment, but who cares? */
-    } else {
-      if (o.debugging)
-	error("Unknown protocol (%s) on line %d of services file %s.", proto, lineno, filename);
-      continue;
+      idx = RATIO_PROTO_SCTP;
     }
 
     struct service_node sn;
 
-    sn.s_name = cp_strdup(servicename);
+    sn.s_name = (char *) services_data.name(n);
     sn.s_port = portno;
-    sn.s_proto = cp_strdup(proto);
+    sn.s_proto = (char *) proto;
     sn.s_aliases = NULL;
-    sn.ratio = ratio;
+    sn.ratio = services_data.ratio(n);
 
     service_table[ps] = sn;
 
-    services_by_ratio.push_back(sn);
+    if (idx != -1) {
+      ratio_port rp;
+
+      rp.portno = ntohs(portno);
+      rp.ratio = sn.ratio;
+      ports_by_ratio[idx].push_back(rp);
+      port_ratios[idx][rp.portno] = (float) sn.ratio;
+    }
   }
 
-  /* Sort the list of ports sorted by frequency for top-ports purposes. */
-  services_by_ratio.sort(service_node_ratio_compare);
+  /* Sort the ports by frequency for top-ports purposes. The sort is stable so
+     that ports with equal ratios stay in file order. */
+  for (n = 0; n < RATIO_NUM_PROTOS; n++)
+    std::stable_sort(ports_by_ratio[n].begin(), ports_by_ratio[n].end(), ratio_port_compare);
 
-  fclose(fp);
   services_initialized = 1;
   return 0;
 }
 
 void free_services() {
   /* This doesn't free anything, because the service_table is allocated
-     statically. It just marks the table as needing to be reinitialized because
-     other things have been freed, for example the cp_strdup-allocated members
-     of service_node. */
+     statically. It just marks the table as needing to be reinitialized. */
   services_initialized = 0;
 }
 
@@ -361,29 +428,61 @@ static int port_compare(const void *a, const void *b) {
 
 
 
-// is_port_member() returns true if serv is an element of ptsdata.
-// This could be implemented MUCH more efficiently but it should only be
-// called when you use a non-default top-ports or port-ratio value TOGETHER WITH
-// a -p portlist.
+/* Returns the open frequency of the given port (in host byte order) according
+   to nmap-services, or 0 if the port isn't listed or proto isn't one of
+   IPPROTO_TCP, IPPROTO_UDP, or IPPROTO_SCTP. */
+double getportratio(u16 portno, u8 proto) {
+  if (!services_initialized && nmap_services_init() == -1)
+    fatal("%s: Couldn't get port numbers", __func__);
 
-static bool is_port_member(const struct scan_lists *ptsdata, const struct service_node *serv) {
-  int i;
+  switch (proto) {
+  case IPPROTO_TCP:
+    return port_ratios[RATIO_PROTO_TCP][portno];
+  case IPPROTO_UDP:
+    return port_ratios[RATIO_PROTO_UDP][portno];
+  case IPPROTO_SCTP:
+    return port_ratios[RATIO_PROTO_SCTP][portno];
+  default:
+    return 0;
+  }
+}
 
-  if (strcmp(serv->s_proto, "tcp") == 0) {
-    for (i=0; i<ptsdata->tcp_count; i++)
-      if (ntohs(serv->s_port) == ptsdata->tcp_ports[i])
-        return true;
-  } else if (strcmp(serv->s_proto, "udp") == 0) {
-    for (i=0; i<ptsdata->udp_count; i++)
-      if (ntohs(serv->s_port) == ptsdata->udp_ports[i])
-        return true;
-  } else if (strcmp(serv->s_proto, "sctp") == 0) {
-    for (i=0; i<ptsdata->sctp_count; i++)
-      if (ntohs(serv->s_port) == ptsdata->sctp_ports[i])
-        return true;
+/* Fills in list and count with ports from the top-ports index of one protocol.
+   If level is below 1, these are all the ports with a ratio of at least level;
+   otherwise they are the level ports with the highest ratios. If members is not
+   NULL, ports that it doesn't contain are skipped. The index is already sorted,
+   so this is linear in the number of ports taken (or skipped). */
+static void gettoppts_proto(double level, const std::vector<ratio_port> &index,
+                            const std::vector<bool> *members,
+                            unsigned short **list, int *count) {
+  std::vector<ratio_port>::const_iterator i;
+  std::vector<unsigned short> result;
+
+  for (i = index.begin(); i != index.end(); i++) {
+    if (level < 1 && i->ratio < level)
+      break;
+    if (level >= 1 && result.size() >= (size_t) level)
+      break;
+    if (members != NULL && !(*members)[i->portno])
+      continue;
+    result.push_back(i->portno);
   }
 
-  return false;
+  *count = result.size();
+  if (*count > 0) {
+    *list = (unsigned short *) safe_zalloc(*count * sizeof(unsigned short));
+    memcpy(*list, &result[0], *count * sizeof(unsigned short));
+  }
+}
+
+/* Marks the ports of list in a port-indexed membership table. */
+static void port_members(std::vector<bool> &members, const unsigned short *list,
+                         int count) {
+  int i;
+
+  members.assign(65536, false);
+  for (i = 0; i < count; i++)
+    members[list[i]] = true;
 }
 
 // gettoppts() sets its third parameter, a scan_list, with the most
@@ -400,11 +499,9 @@ static bool is_port_member(const struct scan_lists *ptsdata, const struct servic
 // function if o.TCPScan() || o.UDPScan() || o.SCTPScan()
 
 void gettoppts(double level, char *portlist, struct scan_lists * ports) {
-  int ti=0, ui=0, si=0;
   struct scan_lists ptsdata = { 0 };
   bool ptsdata_initialized = false;
-  const struct service_node *current;
-  std::list<service_node>::iterator i;
+  std::vector<bool> members;
 
   if (!services_initialized && nmap_services_init() == -1)
     fatal("%s: Couldn't get port numbers", __func__);
@@ -435,89 +532,40 @@ void gettoppts(double level, char *portlist, struct scan_lists * ports) {
     else level = 1000;
   }
 
+  if (level >= 1) {
+    if (level > 65536)
+      fatal("Level argument to gettoppts (%g) is too large", level);
+  } else if (!(level < 1))
+    fatal("Argument to gettoppts (%g) should be a positive ratio below 1 or an integer of 1 or higher", level);
+
   if (portlist){
     getpts(portlist, &ptsdata);
     ptsdata_initialized = true;
   }
-  if (level < 1) {
-    for (i = services_by_ratio.begin(); i != services_by_ratio.end(); i++) {
-      current = &(*i);
-      if (ptsdata_initialized && !is_port_member(&ptsdata, current))
-        continue;
-      if (current->ratio >= level) {
-        if (o.TCPScan() && strcmp(current->s_proto, "tcp") == 0)
-          ports->tcp_count++;
-        else if (o.UDPScan() && strcmp(current->s_proto, "udp") == 0)
-          ports->udp_count++;
-        else if (o.SCTPScan() && strcmp(current->s_proto, "sctp") == 0)
-          ports->sctp_count++;
-      } else {
-        break;
-      }
-    }
-
-    if (ports->tcp_count)
-      ports->tcp_ports = (unsigned short *)safe_zalloc(ports->tcp_count * sizeof(unsigned short));
-
-    if (ports->udp_count)
-      ports->udp_ports = (unsigned short *)safe_zalloc(ports->udp_count * sizeof(unsigned short));
 
-    if (ports->sctp_count)
-      ports->sctp_ports = (unsigned short *)safe_zalloc(ports->sctp_count * sizeof(unsigned short));
+  ports->prots = NULL;
 
-    ports->prots = NULL;
-
-    for (i = services_by_ratio.begin(); i != services_by_ratio.end(); i++) {
-      current = &(*i);
-      if (ptsdata_initialized && !is_port_member(&ptsdata, current))
-        continue;
-      if (current->ratio >= level) {
-        if (o.TCPScan() && strcmp(current->s_proto, "tcp") == 0)
-          ports->tcp_ports[ti++] = ntohs(current->s_port);
-        else if (o.UDPScan() && strcmp(current->s_proto, "udp") == 0)
-          ports->udp_ports[ui++] = ntohs(current->s_port);
-        else if (o.SCTPScan() && strcmp(current->s_proto, "sctp") == 0)
-          ports->sctp_ports[si++] = ntohs(current->s_port);
-      } else {
-        break;
-      }
-    }
-  } else if (level >= 1) {
-    if (level > 65536)
-      fatal("Level argument to gettoppts (%g) is too large", level);
-
-    if (o.TCPScan()) {
-      ports->tcp_count = MIN((int) level, numtcpports);
-      ports->tcp_ports = (unsigned short *)safe_zalloc(ports->tcp_count * sizeof(unsigned short));
-    }
-    if (o.UDPScan()) {
-      ports->udp_count = MIN((int) level, numudpports);
-      ports->udp_ports = (unsigned short *)safe_zalloc(ports->udp_count * sizeof(unsigned short));
-    }
-    if (o.SCTPScan()) {
-      ports->sctp_count = MIN((int) level, numsctpports);
-      ports->sctp_ports = (unsigned short *)safe_zalloc(ports->sctp_count * sizeof(unsigned short));
-    }
-
-    ports->prots = NULL;
-
-    for (i = services_by_ratio.begin(); i != services_by_ratio.end(); i++) {
-      current = &(*i);
-      if (ptsdata_initialized && !is_port_member(&ptsdata, current))
-        continue;
-      if (o.TCPScan() && strcmp(current->s_proto, "tcp") == 0 && ti < ports->tcp_count)
-        ports->tcp_ports[ti++] = ntohs(current->s_port);
-      else if (o.UDPScan() && strcmp(current->s_proto, "udp") == 0 && ui < ports->udp_count)
-        ports->udp_ports[ui++] = ntohs(current->s_port);
-      else if (o.SCTPScan() && strcmp(current->s_proto, "sctp") == 0 && si < ports->sctp_count)
-        ports->sctp_ports[si++] = ntohs(current->s_port);
-    }
-
-    if (ti < ports->tcp_count) ports->tcp_count = ti;
-    if (ui < ports->udp_count) ports->udp_count = ui;
-    if (si < ports->sctp_count) ports->sctp_count = si;
-  } else
-    fatal("Argument to gettoppts (%g) should be a positive ratio below 1 or an integer of 1 or higher", level);
+  if (o.TCPScan()) {
+    if (ptsdata_initialized)
+      port_members(members, ptsdata.tcp_ports, ptsdata.tcp_count);
+    gettoppts_proto(level, ports_by_ratio[RATIO_PROTO_TCP],
+                    ptsdata_initialized ? &members : NULL,
+                    &ports->tcp_ports, &ports->tcp_count);
+  }
+  if (o.UDPScan()) {
+    if (ptsdata_initialized)
+      port_members(members, ptsdata.udp_ports, ptsdata.udp_count);
+    gettoppts_proto(level, ports_by_ratio[RATIO_PROTO_UDP],
+                    ptsdata_initialized ? &members : NULL,
+                    &ports->udp_ports, &ports->udp_count);
+  }
+  if (o.SCTPScan()) {
+    if (ptsdata_initialized)
+      port_members(members, ptsdata.sctp_ports, ptsdata.sctp_count);
+    gettoppts_proto(level, ports_by_ratio[RATIO_PROTO_SCTP],
+                    ptsdata_initialized ? &members : NULL,
+                    &ports->sctp_ports, &ports->sctp_count);
+  }
 
   if (ptsdata_initialized) {
     free_scan_lists(&ptsdata);
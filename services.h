@@ -117,9 +117,13 @@
 #define SCAN_SCTP_PORT	(1 << 2)
 #define SCAN_PROTOCOLS	(1 << 3)
 
+class DataTable;
+
+int services_parse_file(const char *filename, DataTable *table);
 int addportsfromservmask(char *mask, u8 *porttbl, int range_type);
 struct servent *nmap_getservbyport(int port, const char *proto);
 void gettoppts(double level, char *portlist, struct scan_lists * ports);
+double getportratio(u16 portno, u8 proto);
 
 void free_services();
 
@@ -1500,36 +1500,12 @@ char *readipv4_pcap(pcap_t *pd, unsigned int *len, long to_usec,
   return buf;
 }
 
-char *readip_pcap(pcap_t *pd, unsigned int *len, long to_usec,
-                  struct timeval *rcvdtime, struct link_header *linknfo, bool validate) {
+/* Returns the offset of the IP header in frames captured from pd, whose
+   datalink type is datalink. Exits if the datalink type is unknown. */
+static unsigned int readip_pcap_offset(pcap_t *pd, int datalink) {
   unsigned int offset = 0;
   struct pcap_pkthdr head;
   char *p;
-  int datalink;
-  int timedout = 0;
-  struct timeval tv_start, tv_end;
-  static char *alignedbuf = NULL;
-  static unsigned int alignedbufsz = 0;
-  static int warning = 0;
-
-  if (linknfo) {
-    memset(linknfo, 0, sizeof(*linknfo));
-  }
-
-  if (!pd)
-    fatal("NULL packet device passed to %s", __func__);
-
-  if (to_usec < 0) {
-    if (!warning) {
-      warning = 1;
-      error("WARNING: Negative timeout value (%lu) passed to %s() -- using 0", to_usec, __func__);
-    }
-    to_usec = 0;
-  }
-
-  /* New packet capture device, need to recompute offset */
-  if ((datalink = pcap_datalink(pd)) < 0)
-    fatal("Cannot obtain datalink information: %s", pcap_geterr(pd));
 
   /* NOTE: IF A NEW OFFSET EVER EXCEEDS THE CURRENT MAX (24), ADJUST
      MAX_LINK_HEADERSZ in libnetutil/netutil.h */
@@ -1618,6 +1594,105 @@ char *readip_pcap(pcap_t *pd, unsigned int *len, long to_usec,
     exit(1);
   }
 
+  return offset;
+}
+
+/* Does the work of readip_pcap on a frame that has been captured: copies
+   the IP packet into an aligned buffer, validates it, and fills in rcvdtime
+   and linknfo. The buffer is reused by the next call. */
+static char *readip_pcap_finish(int datalink, unsigned int offset,
+                                const struct pcap_pkthdr *head, const char *p,
+                                unsigned int *len, struct timeval *rcvdtime,
+                                struct link_header *linknfo, bool validate) {
+  static char *alignedbuf = NULL;
+  static unsigned int alignedbufsz = 0;
+#if defined(WIN32) || defined(__amigaos__)
+  struct timeval tv_end;
+#endif
+
+  if (head->caplen <= offset) {
+    *len = 0;
+    return NULL;
+  }
+  if (offset && linknfo) {
+    linknfo->datalinktype = datalink;
+    linknfo->headerlen = offset;
+    assert(offset <= MAX_LINK_HEADERSZ);
+    memcpy(linknfo->header, p, MIN(sizeof(linknfo->header), offset));
+  }
+  p += offset;
+  *len = head->caplen - offset;
+  if (*len > alignedbufsz) {
+    alignedbuf = (char *) safe_realloc(alignedbuf, *len);
+    alignedbufsz = *len;
+  }
+  memcpy(alignedbuf, p, *len);
+
+  if (validate) {
+    /* Let's see if this packet passes inspection.. */
+    if (!validatepkt((u8 *) alignedbuf, len)) {
+      *len = 0;
+      return NULL;
+    }
+  }
+  // printf("Just got a packet at %li,%li\n", head->ts.tv_sec, head->ts.tv_usec);
+  if (rcvdtime) {
+    // FIXME: I eventually need to figure out why Windows head.ts time is sometimes BEFORE the time I
+    // sent the packet (which is according to gettimeofday() in nbase).  For now, I will sadly have to
+    // use gettimeofday() for Windows in this case
+    // Actually I now allow .05 discrepancy.   So maybe this isn't needed.  I'll comment out for now.
+    // Nope: it is still needed at least for Windows.  Sometimes the time from he pcap header is a
+    // COUPLE SECONDS before the gettimeofday() results :(.
+#if defined(WIN32) || defined(__amigaos__)
+    gettimeofday(&tv_end, NULL);
+    *rcvdtime = tv_end;
+#else
+    rcvdtime->tv_sec = head->ts.tv_sec;
+    rcvdtime->tv_usec = head->ts.tv_usec;
+    assert(head->ts.tv_sec);
+#endif
+  }
+
+  if (rcvdtime)
+    PacketTrace::trace(PacketTrace::RCVD, (u8 *) alignedbuf, *len,
+                       rcvdtime);
+  else
+    PacketTrace::trace(PacketTrace::RCVD, (u8 *) alignedbuf, *len);
+
+  return alignedbuf;
+}
+
+char *readip_pcap(pcap_t *pd, unsigned int *len, long to_usec,
+                  struct timeval *rcvdtime, struct link_header *linknfo, bool validate) {
+  unsigned int offset;
+  struct pcap_pkthdr head;
+  char *p;
+  int datalink;
+  int timedout = 0;
+  struct timeval tv_start, tv_end;
+  static int warning = 0;
+
+  if (linknfo) {
+    memset(linknfo, 0, sizeof(*linknfo));
+  }
+
+  if (!pd)
+    fatal("NULL packet device passed to %s", __func__);
+
+  if (to_usec < 0) {
+    if (!warning) {
+      warning = 1;
+      error("WARNING: Negative timeout value (%lu) passed to %s() -- using 0", to_usec, __func__);
+    }
+    to_usec = 0;
+  }
+
+  /* New packet capture device, need to recompute offset */
+  if ((datalink = pcap_datalink(pd)) < 0)
+    fatal("Cannot obtain datalink information: %s", pcap_geterr(pd));
+
+  offset = readip_pcap_offset(pd, datalink);
+
   if (to_usec > 0) {
     gettimeofday(&tv_start, NULL);
   }
@@ -1660,19 +1735,6 @@ char *readip_pcap(pcap_t *pd, unsigned int *len, long to_usec,
         p = (char *) pcap_next(pd, &head);
     }
 
-    if (p) {
-      if (head.caplen <= offset) {
-        *len = 0;
-        return NULL;
-      }
-      if (offset && linknfo) {
-        linknfo->datalinktype = datalink;
-        linknfo->headerlen = offset;
-        assert(offset <= MAX_LINK_HEADERSZ);
-        memcpy(linknfo->header, p, MIN(sizeof(linknfo->header), offset));
-      }
-      p += offset;
-    }
     if (!p) {
       /* Should we timeout? */
       if (to_usec == 0) {
@@ -1690,45 +1752,28 @@ char *readip_pcap(pcap_t *pd, unsigned int *len, long to_usec,
     *len = 0;
     return NULL;
   }
-  *len = head.caplen - offset;
-  if (*len > alignedbufsz) {
-    alignedbuf = (char *) safe_realloc(alignedbuf, *len);
-    alignedbufsz = *len;
-  }
-  memcpy(alignedbuf, p, *len);
 
-  if (validate) {
-    /* Let's see if this packet passes inspection.. */
-    if (!validatepkt((u8 *) alignedbuf, len)) {
-      *len = 0;
-      return NULL;
-    }
-  }
-  // printf("Just got a packet at %li,%li\n", head.ts.tv_sec, head.ts.tv_usec);
-  if (rcvdtime) {
-    // FIXME: I eventually need to figure out why Windows head.ts time is sometimes BEFORE the time I
-    // sent the packet (which is according to gettimeofday() in nbase).  For now, I will sadly have to
-    // use gettimeofday() for Windows in this case
-    // Actually I now allow .05 discrepancy.   So maybe this isn't needed.  I'll comment out for now.
-    // Nope: it is still needed at least for Windows.  Sometimes the time from he pcap header is a
-    // COUPLE SECONDS before the gettimeofday() results :(.
-#if defined(WIN32) || defined(__amigaos__)
-    gettimeofday(&tv_end, NULL);
-    *rcvdtime = tv_end;
-#else
-    rcvdtime->tv_sec = head.ts.tv_sec;
-    rcvdtime->tv_usec = head.ts.tv_usec;
-    assert(head.ts.tv_sec);
-#endif
+  return readip_pcap_finish(datalink, offset, &head, p, len, rcvdtime, linknfo, validate);
+}
+
+/* Like readip_pcap, but for a frame that was already captured from pd, for
+   example by another thread. head and frame are as returned by pcap_next. */
+char *readip_pcap_frame(pcap_t *pd, const struct pcap_pkthdr *head,
+                        const u8 *frame, unsigned int *len,
+                        struct timeval *rcvdtime, struct link_header *linknfo,
+                        bool validate) {
+  int datalink;
+
+  if (linknfo) {
+    memset(linknfo, 0, sizeof(*linknfo));
   }
 
-  if (rcvdtime)
-    PacketTrace::trace(PacketTrace::RCVD, (u8 *) alignedbuf, *len,
-                       rcvdtime);
-  else
-    PacketTrace::trace(PacketTrace::RCVD, (u8 *) alignedbuf, *len);
+  if ((datalink = pcap_datalink(pd)) < 0)
+    fatal("Cannot obtain datalink information: %s", pcap_geterr(pd));
 
-  return alignedbuf;
+  return readip_pcap_finish(datalink, readip_pcap_offset(pd, datalink), head,
+                            (const char *) frame, len, rcvdtime, linknfo,
+                            validate);
 }
 
 /* Attempts to read one IPv6 Neighbor Solicitation reply packet from the pcap
@@ -1850,7 +1895,7 @@ void pcap_print_stats(int logt, pcap_t *pd) {
       directly connected to the src host running Nmap.  If it is, set the MAC.
 
    This function returns 0 if it ends up setting the MAC, nonzero otherwise. */
-int setTargetMACIfAvailable(Target *target, struct link_header *linkhdr,
+int setTargetMACIfAvailable(Target *target, const struct link_header *linkhdr,
                             const struct sockaddr_storage *src, int overwrite) {
   struct sockaddr_storage addr;
   size_t addr_len;
@@ -467,7 +467,7 @@ char *getFinalPacketStats(char *buf, int buflen);
    This function returns 0 if it ends up setting the MAC, nonzero otherwise
 */  
 
-int setTargetMACIfAvailable(Target *target, struct link_header *linkhdr,
+int setTargetMACIfAvailable(Target *target, const struct link_header *linkhdr,
                             const struct sockaddr_storage *src, int overwrite);
 
 /* This function ensures that the next hop MAC address for a target is
@@ -496,6 +496,13 @@ char *readipv4_pcap(pcap_t *pd, unsigned int *len, long to_usec,
 char *readip_pcap(pcap_t *pd, unsigned int *len, long to_usec,
                   struct timeval *rcvdtime, struct link_header *linknfo, bool validate);
 
+/* Like readip_pcap, but for a frame that was already captured from pd (head
+   and frame are as returned by pcap_next). Does not read from pd. */
+char *readip_pcap_frame(pcap_t *pd, const struct pcap_pkthdr *head,
+                        const u8 *frame, unsigned int *len,
+                        struct timeval *rcvdtime, struct link_header *linknfo,
+                        bool validate);
+
 int read_na_pcap(pcap_t *pd, u8 *sendermac, struct sockaddr_in6 *senderIP, long to_usec,
                   struct timeval *rcvdtime, bool *has_mac);
 
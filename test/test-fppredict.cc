@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "linear.h"
+#include "../FPPredict.h"
+
+/* From FPModel.cc. */
+extern struct model FPModel;
+extern double FPmean[][659];
+
+static long test_count = 0;
+static long success_count = 0;
+
+/* Compares predict_values_batch() for the n vectors in features against
+   liblinear's predict_values() for each of them. */
+static void test_batch(const char *desc, const double *features, unsigned int n)
+{
+  unsigned int nr_feature, nr_class, h, i;
+  struct feature_node *nodes;
+  double *values, *expected;
+  bool ok = true;
+
+  nr_feature = get_nr_feature(&FPModel);
+  nr_class = get_nr_class(&FPModel);
+  nodes = new feature_node[nr_feature + 1];
+  values = new double[n * nr_class];
+  expected = new double[nr_class];
+
+  predict_values_batch(&FPModel, features, n, values);
+
+  for (h = 0; h < n; h++) {
+    for (i = 0; i < nr_feature; i++) {
+      nodes[i].index = i + 1;
+      nodes[i].value = features[h * nr_feature + i];
+    }
+    nodes[i].index = -1;
+    predict_values(&FPModel, nodes, expected);
+    if (memcmp(expected, values + h * nr_class, nr_class * sizeof(*expected)) != 0) {
+      printf("  vector %u differs\n", h);
+      ok = false;
+    }
+  }
+
+  test_count++;
+  if (ok) {
+    success_count++;
+    printf("PASS %s\n", desc);
+  } else {
+    printf("FAIL %s\n", desc);
+  }
+
+  delete[] nodes;
+  delete[] values;
+  delete[] expected;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned int nr_feature, nr_class, n, h, i;
+  double *features;
+
+  nr_feature = get_nr_feature(&FPModel);
+  nr_class = get_nr_class(&FPModel);
+  if (nr_feature != sizeof(FPmean[0]) / sizeof(FPmean[0][0])) {
+    printf("FAIL model has %u features, FPmean has %u\n", nr_feature,
+           (unsigned int) (sizeof(FPmean[0]) / sizeof(FPmean[0][0])));
+    return 1;
+  }
+
+  /* The mean fingerprint of every class. */
+  n = nr_class;
+  features = new double[n * nr_feature];
+  for (h = 0; h < n; h++)
+    memcpy(features + h * nr_feature, FPmean[h], nr_feature * sizeof(double));
+  test_batch("class means", features, n);
+  test_batch("single vector", features, 1);
+
+  /* The same fingerprints with responses missing, as from hosts that didn't
+     answer some probes. */
+  for (h = 0; h < n; h++) {
+    for (i = h % 7; i < nr_feature; i += 7)
+      features[h * nr_feature + i] = -1;
+  }
+  test_batch("class means with missing values", features, n);
+
+  /* All missing. */
+  for (i = 0; i < nr_feature; i++)
+    features[i] = -1;
+  test_batch("no responses", features, 1);
+
+  delete[] features;
+
+  printf("%ld / %ld tests passed.\n", success_count, test_count);
+  return success_count == test_count ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+
+#include <string>
+
+#include "../nse_cache.h"
+
+static long test_count = 0;
+static long success_count = 0;
+
+static void check(bool ok, const char *desc)
+{
+  test_count++;
+  if (ok) {
+    success_count++;
+    printf("PASS %s\n", desc);
+  } else {
+    printf("FAIL %s\n", desc);
+  }
+}
+
+static bool has(NseCache &cache, const char *key, time_t now,
+                const char *expected)
+{
+  std::string value;
+
+  return cache.get(key, now, value) && value == expected;
+}
+
+static bool missing(NseCache &cache, const char *key, time_t now)
+{
+  std::string value;
+
+  return !cache.get(key, now, value);
+}
+
+static void test_ttl()
+{
+  NseCache cache(1000);
+
+  check(cache.put("k", "v", 100, 10), "put with TTL");
+  check(has(cache, "k", 100, "v"), "get at insert time");
+  check(has(cache, "k", 109, "v"), "get just before expiry");
+  check(missing(cache, "k", 110), "get at expiry");
+  check(cache.size() == 0, "expired entry is freed");
+
+  check(!cache.put("k", "v", 100, 0), "zero TTL is refused");
+  check(missing(cache, "k", 100), "zero TTL stores nothing");
+
+  cache.put("k", "old", 100, 5);
+  cache.put("k", "new", 100, 50);
+  check(has(cache, "k", 120, "new"), "put replaces value and TTL");
+  check(cache.size() == 4, "replaced entry is counted once");
+}
+
+static void test_eviction()
+{
+  /* Each entry below takes 1 + 9 = 10 bytes. */
+  NseCache cache(30);
+
+  cache.put("a", "123456789", 0, 100);
+  cache.put("b", "123456789", 0, 100);
+  cache.put("c", "123456789", 0, 100);
+  check(cache.size() == 30, "cache fills up to its limit");
+
+  /* Using a makes b the least recently used. */
+  check(has(cache, "a", 1, "123456789"), "get a");
+  cache.put("d", "123456789", 1, 100);
+  check(missing(cache, "b", 1), "least recently used entry is evicted");
+  check(has(cache, "a", 1, "123456789"), "recently used entry is kept");
+  check(has(cache, "c", 1, "123456789"), "other entry is kept");
+  check(has(cache, "d", 1, "123456789"), "new entry is stored");
+
+  /* A large entry evicts as many as it needs. */
+  cache.put("e", "1234567890123456789", 2, 100);
+  check(cache.size() == 30, "large entry fits after eviction");
+  check(missing(cache, "c", 2) && missing(cache, "a", 2),
+        "large entry evicts the two least recently used");
+  check(has(cache, "d", 2, "123456789"), "most recently used entry is kept");
+
+  check(!cache.put("f", "123456789012345678901234567890", 3, 100),
+        "entry larger than the cache is refused");
+  check(has(cache, "e", 3, "1234567890123456789"),
+        "refused entry evicts nothing");
+}
+
+int main(int argc, char *argv[])
+{
+  test_ttl();
+  test_eviction();
+
+  printf("%ld / %ld tests passed.\n", success_count, test_count);
+  return success_count == test_count ? 0 : 1;
+}
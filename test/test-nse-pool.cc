@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "../nse_pool.h"
+
+/* The connections in these tests are socketpair() descriptors, cast to and
+   from void *. The test keeps the other end of each pair. */
+
+static long test_count = 0;
+static long success_count = 0;
+static int discarded = 0;
+
+static void check(bool ok, const char *desc)
+{
+  test_count++;
+  if (ok) {
+    success_count++;
+    printf("PASS %s\n", desc);
+  } else {
+    printf("FAIL %s\n", desc);
+  }
+}
+
+static void *fd_conn(int sd)
+{
+  return (void *) (long) sd;
+}
+
+static int conn_fd(void *conn)
+{
+  return (int) (long) conn;
+}
+
+static bool usable(void *conn)
+{
+  return NseConnPool::fd_idle(conn_fd(conn));
+}
+
+static void discard(void *conn)
+{
+  close(conn_fd(conn));
+  discarded++;
+}
+
+static struct timeval at(long ms)
+{
+  struct timeval tv;
+
+  tv.tv_sec = ms / 1000;
+  tv.tv_usec = ms % 1000 * 1000;
+  return tv;
+}
+
+static void test_checkout()
+{
+  NseConnPool pool(usable, discard);
+  struct timeval now = at(0);
+  int sv[2], sv2[2];
+  void *conn;
+  int af = 0;
+
+  check(pool.get("tcp|192.0.2.1|80", &now, &af) == NULL, "empty pool");
+
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  check(pool.put("tcp|192.0.2.1|80", fd_conn(sv[0]), AF_INET, &now),
+        "checkin");
+  check(pool.idle() == 1, "checked in connection is idle");
+  check(pool.get("tcp|192.0.2.1|443", &now, &af) == NULL,
+        "other service gets nothing");
+  conn = pool.get("tcp|192.0.2.1|80", &now, &af);
+  check(conn == fd_conn(sv[0]) && af == AF_INET,
+        "checkout returns the same connection");
+  check(pool.idle() == 0, "checked out connection is no longer idle");
+  check(pool.get("tcp|192.0.2.1|80", &now, &af) == NULL,
+        "connection is checked out only once");
+
+  /* The most recently checked in connection comes out first. */
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv2);
+  pool.put("tcp|192.0.2.1|80", fd_conn(sv[0]), AF_INET, &now);
+  pool.put("tcp|192.0.2.1|80", fd_conn(sv2[0]), AF_INET, &now);
+  check(pool.get("tcp|192.0.2.1|80", &now, &af) == fd_conn(sv2[0]),
+        "most recent connection first");
+  check(pool.get("tcp|192.0.2.1|80", &now, &af) == fd_conn(sv[0]),
+        "then the older one");
+
+  close(sv[0]);
+  close(sv[1]);
+  close(sv2[0]);
+  close(sv2[1]);
+}
+
+static void test_unusable()
+{
+  NseConnPool pool(usable, discard);
+  struct timeval now = at(0);
+  int sv[2];
+  int af;
+
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  pool.put("tcp|192.0.2.1|80", fd_conn(sv[0]), AF_INET, &now);
+  close(sv[1]);
+  discarded = 0;
+  check(pool.get("tcp|192.0.2.1|80", &now, &af) == NULL,
+        "connection closed by the peer is refused");
+  check(discarded == 1 && pool.idle() == 0,
+        "connection closed by the peer is discarded");
+
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  pool.put("tcp|192.0.2.1|80", fd_conn(sv[0]), AF_INET, &now);
+  check(write(sv[1], "x", 1) == 1, "peer sends unsolicited data");
+  discarded = 0;
+  check(pool.get("tcp|192.0.2.1|80", &now, &af) == NULL,
+        "connection with unsolicited data is refused");
+  check(discarded == 1, "connection with unsolicited data is discarded");
+  close(sv[1]);
+}
+
+static void test_timeout()
+{
+  NseConnPool pool(usable, discard);
+  struct timeval now = at(1000), later;
+  int sv[2];
+  int af;
+
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  pool.put("tcp|192.0.2.1|80", fd_conn(sv[0]), AF_INET, &now);
+  later = at(1000 + POOL_IDLE_TIMEOUT - 1);
+  check(pool.get("tcp|192.0.2.1|80", &later, &af) == fd_conn(sv[0]),
+        "checkout just before the idle timeout");
+
+  pool.put("tcp|192.0.2.1|80", fd_conn(sv[0]), AF_INET, &now);
+  discarded = 0;
+  later = at(1000 + POOL_IDLE_TIMEOUT);
+  check(pool.get("tcp|192.0.2.1|80", &later, &af) == NULL,
+        "no checkout at the idle timeout");
+  check(discarded == 1 && pool.idle() == 0,
+        "timed out connection is discarded");
+  close(sv[1]);
+}
+
+static void test_limits()
+{
+  NseConnPool pool(usable, discard);
+  struct timeval now = at(0);
+  int i, sv[2];
+
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  for (i = 0; i < POOL_MAX_PER_KEY; i++)
+    pool.put("tcp|192.0.2.1|80", fd_conn(sv[0]), AF_INET, &now);
+  check(!pool.put("tcp|192.0.2.1|80", fd_conn(sv[0]), AF_INET, &now),
+        "checkin refused when the service has its share");
+  check(pool.put("tcp|192.0.2.2|80", fd_conn(sv[0]), AF_INET, &now),
+        "checkin to another service still accepted");
+  /* The pool does not own connections it forgets. */
+  pool.clear();
+  check(pool.idle() == 0, "clear forgets connections");
+  close(sv[0]);
+  close(sv[1]);
+}
+
+static void test_sessions()
+{
+  NseConnPool pool(usable, discard);
+  std::string session;
+  char key[32];
+  int i;
+
+  check(!pool.get_session("ssl|192.0.2.1|443", session), "no session");
+  pool.put_session("ssl|192.0.2.1|443", "first");
+  pool.put_session("ssl|192.0.2.1|443", "second");
+  check(pool.get_session("ssl|192.0.2.1|443", session) && session == "second",
+        "latest session is reused");
+  check(!pool.get_session("ssl|192.0.2.1|8443", session),
+        "session is not offered to another service");
+
+  for (i = 0; i < SSL_SESSION_CACHE_MAX + 10; i++) {
+    snprintf(key, sizeof(key), "ssl|192.0.2.2|%d", i);
+    pool.put_session(key, "s");
+  }
+  snprintf(key, sizeof(key), "ssl|192.0.2.2|%d", SSL_SESSION_CACHE_MAX + 9);
+  check(pool.get_session(key, session), "newest session is kept when full");
+}
+
+int main(int argc, char *argv[])
+{
+  test_checkout();
+  test_unusable();
+  test_timeout();
+  test_limits();
+  test_sessions();
+
+  printf("%ld / %ld tests passed.\n", success_count, test_count);
+  return success_count == test_count ? 0 : 1;
+}
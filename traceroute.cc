@@ -161,6 +161,9 @@ extern NmapOps o;
 /* If the hop cache (including timed-out hops) is bigger than this after a
    round, the hop is cleared and rebuilt from scratch. */
 #define MAX_HOP_CACHE_SIZE 1000
+/* Number of buckets in the index of outstanding probes. Must be a power of
+   two. */
+#define PROBE_INDEX_SIZE 1024
 
 struct Hop;
 class HostState;
@@ -183,6 +186,26 @@ static u8 initial_ttl = 10;
 static struct timeval get_now(struct timeval *now = NULL);
 static const char *ss_to_string(const struct sockaddr_storage *ss);
 
+/* Dummy class to use sockaddr_storage as a map key. */
+struct lt_sockaddr_storage {
+  bool operator()(const struct sockaddr_storage& a, const struct sockaddr_storage& b) const {
+    return sockaddr_storage_cmp(&a, &b) < 0;
+  }
+};
+
+/* The distance of the last target found in each network prefix (/24 for IPv4,
+   /64 for IPv6). Targets in the same prefix are usually behind the same
+   router, so a newly traced target starts counting down from this distance
+   instead of from initial_ttl. The probe one TTL below then normally hits the
+   hop cache, which links the whole path at once. */
+static std::map<struct sockaddr_storage, u8, lt_sockaddr_storage> prefix_distances;
+
+/* A hash index of all probes that have not been answered, so that a reply can
+   be matched to its probe without searching every host. Probes are hashed by
+   token, which is unique among the latest 65536 probes; the target address
+   tells apart the rare probes that share a token. */
+static std::vector<std::list<Probe *> > probe_index(PROBE_INDEX_SIZE);
+
 /* An object of this class is a (TTL, address) pair that uniquely identifies a
    hop. Hops in the hop_cache are indexed by this type. */
 struct HopIdent {
@@ -242,6 +265,9 @@ public:
   enum counting_state state;
   /* If nonzero, the known hop distance to the target. */
   int reached_target;
+  /* True once the first probe has been sent. */
+  bool started;
+  struct sockaddr_storage target_addr;
   struct probespec pspec;
   std::list<Probe *> unanswered_probes;
   std::list<Probe *> active_probes;
@@ -282,6 +308,8 @@ public:
   /* The token is used to match up probe replies. */
   u16 token;
   struct timeval sent_time;
+  /* Position of this probe in host->unanswered_probes. */
+  std::list<Probe *>::iterator unanswered_pos;
 
   Probe(HostState *host, struct probespec pspec, u8 ttl);
   virtual ~Probe();
@@ -334,12 +362,19 @@ static Hop *merge_hops(const struct sockaddr_storage *tag, Hop *a, Hop *b);
 static Hop *hop_cache_lookup(u8 ttl, const struct sockaddr_storage *addr);
 static void hop_cache_insert(Hop *hop);
 static unsigned int hop_cache_size();
+static bool addr_prefix(const struct sockaddr_storage *addr,
+  struct sockaddr_storage *prefix);
 
 HostState::HostState(Target *target) : sent_ttls(MAX_TTL + 1, false) {
+  size_t sslen;
+
   this->target = target;
   current_ttl = MIN(MAX(1, HostState::distance_guess(target)), MAX_TTL);
   state = HostState::COUNTING_DOWN;
   reached_target = 0;
+  started = false;
+  sslen = sizeof(target_addr);
+  target->TargetSockAddr(&target_addr, &sslen);
   pspec = HostState::get_probe(target);
   hops = NULL;
 }
@@ -383,13 +418,31 @@ bool HostState::send_next_probe(int rawsd, eth_t *ethsd) {
     return true;
   }
 
+  if (!started) {
+    struct sockaddr_storage prefix;
+    std::map<struct sockaddr_storage, u8, lt_sockaddr_storage>::iterator it;
+
+    /* Another target in the same prefix may have been reached since this
+       host's distance was guessed. Its distance is a better guess, unless we
+       know the real one from OS detection. */
+    started = true;
+    if (target->distance == -1 && addr_prefix(&target_addr, &prefix)
+        && (it = prefix_distances.find(prefix)) != prefix_distances.end()) {
+      if (o.debugging > 1) {
+        log_write(LOG_STDOUT, "%s starting at TTL %d from prefix distance\n",
+          target->targetipstr(), it->second);
+      }
+      current_ttl = MIN(MAX(1, it->second), MAX_TTL);
+    }
+  }
+
   this->next_ttl();
 
   if (!this->has_more_probes())
     return false;
 
   probe = Probe::make(this, pspec, current_ttl);
-  unanswered_probes.push_back(probe);
+  probe->unanswered_pos = unanswered_probes.insert(unanswered_probes.end(), probe);
   active_probes.push_back(probe);
   probe->send(rawsd, ethsd);
   sent_ttls[current_ttl] = true;
@@ -601,9 +654,11 @@ Probe::Probe(HostState *host, struct probespec pspec, u8 ttl) {
   sent_time.tv_sec = 0;
   sent_time.tv_usec = 0;
   num_resends = 0;
+  probe_index[token & (PROBE_INDEX_SIZE - 1)].push_back(this);
 }
 
 Probe::~Probe() {
+  probe_index[token & (PROBE_INDEX_SIZE - 1)].remove(this);
 }
 
 void Probe::send(int rawsd, eth_t *ethsd, struct timeval *now) {
@@ -749,7 +804,7 @@ public:
     assert(source->ss_family == AF_INET);
     sin = (struct sockaddr_in *) source;
 
-    payload = get_udp_payload(pspec.pd.udp.dport, &payload_length);
+    payload = get_udp_payload(pspec.pd.udp.dport, &payload_length, 0);
 
     /* For UDP we encode the token in the source port. */
     return build_udp_raw(&sin->sin_addr, host->target->v4hostip(), ttl,
@@ -951,6 +1006,30 @@ static unsigned int hop_cache_size() {
   return hop_cache.size() + timedout_hops.size();
 }
 
+/* Get the network prefix (/24 for IPv4, /64 for IPv6) of addr, for use as a
+   key in prefix_distances. */
+static bool addr_prefix(const struct sockaddr_storage *addr,
+  struct sockaddr_storage *prefix) {
+  memset(prefix, 0, sizeof(*prefix));
+  if (addr->ss_family == AF_INET) {
+    const struct sockaddr_in *sin = (struct sockaddr_in *) addr;
+    struct sockaddr_in *psin = (struct sockaddr_in *) prefix;
+
+    psin->sin_family = AF_INET;
+    psin->sin_addr.s_addr = sin->sin_addr.s_addr & htonl(0xFFFFFF00);
+  } else if (addr->ss_family == AF_INET6) {
+    const struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) addr;
+    struct sockaddr_in6 *psin6 = (struct sockaddr_in6 *) prefix;
+
+    psin6->sin6_family = AF_INET6;
+    memcpy(psin6->sin6_addr.s6_addr, sin6->sin6_addr.s6_addr, 8);
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
 void traceroute_hop_cache_clear() {
   std::map<struct HopIdent, Hop *>::iterator map_iter;
   std::list<Hop *>::iterator list_iter;
@@ -961,6 +1040,8 @@ void traceroute_hop_cache_clear() {
   for (list_iter = timedout_hops.begin(); list_iter != timedout_hops.end(); list_iter++)
     delete *list_iter;
   timedout_hops.clear();
+  /* The distances refer to hops that are gone now. */
+  prefix_distances.clear();
 }
 
 /* Merge two hop chains together and return the head of the merged chain. This
@@ -1253,9 +1334,8 @@ static bool read_reply(Reply *reply, pcap_t *pd, long timeout) {
 }
 
 void TracerouteState::read_replies(long timeout) {
-  struct sockaddr_storage ss;
+  struct sockaddr_storage prefix;
   struct timeval now;
-  size_t sslen;
   Reply reply;
 
   assert(timeout / 1000 <= (long) o.scan_delay);
@@ -1263,7 +1343,6 @@ void TracerouteState::read_replies(long timeout) {
   now = get_now();
 
   while (timeout > 0 && read_reply(&reply, pd, timeout)) {
-    std::list<Probe *>::iterator it;
     struct timeval oldnow;
     HostState *host;
     Probe *probe;
@@ -1278,12 +1357,13 @@ void TracerouteState::read_replies(long timeout) {
       continue;
     host = probe->host;
 
-    sslen = sizeof(ss);
-    host->target->TargetSockAddr(&ss, &sslen);
-    if (sockaddr_storage_equal(&ss, &reply.from_addr)) {
+    if (sockaddr_storage_equal(&host->target_addr, &reply.from_addr)) {
       adjust_timeouts2(&probe->sent_time, &reply.rcvdtime, &host->target->to);
-      if (host->reached_target == 0 || probe->ttl < host->reached_target)
+      if (host->reached_target == 0 || probe->ttl < host->reached_target) {
         host->reached_target = probe->ttl;
+        if (addr_prefix(&host->target_addr, &prefix))
+          prefix_distances[prefix] = host->reached_target;
+      }
       if (host->state == HostState::COUNTING_DOWN) {
         /* If this probe was past the target, skip ahead to what we think the
            actual distance is. */
@@ -1297,8 +1377,7 @@ void TracerouteState::read_replies(long timeout) {
     rtt = TIMEVAL_SUBTRACT(reply.rcvdtime, probe->sent_time) / 1000.0;
     set_host_hop(host, probe->ttl, &reply.from_addr, rtt);
 
-    it = find(host->unanswered_probes.begin(), host->unanswered_probes.end(), probe);
-    num_active_probes -= host->cancel_probe(it);
+    num_active_probes -= host->cancel_probe(probe->unanswered_pos);
   }
 }
 
@@ -1341,13 +1420,6 @@ void TracerouteState::remove_finished_hosts() {
   }
 }
 
-/* Dummy class to use sockaddr_storage as a map key. */
-struct lt_sockaddr_storage {
-  bool operator()(const struct sockaddr_storage& a, const struct sockaddr_storage& b) const {
-    return sockaddr_storage_cmp(&a, &b) < 0;
-  }
-};
-
 /* Find the reverse-DNS names of the hops. */
 void TracerouteState::resolve_hops() {
   std::set<sockaddr_storage, lt_sockaddr_storage> addrs;
@@ -1442,25 +1514,20 @@ void TracerouteState::transfer_hops() {
   }
 }
 
+/* Find the unanswered probe with the given target and token, ignoring hosts
+   that are already finished. */
 Probe *TracerouteState::lookup_probe(
   const struct sockaddr_storage *target_addr, u16 token) {
-  std::list<HostState *>::iterator host_iter;
+  std::list<Probe *> &bucket = probe_index[token & (PROBE_INDEX_SIZE - 1)];
   std::list<Probe *>::iterator probe_iter;
 
-  for (host_iter = active_hosts.begin(); host_iter != active_hosts.end(); host_iter++) {
-    struct sockaddr_storage ss;
-    size_t sslen;
+  for (probe_iter = bucket.begin(); probe_iter != bucket.end(); probe_iter++) {
+    Probe *probe = *probe_iter;
 
-    sslen = sizeof(ss);
-    (*host_iter)->target->TargetSockAddr(&ss, &sslen);
-    if (!sockaddr_storage_equal(&ss, target_addr))
-      continue;
-    for (probe_iter = (*host_iter)->unanswered_probes.begin();
-         probe_iter != (*host_iter)->unanswered_probes.end();
-         probe_iter++) {
-      if ((*probe_iter)->token == token)
-        return *probe_iter;
-    }
+    if (probe->token == token
+        && sockaddr_storage_equal(&probe->host->target_addr, target_addr)
+        && !probe->host->is_finished())
+      return probe;
   }
 
   return NULL;